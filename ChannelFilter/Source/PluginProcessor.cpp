@@ -34,35 +34,161 @@ MIDIClipVariationsAudioProcessor::MIDIClipVariationsAudioProcessor()
                 std::make_unique<juce::AudioParameterChoice> (
                     "phraseBeats", // parameterID
                     "Phrase length", // parameter name
-                    juce::StringArray( {"1 beat", "4 beats", "8 beats", "16 beats", "32 beats", "64 beats"} ),
+                    PhraseClock::getPhraseChoices(),
                     2 // default index
+                ),
+                // Phrase length for the "Custom beats" and "Custom bars" phrase options.
+                std::make_unique<juce::AudioParameterInt> (
+                    "phraseLength", // parameterID
+                    "Custom phrase length", // parameter name
+                    1,
+                    CBR_PHRASECLOCK_MAX_LENGTH,
+                    8
+                ),
+                // Shift the phrase grid later by a number of beats from the bar.
+                std::make_unique<juce::AudioParameterInt> (
+                    "phraseOffset", // parameterID
+                    "Phrase offset (beats)", // parameter name
+                    0,
+                    CBR_PHRASECLOCK_MAX_LENGTH - 1,
+                    0
+                ),
+
+                // Play the variation for each phrase from the arrangement, or record it.
+                std::make_unique<juce::AudioParameterChoice> (
+                    "arrangement", // parameterID
+                    "Arrangement", // parameter name
+                    PhraseArrangement::getModeChoices(),
+                    0 // default index
+                ),
+
+                // Address OSC cues to this instance, see CBR_OSC_PORT. 0 ignores cues.
+                std::make_unique<juce::AudioParameterInt> (
+                    "oscInstance", // parameterID
+                    "OSC instance", // parameter name
+                    0,
+                    CBR_OSC_MAX_INSTANCES,
+                    0
+                ),
+
+                // Layer several channels at once, e.g. drums on channel 1 with fills on channel 3.
+                std::make_unique<juce::AudioParameterChoice> (
+                    "channelMode", // parameterID
+                    "Channel mode", // parameter name
+                    juce::StringArray( {"Single channel", "Layered channels"} ),
+                    0 // default index
+                ),
+                std::make_unique<juce::AudioParameterBool> (
+                    "layerChannel1", // parameterID
+                    "Layer channel 1", // parameter name
+                    true
+                ),
+                std::make_unique<juce::AudioParameterBool> (
+                    "layerChannel2", // parameterID
+                    "Layer channel 2", // parameter name
+                    false
+                ),
+                std::make_unique<juce::AudioParameterBool> (
+                    "layerChannel3", // parameterID
+                    "Layer channel 3", // parameter name
+                    false
+                ),
+                std::make_unique<juce::AudioParameterBool> (
+                    "layerChannel4", // parameterID
+                    "Layer channel 4", // parameter name
+                    false
+                ),
+                std::make_unique<juce::AudioParameterBool> (
+                    "layerChannel5", // parameterID
+                    "Layer channel 5", // parameter name
+                    false
+                ),
+                std::make_unique<juce::AudioParameterBool> (
+                    "layerChannel6", // parameterID
+                    "Layer channel 6", // parameter name
+                    false
+                ),
+                std::make_unique<juce::AudioParameterBool> (
+                    "layerChannel7", // parameterID
+                    "Layer channel 7", // parameter name
+                    false
+                ),
+                std::make_unique<juce::AudioParameterBool> (
+                    "layerChannel8", // parameterID
+                    "Layer channel 8", // parameter name
+                    false
+                ),
+                std::make_unique<juce::AudioParameterBool> (
+                    "layerChannel9", // parameterID
+                    "Layer channel 9", // parameter name
+                    false
+                ),
+                std::make_unique<juce::AudioParameterBool> (
+                    "layerChannel10", // parameterID
+                    "Layer channel 10", // parameter name
+                    false
+                ),
+                std::make_unique<juce::AudioParameterBool> (
+                    "layerChannel11", // parameterID
+                    "Layer channel 11", // parameter name
+                    false
+                ),
+                std::make_unique<juce::AudioParameterBool> (
+                    "layerChannel12", // parameterID
+                    "Layer channel 12", // parameter name
+                    false
+                ),
+                std::make_unique<juce::AudioParameterBool> (
+                    "layerChannel13", // parameterID
+                    "Layer channel 13", // parameter name
+                    false
+                ),
+                std::make_unique<juce::AudioParameterBool> (
+                    "layerChannel14", // parameterID
+                    "Layer channel 14", // parameter name
+                    false
+                ),
+                std::make_unique<juce::AudioParameterBool> (
+                    "layerChannel15", // parameterID
+                    "Layer channel 15", // parameter name
+                    false
+                ),
+                std::make_unique<juce::AudioParameterBool> (
+                    "layerChannel16", // parameterID
+                    "Layer channel 16", // parameter name
+                    false
                 )
             } )
 #endif
 {
     tempoBpm = 120.0;
+    timeSigNumerator = 4;
+    timeSigDenominator = 4;
     lastBufferTimestamp = 0;
-    currentAllowedChannel = 1;
+    currentAllowedMask = 1u;
+    pendingAllowedMask = 1u;
     
     selectedChannel = (juce::AudioParameterInt*)parameters.getParameter("channel");
     phraseBeats = (juce::AudioParameterChoice*)parameters.getParameter("phraseBeats");
-}
-
-int MIDIClipVariationsAudioProcessor::getPhraseBeats ()
-{
-    int selected = phraseBeats->getIndex();
-    
-    switch (selected) {
-        case 0: return 1;
-        case 1: return 4;
-        case 2: return 8;
-        case 3: return 16;
-        case 4: return 32;
-        case 5: return 64;
+    phraseLength = (juce::AudioParameterInt*)parameters.getParameter("phraseLength");
+    phraseOffset = (juce::AudioParameterInt*)parameters.getParameter("phraseOffset");
+    arrangementMode = (juce::AudioParameterChoice*)parameters.getParameter("arrangement");
+    oscInstance = (juce::AudioParameterInt*)parameters.getParameter("oscInstance");
+
+    // Arrangement entries are single channels.
+    arrangement.setMaxValue(CBR_CHANNELFILTER_NUM_CHANNELS);
+    channelMode = (juce::AudioParameterChoice*)parameters.getParameter("channelMode");
+
+    for (int i=0; i<CBR_CHANNELFILTER_NUM_CHANNELS; i++) {
+        std::ostringstream paramIdentifier;
+        paramIdentifier << "layerChannel" << (i + 1);
+        layerChannel[i] = (juce::AudioParameterBool*)parameters.getParameter(paramIdentifier.str());
     }
 
-    return 4;
+    parameterConfig.attach(*this);
+    programs.initialise(*this);
 }
+
 MIDIClipVariationsAudioProcessor::~MIDIClipVariationsAudioProcessor()
 {
 }
@@ -107,26 +233,27 @@ double MIDIClipVariationsAudioProcessor::getTailLengthSeconds() const
 
 int MIDIClipVariationsAudioProcessor::getNumPrograms()
 {
-    return 1;   // NB: some hosts don't cope very well if you tell them there are 0 programs,
-                // so this should be at least 1, even if you're not really implementing programs.
+    return CBR_PROGRAMS_NUM;
 }
 
 int MIDIClipVariationsAudioProcessor::getCurrentProgram()
 {
-    return 0;
+    return programs.getCurrentProgram();
 }
 
 void MIDIClipVariationsAudioProcessor::setCurrentProgram (int index)
 {
+    programs.setCurrentProgram (*this, parameterConfig, index);
 }
 
 const juce::String MIDIClipVariationsAudioProcessor::getProgramName (int index)
 {
-    return {};
+    return programs.getProgramName (index);
 }
 
 void MIDIClipVariationsAudioProcessor::changeProgramName (int index, const juce::String& newName)
 {
+    programs.changeProgramName (index, newName);
 }
 
 //==============================================================================
@@ -134,6 +261,12 @@ void MIDIClipVariationsAudioProcessor::prepareToPlay (double sampleRate, int sam
 {
     // Use this method as the place to do any pre-playback
     // initialisation that you need..
+    // The output buffer is swapped with the host's at the end of each block, which
+    // the plugin wrapper reserves too, so both storages stay at least this large.
+    outputMidiBuffer.ensureSize(CBR_MIDI_OUTPUT_RESERVE_BYTES);
+
+    blockCapture.openIfEnabled(getName());
+    boundaryTiming.openIfEnabled(getName());
 }
 
 void MIDIClipVariationsAudioProcessor::releaseResources()
@@ -168,34 +301,78 @@ bool MIDIClipVariationsAudioProcessor::isBusesLayoutSupported (const BusesLayout
 }
 #endif
 
-double MIDIClipVariationsAudioProcessor::samplesToBeats(juce::int64 timestamp) {
-    double secondsPerBeat = 60.0 / tempoBpm;
-    double samplesPerBeat = secondsPerBeat * getSampleRate();
-    
-    return (timestamp / samplesPerBeat);
+void MIDIClipVariationsAudioProcessor::updatePhraseClock ()
+{
+    const ParameterConfig& config = parameterConfig.get();
+    juce::int64 lengthTicks = PhraseClock::getPhraseLengthTicks(
+        config.getIndex(phraseBeats),
+        config.getInt(phraseLength),
+        timeSigNumerator,
+        timeSigDenominator
+    );
+    juce::int64 offsetTicks = config.getInt(phraseOffset) * PhraseClock::getBeatTicks(timeSigDenominator);
+
+    phraseClock.update(tempoBpm, getSampleRate(), lengthTicks, offsetTicks);
+}
+
+/**
+ * Switch to a program from a program change. Notes from here on use its
+ * channels, arrangement mode and phrase settings.
+ *
+ * @param program The program number.
+ * @param sampleOffset Offset in the current block, for tracing.
+ * @param isPlaying Whether the transport is playing, for tracing.
+*/
+void MIDIClipVariationsAudioProcessor::switchProgram (int program, int sampleOffset, bool isPlaying)
+{
+    programs.switchProgram(program, *this, parameterConfig);
+    updatePhraseClock();
+    // Notes after the boundary switch to the program's channels.
+    pendingAllowedMask = getAllowedChannelMask(parameterConfig.get());
+    CBR_TRACE(traceRecorder, "program switched", sampleOffset, isPlaying ? "phrase boundary" : "not playing", program);
+    juce::ignoreUnused(sampleOffset, isPlaying);
 }
 
-double MIDIClipVariationsAudioProcessor::beatsToPhrase(double beats) {    
-    return (beats / getPhraseBeats());
+/**
+ * The channels the params select, one bit per channel (bit 0 = channel 1).
+*/
+juce::uint32 MIDIClipVariationsAudioProcessor::getAllowedChannelMask (const ParameterConfig& config) const
+{
+    if (config.getIndex(channelMode) == channelModeSingle) {
+        return 1u << (config.getInt(selectedChannel) - 1);
+    }
+
+    juce::uint32 mask = 0;
+    for (int i=0; i<CBR_CHANNELFILTER_NUM_CHANNELS; i++) {
+        if (config.getBool(layerChannel[i])) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
 }
 
-bool MIDIClipVariationsAudioProcessor::timeRangeStraddlesPhraseChange (juce::int64 time1, juce::int64 time2) {
-    double a = samplesToBeats(time1);
-    double b = samplesToBeats(time2);
-
-    // Fudge factor alert!
-    // Sometimes we get a floating point rounding error.
-    // E.g. aPhrase = 2, bPhrase = 2.99998
-    // In this case the phrase is different and we need to catch it.
-    // We add 0.001 phrases because that's much smaller
-    // than the period we're concerned with, and larger
-    // than the rounding error.
-    double aPhrase = beatsToPhrase(a) + 0.001;
-    double bPhrase = beatsToPhrase(b) + 0.001;
-
-    // Determine whether to use current channel or param channel for this event.
-    // If phrase boundary has occurred since start of block, use param.
-    return ( std::floor(aPhrase) < std::floor(bPhrase) );
+/**
+ * The channel bit for an arrangement entry.
+ *
+ * @return The mask, or 0 for no entry or anything that isn't a channel, e.g. from a hand-edited state.
+*/
+juce::uint32 MIDIClipVariationsAudioProcessor::getArrangedChannelMask (int arrangedChannel)
+{
+    if (arrangedChannel < 1 || arrangedChannel > CBR_CHANNELFILTER_NUM_CHANNELS) {
+        return 0;
+    }
+    return 1u << (arrangedChannel - 1);
+}
+
+/**
+ * The arrangement mode in use. Entries hold one channel, so arrangements are off in layered mode.
+*/
+int MIDIClipVariationsAudioProcessor::getArrangementMode (const ParameterConfig& config) const
+{
+    if (config.getIndex(channelMode) != channelModeSingle) {
+        return PhraseArrangement::off;
+    }
+    return config.getIndex(arrangementMode);
 }
 
 bool MIDIClipVariationsAudioProcessor::shouldPlayMidiMessage (juce::MidiMessage message, juce::int64 blockTime, juce::int64 eventTime)
@@ -205,25 +382,51 @@ bool MIDIClipVariationsAudioProcessor::shouldPlayMidiMessage (juce::MidiMessage
         return true;
     }
     
-    int channel = currentAllowedChannel;
+    juce::uint32 allowedMask = currentAllowedMask;
     
-    // Determine whether to use current channel or param channel for this event.
-    // If phrase boundary has occurred since start of block, use param.
-    if ( timeRangeStraddlesPhraseChange(blockTime, eventTime) ) {
-        channel = *selectedChannel;
+    // Determine whether to use current channels or param channels for this event.
+    // If phrase boundary has occurred since start of block, use params.
+    const bool afterBoundary = phraseClock.timeRangeStraddlesPhraseChange(blockTime, eventTime);
+    if ( afterBoundary ) {
+        allowedMask = pendingAllowedMask;
+    }
+
+    // When playing an arrangement, the phrase alone decides the channel, so seeks and loops play the same.
+    // Phrases without an entry carry on as above.
+    int arrangedChannel = 0;
+    if (getArrangementMode(parameterConfig.get()) == PhraseArrangement::play) {
+        arrangedChannel = arrangement.getValue(phraseClock.getPhraseIndex(eventTime));
+        if (getArrangedChannelMask(arrangedChannel) != 0) {
+            allowedMask = getArrangedChannelMask(arrangedChannel);
+        }
+        else {
+            arrangedChannel = 0;
+        }
     }
 
-    return (message.getChannel() == channel);
+    // One bit test, however many channels are layered.
+    const bool shouldPlay = (allowedMask >> (message.getChannel() - 1)) & 1u;
+
+    CBR_TRACE(traceRecorder, shouldPlay ? "note played" : "note dropped", eventTime - blockTime,
+              arrangedChannel != 0 ? "arrangement" : afterBoundary ? "channel switched earlier in block" : "current channel",
+              message.getChannel());
+
+    return shouldPlay;
 }
 
 
 void MIDIClipVariationsAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
+    // Checked for allocations, locks and blocking calls in the RealtimeCheck build.
+    CBR_REALTIME_SCOPE;
+
+    // Read the parameters once, as one consistent set for the whole block.
+    const ParameterConfig& config = parameterConfig.update(*this);
+
     outputMidiBuffer.clear();
-  
-    const int allowChannel = *selectedChannel;
 
     juce::int64 playheadTimeSamples = 0;
+    bool isPlaying = false;
 
     juce::AudioPlayHead::CurrentPositionInfo playheadPosition;
     juce::AudioPlayHead* playhead = AudioProcessor::getPlayHead();
@@ -231,29 +434,95 @@ void MIDIClipVariationsAudioProcessor::processBlock (juce::AudioBuffer<float>& b
         playhead->getCurrentPosition(playheadPosition);
         playheadTimeSamples = playheadPosition.timeInSamples;
         tempoBpm = playheadPosition.bpm;
-    
+        timeSigNumerator = playheadPosition.timeSigNumerator;
+        timeSigDenominator = playheadPosition.timeSigDenominator;
+        isPlaying = playheadPosition.isPlaying;
+    }
+
+    // Everything traced from here is stamped with this block's time.
+    CBR_TRACE_BLOCK_BEGIN(traceRecorder, playheadTimeSamples, buffer.getNumSamples());
+
+    // Apply OSC cues for this instance, as if the host had set them before the block.
+    oscCommands.setInstanceId(config.getInt(oscInstance));
+    OSCCommand command;
+    while (oscCommands.pop(command)) {
+        oscCommands.apply(command, *this, parameterConfig, programs);
+        CBR_TRACE(traceRecorder, "osc cue applied", 0, command.type == OSCCommand::programChange ? "program" : "parameter",
+                  (juce::Time::getMillisecondCounterHiRes() - command.receivedMs) * 1000.0);
+    }
+
+    // Cued phrase settings apply from this block.
+    if (playhead) {
+        updatePhraseClock();
+    }
+
+    // A program change switches on the phrase boundary in this block, or straight away when stopped or looping.
+    int programBoundaryOffset = 0;
+    if (isPlaying && lastBufferTimestamp <= playheadTimeSamples) {
+        programBoundaryOffset = phraseClock.getPhraseStartInBlock(playheadTimeSamples, buffer.getNumSamples());
+    }
+    // Events before the boundary play with the outgoing program, so a later boundary switches in the event loop.
+    int program = programs.takeProgramChange(midiMessages, programBoundaryOffset);
+    if (program >= 0 && programBoundaryOffset == 0) {
+        switchProgram(program, 0, isPlaying);
+        program = -1;
+    }
+
+    // Measure switches against the exact boundaries from here, with the phrase settings playing now.
+    boundaryTiming.beginBlock(playhead ? &playheadPosition : nullptr, getSampleRate(), phraseClock);
+
+    // All the selected channels switch together, from one consistent set of params.
+    pendingAllowedMask = getAllowedChannelMask(config);
+
+    if (playhead) {
         if (! playheadPosition.isPlaying) {
-            currentAllowedChannel = allowChannel;
+            currentAllowedMask = pendingAllowedMask;
         }
         else {
             // Determine if the last block straddled a phrase boundary.
-            bool lastBlockNewPhrase = timeRangeStraddlesPhraseChange(lastBufferTimestamp, playheadTimeSamples);
+            bool lastBlockNewPhrase = phraseClock.timeRangeStraddlesPhraseChange(lastBufferTimestamp, playheadTimeSamples);
             // Or if the transport has looped back around start.
             bool reloopNewPhrase = (lastBufferTimestamp > playheadTimeSamples);
             // If so, apply the channel param.
             if (lastBlockNewPhrase || reloopNewPhrase) {
-                currentAllowedChannel = allowChannel;
+                if (! reloopNewPhrase) {
+                    boundaryTiming.record(BoundaryTimingRecorder::blockSwitch, playheadTimeSamples);
+                }
+                currentAllowedMask = pendingAllowedMask;
+                CBR_TRACE(traceRecorder, "channel applied", 0, reloopNewPhrase ? "transport looped" : "phrase boundary in last block", pendingAllowedMask);
             }
         }
     }
     else {
-        currentAllowedChannel = allowChannel;
+        currentAllowedMask = pendingAllowedMask;
     }
 
+    // Record the channel playing in each phrase. Entries hold one channel, so nothing is recorded
+    // while layers from before a switch to single channel mode are still playing.
+    if (isPlaying && getArrangementMode(config) == PhraseArrangement::record && currentAllowedMask != 0 && juce::isPowerOfTwo(currentAllowedMask)) {
+        arrangement.setValue(phraseClock.getPhraseIndex(playheadTimeSamples), juce::findHighestSetBit(currentAllowedMask) + 1);
+    }
+
+    // Notes after a boundary in this block switch on its sample.
+    if (isPlaying && boundaryTiming.isEnabled()) {
+        const juce::int64 nextPhraseStart = phraseClock.getNextPhraseStart(playheadTimeSamples);
+        if (nextPhraseStart < playheadTimeSamples + buffer.getNumSamples()) {
+            boundaryTiming.record(BoundaryTimingRecorder::phraseSwitch, nextPhraseStart);
+        }
+    }
+
+    // Record the block for replay, if capture is enabled.
+    blockCapture.captureBlockInput(playhead ? &playheadPosition : nullptr, buffer.getNumSamples(), getSampleRate(), parameterConfig.get(), midiMessages);
+
     for (auto m: midiMessages)
     {
         auto message = m.getMessage();
         auto timestamp = message.getTimeStamp();
+
+        if (program >= 0 && timestamp >= programBoundaryOffset) {
+            switchProgram(program, programBoundaryOffset, isPlaying);
+            program = -1;
+        }
         
         if (this->shouldPlayMidiMessage(message, playheadTimeSamples, playheadTimeSamples + timestamp)) {
             outputMidiBuffer.addEvent(message, timestamp);
@@ -261,26 +530,73 @@ void MIDIClipVariationsAudioProcessor::processBlock (juce::AudioBuffer<float>& b
 
     }
 
+    // No events from the boundary on - the program still switches in this block.
+    if (program >= 0) {
+        switchProgram(program, programBoundaryOffset, isPlaying);
+    }
+
     midiMessages.swapWith(outputMidiBuffer);
-    
+
+    publishDisplayState(playheadTimeSamples, isPlaying);
+
+    blockCapture.captureBlockOutput(midiMessages);
+    CBR_TRACE_BLOCK_END(traceRecorder);
+
     lastBufferTimestamp = playheadTimeSamples;
 }
 
+/**
+ * Publish what the editor shows, see PhraseDisplay.h.
+ *
+ * @param blockTime Sample time of the start of the block.
+ * @param isPlaying Whether the transport is playing.
+*/
+void MIDIClipVariationsAudioProcessor::publishDisplayState (juce::int64 blockTime, bool isPlaying)
+{
+    const ParameterConfig& config = parameterConfig.get();
+
+    displayState.setPhrase(phraseClock, blockTime, timeSigDenominator, isPlaying);
+    displayState.valueIsChannelMask = true;
+    displayState.currentValue = (int) currentAllowedMask;
+    displayState.pendingValue = (int) pendingAllowedMask;
+
+    // Playing an arrangement, show the channels it has for this phrase and the next.
+    if (getArrangementMode(config) == PhraseArrangement::play) {
+        const juce::uint32 arrangedCurrent = getArrangedChannelMask(arrangement.getValue(displayState.phraseIndex));
+        const juce::uint32 arrangedNext = getArrangedChannelMask(arrangement.getValue(displayState.phraseIndex + 1));
+        if (arrangedCurrent != 0) {
+            displayState.currentValue = (int) arrangedCurrent;
+        }
+        if (arrangedNext != 0) {
+            displayState.pendingValue = (int) arrangedNext;
+        }
+    }
+
+    displayState.currentProgram = programs.getCurrentProgram();
+    displayState.pendingProgram = programs.getPendingProgram();
+
+    displaySnapshot.publish(displayState);
+}
+
 //==============================================================================
 bool MIDIClipVariationsAudioProcessor::hasEditor() const
 {
-    return false;
+    return true;
 }
 
 juce::AudioProcessorEditor* MIDIClipVariationsAudioProcessor::createEditor()
 {
-    return 0;
+    return new PhraseDisplayEditor (*this, displaySnapshot, "Channels", 0, 0);
 }
 
 //==============================================================================
 void MIDIClipVariationsAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 {
+    // Values set on the audio thread go in the state, with the program they belong to.
+    parameterConfig.flushPending();
     auto state = parameters.copyState();
+    programs.writeToState (state, *this, parameterConfig);
+    arrangement.writeToState (state);
     std::unique_ptr<juce::XmlElement> xml (state.createXml());
     copyXmlToBinary (*xml, destData);
 }
@@ -290,8 +606,12 @@ void MIDIClipVariationsAudioProcessor::setStateInformation (const void* data, in
     std::unique_ptr<juce::XmlElement> xmlState (getXmlFromBinary (data, sizeInBytes));
 
     if (xmlState.get() != nullptr)
-        if (xmlState->hasTagName (parameters.state.getType()))
-            parameters.replaceState (juce::ValueTree::fromXml (*xmlState));
+        if (xmlState->hasTagName (parameters.state.getType())) {
+            juce::ValueTree state = juce::ValueTree::fromXml (*xmlState);
+            programs.readFromState (state, *this);
+            arrangement.readFromState (state);
+            parameterConfig.loadState (parameters, state);
+        }
 }
 
 //==============================================================================
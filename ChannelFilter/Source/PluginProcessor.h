@@ -9,6 +9,19 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "../../Common/PhraseClock.h"
+#include "../../Common/ParameterConfig.h"
+#include "../../Common/PhrasePrograms.h"
+#include "../../Common/PhraseArrangement.h"
+#include "../../Common/PhraseDisplay.h"
+#include "../../Common/OSCControl.h"
+#include "../../Common/BlockCapture.h"
+#include "../../Common/BoundaryTiming.h"
+#include "../../Common/Trace.h"
+#include "../../Common/RealtimeCheck.h"
+
+// One bit per MIDI channel in the allowed channel mask.
+#define CBR_CHANNELFILTER_NUM_CHANNELS 16
 
 //==============================================================================
 /**
@@ -57,21 +70,58 @@ private:
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MIDIClipVariationsAudioProcessor)
     
-    double samplesToBeats (juce::int64 timestamp);
-    double beatsToPhrase (double beats);
-    bool timeRangeStraddlesPhraseChange (juce::int64 time1, juce::int64 time2);
+    void updatePhraseClock ();
+    void switchProgram (int program, int sampleOffset, bool isPlaying);
+    juce::uint32 getAllowedChannelMask (const ParameterConfig& config) const;
+    static juce::uint32 getArrangedChannelMask (int arrangedChannel);
+    int getArrangementMode (const ParameterConfig& config) const;
     bool shouldPlayMidiMessage (juce::MidiMessage message,juce::int64 blockTime, juce::int64 eventTime);
-
-    int getPhraseBeats ();
+    void publishDisplayState (juce::int64 blockTime, bool isPlaying);
 
     juce::AudioProcessorValueTreeState parameters;
 
     juce::AudioParameterInt* selectedChannel;
     juce::AudioParameterChoice* phraseBeats;
+    juce::AudioParameterInt* phraseLength;
+    juce::AudioParameterInt* phraseOffset;
+    juce::AudioParameterChoice* arrangementMode;
+    juce::AudioParameterInt* oscInstance;
+    // Options for the `channelMode` choice parameter.
+    enum ChannelMode
+    {
+        channelModeSingle = 0,
+        channelModeLayered
+    };
+    juce::AudioParameterChoice* channelMode;
+    juce::AudioParameterBool* layerChannel[CBR_CHANNELFILTER_NUM_CHANNELS];
+    // Parameter values for the current block, see ParameterConfig.h.
+    ParameterConfigSwap parameterConfig;
+    // Programs recalled with program change, see PhrasePrograms.h.
+    PhrasePrograms programs;
+    // Value for each phrase index, see PhraseArrangement.h.
+    PhraseArrangement arrangement;
+    // Cues received over OSC, see OSCControl.h.
+    OSCCommandQueue oscCommands { *this };
 
     double tempoBpm;
-    int currentAllowedChannel;
+    int timeSigNumerator;
+    int timeSigDenominator;
+    PhraseClock phraseClock;
+    // Channels playing, one bit per channel, and the channels the params select for the next phrase.
+    juce::uint32 currentAllowedMask;
+    juce::uint32 pendingAllowedMask;
     juce::int64 lastBufferTimestamp;
 
+    // Published once per block for the editor.
+    PhraseDisplayState displayState;
+    SeqlockSnapshot<PhraseDisplayState> displaySnapshot;
+
+    // Post-mortem capture of each block, see CBR_CAPTURE_DIR.
+    BlockCaptureRecorder blockCapture;
+    // How far switches land from the exact boundaries, see CBR_TIMING_DIR.
+    BoundaryTimingRecorder boundaryTiming;
+    // Trace points, compiled out unless CBR_TRACE_ENABLED.
+    CBR_TRACE_RECORDER(traceRecorder);
+
     juce::MidiBuffer outputMidiBuffer;
 };
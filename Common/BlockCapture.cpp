@@ -0,0 +1,273 @@
+/*
+  ==============================================================================
+
+    BlockCapture.cpp
+    Records each processed block to a memory-mapped ring file, for replaying
+    glitches from a live show after the fact.
+
+  ==============================================================================
+*/
+
+#include "BlockCapture.h"
+
+using namespace BlockCaptureFormat;
+
+// Bytes per captured event, excluding the MIDI bytes.
+static const int eventHeaderBytes = 3;
+
+// Params alone mustn't fill a slot.
+static_assert (sizeof (BlockCaptureFormat::BlockHeader) + CBR_CAPTURE_MAX_PARAMS * sizeof (float) <= CBR_CAPTURE_SLOT_BYTES / 2,
+               "Captured params leave too little room for MIDI");
+
+void BlockCaptureFormat::readEvents (const juce::uint8* data, int numBytes, juce::MidiBuffer& midiMessages)
+{
+    int position = 0;
+    while (position + eventHeaderBytes <= numBytes) {
+        const int samplePosition = data[position] | (data[position + 1] << 8);
+        const int size = data[position + 2];
+        position += eventHeaderBytes;
+
+        if (position + size > numBytes) {
+            break;
+        }
+
+        midiMessages.addEvent (data + position, size, samplePosition);
+        position += size;
+    }
+}
+
+//==============================================================================
+BlockCaptureRecorder::BlockCaptureRecorder ()
+{
+    slots = nullptr;
+    nextSequence = 1;
+    currentSlot = nullptr;
+    currentSlotBytes = 0;
+}
+
+BlockCaptureRecorder::~BlockCaptureRecorder ()
+{
+    close();
+}
+
+void BlockCaptureRecorder::openIfEnabled (const juce::String& pluginName)
+{
+    if (isOpen()) {
+        return;
+    }
+
+    // One file per instance.
+    const juce::File file = getInstanceFile (CBR_CAPTURE_DIR_ENV, pluginName, this, ".cbrcap");
+    if (file != juce::File()) {
+        open (file, pluginName);
+    }
+}
+
+bool BlockCaptureRecorder::open (const juce::File& file, const juce::String& pluginName)
+{
+    close();
+
+    const juce::int64 fileBytes = (juce::int64) CBR_CAPTURE_SLOT_BYTES * (CBR_CAPTURE_NUM_SLOTS + 1);
+
+    // Create the whole file up front so the mapping never grows.
+    {
+        if (file.getParentDirectory().createDirectory().failed() || ! file.deleteFile()) {
+            return false;
+        }
+
+        juce::FileOutputStream output (file);
+        if (output.failedToOpen()) {
+            return false;
+        }
+
+        juce::HeapBlock<char> zeros (CBR_CAPTURE_SLOT_BYTES, true);
+        for (juce::int64 written = 0; written < fileBytes; written += CBR_CAPTURE_SLOT_BYTES) {
+            if (! output.write (zeros, CBR_CAPTURE_SLOT_BYTES)) {
+                return false;
+            }
+        }
+    }
+
+    mappedFile.reset (new juce::MemoryMappedFile (file, juce::MemoryMappedFile::readWrite, false));
+    if (mappedFile->getData() == nullptr || (juce::int64) mappedFile->getSize() < fileBytes) {
+        mappedFile.reset();
+        return false;
+    }
+
+    juce::uint8* data = static_cast<juce::uint8*> (mappedFile->getData());
+
+    // Touch every page now, so the audio thread doesn't take page faults later.
+    memset (data, 0, (size_t) fileBytes);
+
+    FileHeader* header = reinterpret_cast<FileHeader*> (data);
+    header->magic = CBR_CAPTURE_MAGIC;
+    header->version = CBR_CAPTURE_VERSION;
+    header->slotBytes = CBR_CAPTURE_SLOT_BYTES;
+    header->numSlots = CBR_CAPTURE_NUM_SLOTS;
+    pluginName.copyToUTF8 (header->pluginName, sizeof (header->pluginName));
+
+    slots = data + CBR_CAPTURE_SLOT_BYTES;
+    nextSequence = 1;
+    return true;
+}
+
+void BlockCaptureRecorder::close ()
+{
+    slots = nullptr;
+    currentSlot = nullptr;
+    mappedFile.reset();
+}
+
+int BlockCaptureRecorder::writeEvents (const juce::MidiBuffer& midiMessages, juce::uint8* dest, int maxBytes)
+{
+    int numBytes = 0;
+    for (const juce::MidiMessageMetadata metadata : midiMessages) {
+        const int eventBytes = eventHeaderBytes + metadata.numBytes;
+        if (metadata.numBytes > 255 || numBytes + eventBytes > maxBytes) {
+            // Long sysex or out of space.
+            BlockHeader* header = reinterpret_cast<BlockHeader*> (currentSlot);
+            header->flags |= truncated;
+            continue;
+        }
+
+        dest[numBytes] = (juce::uint8) (metadata.samplePosition & 0xff);
+        dest[numBytes + 1] = (juce::uint8) ((metadata.samplePosition >> 8) & 0xff);
+        dest[numBytes + 2] = (juce::uint8) metadata.numBytes;
+        memcpy (dest + numBytes + eventHeaderBytes, metadata.data, (size_t) metadata.numBytes);
+        numBytes += eventBytes;
+    }
+
+    return numBytes;
+}
+
+void BlockCaptureRecorder::captureBlockInput (const juce::AudioPlayHead::CurrentPositionInfo* position, int numSamples, double sampleRate,
+                                              const ParameterConfig& config, const juce::MidiBuffer& midiIn)
+{
+    if (slots == nullptr) {
+        return;
+    }
+
+    currentSlot = slots + (size_t) ((nextSequence - 1) % CBR_CAPTURE_NUM_SLOTS) * CBR_CAPTURE_SLOT_BYTES;
+
+    BlockHeader* header = reinterpret_cast<BlockHeader*> (currentSlot);
+    // Invalidate the slot while it's being rewritten.
+    header->sequence = 0;
+
+    header->flags = 0;
+    header->sampleRate = sampleRate;
+    header->numSamples = numSamples;
+    if (position != nullptr) {
+        header->flags |= hasPlayhead;
+        header->flags |= position->isPlaying ? isPlaying : 0;
+        header->flags |= position->isLooping ? isLooping : 0;
+        header->timeInSamples = position->timeInSamples;
+        header->bpm = position->bpm;
+        header->ppqPosition = position->ppqPosition;
+        header->timeSigNumerator = position->timeSigNumerator;
+        header->timeSigDenominator = position->timeSigDenominator;
+    }
+    else {
+        header->timeInSamples = 0;
+        header->bpm = 0;
+        header->ppqPosition = 0;
+        header->timeSigNumerator = 0;
+        header->timeSigDenominator = 0;
+    }
+
+    // The block's params, as normalised values.
+    // Blocks with params missing can't be replayed.
+    jassert (config.numValues <= CBR_CAPTURE_MAX_PARAMS);
+    const int numParams = juce::jmin (config.numValues, CBR_CAPTURE_MAX_PARAMS);
+    if (numParams < config.numValues) {
+        header->flags |= paramsTruncated;
+    }
+    memcpy (currentSlot + sizeof (BlockHeader), config.values, (size_t) numParams * sizeof (float));
+    header->numParams = (juce::uint16) numParams;
+
+    currentSlotBytes = (int) sizeof (BlockHeader) + numParams * (int) sizeof (float);
+
+    const int midiInBytes = writeEvents (midiIn, currentSlot + currentSlotBytes, CBR_CAPTURE_SLOT_BYTES - currentSlotBytes);
+    header->midiInBytes = (juce::uint16) midiInBytes;
+    header->midiOutBytes = 0;
+    currentSlotBytes += midiInBytes;
+}
+
+void BlockCaptureRecorder::captureBlockOutput (const juce::MidiBuffer& midiOut)
+{
+    if (currentSlot == nullptr) {
+        return;
+    }
+
+    BlockHeader* header = reinterpret_cast<BlockHeader*> (currentSlot);
+    const int midiOutBytes = writeEvents (midiOut, currentSlot + currentSlotBytes, CBR_CAPTURE_SLOT_BYTES - currentSlotBytes);
+    header->midiOutBytes = (juce::uint16) midiOutBytes;
+
+    // Commit - the sequence number marks the slot as complete.
+    std::atomic_thread_fence (std::memory_order_release);
+    header->sequence = nextSequence++;
+    currentSlot = nullptr;
+}
+
+//==============================================================================
+bool BlockCaptureReader::open (const juce::File& file)
+{
+    blocks.clear();
+    mappedFile.reset (new juce::MemoryMappedFile (file, juce::MemoryMappedFile::readOnly, false));
+
+    const juce::uint8* data = static_cast<const juce::uint8*> (mappedFile->getData());
+    if (data == nullptr || mappedFile->getSize() < sizeof (FileHeader)) {
+        return false;
+    }
+
+    const FileHeader* header = reinterpret_cast<const FileHeader*> (data);
+    if (header->magic != CBR_CAPTURE_MAGIC || header->version != CBR_CAPTURE_VERSION
+        || header->slotBytes < sizeof (BlockHeader)
+        || mappedFile->getSize() < (size_t) header->slotBytes * (header->numSlots + 1)) {
+        return false;
+    }
+
+    for (juce::uint32 i = 0; i < header->numSlots; i++) {
+        const BlockHeader* block = reinterpret_cast<const BlockHeader*> (data + (size_t) header->slotBytes * (i + 1));
+        const size_t blockBytes = sizeof (BlockHeader) + block->numParams * sizeof (float) + block->midiInBytes + block->midiOutBytes;
+
+        // Skip empty slots, and any that were cut off mid-write.
+        if (block->sequence != 0 && blockBytes <= header->slotBytes) {
+            blocks.add (block);
+        }
+    }
+
+    std::sort (blocks.begin(), blocks.end(), [] (const BlockHeader* a, const BlockHeader* b) {
+        return a->sequence < b->sequence;
+    });
+
+    return true;
+}
+
+juce::String BlockCaptureReader::getPluginName () const
+{
+    if (mappedFile == nullptr || mappedFile->getData() == nullptr) {
+        return {};
+    }
+
+    const FileHeader* header = static_cast<const FileHeader*> (mappedFile->getData());
+    return juce::String::fromUTF8 (header->pluginName, (int) strnlen (header->pluginName, sizeof (header->pluginName)));
+}
+
+const float* BlockCaptureReader::getParams (int index) const
+{
+    return reinterpret_cast<const float*> (blocks[index] + 1);
+}
+
+void BlockCaptureReader::getMidiIn (int index, juce::MidiBuffer& midiMessages) const
+{
+    const BlockHeader* block = blocks[index];
+    const juce::uint8* events = reinterpret_cast<const juce::uint8*> (getParams (index) + block->numParams);
+    readEvents (events, block->midiInBytes, midiMessages);
+}
+
+void BlockCaptureReader::getMidiOut (int index, juce::MidiBuffer& midiMessages) const
+{
+    const BlockHeader* block = blocks[index];
+    const juce::uint8* events = reinterpret_cast<const juce::uint8*> (getParams (index) + block->numParams) + block->midiInBytes;
+    readEvents (events, block->midiOutBytes, midiMessages);
+}
@@ -0,0 +1,158 @@
+/*
+  ==============================================================================
+
+    BlockCapture.h
+    Records each processed block to a memory-mapped ring file, for replaying
+    glitches from a live show after the fact.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "InstanceFile.h"
+#include "ParameterConfig.h"
+
+// Set this environment variable to a directory to record captures there.
+#define CBR_CAPTURE_DIR_ENV "CBR_CAPTURE_DIR"
+
+#define CBR_CAPTURE_MAGIC 0x43425243 // "CBRC"
+#define CBR_CAPTURE_VERSION 1
+// Each block is stored in a fixed size slot. The first slot holds the file header.
+#define CBR_CAPTURE_SLOT_BYTES 4096
+// 8192 slots = 32MB, around 90 seconds of 512 sample blocks at 48kHz.
+#define CBR_CAPTURE_NUM_SLOTS 8192
+// Every parameter a processor can have - see ParameterConfig.
+#define CBR_CAPTURE_MAX_PARAMS CBR_CONFIG_MAX_PARAMS
+
+//==============================================================================
+/**
+ * Binary layout of a capture file.
+*/
+namespace BlockCaptureFormat
+{
+    struct FileHeader
+    {
+        juce::uint32 magic;
+        juce::uint32 version;
+        juce::uint32 slotBytes;
+        juce::uint32 numSlots;
+        char pluginName[64];
+    };
+
+    enum BlockFlags
+    {
+        hasPlayhead = 1,
+        isPlaying = 2,
+        isLooping = 4,
+        // Some events didn't fit in the slot.
+        truncated = 8,
+        // The processor had more params than a slot holds.
+        paramsTruncated = 16
+    };
+
+    /**
+     * Start of each block slot. Followed by numParams floats - the block's
+     * ParameterConfig, including values set on the audio thread - then the
+     * input MIDI events, then the output MIDI events.
+     *
+     * Events are stored as a uint16 sample position, a uint8 size, then the MIDI bytes.
+    */
+    struct BlockHeader
+    {
+        // Written last, 0 while the slot is being written. Blocks replay in sequence order.
+        juce::uint64 sequence;
+        juce::int64 timeInSamples;
+        double sampleRate;
+        double bpm;
+        double ppqPosition;
+        juce::int32 timeSigNumerator;
+        juce::int32 timeSigDenominator;
+        juce::int32 numSamples;
+        juce::uint32 flags;
+        juce::uint16 numParams;
+        juce::uint16 midiInBytes;
+        juce::uint16 midiOutBytes;
+        juce::uint16 reserved;
+    };
+
+    /**
+     * Decode captured events into a MIDI buffer.
+    */
+    void readEvents (const juce::uint8* data, int numBytes, juce::MidiBuffer& midiMessages);
+}
+
+//==============================================================================
+/**
+ * Writes block captures on the audio thread.
+ *
+ * The ring file is created, sized and mapped up front, and every page is touched
+ * when it is opened. Capturing a block is then just copies into mapped memory -
+ * no allocation, locks or syscalls.
+*/
+class BlockCaptureRecorder
+{
+public:
+    BlockCaptureRecorder ();
+    ~BlockCaptureRecorder ();
+
+    /**
+     * Start capturing if CBR_CAPTURE_DIR is set. Safe to call repeatedly (e.g. from prepareToPlay).
+     * Not real-time safe.
+    */
+    void openIfEnabled (const juce::String& pluginName);
+
+    bool open (const juce::File& file, const juce::String& pluginName);
+    void close ();
+    bool isOpen () const { return slots != nullptr; }
+
+    /**
+     * Capture the inputs of a block, before it is processed. Audio thread.
+     *
+     * @param position Playhead position, or nullptr if there is no playhead.
+     * @param config The params the block plays with, after program switches, OSC cues and MIDI learn.
+    */
+    void captureBlockInput (const juce::AudioPlayHead::CurrentPositionInfo* position, int numSamples, double sampleRate,
+                            const ParameterConfig& config, const juce::MidiBuffer& midiIn);
+
+    /**
+     * Capture the output MIDI of the block and commit it to the ring. Audio thread.
+    */
+    void captureBlockOutput (const juce::MidiBuffer& midiOut);
+
+private:
+    int writeEvents (const juce::MidiBuffer& midiMessages, juce::uint8* dest, int maxBytes);
+
+    std::unique_ptr<juce::MemoryMappedFile> mappedFile;
+    juce::uint8* slots;
+    juce::uint64 nextSequence;
+
+    // Slot currently being written, between captureBlockInput() and captureBlockOutput().
+    juce::uint8* currentSlot;
+    int currentSlotBytes;
+
+    JUCE_DECLARE_NON_COPYABLE (BlockCaptureRecorder)
+};
+
+//==============================================================================
+/**
+ * Reads a capture file, with blocks in the order they were recorded.
+*/
+class BlockCaptureReader
+{
+public:
+    bool open (const juce::File& file);
+
+    juce::String getPluginName () const;
+    int getNumBlocks () const { return blocks.size(); }
+
+    const BlockCaptureFormat::BlockHeader& getBlock (int index) const { return *blocks[index]; }
+    const float* getParams (int index) const;
+    void getMidiIn (int index, juce::MidiBuffer& midiMessages) const;
+    void getMidiOut (int index, juce::MidiBuffer& midiMessages) const;
+
+private:
+    std::unique_ptr<juce::MemoryMappedFile> mappedFile;
+    juce::Array<const BlockCaptureFormat::BlockHeader*> blocks;
+};
@@ -0,0 +1,275 @@
+/*
+  ==============================================================================
+
+    BoundaryTiming.cpp
+    Histograms of how far each phrase switch lands from the exact boundary,
+    measured against the host's ppq position.
+
+  ==============================================================================
+*/
+
+#include "BoundaryTiming.h"
+
+// Bin for an error of 0.
+static const int centreBin = CBR_TIMING_LINEAR_BINS - 1 + CBR_TIMING_NUM_OCTAVES;
+
+//==============================================================================
+void BoundaryTimingHistogram::add (const BoundaryTimingHistogram& other)
+{
+    if (other.total == 0) {
+        return;
+    }
+
+    minError = (total == 0) ? other.minError : juce::jmin (minError, other.minError);
+    maxError = (total == 0) ? other.maxError : juce::jmax (maxError, other.maxError);
+    for (int bin = 0; bin < CBR_TIMING_NUM_BINS; bin++) {
+        counts[bin] += other.counts[bin];
+    }
+    total += other.total;
+    sumError += other.sumError;
+    sumSquaredError += other.sumSquaredError;
+}
+
+int BoundaryTimingHistogram::getBin (double errorSamples)
+{
+    const double rounded = std::round (juce::jlimit (-1.0e9, 1.0e9, errorSamples));
+    const juce::int64 magnitude = (juce::int64) std::abs (rounded);
+    if (magnitude < CBR_TIMING_LINEAR_BINS) {
+        return centreBin + (int) rounded;
+    }
+
+    // 16-31 is the first octave, 32-63 the second, and so on. The last one has everything beyond.
+    const int octave = juce::jmin (CBR_TIMING_NUM_OCTAVES,
+        juce::findHighestSetBit ((juce::uint32) juce::jmin (magnitude, (juce::int64) 1 << 30)) - juce::findHighestSetBit (CBR_TIMING_LINEAR_BINS) + 1);
+    const int offset = CBR_TIMING_LINEAR_BINS - 1 + octave;
+    return rounded < 0 ? centreBin - offset : centreBin + offset;
+}
+
+juce::String BoundaryTimingHistogram::getBinName (int bin)
+{
+    const int offset = bin - centreBin;
+    const int magnitude = std::abs (offset);
+    if (magnitude < CBR_TIMING_LINEAR_BINS) {
+        return juce::String (offset);
+    }
+
+    const int octave = magnitude - (CBR_TIMING_LINEAR_BINS - 1);
+    const int low = CBR_TIMING_LINEAR_BINS << (octave - 1);
+    const juce::String sign = offset < 0 ? "-" : "";
+    if (octave == CBR_TIMING_NUM_OCTAVES) {
+        return sign + juce::String (low) + "+";
+    }
+    return sign + juce::String (low) + ".." + sign + juce::String (low * 2 - 1);
+}
+
+//==============================================================================
+const char* BoundaryTimingRecorder::getKindName (int kind)
+{
+    switch (kind) {
+        case phraseSwitch: return "phrase switch";
+        case blockSwitch: return "block switch";
+        case gatedEvent: return "gated event";
+        case rampBoundary: return "ramp boundary";
+    }
+    return "";
+}
+
+BoundaryTimingRecorder::BoundaryTimingRecorder ()
+    : enabled (false)
+{
+    blockValid = false;
+    blockTime = 0;
+    blockPpq = 0;
+    samplesPerQuarter = 0;
+    phraseQuarters = 0;
+    offsetQuarters = 0;
+
+    for (int kind = 0; kind < numKinds; kind++) {
+        for (int bin = 0; bin < CBR_TIMING_NUM_BINS; bin++) {
+            counts[kind][bin] = 0;
+        }
+        totals[kind] = 0;
+        sumErrors[kind] = 0;
+        sumSquaredErrors[kind] = 0;
+        minErrors[kind] = 0;
+        maxErrors[kind] = 0;
+    }
+}
+
+BoundaryTimingRecorder::~BoundaryTimingRecorder ()
+{
+    if (isEnabled()) {
+        writeToFile (timingFile);
+    }
+}
+
+void BoundaryTimingRecorder::openIfEnabled (const juce::String& newPluginName)
+{
+    if (isEnabled()) {
+        return;
+    }
+
+    // One file per instance.
+    const juce::File file = getInstanceFile (CBR_TIMING_DIR_ENV, newPluginName, this, ".csv");
+    if (file == juce::File()) {
+        return;
+    }
+
+    pluginName = newPluginName;
+    timingFile = file;
+    enabled = true;
+}
+
+void BoundaryTimingRecorder::beginBlock (const juce::AudioPlayHead::CurrentPositionInfo* position, double sampleRate, const PhraseClock& phraseClock)
+{
+    blockValid = false;
+    if (! isEnabled() || position == nullptr || position->bpm <= 0 || sampleRate <= 0) {
+        return;
+    }
+
+    blockValid = true;
+    blockTime = position->timeInSamples;
+    blockPpq = position->ppqPosition;
+    samplesPerQuarter = sampleRate * 60.0 / position->bpm;
+    phraseQuarters = (double) phraseClock.getPhraseLengthTicks() / CBR_PHRASECLOCK_TICKS_PER_QUARTER;
+    offsetQuarters = (double) phraseClock.getOffsetTicks() / CBR_PHRASECLOCK_TICKS_PER_QUARTER;
+}
+
+void BoundaryTimingRecorder::record (int kind, juce::int64 appliedTime)
+{
+    if (! blockValid || phraseQuarters <= 0) {
+        return;
+    }
+
+    // Where the switch landed in phrases, from the host's ppq, against the nearest whole phrase.
+    const double appliedPpq = blockPpq + (appliedTime - blockTime) / samplesPerQuarter;
+    const double phrases = (appliedPpq - offsetQuarters) / phraseQuarters;
+    const double errorSamples = (phrases - std::round (phrases)) * phraseQuarters * samplesPerQuarter;
+
+    // Only the audio thread writes, so plain loads and stores are enough.
+    const int bin = BoundaryTimingHistogram::getBin (errorSamples);
+    counts[kind][bin].store (counts[kind][bin].load (std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    const juce::int64 total = totals[kind].load (std::memory_order_relaxed);
+    minErrors[kind].store (total == 0 ? errorSamples : juce::jmin (minErrors[kind].load (std::memory_order_relaxed), errorSamples), std::memory_order_relaxed);
+    maxErrors[kind].store (total == 0 ? errorSamples : juce::jmax (maxErrors[kind].load (std::memory_order_relaxed), errorSamples), std::memory_order_relaxed);
+    sumErrors[kind].store (sumErrors[kind].load (std::memory_order_relaxed) + errorSamples, std::memory_order_relaxed);
+    sumSquaredErrors[kind].store (sumSquaredErrors[kind].load (std::memory_order_relaxed) + errorSamples * errorSamples, std::memory_order_relaxed);
+    totals[kind].store (total + 1, std::memory_order_release);
+}
+
+BoundaryTimingHistogram BoundaryTimingRecorder::getHistogram (int kind) const
+{
+    BoundaryTimingHistogram histogram;
+    histogram.total = totals[kind].load (std::memory_order_acquire);
+    for (int bin = 0; bin < CBR_TIMING_NUM_BINS; bin++) {
+        histogram.counts[bin] = counts[kind][bin].load (std::memory_order_relaxed);
+    }
+    histogram.sumError = sumErrors[kind].load (std::memory_order_relaxed);
+    histogram.sumSquaredError = sumSquaredErrors[kind].load (std::memory_order_relaxed);
+    histogram.minError = minErrors[kind].load (std::memory_order_relaxed);
+    histogram.maxError = maxErrors[kind].load (std::memory_order_relaxed);
+    return histogram;
+}
+
+//==============================================================================
+bool BoundaryTimingRecorder::writeToFile (const juce::File& file) const
+{
+    juce::String csv = "plugin,kind,statistic,value\n";
+    for (int kind = 0; kind < numKinds; kind++) {
+        const BoundaryTimingHistogram histogram = getHistogram (kind);
+        if (histogram.total == 0) {
+            continue;
+        }
+
+        const juce::String prefix = pluginName + "," + getKindName (kind) + ",";
+        csv << prefix << "count," << histogram.total << "\n"
+            << prefix << "sum," << juce::String (histogram.sumError, 6) << "\n"
+            << prefix << "sum of squares," << juce::String (histogram.sumSquaredError, 6) << "\n"
+            << prefix << "min," << juce::String (histogram.minError, 6) << "\n"
+            << prefix << "max," << juce::String (histogram.maxError, 6) << "\n";
+        for (int bin = 0; bin < CBR_TIMING_NUM_BINS; bin++) {
+            if (histogram.counts[bin] > 0) {
+                csv << prefix << "bin " << bin << "," << histogram.counts[bin] << "\n";
+            }
+        }
+    }
+
+    return file.getParentDirectory().createDirectory().wasOk() && file.replaceWithText (csv);
+}
+
+bool BoundaryTimingRecorder::readFromFile (const juce::File& file, juce::StringArray& pluginNames, juce::Array<BoundaryTimingHistogram>& totals)
+{
+    juce::StringArray lines;
+    file.readLines (lines);
+    if (lines.isEmpty() || lines[0] != "plugin,kind,statistic,value") {
+        return false;
+    }
+
+    // Each file is one instance - read it whole, then add it on.
+    juce::StringArray names;
+    juce::Array<BoundaryTimingHistogram> histograms;
+    for (int i = 1; i < lines.size(); i++) {
+        const juce::StringArray fields = juce::StringArray::fromTokens (lines[i], ",", "");
+        if (fields.size() != 4) {
+            continue;
+        }
+
+        int kind = -1;
+        for (int k = 0; k < numKinds; k++) {
+            if (fields[1] == getKindName (k)) {
+                kind = k;
+            }
+        }
+        if (kind < 0) {
+            continue;
+        }
+
+        int plugin = names.indexOf (fields[0]);
+        if (plugin < 0) {
+            plugin = names.size();
+            names.add (fields[0]);
+            for (int k = 0; k < numKinds; k++) {
+                histograms.add (BoundaryTimingHistogram());
+            }
+        }
+
+        BoundaryTimingHistogram& histogram = histograms.getReference (plugin * numKinds + kind);
+        const juce::String& statistic = fields[2];
+        if (statistic == "count") {
+            histogram.total = fields[3].getLargeIntValue();
+        }
+        else if (statistic == "sum") {
+            histogram.sumError = fields[3].getDoubleValue();
+        }
+        else if (statistic == "sum of squares") {
+            histogram.sumSquaredError = fields[3].getDoubleValue();
+        }
+        else if (statistic == "min") {
+            histogram.minError = fields[3].getDoubleValue();
+        }
+        else if (statistic == "max") {
+            histogram.maxError = fields[3].getDoubleValue();
+        }
+        else if (statistic.startsWith ("bin ")) {
+            const int bin = statistic.substring (4).getIntValue();
+            if (bin >= 0 && bin < CBR_TIMING_NUM_BINS) {
+                histogram.counts[bin] = fields[3].getLargeIntValue();
+            }
+        }
+    }
+
+    for (int plugin = 0; plugin < names.size(); plugin++) {
+        int total = pluginNames.indexOf (names[plugin]);
+        if (total < 0) {
+            total = pluginNames.size();
+            pluginNames.add (names[plugin]);
+            for (int k = 0; k < numKinds; k++) {
+                totals.add (BoundaryTimingHistogram());
+            }
+        }
+        for (int kind = 0; kind < numKinds; kind++) {
+            totals.getReference (total * numKinds + kind).add (histograms.getReference (plugin * numKinds + kind));
+        }
+    }
+    return true;
+}
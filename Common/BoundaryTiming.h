@@ -0,0 +1,150 @@
+/*
+  ==============================================================================
+
+    BoundaryTiming.h
+    Histograms of how far each phrase switch lands from the exact boundary,
+    measured against the host's ppq position.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "InstanceFile.h"
+#include "PhraseClock.h"
+
+#include <atomic>
+
+// Folder for timing files. Timing is only recorded if this is set.
+#define CBR_TIMING_DIR_ENV "CBR_TIMING_DIR"
+// Errors under this many samples get a bin per sample, larger ones a bin per octave.
+#define CBR_TIMING_LINEAR_BINS 16
+#define CBR_TIMING_NUM_OCTAVES 12
+#define CBR_TIMING_NUM_BINS (2 * (CBR_TIMING_LINEAR_BINS - 1 + CBR_TIMING_NUM_OCTAVES) + 1)
+
+//==============================================================================
+/**
+ * Counts of boundary timing errors, in samples - positive when late.
+*/
+struct BoundaryTimingHistogram
+{
+    juce::int64 counts[CBR_TIMING_NUM_BINS] = {};
+    juce::int64 total = 0;
+    double sumError = 0;
+    double sumSquaredError = 0;
+    double minError = 0;
+    double maxError = 0;
+
+    void add (const BoundaryTimingHistogram& other);
+
+    double getMean () const { return total > 0 ? sumError / total : 0; }
+    double getRMS () const { return total > 0 ? std::sqrt (sumSquaredError / total) : 0; }
+
+    /**
+     * The bin for an error, 1 sample wide near 0 and an octave wide further out.
+    */
+    static int getBin (double errorSamples);
+
+    /**
+     * The range of errors in a bin, e.g. "3" or "32..63".
+    */
+    static juce::String getBinName (int bin);
+};
+
+//==============================================================================
+/**
+ * Records, for each phrase switch and gated event, the difference in samples
+ * between where it was applied and where the boundary lies exactly, worked out
+ * from the host's ppq position rather than the phrase clock. That covers the
+ * phrase clock's sample rounding and switches that wait for the next block or
+ * grid line.
+ *
+ * Histograms are updated with atomics on the audio thread and can be read from
+ * any thread. With CBR_TIMING_DIR set, each instance writes its histograms to a
+ * CSV file there when it's destroyed, e.g. for BenchmarkHost --timing.
+*/
+class BoundaryTimingRecorder
+{
+public:
+    enum Kind
+    {
+        // Applied at the boundary's sample within the block, e.g. notes after the boundary.
+        phraseSwitch = 0,
+        // Applied at the start of the block after the boundary.
+        blockSwitch,
+        // LineToggler gates latched for the boundary.
+        gatedEvent,
+        // ControllerMotion ramps landing, on the next block or CC grid line.
+        rampBoundary,
+        numKinds
+    };
+
+    static const char* getKindName (int kind);
+
+    BoundaryTimingRecorder ();
+    ~BoundaryTimingRecorder ();
+
+    /**
+     * Start recording if CBR_TIMING_DIR is set. Safe to call repeatedly (e.g. from prepareToPlay).
+    */
+    void openIfEnabled (const juce::String& pluginName);
+    bool isEnabled () const { return enabled.load(); }
+
+    /**
+     * Take the exact grid for the block from the host position. Audio thread.
+     *
+     * @param position Playhead position, or nullptr if there is no playhead.
+     * @param sampleRate Current sample rate.
+     * @param phraseClock The phrase length and offset in use.
+    */
+    void beginBlock (const juce::AudioPlayHead::CurrentPositionInfo* position, double sampleRate, const PhraseClock& phraseClock);
+
+    /**
+     * Record a switch against the nearest exact boundary. Audio thread.
+     *
+     * @param kind One of Kind.
+     * @param appliedTime Sample time the switch took effect.
+    */
+    void record (int kind, juce::int64 appliedTime);
+
+    /**
+     * A copy of a histogram so far. Any thread.
+    */
+    BoundaryTimingHistogram getHistogram (int kind) const;
+
+    /**
+     * Write the histograms as CSV - plugin, kind, statistic, value.
+    */
+    bool writeToFile (const juce::File& file) const;
+
+    /**
+     * Add the histograms from a file written by writeToFile() to per-plugin totals.
+     *
+     * @param totals Histograms for each plugin name, numKinds each, added to.
+    */
+    static bool readFromFile (const juce::File& file, juce::StringArray& pluginNames, juce::Array<BoundaryTimingHistogram>& totals);
+
+private:
+    std::atomic<bool> enabled;
+    juce::String pluginName;
+    juce::File timingFile;
+
+    // Exact grid for the current block.
+    bool blockValid;
+    juce::int64 blockTime;
+    double blockPpq;
+    double samplesPerQuarter;
+    double phraseQuarters;
+    double offsetQuarters;
+
+    // Written by the audio thread only.
+    std::atomic<juce::int64> counts[numKinds][CBR_TIMING_NUM_BINS];
+    std::atomic<juce::int64> totals[numKinds];
+    std::atomic<double> sumErrors[numKinds];
+    std::atomic<double> sumSquaredErrors[numKinds];
+    std::atomic<double> minErrors[numKinds];
+    std::atomic<double> maxErrors[numKinds];
+
+    JUCE_DECLARE_NON_COPYABLE (BoundaryTimingRecorder)
+};
@@ -0,0 +1,111 @@
+/*
+  ==============================================================================
+
+    ConfigSwap.h
+    Hands immutable configuration objects from the message thread to the audio
+    thread without locking.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <atomic>
+
+// Retired configurations waiting to be freed. At most one is retired per publish().
+#define CBR_CONFIGSWAP_RETIRED_SLOTS 8
+
+//==============================================================================
+/**
+ * The message thread builds a configuration and publishes it. The audio thread
+ * picks it up at the start of a block with an atomic pointer swap, and hands
+ * the one it was using back to be freed on the message thread.
+ *
+ * Only one thread may publish, and only one thread may acquire.
+*/
+template <typename Config>
+class ConfigSwap
+{
+public:
+    ConfigSwap ()
+        : retiredFifo (CBR_CONFIGSWAP_RETIRED_SLOTS)
+    {
+    }
+
+    ~ConfigSwap ()
+    {
+        collectGarbage();
+        delete pending.exchange (nullptr);
+        delete current;
+    }
+
+    /**
+     * Publish a configuration for the audio thread to pick up.
+     * Replaces any published configuration the audio thread hasn't picked up yet.
+     *
+     * Message thread.
+    */
+    void publish (std::unique_ptr<const Config> config)
+    {
+        collectGarbage();
+        delete pending.exchange (config.release());
+    }
+
+    /**
+     * Free configurations the audio thread has finished with.
+     *
+     * Message thread.
+    */
+    void collectGarbage ()
+    {
+        int start1, size1, start2, size2;
+        retiredFifo.prepareToRead (retiredFifo.getNumReady(), start1, size1, start2, size2);
+        for (int i = 0; i < size1; i++) {
+            delete retired[start1 + i];
+        }
+        for (int i = 0; i < size2; i++) {
+            delete retired[start2 + i];
+        }
+        retiredFifo.finishedRead (size1 + size2);
+    }
+
+    /**
+     * Pick up the latest published configuration. Never blocks or frees memory.
+     *
+     * Audio thread, at the start of a block.
+     *
+     * @return The newly published configuration, valid until the next call, or null if nothing new was published.
+    */
+    const Config* acquire ()
+    {
+        const Config* config = pending.exchange (nullptr);
+        if (config == nullptr) {
+            return nullptr;
+        }
+
+        if (current != nullptr) {
+            int start1, size1, start2, size2;
+            retiredFifo.prepareToWrite (1, start1, size1, start2, size2);
+            // The message thread collects before each publish, so there's always room.
+            jassert (size1 == 1);
+            retired[start1] = current;
+            retiredFifo.finishedWrite (size1);
+        }
+
+        current = config;
+        return current;
+    }
+
+private:
+    std::atomic<const Config*> pending { nullptr };
+
+    // Owned by the audio thread.
+    const Config* current = nullptr;
+
+    juce::AbstractFifo retiredFifo;
+    const Config* retired[CBR_CONFIGSWAP_RETIRED_SLOTS];
+
+    JUCE_DECLARE_NON_COPYABLE (ConfigSwap)
+};
@@ -0,0 +1,37 @@
+/*
+  ==============================================================================
+
+    InstanceFile.h
+    Names the file each plugin instance records to, in a folder chosen by an
+    environment variable (e.g. block capture and boundary timing).
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+ * A file for one instance, e.g. CBR_CAPTURE_DIR/ClipVariations-Note-20260101-120000-7f3a2c10.cbrcap.
+ * Not real-time safe.
+ *
+ * @param envVarName Environment variable naming the folder.
+ * @param pluginName Plugin name, spaces are removed.
+ * @param instance The recorder, whose address tells instances started together apart.
+ * @param extension File extension, e.g. ".csv".
+ * @return The file, or File() if the variable isn't set.
+*/
+inline juce::File getInstanceFile (const char* envVarName, const juce::String& pluginName, const void* instance, const juce::String& extension)
+{
+    const juce::String folder = juce::SystemStats::getEnvironmentVariable (envVarName, {});
+    if (folder.isEmpty()) {
+        return {};
+    }
+
+    return juce::File (folder).getChildFile (pluginName.removeCharacters (" ")
+        + "-" + juce::Time::getCurrentTime().formatted ("%Y%m%d-%H%M%S")
+        + "-" + juce::String::toHexString ((juce::pointer_sized_int) instance)
+        + extension);
+}
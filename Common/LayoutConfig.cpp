@@ -0,0 +1,495 @@
+/*
+  ==============================================================================
+
+    LayoutConfig.cpp
+    Note ranges, line maps and CC layouts loaded from a file, and reloaded
+    while the plugin runs whenever the file changes.
+
+  ==============================================================================
+*/
+
+#include "LayoutConfig.h"
+
+#if JUCE_LINUX
+ #include <poll.h>
+ #include <sys/inotify.h>
+ #include <unistd.h>
+#endif
+
+//==============================================================================
+LayoutTables::LayoutTables ()
+{
+    const int builtInHeights[CBR_LAYOUT_NUM_HEIGHTS] = { 6, 12, 24, 36 };
+    for (int i = 0; i < CBR_LAYOUT_NUM_HEIGHTS; i++) {
+        variationHeights[i] = builtInHeights[i];
+    }
+
+    for (int i = 0; i < CBR_LAYOUT_MAX_LANES; i++) {
+        laneCCNumbers[i] = -1;
+        laneChannels[i] = 0;
+    }
+
+    // Up and down, until the layout file gives a table.
+    numLFOPoints = 2;
+    lfoPoints[0] = 0;
+    lfoPoints[1] = 127;
+
+    compile();
+}
+
+void LayoutTables::setLines (int newNumLines, int newFirstLineNote, const int* newNotesPerLine, const int* newLineControlNotes)
+{
+    numLines = juce::jmin (newNumLines, CBR_LAYOUT_MAX_LINES);
+    firstLineNote = newFirstLineNote;
+    for (int i = 0; i < numLines; i++) {
+        notesPerLine[i] = newNotesPerLine[i];
+        lineControlNotes[i] = newLineControlNotes[i];
+    }
+    compile();
+}
+
+void LayoutTables::setLanes (int newNumLanes)
+{
+    numLanes = juce::jmin (newNumLanes, CBR_LAYOUT_MAX_LANES);
+}
+
+/**
+ * Read a setting's value as a list of ints. A single value counts as a list of one.
+ *
+ * @return An error message, or empty.
+*/
+static juce::String readInts (const juce::String& name, const juce::var& value, int count, int minValue, int maxValue, int* result)
+{
+    juce::Array<juce::var> values;
+    if (value.isArray()) {
+        values = *value.getArray();
+    }
+    else {
+        values.add (value);
+    }
+
+    if (values.size() != count) {
+        return name + " needs " + juce::String (count) + (count == 1 ? " value" : " values");
+    }
+
+    for (int i = 0; i < count; i++) {
+        const int number = values[i];
+        if (! (values[i].isInt() || values[i].isInt64() || values[i].isDouble()) || number < minValue || number > maxValue) {
+            return name + " values must be " + juce::String (minValue) + " to " + juce::String (maxValue);
+        }
+        result[i] = number;
+    }
+    return {};
+}
+
+/**
+ * Read the plain text format - one `name = values` setting per line, values
+ * separated by spaces or commas, and # for comments.
+*/
+static juce::var parseSettingLines (const juce::String& text)
+{
+    juce::DynamicObject::Ptr settings = new juce::DynamicObject();
+
+    for (const juce::String& fullLine : juce::StringArray::fromLines (text)) {
+        const juce::String line = fullLine.upToFirstOccurrenceOf ("#", false, false).trim();
+        if (line.isEmpty()) {
+            continue;
+        }
+
+        const juce::String name = line.upToFirstOccurrenceOf ("=", false, false).trim();
+        juce::Array<juce::var> values;
+        for (const juce::String& token : juce::StringArray::fromTokens (line.fromFirstOccurrenceOf ("=", false, false), " ,\t", "")) {
+            values.add (token.containsOnly ("-0123456789") ? juce::var (token.getIntValue()) : juce::var (token));
+        }
+        settings->setProperty (name, values.size() == 1 ? values[0] : juce::var (values));
+    }
+
+    return juce::var (settings.get());
+}
+
+juce::String LayoutTables::parse (const juce::String& text)
+{
+    juce::var settings;
+    if (text.trimStart().startsWithChar ('{')) {
+        const juce::Result result = juce::JSON::parse (text, settings);
+        if (result.failed()) {
+            return result.getErrorMessage();
+        }
+    }
+    else {
+        settings = parseSettingLines (text);
+    }
+
+    juce::DynamicObject* object = settings.getDynamicObject();
+    if (object == nullptr) {
+        return "expected a JSON object or name = values lines";
+    }
+
+    for (const juce::NamedValueSet::NamedValue& setting : object->getProperties()) {
+        const juce::String error = parseSetting (setting.name.toString(), setting.value);
+        if (error.isNotEmpty()) {
+            return error;
+        }
+    }
+
+    const juce::String error = validate();
+    if (error.isEmpty()) {
+        compile();
+    }
+    return error;
+}
+
+juce::String LayoutTables::parseSetting (const juce::String& name, const juce::var& value)
+{
+    if (name == "variationHeights") {
+        return readInts (name, value, CBR_LAYOUT_NUM_HEIGHTS, 1, 127, variationHeights);
+    }
+
+    if (name == "variationSplits") {
+        return parseSplits (value);
+    }
+
+    if (name == "firstLineNote" || name == "notesPerLine" || name == "lineControlNotes") {
+        if (numLines == 0) {
+            return name + " isn't used by this plugin";
+        }
+        if (name == "firstLineNote") {
+            return readInts (name, value, 1, 0, 127, &firstLineNote);
+        }
+        if (name == "notesPerLine") {
+            return readInts (name, value, numLines, 1, 127, notesPerLine);
+        }
+        return readInts (name, value, numLines, 0, 127, lineControlNotes);
+    }
+
+    if (name == "ccNumbers" || name == "ccChannels") {
+        if (numLanes == 0) {
+            return name + " isn't used by this plugin";
+        }
+        if (name == "ccNumbers") {
+            return readInts (name, value, numLanes, 0, 127, laneCCNumbers);
+        }
+        return readInts (name, value, numLanes, 1, 16, laneChannels);
+    }
+
+    if (name == "lfoTable") {
+        if (numLanes == 0) {
+            return name + " isn't used by this plugin";
+        }
+        const int count = value.isArray() ? value.getArray()->size() : 1;
+        if (count < 2 || count > CBR_LAYOUT_MAX_LFO_POINTS) {
+            return name + " needs 2 to " + juce::String (CBR_LAYOUT_MAX_LFO_POINTS) + " values";
+        }
+        numLFOPoints = count;
+        return readInts (name, value, count, 0, 127, lfoPoints);
+    }
+
+    return "unknown setting " + name;
+}
+
+/**
+ * Read the split table - four values for each range: variation, first note,
+ * last note, and the semitones to transpose by. In JSON each range can be an
+ * array of its own.
+*/
+juce::String LayoutTables::parseSplits (const juce::var& value)
+{
+    juce::Array<juce::var> items;
+    if (value.isArray()) {
+        items = *value.getArray();
+    }
+    else {
+        items.add (value);
+    }
+
+    juce::Array<juce::var> values;
+    for (const juce::var& item : items) {
+        if (item.isArray()) {
+            values.addArray (*item.getArray());
+        }
+        else {
+            values.add (item);
+        }
+    }
+
+    if (values.size() == 0 || values.size() % 4 != 0 || values.size() / 4 > CBR_LAYOUT_MAX_SPLITS) {
+        return "variationSplits needs 4 values (variation, first note, last note, transpose) for each of up to "
+            + juce::String (CBR_LAYOUT_MAX_SPLITS) + " ranges";
+    }
+
+    numSplits = values.size() / 4;
+    for (int i = 0; i < numSplits; i++) {
+        juce::Array<juce::var> rangeValues;
+        for (int j = 0; j < 4; j++) {
+            rangeValues.add (values[i * 4 + j]);
+        }
+        const juce::String error = readInts ("variationSplits range " + juce::String (i + 1), juce::var (rangeValues), 4, -127, 127, splits[i]);
+        if (error.isNotEmpty()) {
+            return error;
+        }
+    }
+    return {};
+}
+
+juce::String LayoutTables::validate () const
+{
+    for (int i = 0; i < numSplits; i++) {
+        const int* split = splits[i];
+        const juce::String range = "variationSplits range " + juce::String (i + 1);
+        if (split[0] < 1 || split[0] > 16) {
+            return range + ": variation must be 1 to 16";
+        }
+        if (split[1] < 0 || split[2] > 127 || split[1] > split[2]) {
+            return range + ": notes must be 0 to 127, first to last";
+        }
+        if (split[1] + split[3] < 0 || split[2] + split[3] > 127) {
+            return range + ": transposes past note 0 or 127";
+        }
+        for (int j = 0; j < i; j++) {
+            if (split[1] <= splits[j][2] && splits[j][1] <= split[2]) {
+                return range + " overlaps range " + juce::String (j + 1);
+            }
+        }
+    }
+
+    int lineEnd = firstLineNote;
+    for (int i = 0; i < numLines; i++) {
+        lineEnd += notesPerLine[i];
+    }
+    if (lineEnd > 128) {
+        return "lines go past note 127";
+    }
+
+    for (int i = 0; i < numLines; i++) {
+        const int controlNote = lineControlNotes[i];
+        if (controlNote >= firstLineNote && controlNote < lineEnd) {
+            return "control note " + juce::String (controlNote) + " is in a line";
+        }
+        for (int j = 0; j < i; j++) {
+            if (lineControlNotes[j] == controlNote) {
+                return "control note " + juce::String (controlNote) + " is used twice";
+            }
+        }
+    }
+
+    return {};
+}
+
+void LayoutTables::compile ()
+{
+    for (int choice = 0; choice < CBR_LAYOUT_NUM_HEIGHTS; choice++) {
+        const int height = variationHeights[choice];
+        for (int note = 0; note < 128; note++) {
+            NoteSplit& noteSplit = noteSplits[choice][note];
+            if (numSplits > 0) {
+                noteSplit = { -1, (juce::int8) note };
+            }
+            else {
+                // Equal heights, variation 0 from note 0.
+                noteSplit = { (juce::int8) (note / height), (juce::int8) (note % height) };
+            }
+        }
+    }
+    for (int i = 0; i < numSplits; i++) {
+        for (int note = splits[i][1]; note <= splits[i][2]; note++) {
+            for (int choice = 0; choice < CBR_LAYOUT_NUM_HEIGHTS; choice++) {
+                noteSplits[choice][note] = { (juce::int8) splits[i][0], (juce::int8) (note + splits[i][3]) };
+            }
+        }
+    }
+
+    for (int note = 0; note < 128; note++) {
+        lineForNote[note] = -1;
+        lineForControlNote[note] = -1;
+    }
+
+    // The LFO points wrap around, so the cycle joins up with the next one.
+    for (int i = 0; i <= CBR_LAYOUT_LFO_TABLE_SIZE; i++) {
+        const double position = (double) i * numLFOPoints / CBR_LAYOUT_LFO_TABLE_SIZE;
+        const int point = (int) position;
+        const double fraction = position - point;
+        const int from = lfoPoints[point % numLFOPoints];
+        const int to = lfoPoints[(point + 1) % numLFOPoints];
+        lfoTable[i] = (float) ((from + fraction * (to - from)) / 127.0);
+    }
+
+    int note = firstLineNote;
+    for (int i = 0; i < numLines; i++) {
+        for (int n = 0; n < notesPerLine[i] && note < 128; n++) {
+            lineForNote[note++] = (juce::int8) i;
+        }
+        lineForControlNote[lineControlNotes[i] & 0x7f] = (juce::int8) i;
+    }
+}
+
+//==============================================================================
+LayoutWatcher::LayoutWatcher (const LayoutTables& defaults)
+    : juce::Thread ("CBR layout watcher"),
+      defaults (defaults)
+{
+}
+
+LayoutWatcher::~LayoutWatcher ()
+{
+    stopThread (CBR_LAYOUT_POLL_MS * 4);
+}
+
+void LayoutWatcher::setFile (const juce::File& newFile)
+{
+    {
+        const juce::ScopedLock sl (lock);
+        if (newFile == file) {
+            return;
+        }
+        file = newFile;
+        status = {};
+    }
+
+    fileChanged = true;
+    if (! isThreadRunning()) {
+        startThread();
+    }
+    notify();
+}
+
+juce::File LayoutWatcher::getFile () const
+{
+    const juce::ScopedLock sl (lock);
+    return file;
+}
+
+juce::String LayoutWatcher::getStatus () const
+{
+    const juce::ScopedLock sl (lock);
+    return status;
+}
+
+void LayoutWatcher::setStatus (const juce::String& newStatus)
+{
+    const juce::ScopedLock sl (lock);
+    status = newStatus;
+}
+
+void LayoutWatcher::writeToState (juce::ValueTree& state) const
+{
+    const juce::File layoutFile = getFile();
+    if (layoutFile != juce::File()) {
+        state.setProperty ("layoutFile", layoutFile.getFullPathName(), nullptr);
+    }
+}
+
+void LayoutWatcher::readFromState (juce::ValueTree& state)
+{
+    const juce::String path = state.getProperty ("layoutFile", juce::String()).toString();
+    setFile (juce::File::isAbsolutePath (path) ? juce::File (path) : juce::File());
+    state.removeProperty ("layoutFile", nullptr);
+}
+
+//==============================================================================
+void LayoutWatcher::run ()
+{
+   #if JUCE_LINUX
+    notifyFd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+   #endif
+
+    juce::File watchedFile;
+
+    while (! threadShouldExit()) {
+        bool changed = false;
+
+        if (fileChanged.exchange (false)) {
+            watchedFile = getFile();
+            changed = true;
+
+           #if JUCE_LINUX
+            if (notifyWatch >= 0) {
+                inotify_rm_watch (notifyFd, notifyWatch);
+                notifyWatch = -1;
+            }
+            // Watch the folder rather than the file, as editors often save by replacing it.
+            if (notifyFd >= 0 && watchedFile != juce::File()) {
+                notifyWatch = inotify_add_watch (notifyFd, watchedFile.getParentDirectory().getFullPathName().toRawUTF8(),
+                                                 IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+            }
+           #endif
+        }
+        else {
+            changed = waitForChange (watchedFile);
+        }
+
+        if (changed && ! threadShouldExit()) {
+            wait (CBR_LAYOUT_SETTLE_MS);
+            reload (watchedFile);
+        }
+    }
+
+   #if JUCE_LINUX
+    if (notifyFd >= 0) {
+        close (notifyFd);
+        notifyFd = -1;
+        notifyWatch = -1;
+    }
+   #endif
+}
+
+/**
+ * Wait up to CBR_LAYOUT_POLL_MS for the watched file to change.
+*/
+bool LayoutWatcher::waitForChange (const juce::File& watchedFile)
+{
+   #if JUCE_LINUX
+    if (notifyWatch >= 0) {
+        pollfd descriptor = { notifyFd, POLLIN, 0 };
+        if (poll (&descriptor, 1, CBR_LAYOUT_POLL_MS) <= 0) {
+            return false;
+        }
+
+        bool changed = false;
+        alignas (inotify_event) char buffer[4096];
+        ssize_t length;
+        while ((length = read (notifyFd, buffer, sizeof (buffer))) > 0) {
+            for (char* position = buffer; position < buffer + length; ) {
+                const inotify_event* event = (const inotify_event*) position;
+                if (event->len > 0 && watchedFile.getFileName() == event->name) {
+                    changed = true;
+                }
+                position += sizeof (inotify_event) + event->len;
+            }
+        }
+        return changed;
+    }
+   #endif
+
+    // No inotify - compare the modification time.
+    wait (CBR_LAYOUT_POLL_MS);
+    if (watchedFile == juce::File()) {
+        return false;
+    }
+    return watchedFile.getLastModificationTime() != lastModified;
+}
+
+void LayoutWatcher::reload (const juce::File& layoutFile)
+{
+    if (layoutFile == juce::File()) {
+        layouts.publish (std::make_unique<const LayoutTables> (defaults));
+        setStatus ({});
+        return;
+    }
+
+    lastModified = layoutFile.getLastModificationTime();
+    if (! layoutFile.existsAsFile()) {
+        setStatus ("Can't find " + layoutFile.getFileName() + ", keeping the last layout");
+        return;
+    }
+
+    // Settings not in the file keep the built-in layout, not the last file's.
+    std::unique_ptr<LayoutTables> layout = std::make_unique<LayoutTables> (defaults);
+    const juce::String error = layout->parse (layoutFile.loadFileAsString());
+    if (error.isNotEmpty()) {
+        setStatus (layoutFile.getFileName() + ": " + error + ", keeping the last layout");
+        return;
+    }
+
+    layouts.publish (std::move (layout));
+    setStatus ("Loaded " + layoutFile.getFileName());
+}
@@ -0,0 +1,216 @@
+/*
+  ==============================================================================
+
+    LayoutConfig.h
+    Note ranges, line maps and CC layouts loaded from a file, and reloaded
+    while the plugin runs whenever the file changes.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "ConfigSwap.h"
+
+#include <atomic>
+
+// One height for each `Variation height` choice.
+#define CBR_LAYOUT_NUM_HEIGHTS 4
+#define CBR_LAYOUT_MAX_LINES 16
+#define CBR_LAYOUT_MAX_LANES 32
+// Points in a ControllerMotion LFO user table, and the wavetable it's compiled into.
+#define CBR_LAYOUT_MAX_LFO_POINTS 64
+#define CBR_LAYOUT_LFO_TABLE_SIZE 256
+// Note ranges in a NoteFilter split table.
+#define CBR_LAYOUT_MAX_SPLITS 32
+// How often the watcher checks for a new file, or a changed one where there's no inotify.
+#define CBR_LAYOUT_POLL_MS 250
+// Wait for the file to settle after a change before reading it, e.g. while an editor is still saving.
+#define CBR_LAYOUT_SETTLE_MS 50
+
+//==============================================================================
+/**
+ * Where a NoteFilter input note plays: its variation, and the note it plays as.
+*/
+struct NoteSplit
+{
+    // -1 if the note isn't in any variation.
+    juce::int8 variation;
+    juce::int8 note;
+};
+
+//==============================================================================
+/**
+ * A layout compiled into lookup tables. Plain data with fixed-size tables, so
+ * the audio thread reads it without allocating or searching.
+ *
+ * The layout file is JSON, or plain text with one `name = values` setting per
+ * line. Settings left out keep the plugin's built-in layout.
+*/
+struct LayoutTables
+{
+    LayoutTables ();
+
+    /**
+     * Set up the line map, e.g. LineToggler's built-in one.
+    */
+    void setLines (int newNumLines, int newFirstLineNote, const int* newNotesPerLine, const int* newLineControlNotes);
+
+    /**
+     * Set the number of controller lanes, which all follow the plugin's CC parameters.
+    */
+    void setLanes (int newNumLanes);
+
+    /**
+     * Apply the settings in a layout file, and compile the lookup tables.
+     *
+     * @return An error message if the file isn't a valid layout for the plugin, or empty.
+    */
+    juce::String parse (const juce::String& text);
+
+    /**
+     * Semitones per variation for a `Variation height` choice.
+    */
+    int getVariationHeight (int choice) const { return variationHeights[juce::jlimit (0, CBR_LAYOUT_NUM_HEIGHTS - 1, choice)]; }
+
+    /**
+     * Look up a NoteFilter input note, for a `Variation height` choice.
+     * A split table in the layout file overrides the choice.
+    */
+    NoteSplit getNoteSplit (int choice, int noteNumber) const { return noteSplits[juce::jlimit (0, CBR_LAYOUT_NUM_HEIGHTS - 1, choice)][noteNumber & 0x7f]; }
+
+    /**
+     * @return The line a note plays on, or -1.
+    */
+    int getLineForNote (int noteNumber) const { return lineForNote[noteNumber & 0x7f]; }
+
+    /**
+     * @return The line a control note toggles, or -1.
+    */
+    int getLineForControlNote (int noteNumber) const { return lineForControlNote[noteNumber & 0x7f]; }
+
+    /**
+     * @return The CC number for a lane, or -1 to follow the plugin's first CC parameter.
+    */
+    int getLaneCCNumber (int lane) const { return laneCCNumbers[lane]; }
+
+    /**
+     * @return The channel for a lane, or 0 to follow the plugin's channel parameter.
+    */
+    int getLaneChannel (int lane) const { return laneChannels[lane]; }
+
+    /**
+     * @return The LFO user table, CBR_LAYOUT_LFO_TABLE_SIZE + 1 values from 0-1 over one cycle.
+    */
+    const float* getLFOTable () const { return lfoTable; }
+
+private:
+    juce::String parseSetting (const juce::String& name, const juce::var& value);
+    juce::String parseSplits (const juce::var& value);
+    juce::String validate () const;
+    void compile ();
+
+    // NoteFilter.
+    int variationHeights[CBR_LAYOUT_NUM_HEIGHTS];
+    // Variation, first note, last note and transpose for each range in the split table.
+    int numSplits = 0;
+    int splits[CBR_LAYOUT_MAX_SPLITS][4] = {};
+    // Compiled from the heights, or the split table, by height choice and note number.
+    NoteSplit noteSplits[CBR_LAYOUT_NUM_HEIGHTS][128];
+
+    // LineToggler.
+    int numLines = 0;
+    int firstLineNote = 0;
+    int notesPerLine[CBR_LAYOUT_MAX_LINES] = {};
+    int lineControlNotes[CBR_LAYOUT_MAX_LINES] = {};
+    // Compiled from the line map, by note number.
+    juce::int8 lineForNote[128];
+    juce::int8 lineForControlNote[128];
+
+    // ControllerMotion.
+    int numLanes = 0;
+    int laneCCNumbers[CBR_LAYOUT_MAX_LANES];
+    int laneChannels[CBR_LAYOUT_MAX_LANES];
+    // Points spread evenly over one cycle, 0-127, and the wavetable compiled from them.
+    int numLFOPoints = 0;
+    int lfoPoints[CBR_LAYOUT_MAX_LFO_POINTS] = {};
+    float lfoTable[CBR_LAYOUT_LFO_TABLE_SIZE + 1];
+};
+
+//==============================================================================
+/**
+ * Watches an instance's layout file on a background thread. Each change is
+ * parsed and validated there, and published for the audio thread to swap in
+ * with ConfigSwap - at the start of a block, or on the phrase boundary for
+ * layouts that would change what's playing mid-phrase.
+ *
+ * A file that doesn't parse is reported and ignored, and the last good layout
+ * stays in use. The thread is only started once a file is set.
+*/
+class LayoutWatcher : private juce::Thread
+{
+public:
+    /**
+     * @param defaults The plugin's built-in layout, used when no file is set.
+    */
+    LayoutWatcher (const LayoutTables& defaults);
+    ~LayoutWatcher () override;
+
+    /**
+     * Watch a file, or stop watching and go back to the built-in layout if it's File().
+     *
+     * Message thread.
+    */
+    void setFile (const juce::File& newFile);
+    juce::File getFile () const;
+
+    /**
+     * What happened to the last change, e.g. a parse error, for the editor.
+     *
+     * Message thread.
+    */
+    juce::String getStatus () const;
+
+    void writeToState (juce::ValueTree& state) const;
+    void readFromState (juce::ValueTree& state);
+
+    /**
+     * The built-in layout, to use until a file's layout is swapped in.
+    */
+    const LayoutTables& getDefaults () const { return defaults; }
+
+    /**
+     * Pick up a layout loaded since the last call. The previous layout stays
+     * valid until this is next called, so only call it where the new one
+     * should take over.
+     *
+     * Audio thread.
+     *
+     * @return The new layout, or null if the file hasn't changed.
+    */
+    const LayoutTables* acquire () { return layouts.acquire(); }
+
+private:
+    void run () override;
+    bool waitForChange (const juce::File& watchedFile);
+    void reload (const juce::File& layoutFile);
+    void setStatus (const juce::String& newStatus);
+
+    const LayoutTables defaults;
+    // Published from the watcher thread only.
+    ConfigSwap<LayoutTables> layouts;
+
+    mutable juce::CriticalSection lock;
+    juce::File file;
+    juce::String status;
+    std::atomic<bool> fileChanged { false };
+
+   #if JUCE_LINUX
+    int notifyFd = -1;
+    int notifyWatch = -1;
+   #endif
+    juce::Time lastModified;
+
+    JUCE_DECLARE_NON_COPYABLE (LayoutWatcher)
+};
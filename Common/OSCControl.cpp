@@ -0,0 +1,156 @@
+/*
+  ==============================================================================
+
+    OSCControl.cpp
+    Show control cues over OSC, received on one listener thread per process
+    and handed to each plugin instance through a lock-free queue.
+
+  ==============================================================================
+*/
+
+#include "OSCControl.h"
+
+//==============================================================================
+OSCListener::OSCListener ()
+{
+    const int port = juce::SystemStats::getEnvironmentVariable (CBR_OSC_PORT_ENV, {}).getIntValue();
+    if (port <= 0) {
+        return;
+    }
+
+    if (receiver.connect (port)) {
+        receiver.addListener (this);
+    }
+    else {
+        DBG ("OSC control can't listen on port " << port);
+    }
+}
+
+OSCListener::~OSCListener ()
+{
+    receiver.removeListener (this);
+    receiver.disconnect();
+}
+
+void OSCListener::addQueue (OSCCommandQueue* queue)
+{
+    const juce::ScopedLock scopedLock (lock);
+    queues.addIfNotAlreadyThere (queue);
+}
+
+void OSCListener::removeQueue (OSCCommandQueue* queue)
+{
+    const juce::ScopedLock scopedLock (lock);
+    queues.removeFirstMatchingValue (queue);
+}
+
+void OSCListener::oscMessageReceived (const juce::OSCMessage& message)
+{
+    const double receivedMs = juce::Time::getMillisecondCounterHiRes();
+
+    // /cbr/<instance>/<name> <value>
+    const juce::String address = message.getAddressPattern().toString();
+    if (! address.startsWith (CBR_OSC_ADDRESS_PREFIX) || message.isEmpty()) {
+        return;
+    }
+
+    const juce::String path = address.substring ((int) strlen (CBR_OSC_ADDRESS_PREFIX));
+    const int instance = path.upToFirstOccurrenceOf ("/", false, false).getIntValue();
+    const juce::String name = path.fromFirstOccurrenceOf ("/", false, false);
+    if (instance <= 0 || instance > CBR_OSC_MAX_INSTANCES || name.isEmpty()) {
+        return;
+    }
+
+    const juce::OSCArgument& argument = message[0];
+    float value;
+    if (argument.isFloat32()) {
+        value = argument.getFloat32();
+    }
+    else if (argument.isInt32()) {
+        value = (float) argument.getInt32();
+    }
+    else {
+        return;
+    }
+
+    const juce::ScopedLock scopedLock (lock);
+    for (OSCCommandQueue* queue : queues) {
+        if (queue->getInstanceId() == instance) {
+            queue->push (name, value, receivedMs);
+        }
+    }
+}
+
+//==============================================================================
+OSCCommandQueue::OSCCommandQueue (const juce::AudioProcessor& processor)
+    : fifo (CBR_OSC_QUEUE_SIZE)
+{
+    for (juce::AudioProcessorParameter* parameter : processor.getParameters()) {
+        const juce::RangedAudioParameter* ranged = dynamic_cast<const juce::RangedAudioParameter*> (parameter);
+        parameterIDs.add (ranged != nullptr ? ranged->paramID : juce::String());
+    }
+
+    listener->addQueue (this);
+}
+
+OSCCommandQueue::~OSCCommandQueue ()
+{
+    listener->removeQueue (this);
+}
+
+bool OSCCommandQueue::push (const juce::String& name, float value, double receivedMs)
+{
+    OSCCommand command;
+    command.value = value;
+    command.receivedMs = receivedMs;
+
+    if (name == "program") {
+        command.type = OSCCommand::programChange;
+        command.index = juce::roundToInt (value);
+    }
+    else {
+        command.type = OSCCommand::setParameter;
+        command.index = parameterIDs.indexOf (name);
+        if (command.index < 0) {
+            return false;
+        }
+    }
+
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite (1, start1, size1, start2, size2);
+    if (size1 == 0) {
+        // The audio thread isn't draining, e.g. the plugin is bypassed.
+        return false;
+    }
+
+    commands[start1] = command;
+    fifo.finishedWrite (1);
+    return true;
+}
+
+bool OSCCommandQueue::pop (OSCCommand& command)
+{
+    int start1, size1, start2, size2;
+    fifo.prepareToRead (1, start1, size1, start2, size2);
+    if (size1 == 0) {
+        return false;
+    }
+
+    command = commands[start1];
+    fifo.finishedRead (1);
+    return true;
+}
+
+void OSCCommandQueue::apply (const OSCCommand& command, juce::AudioProcessor& processor,
+                             ParameterConfigSwap& parameterConfig, PhrasePrograms& programs)
+{
+    if (command.type == OSCCommand::programChange) {
+        programs.queueProgramChange (command.index);
+        return;
+    }
+
+    const juce::RangedAudioParameter* parameter = dynamic_cast<const juce::RangedAudioParameter*> (processor.getParameters()[command.index]);
+    if (parameter != nullptr) {
+        parameterConfig.applyValue (processor, command.index, parameter->convertTo0to1 (command.value));
+    }
+}
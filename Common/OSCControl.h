@@ -0,0 +1,138 @@
+/*
+  ==============================================================================
+
+    OSCControl.h
+    Show control cues over OSC, received on one listener thread per process
+    and handed to each plugin instance through a lock-free queue.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "ParameterConfig.h"
+#include "PhrasePrograms.h"
+
+#include <atomic>
+
+// Set this environment variable to a UDP port to listen for OSC cues on it.
+#define CBR_OSC_PORT_ENV "CBR_OSC_PORT"
+// Cues are addressed to /cbr/<instance>/<parameter ID> or /cbr/<instance>/program.
+#define CBR_OSC_ADDRESS_PREFIX "/cbr/"
+#define CBR_OSC_MAX_INSTANCES 64
+// Cues waiting for the audio thread, per instance.
+#define CBR_OSC_QUEUE_SIZE 256
+
+//==============================================================================
+/**
+ * A cue for one instance, fixed size so it can be queued without allocating.
+*/
+struct OSCCommand
+{
+    enum Type
+    {
+        setParameter = 0,
+        programChange
+    };
+
+    int type;
+    // Parameter index, or program number.
+    int index;
+    // Parameter value, in the parameter's own range (not normalised).
+    float value;
+    // When the listener received it, from juce::Time::getMillisecondCounterHiRes().
+    double receivedMs;
+};
+
+class OSCCommandQueue;
+
+//==============================================================================
+/**
+ * Receives OSC for every instance in the process, and routes each message to
+ * the queues of the instances it's addressed to.
+ *
+ * Shared with juce::SharedResourcePointer. The lock is only taken by the
+ * listener and message threads, never the audio thread.
+*/
+class OSCListener : private juce::OSCReceiver::Listener<juce::OSCReceiver::RealtimeCallback>
+{
+public:
+    OSCListener ();
+    ~OSCListener () override;
+
+    void addQueue (OSCCommandQueue* queue);
+    void removeQueue (OSCCommandQueue* queue);
+
+private:
+    void oscMessageReceived (const juce::OSCMessage& message) override;
+
+    juce::OSCReceiver receiver;
+    juce::CriticalSection lock;
+    juce::Array<OSCCommandQueue*> queues;
+};
+
+//==============================================================================
+/**
+ * One instance's cues. The listener thread pushes, the audio thread drains
+ * the queue at the start of each block.
+ *
+ * Parameters set by a cue take effect as if the host had changed them -
+ * variations on the next boundary, ControllerMotion targets from the current
+ * grid line. Program changes wait for the boundary like MIDI program changes.
+ * Nothing on the cue's path from the socket to the block takes a lock.
+*/
+class OSCCommandQueue
+{
+public:
+    /**
+     * Register with the process's listener, which starts listening if
+     * CBR_OSC_PORT is set.
+     *
+     * Message thread, after the processor's parameters are created.
+    */
+    OSCCommandQueue (const juce::AudioProcessor& processor);
+    ~OSCCommandQueue ();
+
+    /**
+     * Set the instance ID cues are addressed to, 0 to ignore all cues.
+     *
+     * Audio thread, from the `oscInstance` parameter.
+    */
+    void setInstanceId (int newInstanceId) { instanceId.store (newInstanceId, std::memory_order_relaxed); }
+
+    /**
+     * Take the next cue.
+     *
+     * Audio thread.
+    */
+    bool pop (OSCCommand& command);
+
+    /**
+     * Apply a cue to the processor's parameters, or hand a program change to
+     * the programs.
+     *
+     * Audio thread, before the block's program changes are handled. Lock-free -
+     * the cue goes into the block's config, and the parameters and host are
+     * updated from the message thread (see ParameterConfigSwap).
+    */
+    void apply (const OSCCommand& command, juce::AudioProcessor& processor,
+                ParameterConfigSwap& parameterConfig, PhrasePrograms& programs);
+
+    //==============================================================================
+    // Listener thread.
+    int getInstanceId () const { return instanceId.load (std::memory_order_relaxed); }
+    bool push (const juce::String& name, float value, double receivedMs);
+
+private:
+    juce::SharedResourcePointer<OSCListener> listener;
+
+    // Copied when created, so the listener thread can look them up.
+    juce::StringArray parameterIDs;
+    std::atomic<int> instanceId { 0 };
+
+    juce::AbstractFifo fifo;
+    OSCCommand commands[CBR_OSC_QUEUE_SIZE];
+
+    JUCE_DECLARE_NON_COPYABLE (OSCCommandQueue)
+};
@@ -0,0 +1,259 @@
+/*
+  ==============================================================================
+
+    ParameterConfig.cpp
+    Snapshot of a processor's parameter values, so each block reads one
+    consistent set - including while the host is loading a state.
+
+  ==============================================================================
+*/
+
+#include "ParameterConfig.h"
+
+//==============================================================================
+void ParameterConfig::readFrom (const juce::AudioProcessor& processor)
+{
+    const juce::Array<juce::AudioProcessorParameter*>& parameters = processor.getParameters();
+    jassert (parameters.size() <= CBR_CONFIG_MAX_PARAMS);
+
+    numValues = juce::jmin (parameters.size(), CBR_CONFIG_MAX_PARAMS);
+    for (int i = 0; i < numValues; i++) {
+        values[i] = parameters[i]->getValue();
+    }
+}
+
+void ParameterConfig::readFrom (const juce::AudioProcessor& processor, const juce::ValueTree& state)
+{
+    readFrom (processor);
+
+    for (int i = 0; i < numValues; i++) {
+        const juce::RangedAudioParameter* parameter = dynamic_cast<const juce::RangedAudioParameter*> (processor.getParameters()[i]);
+        if (parameter == nullptr) {
+            continue;
+        }
+
+        // AudioProcessorValueTreeState saves each parameter as <PARAM id="..." value="..."/>.
+        const juce::ValueTree child = state.getChildWithProperty ("id", parameter->paramID);
+        if (child.isValid() && child.hasProperty ("value")) {
+            values[i] = parameter->convertTo0to1 ((float) child.getProperty ("value"));
+        }
+    }
+}
+
+int ParameterConfig::getInt (const juce::AudioParameterInt* parameter) const
+{
+    return juce::roundToInt (parameter->convertFrom0to1 (values[parameter->getParameterIndex()]));
+}
+
+int ParameterConfig::getIndex (const juce::AudioParameterChoice* parameter) const
+{
+    return juce::roundToInt (parameter->convertFrom0to1 (values[parameter->getParameterIndex()]));
+}
+
+bool ParameterConfig::getBool (const juce::AudioParameterBool* parameter) const
+{
+    return values[parameter->getParameterIndex()] >= 0.5f;
+}
+
+float ParameterConfig::getFloat (const juce::AudioParameterFloat* parameter) const
+{
+    return parameter->convertFrom0to1 (values[parameter->getParameterIndex()]);
+}
+
+//==============================================================================
+ParameterConfigSwap::ParameterConfigSwap ()
+{
+    for (int i = 0; i < CBR_CONFIG_MAX_PARAMS; i++) {
+        pendingValues[i] = 0;
+    }
+    for (int word = 0; word < numPendingWords; word++) {
+        pendingMask[word] = 0;
+    }
+
+    startTimerHz (CBR_CONFIG_NOTIFY_HZ);
+}
+
+ParameterConfigSwap::~ParameterConfigSwap ()
+{
+    stopTimer();
+
+    if (attachedProcessor != nullptr) {
+        for (juce::AudioProcessorParameter* parameter : attachedProcessor->getParameters()) {
+            parameter->removeListener (this);
+        }
+    }
+}
+
+void ParameterConfigSwap::attach (juce::AudioProcessor& processor)
+{
+    jassert (attachedProcessor == nullptr);
+
+    attachedProcessor = &processor;
+    pendingProcessor = &processor;
+    for (juce::AudioProcessorParameter* parameter : processor.getParameters()) {
+        parameter->addListener (this);
+    }
+}
+
+void ParameterConfigSwap::parameterValueChanged (int parameterIndex, float newValue)
+{
+    juce::ignoreUnused (newValue);
+
+    // flushPending() clears its own bits.
+    if (isFlushing.load() || parameterIndex < 0 || parameterIndex >= CBR_CONFIG_MAX_PARAMS) {
+        return;
+    }
+
+    // The host's value replaces one set on the audio thread.
+    pendingMask[parameterIndex / 32].fetch_and (~(1u << (parameterIndex % 32)));
+}
+
+void ParameterConfigSwap::loadState (juce::AudioProcessorValueTreeState& parameters, const juce::ValueTree& newState)
+{
+    std::unique_ptr<ParameterConfig> config (new ParameterConfig());
+    config->readFrom (parameters.processor, newState);
+
+    // The loaded state replaces anything the audio thread set.
+    clearPending();
+
+    loadSequence++;
+    loadedConfigs.publish (std::move (config));
+    parameters.replaceState (newState);
+    loadSequence++;
+}
+
+void ParameterConfigSwap::loadConfig (juce::AudioProcessor& processor, const ParameterConfig& config)
+{
+    clearPending();
+
+    loadSequence++;
+    loadedConfigs.publish (std::make_unique<ParameterConfig> (config));
+    setParameters (processor, config);
+    loadSequence++;
+}
+
+void ParameterConfigSwap::applyConfig (juce::AudioProcessor& processor, const ParameterConfig& config)
+{
+    blockConfig = config;
+
+    const juce::Array<juce::AudioProcessorParameter*>& parameters = processor.getParameters();
+    const int numValues = juce::jmin (parameters.size(), config.numValues);
+    for (int i = 0; i < numValues; i++) {
+        if (parameters[i]->getValue() != config.values[i]) {
+            setPending (processor, i, config.values[i]);
+        }
+    }
+}
+
+void ParameterConfigSwap::applyValue (juce::AudioProcessor& processor, int parameterIndex, float value)
+{
+    juce::AudioProcessorParameter* parameter = processor.getParameters()[parameterIndex];
+    if (parameter == nullptr || parameterIndex >= blockConfig.numValues) {
+        return;
+    }
+
+    blockConfig.values[parameterIndex] = value;
+    if (parameter->getValue() != value) {
+        setPending (processor, parameterIndex, value);
+    }
+}
+
+void ParameterConfigSwap::setPending (juce::AudioProcessor& processor, int parameterIndex, float value)
+{
+    pendingProcessor = &processor;
+    // The value first - the timer reads it once it sees the bit.
+    pendingValues[parameterIndex].store (value);
+    pendingMask[parameterIndex / 32].fetch_or (1u << (parameterIndex % 32));
+}
+
+void ParameterConfigSwap::clearPending ()
+{
+    for (int word = 0; word < numPendingWords; word++) {
+        pendingMask[word] = 0;
+    }
+}
+
+void ParameterConfigSwap::flushPending ()
+{
+    juce::AudioProcessor* processor = pendingProcessor.load();
+    if (processor == nullptr) {
+        return;
+    }
+
+    const juce::Array<juce::AudioProcessorParameter*>& parameters = processor->getParameters();
+    isFlushing = true;
+    for (int word = 0; word < numPendingWords; word++) {
+        juce::uint32 mask = pendingMask[word].load();
+        while (mask != 0) {
+            const int bit = juce::findHighestSetBit (mask);
+            mask &= ~(1u << bit);
+
+            const int index = word * 32 + bit;
+            const float value = pendingValues[index].load();
+            if (index < parameters.size() && parameters[index]->getValue() != value) {
+                parameters[index]->setValueNotifyingHost (value);
+            }
+
+            // Done, unless the audio thread set a newer value meanwhile - that goes next time.
+            pendingMask[word].fetch_and (~(1u << bit));
+            if (pendingValues[index].load() != value) {
+                pendingMask[word].fetch_or (1u << bit);
+            }
+        }
+    }
+    isFlushing = false;
+}
+
+void ParameterConfigSwap::setParameters (juce::AudioProcessor& processor, const ParameterConfig& config)
+{
+    const juce::Array<juce::AudioProcessorParameter*>& parameters = processor.getParameters();
+    const int numValues = juce::jmin (parameters.size(), config.numValues);
+    for (int i = 0; i < numValues; i++) {
+        if (parameters[i]->getValue() != config.values[i]) {
+            parameters[i]->setValueNotifyingHost (config.values[i]);
+        }
+    }
+}
+
+const ParameterConfig& ParameterConfigSwap::update (const juce::AudioProcessor& processor)
+{
+    // A state was loaded - use it as a whole.
+    if (const ParameterConfig* loaded = loadedConfigs.acquire()) {
+        blockConfig = *loaded;
+        return blockConfig;
+    }
+
+    // Otherwise the live values, unless a load started or finished while reading them.
+    // The first block always reads them, so there's something to use.
+    const juce::uint32 sequence = loadSequence.load();
+    if (sequence % 2 == 0 || blockConfig.numValues == 0) {
+        ParameterConfig live;
+        live.readFrom (processor);
+
+        // Values set on this thread win until the timer has passed them to the parameters.
+        // Once a parameter holds its value, it's no longer pending.
+        for (int word = 0; word < numPendingWords; word++) {
+            juce::uint32 mask = pendingMask[word].load();
+            while (mask != 0) {
+                const int bit = juce::findHighestSetBit (mask);
+                mask &= ~(1u << bit);
+
+                const int index = word * 32 + bit;
+                const float value = pendingValues[index].load();
+                if (index >= live.numValues) {
+                    continue;
+                }
+                if (live.values[index] == value) {
+                    pendingMask[word].fetch_and (~(1u << bit));
+                }
+                live.values[index] = value;
+            }
+        }
+
+        if (loadSequence.load() == sequence || blockConfig.numValues == 0) {
+            blockConfig = live;
+        }
+    }
+
+    return blockConfig;
+}
@@ -0,0 +1,173 @@
+/*
+  ==============================================================================
+
+    ParameterConfig.h
+    Snapshot of a processor's parameter values, so each block reads one
+    consistent set - including while the host is loading a state.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "ConfigSwap.h"
+
+#include <atomic>
+
+#define CBR_CONFIG_MAX_PARAMS 128
+// How often parameter changes made on the audio thread are passed to the host.
+#define CBR_CONFIG_NOTIFY_HZ 30
+
+//==============================================================================
+/**
+ * Normalised value of each of a processor's parameters, by parameter index.
+*/
+struct ParameterConfig
+{
+    /**
+     * Read the current parameter values. Lock-free, safe on the audio thread.
+    */
+    void readFrom (const juce::AudioProcessor& processor);
+
+    /**
+     * Read the parameter values from a saved AudioProcessorValueTreeState state.
+     * Parameters missing from the state keep their current value.
+    */
+    void readFrom (const juce::AudioProcessor& processor, const juce::ValueTree& state);
+
+    int getInt (const juce::AudioParameterInt* parameter) const;
+    int getIndex (const juce::AudioParameterChoice* parameter) const;
+    bool getBool (const juce::AudioParameterBool* parameter) const;
+    float getFloat (const juce::AudioParameterFloat* parameter) const;
+
+    float values[CBR_CONFIG_MAX_PARAMS];
+    int numValues = 0;
+};
+
+//==============================================================================
+/**
+ * Gives the audio thread a consistent ParameterConfig for each block.
+ *
+ * Between state loads, each block reads the live parameter values, so automation
+ * is picked up straight away. A state load publishes the loaded values as one
+ * immutable config before replacing the parameters' state, and until the replace
+ * is done blocks keep using it rather than a mix of old and new values.
+ *
+ * Changes made on the audio thread (program switches, OSC cues, MIDI learn) only
+ * go into the block's config there. The parameters and the host are updated from
+ * a timer on the message thread, and until then each block keeps the new values
+ * over the live ones - unless the host sets the parameter meanwhile, which wins.
+ * Hosts that never run the message thread while processing, e.g. offline
+ * renderers, still get the values they set.
+*/
+class ParameterConfigSwap : private juce::Timer,
+                            private juce::AudioProcessorParameter::Listener
+{
+public:
+    /**
+     * Message thread, e.g. as a processor member.
+    */
+    ParameterConfigSwap ();
+    ~ParameterConfigSwap () override;
+
+    /**
+     * Listen to the processor's parameters, so changes from the host replace
+     * values set on the audio thread.
+     *
+     * Message thread, once the processor's parameters have been created.
+    */
+    void attach (juce::AudioProcessor& processor);
+
+    /**
+     * Load a saved state into the parameters, replacing setStateInformation's
+     * call to replaceState().
+     *
+     * Message thread.
+    */
+    void loadState (juce::AudioProcessorValueTreeState& parameters, const juce::ValueTree& newState);
+
+    /**
+     * Set the parameters to a config, e.g. when the host selects a program.
+     *
+     * Message thread.
+    */
+    void loadConfig (juce::AudioProcessor& processor, const ParameterConfig& config);
+
+    /**
+     * Use a config from now on in this block, and in following blocks until
+     * the parameters have been set to match.
+     *
+     * Audio thread. Lock-free - the parameters are set, and the host notified,
+     * from the message thread.
+    */
+    void applyConfig (juce::AudioProcessor& processor, const ParameterConfig& config);
+
+    /**
+     * Set one parameter from now on in this block, like applyConfig().
+     *
+     * Audio thread. Lock-free, as applyConfig().
+     *
+     * @param value Normalised value.
+    */
+    void applyValue (juce::AudioProcessor& processor, int parameterIndex, float value);
+
+    /**
+     * Update the config for this block.
+     *
+     * Audio thread, at the start of processBlock.
+    */
+    const ParameterConfig& update (const juce::AudioProcessor& processor);
+
+    /**
+     * The config for the current block.
+     *
+     * Audio thread.
+    */
+    const ParameterConfig& get () const { return blockConfig; }
+
+    /**
+     * Set the parameters to the values made on the audio thread now, rather than
+     * waiting for the timer - e.g. before saving the parameters' state.
+     *
+     * Message thread.
+    */
+    void flushPending ();
+
+private:
+    static void setParameters (juce::AudioProcessor& processor, const ParameterConfig& config);
+
+    /**
+     * Hold a value made on the audio thread until the timer sets the parameter.
+    */
+    void setPending (juce::AudioProcessor& processor, int parameterIndex, float value);
+
+    /**
+     * Forget values waiting for the timer, e.g. when a state is loaded over them.
+    */
+    void clearPending ();
+
+    // Sets the parameters to the pending values, notifying the host.
+    void timerCallback () override { flushPending(); }
+
+    // A parameter set by the host or the editor, on any thread.
+    void parameterValueChanged (int parameterIndex, float newValue) override;
+    void parameterGestureChanged (int, bool) override {}
+
+    ConfigSwap<ParameterConfig> loadedConfigs;
+
+    // Values set on the audio thread, and a bit for each one not yet passed to the parameter.
+    static const int numPendingWords = (CBR_CONFIG_MAX_PARAMS + 31) / 32;
+    std::atomic<float> pendingValues[CBR_CONFIG_MAX_PARAMS];
+    std::atomic<juce::uint32> pendingMask[numPendingWords];
+    std::atomic<juce::AudioProcessor*> pendingProcessor { nullptr };
+    // True while flushPending() sets the parameters, so its own changes don't count as the host's.
+    std::atomic<bool> isFlushing { false };
+    juce::AudioProcessor* attachedProcessor = nullptr;
+
+    // Odd while a state load is in progress.
+    std::atomic<juce::uint32> loadSequence { 0 };
+
+    // Owned by the audio thread.
+    ParameterConfig blockConfig;
+};
@@ -0,0 +1,81 @@
+/*
+  ==============================================================================
+
+    PhraseArrangement.cpp
+    A table of values (variation or channel) by phrase index, so the value for
+    any phrase is known without replaying what happened before it.
+
+  ==============================================================================
+*/
+
+#include "PhraseArrangement.h"
+
+//==============================================================================
+PhraseArrangement::PhraseArrangement ()
+{
+    for (int i = 0; i < CBR_ARRANGEMENT_MAX_PHRASES; i++) {
+        values[i] = 0;
+    }
+}
+
+juce::String PhraseArrangement::toString () const
+{
+    juce::StringArray items;
+
+    int runStart = 0;
+    while (runStart < CBR_ARRANGEMENT_MAX_PHRASES) {
+        const int value = getValue (runStart);
+        int runEnd = runStart;
+        while (runEnd + 1 < CBR_ARRANGEMENT_MAX_PHRASES && getValue (runEnd + 1) == value) {
+            runEnd++;
+        }
+
+        if (value != 0) {
+            juce::String item (runStart);
+            if (runEnd > runStart) {
+                item << "-" << runEnd;
+            }
+            item << ":" << value;
+            items.add (item);
+        }
+
+        runStart = runEnd + 1;
+    }
+
+    return items.joinIntoString (" ");
+}
+
+void PhraseArrangement::fromString (const juce::String& text)
+{
+    for (int i = 0; i < CBR_ARRANGEMENT_MAX_PHRASES; i++) {
+        values[i] = 0;
+    }
+
+    const juce::StringArray items = juce::StringArray::fromTokens (text, " ,;\n", "");
+    for (const juce::String& item : items) {
+        // Each item is "phrase:value" or "first-last:value".
+        const juce::String phrases = item.upToFirstOccurrenceOf (":", false, false);
+        if (phrases.isEmpty() || ! item.containsChar (':')) {
+            continue;
+        }
+        const int value = item.fromFirstOccurrenceOf (":", false, false).getIntValue();
+
+        const int first = phrases.upToFirstOccurrenceOf ("-", false, false).getIntValue();
+        const int last = phrases.containsChar ('-') ? phrases.fromFirstOccurrenceOf ("-", false, false).getIntValue() : first;
+        for (int i = juce::jmax (0, first); i <= juce::jmin (last, CBR_ARRANGEMENT_MAX_PHRASES - 1); i++) {
+            setValue (i, value);
+        }
+    }
+}
+
+//==============================================================================
+void PhraseArrangement::writeToState (juce::ValueTree& state) const
+{
+    state.setProperty ("arrangement", toString(), nullptr);
+}
+
+void PhraseArrangement::readFromState (juce::ValueTree& state)
+{
+    fromString (state.getProperty ("arrangement", juce::String()).toString());
+    state.removeProperty ("arrangement", nullptr);
+}
@@ -0,0 +1,115 @@
+/*
+  ==============================================================================
+
+    PhraseArrangement.h
+    A table of values (variation or channel) by phrase index, so the value for
+    any phrase is known without replaying what happened before it.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <atomic>
+
+// Phrases in an arrangement, e.g. 4096 phrases of 4 beats is over an hour at 200bpm.
+#define CBR_ARRANGEMENT_MAX_PHRASES 4096
+// Highest value an entry can hold, whatever the plugin.
+#define CBR_ARRANGEMENT_MAX_VALUE 127
+
+//==============================================================================
+/**
+ * Maps phrase index to a value, with one entry per phrase so a lookup is a
+ * single indexed load.
+ *
+ * Entries are set by recording on the audio thread, or loaded from the saved
+ * state on the message thread. Each entry is atomic, so either thread can read
+ * the table at any time without locking.
+*/
+class PhraseArrangement
+{
+public:
+    // Options for the `arrangement` choice parameter.
+    enum Mode
+    {
+        off = 0,
+        play,
+        record
+    };
+
+    static juce::StringArray getModeChoices ()
+    {
+        return juce::StringArray( {"Off", "Play", "Record"} );
+    }
+
+    PhraseArrangement ();
+
+    /**
+     * Set the values the plugin can play, 1 to maxValue, e.g. its number of variations.
+     * Other values - from a bad or hand-edited state - are treated as no entry.
+     *
+     * Message thread, before playback (e.g. processor constructor).
+    */
+    void setMaxValue (int newMaxValue) { maxValue = juce::jlimit (1, CBR_ARRANGEMENT_MAX_VALUE, newMaxValue); }
+
+    /**
+     * The value for a phrase.
+     *
+     * @return The value, or 0 if the phrase has no entry.
+    */
+    int getValue (juce::int64 phraseIndex) const
+    {
+        if (phraseIndex < 0 || phraseIndex >= CBR_ARRANGEMENT_MAX_PHRASES) {
+            return 0;
+        }
+        return values[phraseIndex].load (std::memory_order_relaxed);
+    }
+
+    /**
+     * Set the value for a phrase, e.g. while recording. Phrases outside the table are ignored,
+     * and values outside 1 to the max value clear the entry.
+    */
+    void setValue (juce::int64 phraseIndex, int value)
+    {
+        if (phraseIndex < 0 || phraseIndex >= CBR_ARRANGEMENT_MAX_PHRASES) {
+            return;
+        }
+        if (value < 1 || value > maxValue) {
+            value = 0;
+        }
+        values[phraseIndex].store ((juce::uint8) value, std::memory_order_relaxed);
+    }
+
+    /**
+     * Text form of the arrangement, a run of phrases per item, e.g. "0-3:1 4:2 5-7:1".
+    */
+    juce::String toString () const;
+
+    /**
+     * Replace the arrangement from its text form. Phrases not listed, or with
+     * values out of range, have no entry.
+    */
+    void fromString (const juce::String& text);
+
+    /**
+     * Add the arrangement to a state being saved, as an `arrangement` property.
+     *
+     * Message thread.
+    */
+    void writeToState (juce::ValueTree& state) const;
+
+    /**
+     * Load the arrangement from a saved state, and remove it from the state.
+     *
+     * Message thread.
+    */
+    void readFromState (juce::ValueTree& state);
+
+private:
+    std::atomic<juce::uint8> values[CBR_ARRANGEMENT_MAX_PHRASES];
+    int maxValue = CBR_ARRANGEMENT_MAX_VALUE;
+
+    JUCE_DECLARE_NON_COPYABLE (PhraseArrangement)
+};
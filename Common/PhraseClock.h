@@ -0,0 +1,226 @@
+/*
+  ==============================================================================
+
+    PhraseClock.h
+    Phrase boundary maths shared by the phrase-locked plugins.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+// Phrase lengths are held as a whole number of ticks, so odd meters (6/8, 7/8)
+// divide exactly. 960 per quarter note divides evenly for every power-of-two
+// time signature denominator up to 64.
+#define CBR_PHRASECLOCK_TICKS_PER_QUARTER 960
+// Longest custom phrase, in beats or bars.
+#define CBR_PHRASECLOCK_MAX_LENGTH 1024
+
+//==============================================================================
+/**
+ * Keeps track of the phrase grid for the current tempo, sample rate, meter and
+ * phrase length.
+ *
+ * Anything that depends on those is folded into a couple of cached factors
+ * whenever they change, so placing a sample time in the phrase grid is a single
+ * multiply, whatever the phrase length. The period is a double, phrases per
+ * sample, rather than a whole number of samples - boundaries rarely fall on a
+ * whole sample - and each boundary is rounded to the nearest sample from it.
+*/
+class PhraseClock
+{
+public:
+    // Options for the `phraseBeats` choice parameter.
+    // The fixed lengths are in quarter notes, as they always have been, so saved sessions keep their phrases.
+    // The last two use the `phraseLength` param, in beats or bars of the current meter.
+    enum PhraseChoice
+    {
+        customBeatsChoice = 6,
+        customBarsChoice = 7
+    };
+
+    static juce::StringArray getPhraseChoices ()
+    {
+        return juce::StringArray( {"1 beat", "4 beats", "8 beats", "16 beats", "32 beats", "64 beats", "Custom beats", "Custom bars"} );
+    }
+
+    /**
+     * Length of one beat of the meter in ticks, e.g. an eighth note in 6/8.
+     *
+     * @param timeSigDenominator Time signature denominator from the host.
+     * @return Ticks per beat.
+    */
+    static juce::int64 getBeatTicks (int timeSigDenominator)
+    {
+        if (timeSigDenominator <= 0 || timeSigDenominator > 64) {
+            return CBR_PHRASECLOCK_TICKS_PER_QUARTER;
+        }
+
+        return (CBR_PHRASECLOCK_TICKS_PER_QUARTER * 4) / timeSigDenominator;
+    }
+
+    /**
+     * Determine the phrase length in ticks from the phrase params and the meter.
+     *
+     * @param phraseChoice Index of the `phraseBeats` choice param.
+     * @param customLength Value of the `phraseLength` param (beats or bars).
+     * @param timeSigNumerator Time signature numerator from the host.
+     * @param timeSigDenominator Time signature denominator from the host.
+     * @return The phrase length in ticks, always at least a quarter note or one beat.
+    */
+    static juce::int64 getPhraseLengthTicks (int phraseChoice, int customLength, int timeSigNumerator, int timeSigDenominator)
+    {
+        const juce::int64 quarterTicks = CBR_PHRASECLOCK_TICKS_PER_QUARTER;
+        const juce::int64 beatTicks = getBeatTicks (timeSigDenominator);
+        const int beatsPerBar = juce::jmax (1, timeSigNumerator);
+        customLength = juce::jlimit (1, CBR_PHRASECLOCK_MAX_LENGTH, customLength);
+
+        switch (phraseChoice) {
+            case 0: return quarterTicks;
+            case 1: return quarterTicks * 4;
+            case 2: return quarterTicks * 8;
+            case 3: return quarterTicks * 16;
+            case 4: return quarterTicks * 32;
+            case 5: return quarterTicks * 64;
+            case customBeatsChoice: return beatTicks * customLength;
+            case customBarsChoice: return beatTicks * beatsPerBar * customLength;
+        }
+
+        return quarterTicks * 4;
+    }
+
+    /**
+     * Update the clock for the current block. Cached factors are only
+     * recomputed if something has changed.
+     *
+     * @param newTempoBpm Host tempo.
+     * @param newSampleRate Current sample rate.
+     * @param newPhraseLengthTicks Phrase length, @see getPhraseLengthTicks().
+     * @param newOffsetTicks Start of the first phrase, measured from the first bar.
+    */
+    void update (double newTempoBpm, double newSampleRate, juce::int64 newPhraseLengthTicks, juce::int64 newOffsetTicks)
+    {
+        if (newTempoBpm == tempoBpm && newSampleRate == sampleRate
+            && newPhraseLengthTicks == phraseLengthTicks && newOffsetTicks == offsetTicks) {
+            return;
+        }
+
+        tempoBpm = newTempoBpm;
+        sampleRate = newSampleRate;
+        phraseLengthTicks = juce::jmax ((juce::int64) 1, newPhraseLengthTicks);
+        offsetTicks = newOffsetTicks;
+
+        const double phrasesPerTick = 1.0 / (double) phraseLengthTicks;
+
+        if (tempoBpm > 0 && sampleRate > 0) {
+            const double ticksPerSample = (tempoBpm / 60.0) * CBR_PHRASECLOCK_TICKS_PER_QUARTER / sampleRate;
+            phrasesPerSample = ticksPerSample * phrasesPerTick;
+            samplesPerPhrase = 1.0 / phrasesPerSample;
+        }
+        else {
+            phrasesPerSample = 0;
+            samplesPerPhrase = 0;
+        }
+
+        offsetPhrases = offsetTicks * phrasesPerTick;
+
+        // The sample nearest to the exact boundary starts the new phrase.
+        // This replaces the old "+0.001 phrases" fudge, which was up to several beats
+        // early for very long phrases.
+        halfSamplePhrases = phrasesPerSample * 0.5;
+    }
+
+    /**
+     * Convert a sample time to (fractional) phrases since the first phrase start.
+    */
+    double samplesToPhrase (juce::int64 timeInSamples) const
+    {
+        return timeInSamples * phrasesPerSample - offsetPhrases;
+    }
+
+    /**
+     * Determine which phrase a sample time falls in.
+    */
+    juce::int64 getPhraseIndex (juce::int64 timeInSamples) const
+    {
+        return (juce::int64) std::floor (samplesToPhrase (timeInSamples) + halfSamplePhrases);
+    }
+
+    /**
+     * Position within the current phrase, normalised 0-1.
+    */
+    double getPhrasePosition (juce::int64 timeInSamples) const
+    {
+        double position = samplesToPhrase (timeInSamples) - (double) getPhraseIndex (timeInSamples);
+        return juce::jlimit (0.0, 1.0, position);
+    }
+
+    /**
+     * Determine whether a phrase boundary lies after time1, up to and including time2.
+    */
+    bool timeRangeStraddlesPhraseChange (juce::int64 time1, juce::int64 time2) const
+    {
+        return getPhraseIndex (time1) < getPhraseIndex (time2);
+    }
+
+    /**
+     * Find the first sample after a given time that starts a new phrase.
+     *
+     * @param timeInSamples Search from the sample after this.
+     * @return Sample time of the next phrase start, or max int64 if the clock is not running.
+    */
+    juce::int64 getNextPhraseStart (juce::int64 timeInSamples) const
+    {
+        if (phrasesPerSample <= 0) {
+            return std::numeric_limits<juce::int64>::max();
+        }
+
+        const juce::int64 nextPhrase = getPhraseIndex (timeInSamples) + 1;
+
+        // Estimate from the cached period, then nudge onto the exact sample
+        // so the result always agrees with getPhraseIndex().
+        auto boundary = (juce::int64) std::ceil ((nextPhrase + offsetPhrases - halfSamplePhrases) * samplesPerPhrase);
+        while (getPhraseIndex (boundary - 1) >= nextPhrase) {
+            boundary--;
+        }
+        while (getPhraseIndex (boundary) < nextPhrase) {
+            boundary++;
+        }
+
+        return boundary;
+    }
+
+    /**
+     * Find the first phrase start in a block.
+     *
+     * @param blockStart Sample time of the start of the block.
+     * @param numSamples Length of the block.
+     * @return Offset of the phrase start from the start of the block, or -1 if no phrase starts in the block.
+    */
+    int getPhraseStartInBlock (juce::int64 blockStart, int numSamples) const
+    {
+        const juce::int64 phraseStart = getNextPhraseStart (blockStart - 1);
+        if (phraseStart >= blockStart + numSamples) {
+            return -1;
+        }
+        return (int) (phraseStart - blockStart);
+    }
+
+    double getPhrasesPerSample () const { return phrasesPerSample; }
+    juce::int64 getPhraseLengthTicks () const { return phraseLengthTicks; }
+    juce::int64 getOffsetTicks () const { return offsetTicks; }
+
+private:
+    double tempoBpm = 0;
+    double sampleRate = 0;
+    juce::int64 phraseLengthTicks = 0;
+    juce::int64 offsetTicks = 0;
+
+    // Cached factors, @see update().
+    double phrasesPerSample = 0;
+    double samplesPerPhrase = 0;
+    double offsetPhrases = 0;
+    double halfSamplePhrases = 0;
+};
@@ -0,0 +1,249 @@
+/*
+  ==============================================================================
+
+    PhraseDisplay.cpp
+    A lightweight editor showing where the plugin is in the phrase, and what
+    changes on the next boundary.
+
+  ==============================================================================
+*/
+
+#include "PhraseDisplay.h"
+
+static const int displayMargin = 10;
+static const int displayWidth = 360;
+static const int phraseHeight = 46;
+static const int rowHeight = 24;
+static const int linesHeight = 40;
+static const int lanesHeight = 100;
+
+static const juce::Colour pendingColour = juce::Colours::orange;
+static const juce::Colour activeColour = juce::Colours::limegreen;
+
+//==============================================================================
+PhraseDisplayEditor::PhraseDisplayEditor (juce::AudioProcessor& processor, const SeqlockSnapshot<PhraseDisplayState>& snapshot,
+                                          const juce::String& valueName, int numLines, int numLanes, LayoutWatcher* layoutWatcher)
+    : juce::AudioProcessorEditor (processor),
+      snapshot (snapshot),
+      valueName (valueName),
+      numLines (juce::jmin (numLines, CBR_DISPLAY_MAX_LINES)),
+      numLanes (juce::jmin (numLanes, CBR_DISPLAY_MAX_LANES)),
+      layoutWatcher (layoutWatcher)
+{
+    int height = displayMargin * 2 + phraseHeight + rowHeight;
+    if (valueName.isNotEmpty()) {
+        height += rowHeight;
+    }
+    if (this->numLines > 0) {
+        height += linesHeight;
+    }
+    if (this->numLanes > 0) {
+        height += lanesHeight + rowHeight;
+    }
+    if (layoutWatcher != nullptr) {
+        height += rowHeight * 2;
+
+        chooseLayoutButton.onClick = [this] { chooseLayoutFile(); };
+        clearLayoutButton.onClick = [this] { this->layoutWatcher->setFile (juce::File()); };
+        addAndMakeVisible (chooseLayoutButton);
+        addAndMakeVisible (clearLayoutButton);
+    }
+    setSize (displayWidth, height);
+
+    snapshot.read (state);
+    startTimerHz (CBR_DISPLAY_REFRESH_HZ);
+}
+
+PhraseDisplayEditor::~PhraseDisplayEditor ()
+{
+    stopTimer();
+}
+
+void PhraseDisplayEditor::timerCallback ()
+{
+    if (layoutWatcher != nullptr) {
+        const juce::File file = layoutWatcher->getFile();
+        juce::String status = layoutWatcher->getStatus();
+        if (status.isEmpty()) {
+            status = (file == juce::File()) ? juce::String ("Built-in layout") : file.getFileName();
+        }
+        if (status != layoutStatus) {
+            layoutStatus = status;
+            repaint();
+        }
+    }
+
+    PhraseDisplayState latest;
+    if (! snapshot.read (latest)) {
+        return;
+    }
+
+    // Only repaint when something visible has changed, e.g. not while stopped.
+    if (std::memcmp (&latest, &state, sizeof (PhraseDisplayState)) != 0) {
+        state = latest;
+        repaint();
+    }
+}
+
+//==============================================================================
+void PhraseDisplayEditor::paint (juce::Graphics& g)
+{
+    g.fillAll (getLookAndFeel().findColour (juce::ResizableWindow::backgroundColourId));
+    g.setFont (14.0f);
+
+    juce::Rectangle<int> area = getLocalBounds().reduced (displayMargin);
+
+    paintPhrase (g, area.removeFromTop (phraseHeight));
+
+    if (valueName.isNotEmpty()) {
+        juce::String text = valueName + " " + formatValue (state.currentValue);
+        if (state.pendingValue != state.currentValue) {
+            text << "  -> " << formatValue (state.pendingValue) << " next phrase";
+        }
+        g.setColour (state.pendingValue != state.currentValue ? pendingColour : juce::Colours::white);
+        g.drawText (text, area.removeFromTop (rowHeight), juce::Justification::centredLeft);
+    }
+
+    juce::String programText = getAudioProcessor()->getProgramName (state.currentProgram);
+    if (state.pendingProgram >= 0) {
+        programText << "  -> " << getAudioProcessor()->getProgramName (state.pendingProgram) << " next phrase";
+    }
+    g.setColour (state.pendingProgram >= 0 ? pendingColour : juce::Colours::white);
+    g.drawText (programText, area.removeFromTop (rowHeight), juce::Justification::centredLeft);
+
+    if (numLines > 0) {
+        paintLines (g, area.removeFromTop (linesHeight));
+    }
+    if (numLanes > 0) {
+        paintLanes (g, area.removeFromTop (lanesHeight));
+
+        juce::String ccText;
+        ccText << "CCs saved " << state.ccMessagesSaved;
+        if (state.ccMessagesWaiting > 0) {
+            ccText << "   waiting " << state.ccMessagesWaiting;
+        }
+        g.setColour (state.ccMessagesWaiting > 0 ? pendingColour : juce::Colours::white);
+        g.drawText (ccText, area.removeFromTop (rowHeight), juce::Justification::centredLeft);
+    }
+
+    // The layout status goes under the layout buttons.
+    if (layoutWatcher != nullptr) {
+        area.removeFromTop (rowHeight);
+        g.setColour (juce::Colours::white);
+        g.drawText (layoutStatus, area.removeFromTop (rowHeight), juce::Justification::centredLeft, true);
+    }
+}
+
+void PhraseDisplayEditor::resized ()
+{
+    if (layoutWatcher == nullptr) {
+        return;
+    }
+
+    juce::Rectangle<int> row = getLocalBounds().reduced (displayMargin).removeFromBottom (rowHeight * 2).removeFromTop (rowHeight).reduced (0, 2);
+    chooseLayoutButton.setBounds (row.removeFromLeft (120));
+    row.removeFromLeft (6);
+    clearLayoutButton.setBounds (row.removeFromLeft (60));
+}
+
+void PhraseDisplayEditor::chooseLayoutFile ()
+{
+    const juce::File current = layoutWatcher->getFile();
+    layoutChooser = std::make_unique<juce::FileChooser> ("Choose a layout file", current.getParentDirectory(), "*.json;*.txt");
+    layoutChooser->launchAsync (juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles,
+                                [this] (const juce::FileChooser& chooser) {
+                                    if (chooser.getResult() != juce::File()) {
+                                        layoutWatcher->setFile (chooser.getResult());
+                                    }
+                                });
+}
+
+/**
+ * A value for the value row, e.g. "3", or "1+3" for a channel mask.
+*/
+juce::String PhraseDisplayEditor::formatValue (int value) const
+{
+    if (! state.valueIsChannelMask) {
+        return juce::String (value);
+    }
+
+    juce::StringArray channels;
+    for (int channel = 1; channel <= 16; channel++) {
+        if ((value >> (channel - 1)) & 1) {
+            channels.add (juce::String (channel));
+        }
+    }
+    return channels.isEmpty() ? juce::String ("none") : channels.joinIntoString ("+");
+}
+
+void PhraseDisplayEditor::paintPhrase (juce::Graphics& g, juce::Rectangle<int> area)
+{
+    const int beats = juce::jmax (1, juce::roundToInt (state.beatsPerPhrase));
+    const int beat = juce::jlimit (1, beats, 1 + (int) (state.phrasePosition * beats));
+
+    juce::String text;
+    if (state.isPlaying) {
+        text << "Phrase " << (int) state.phraseIndex << "   beat " << beat << " / " << beats;
+    }
+    else {
+        text << "Stopped";
+    }
+    g.setColour (juce::Colours::white);
+    g.drawText (text, area.removeFromTop (rowHeight), juce::Justification::centredLeft);
+
+    // Progress through the phrase, with a tick per beat while they're far enough apart.
+    const juce::Rectangle<float> bar = area.reduced (0, 3).toFloat();
+    g.setColour (juce::Colours::darkgrey);
+    g.fillRect (bar);
+    g.setColour (activeColour);
+    g.fillRect (bar.withWidth (bar.getWidth() * (float) juce::jlimit (0.0, 1.0, state.phrasePosition)));
+
+    if (bar.getWidth() / beats >= 4.0f) {
+        g.setColour (juce::Colours::black);
+        for (int i = 1; i < beats; i++) {
+            const float x = bar.getX() + bar.getWidth() * i / beats;
+            g.drawVerticalLine (juce::roundToInt (x), bar.getY(), bar.getBottom());
+        }
+    }
+}
+
+void PhraseDisplayEditor::paintLines (juce::Graphics& g, juce::Rectangle<int> area)
+{
+    const int lineWidth = area.getWidth() / numLines;
+
+    for (int i = 0; i < numLines; i++) {
+        const juce::Rectangle<float> box = area.removeFromLeft (lineWidth).reduced (3, 6).toFloat();
+        const bool gateOpen = (state.lineGateMask >> i) & 1u;
+        const bool changePending = ((state.pendingGateMask >> i) & 1u) && (((state.pendingGateValues >> i) & 1u) != (juce::uint32) gateOpen);
+
+        g.setColour (gateOpen ? activeColour : juce::Colours::darkgrey);
+        g.fillRect (box);
+        if (changePending) {
+            g.setColour (pendingColour);
+            g.drawRect (box, 3.0f);
+        }
+        g.setColour (juce::Colours::black);
+        g.drawText (juce::String (i + 1), box, juce::Justification::centred);
+    }
+}
+
+void PhraseDisplayEditor::paintLanes (juce::Graphics& g, juce::Rectangle<int> area)
+{
+    const int laneWidth = area.getWidth() / numLanes;
+
+    for (int i = 0; i < numLanes; i++) {
+        const juce::Rectangle<float> lane = area.removeFromLeft (laneWidth).reduced (3, 4).toFloat();
+        const float value = juce::jlimit (0.0f, 1.0f, state.laneValues[i]);
+        const float target = juce::jlimit (0.0f, 1.0f, state.laneTargets[i]);
+
+        g.setColour (juce::Colours::darkgrey);
+        g.fillRect (lane);
+        g.setColour (activeColour);
+        g.fillRect (lane.withTop (lane.getBottom() - lane.getHeight() * value));
+
+        // Where the lane is heading by the end of the phrase.
+        g.setColour (pendingColour);
+        const float targetY = lane.getBottom() - lane.getHeight() * target;
+        g.drawLine (lane.getX(), targetY, lane.getRight(), targetY, 2.0f);
+    }
+}
@@ -0,0 +1,118 @@
+/*
+  ==============================================================================
+
+    PhraseDisplay.h
+    A lightweight editor showing where the plugin is in the phrase, and what
+    changes on the next boundary.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "PhraseClock.h"
+#include "LayoutConfig.h"
+#include "SeqlockSnapshot.h"
+
+#define CBR_DISPLAY_MAX_LINES 16
+#define CBR_DISPLAY_MAX_LANES 32
+// Editor refresh rate.
+#define CBR_DISPLAY_REFRESH_HZ 30
+
+//==============================================================================
+/**
+ * What the editor shows, published by the audio thread once per block.
+ * Plain data, so it can be copied as bytes.
+*/
+struct PhraseDisplayState
+{
+    /**
+     * Fill in the phrase position at a sample time.
+    */
+    void setPhrase (const PhraseClock& phraseClock, juce::int64 timeInSamples, int timeSigDenominator, bool playing)
+    {
+        isPlaying = playing;
+        phraseIndex = phraseClock.getPhraseIndex (timeInSamples);
+        phrasePosition = phraseClock.getPhrasePosition (timeInSamples);
+        beatsPerPhrase = (double) phraseClock.getPhraseLengthTicks() / PhraseClock::getBeatTicks (timeSigDenominator);
+    }
+
+    bool isPlaying = false;
+    juce::int64 phraseIndex = 0;
+    double phrasePosition = 0;
+    double beatsPerPhrase = 0;
+
+    // Variation or channel for the clip variation plugins, and what it switches to on the next boundary.
+    int currentValue = 0;
+    int pendingValue = 0;
+    // The values are channel masks, one bit per channel, e.g. layered channels in ChannelFilter.
+    bool valueIsChannelMask = false;
+
+    int currentProgram = 0;
+    // -1 if no program change is waiting for the boundary.
+    int pendingProgram = -1;
+
+    // LineToggler gates, one bit per line.
+    int numLines = 0;
+    juce::uint32 lineGateMask = 0;
+    juce::uint32 pendingGateMask = 0;
+    juce::uint32 pendingGateValues = 0;
+
+    // ControllerMotion lanes, normalised 0-1.
+    int numLanes = 0;
+    float laneValues[CBR_DISPLAY_MAX_LANES] = {};
+    float laneTargets[CBR_DISPLAY_MAX_LANES] = {};
+    // CC messages saved by coalescing and dropping repeats, and waiting for output budget.
+    juce::int64 ccMessagesSaved = 0;
+    int ccMessagesWaiting = 0;
+};
+
+//==============================================================================
+/**
+ * Polls the processor's snapshot on a timer and repaints when it changes.
+ * Never touches the processor's audio thread state directly, so any number
+ * of open editors costs the audio thread nothing extra.
+*/
+class PhraseDisplayEditor : public juce::AudioProcessorEditor,
+                            private juce::Timer
+{
+public:
+    /**
+     * @param snapshot The processor's published display state.
+     * @param valueName What the plugin switches on boundaries, e.g. "Variation", or empty for nothing.
+     * @param numLines Lines of gates to show.
+     * @param numLanes Controller lanes to show.
+     * @param layoutWatcher The processor's layout file, to choose it and show its status, or null for none.
+    */
+    PhraseDisplayEditor (juce::AudioProcessor& processor, const SeqlockSnapshot<PhraseDisplayState>& snapshot,
+                         const juce::String& valueName, int numLines, int numLanes, LayoutWatcher* layoutWatcher = nullptr);
+    ~PhraseDisplayEditor () override;
+
+    void paint (juce::Graphics& g) override;
+    void resized () override;
+
+private:
+    void timerCallback () override;
+
+    juce::String formatValue (int value) const;
+    void paintPhrase (juce::Graphics& g, juce::Rectangle<int> area);
+    void paintLines (juce::Graphics& g, juce::Rectangle<int> area);
+    void paintLanes (juce::Graphics& g, juce::Rectangle<int> area);
+    void chooseLayoutFile ();
+
+    const SeqlockSnapshot<PhraseDisplayState>& snapshot;
+    const juce::String valueName;
+    const int numLines;
+    const int numLanes;
+
+    PhraseDisplayState state;
+
+    LayoutWatcher* layoutWatcher;
+    juce::String layoutStatus;
+    juce::TextButton chooseLayoutButton { "Layout file..." };
+    juce::TextButton clearLayoutButton { "Clear" };
+    std::unique_ptr<juce::FileChooser> layoutChooser;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PhraseDisplayEditor)
+};
@@ -0,0 +1,275 @@
+/*
+  ==============================================================================
+
+    PhrasePrograms.cpp
+    A bank of programs - complete sets of parameter values - recalled with MIDI
+    program change on the next phrase boundary.
+
+  ==============================================================================
+*/
+
+#include "PhrasePrograms.h"
+
+static juce::String getDefaultName (int index)
+{
+    return "Program " + juce::String (index + 1);
+}
+
+static bool hasSameValues (const ParameterConfig& config1, const ParameterConfig& config2)
+{
+    if (config1.numValues != config2.numValues) {
+        return false;
+    }
+    for (int i = 0; i < config1.numValues; i++) {
+        if (config1.values[i] != config2.values[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//==============================================================================
+PhrasePrograms::PhrasePrograms ()
+    : editFifo (CBR_PROGRAMS_EDIT_SLOTS)
+{
+}
+
+void PhrasePrograms::initialise (const juce::AudioProcessor& processor)
+{
+    defaults.readFrom (processor);
+
+    bank.reset (new ProgramBank());
+    for (int i = 0; i < CBR_PROGRAMS_NUM; i++) {
+        bank->configs[i] = defaults;
+        bank->names[i] = getDefaultName (i);
+    }
+    publishBank();
+}
+
+void PhrasePrograms::publishBank ()
+{
+    bankSwap.publish (std::make_unique<ProgramBank> (*bank));
+}
+
+void PhrasePrograms::collectEdits ()
+{
+    int start1, size1, start2, size2;
+    editFifo.prepareToRead (editFifo.getNumReady(), start1, size1, start2, size2);
+    for (int i = 0; i < size1; i++) {
+        bank->configs[edits[start1 + i].program] = edits[start1 + i].config;
+    }
+    for (int i = 0; i < size2; i++) {
+        bank->configs[edits[start2 + i].program] = edits[start2 + i].config;
+    }
+    editFifo.finishedRead (size1 + size2);
+
+    if (size1 + size2 > 0) {
+        publishBank();
+    }
+}
+
+void PhrasePrograms::storeCurrentProgram (juce::AudioProcessor& processor, ParameterConfigSwap& parameterConfig)
+{
+    collectEdits();
+
+    // While the audio thread is switching, the parameters may be a mix of two
+    // programs. It hands the outgoing program's values back itself.
+    const juce::uint32 sequence = switchSequence.load();
+    if (sequence % 2 != 0) {
+        return;
+    }
+
+    // After a switch the parameters hold the outgoing program until the
+    // values from the audio thread are passed on.
+    parameterConfig.flushPending();
+
+    const int program = currentProgram.load();
+    ParameterConfig live;
+    live.readFrom (processor);
+
+    if (switchSequence.load() != sequence || hasSameValues (live, bank->configs[program])) {
+        return;
+    }
+
+    bank->configs[program] = live;
+    publishBank();
+}
+
+bool PhrasePrograms::isDefault (int index) const
+{
+    return bank->names[index] == getDefaultName (index) && hasSameValues (bank->configs[index], defaults);
+}
+
+//==============================================================================
+int PhrasePrograms::getCurrentProgram ()
+{
+    return currentProgram.load();
+}
+
+void PhrasePrograms::setCurrentProgram (juce::AudioProcessor& processor, ParameterConfigSwap& parameterConfig, int index)
+{
+    if (index < 0 || index >= CBR_PROGRAMS_NUM) {
+        return;
+    }
+
+    // Keep the edits to the program we're leaving.
+    storeCurrentProgram (processor, parameterConfig);
+
+    currentProgram = index;
+    parameterConfig.loadConfig (processor, bank->configs[index]);
+}
+
+juce::String PhrasePrograms::getProgramName (int index)
+{
+    if (index < 0 || index >= CBR_PROGRAMS_NUM) {
+        return {};
+    }
+    return bank->names[index];
+}
+
+void PhrasePrograms::changeProgramName (int index, const juce::String& newName)
+{
+    // Names aren't used on the audio thread, so there's no need to publish.
+    if (index >= 0 && index < CBR_PROGRAMS_NUM) {
+        bank->names[index] = newName;
+    }
+}
+
+//==============================================================================
+void PhrasePrograms::writeToState (juce::ValueTree& state, juce::AudioProcessor& processor, ParameterConfigSwap& parameterConfig)
+{
+    storeCurrentProgram (processor, parameterConfig);
+
+    const juce::Array<juce::AudioProcessorParameter*>& parameters = processor.getParameters();
+
+    juce::ValueTree programsTree ("PROGRAMS");
+    programsTree.setProperty ("current", currentProgram.load(), nullptr);
+
+    for (int i = 0; i < CBR_PROGRAMS_NUM; i++) {
+        if (isDefault (i)) {
+            continue;
+        }
+
+        const ParameterConfig& config = bank->configs[i];
+        juce::ValueTree programTree ("PROGRAM");
+        programTree.setProperty ("index", i, nullptr);
+        programTree.setProperty ("name", bank->names[i], nullptr);
+
+        // Same layout as AudioProcessorValueTreeState, so ParameterConfig can read it back.
+        for (int p = 0; p < config.numValues; p++) {
+            const juce::RangedAudioParameter* parameter = dynamic_cast<const juce::RangedAudioParameter*> (parameters[p]);
+            if (parameter == nullptr) {
+                continue;
+            }
+            juce::ValueTree parameterTree ("PARAM");
+            parameterTree.setProperty ("id", parameter->paramID, nullptr);
+            parameterTree.setProperty ("value", parameter->convertFrom0to1 (config.values[p]), nullptr);
+            programTree.addChild (parameterTree, -1, nullptr);
+        }
+
+        programsTree.addChild (programTree, -1, nullptr);
+    }
+
+    state.addChild (programsTree, -1, nullptr);
+}
+
+void PhrasePrograms::readFromState (juce::ValueTree& state, const juce::AudioProcessor& processor)
+{
+    // Edits to the old bank are replaced too.
+    collectEdits();
+
+    for (int i = 0; i < CBR_PROGRAMS_NUM; i++) {
+        bank->configs[i] = defaults;
+        bank->names[i] = getDefaultName (i);
+    }
+
+    // States saved before programs were added load into the first program.
+    int current = 0;
+
+    const juce::ValueTree programsTree = state.getChildWithName ("PROGRAMS");
+    if (programsTree.isValid()) {
+        for (int i = 0; i < programsTree.getNumChildren(); i++) {
+            const juce::ValueTree programTree = programsTree.getChild (i);
+            const int index = programTree.getProperty ("index", -1);
+            if (! programTree.hasType ("PROGRAM") || index < 0 || index >= CBR_PROGRAMS_NUM) {
+                continue;
+            }
+
+            bank->names[index] = programTree.getProperty ("name", getDefaultName (index)).toString();
+            bank->configs[index].readFrom (processor, programTree);
+        }
+
+        current = juce::jlimit (0, CBR_PROGRAMS_NUM - 1, (int) programsTree.getProperty ("current", 0));
+        state.removeChild (programsTree, nullptr);
+    }
+
+    currentProgram = current;
+    publishBank();
+}
+
+//==============================================================================
+int PhrasePrograms::takeProgramChange (const juce::MidiBuffer& midiMessages, int boundaryOffset)
+{
+    if (const ProgramBank* newBank = bankSwap.acquire()) {
+        audioBank = newBank;
+    }
+
+    // Program changes on any channel. The last one before the boundary wins.
+    int programAfterBoundary = -1;
+    for (const juce::MidiMessageMetadata metadata : midiMessages) {
+        const juce::MidiMessage message = metadata.getMessage();
+        if (! message.isProgramChange()) {
+            continue;
+        }
+        if (boundaryOffset >= 0 && metadata.samplePosition > boundaryOffset) {
+            programAfterBoundary = message.getProgramChangeNumber();
+        }
+        else {
+            pendingProgram = message.getProgramChangeNumber();
+        }
+    }
+
+    int program = -1;
+    if (boundaryOffset >= 0 && audioBank != nullptr) {
+        // Selecting the current program again leaves it as it is.
+        if (pendingProgram != currentProgram.load()) {
+            program = pendingProgram;
+        }
+        pendingProgram = -1;
+    }
+
+    if (programAfterBoundary >= 0) {
+        pendingProgram = programAfterBoundary;
+    }
+
+    return program;
+}
+
+void PhrasePrograms::queueProgramChange (int program)
+{
+    if (program >= 0 && program < CBR_PROGRAMS_NUM) {
+        pendingProgram = program;
+    }
+}
+
+void PhrasePrograms::switchProgram (int program, juce::AudioProcessor& processor, ParameterConfigSwap& parameterConfig)
+{
+    jassert (program >= 0 && program < CBR_PROGRAMS_NUM && audioBank != nullptr);
+
+    switchSequence++;
+
+    // Hand the outgoing program's values back, so edits to it are kept.
+    // If the message thread hasn't collected earlier ones, these edits are lost.
+    int start1, size1, start2, size2;
+    editFifo.prepareToWrite (1, start1, size1, start2, size2);
+    if (size1 == 1) {
+        edits[start1].program = currentProgram.load();
+        edits[start1].config = parameterConfig.get();
+        editFifo.finishedWrite (1);
+    }
+
+    currentProgram = program;
+    parameterConfig.applyConfig (processor, audioBank->configs[program]);
+
+    switchSequence++;
+}
@@ -0,0 +1,148 @@
+/*
+  ==============================================================================
+
+    PhrasePrograms.h
+    A bank of programs - complete sets of parameter values - recalled with MIDI
+    program change on the next phrase boundary.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "ConfigSwap.h"
+#include "ParameterConfig.h"
+
+#include <atomic>
+
+// One program per MIDI program change number.
+#define CBR_PROGRAMS_NUM 128
+// Edits to the outgoing program the audio thread can hand back between message thread calls.
+#define CBR_PROGRAMS_EDIT_SLOTS 4
+
+//==============================================================================
+/**
+ * Every program's parameter values and name. Immutable once published.
+*/
+struct ProgramBank
+{
+    ParameterConfig configs[CBR_PROGRAMS_NUM];
+    juce::String names[CBR_PROGRAMS_NUM];
+};
+
+//==============================================================================
+/**
+ * Programs are edited in place: changing parameters changes the current program,
+ * and the edits are kept when switching to another program.
+ *
+ * The message thread owns the bank and publishes a copy for the audio thread
+ * whenever it changes. On the audio thread a program change waits for the next
+ * phrase boundary, then the program's values replace the block's config in one
+ * copy - no allocation, no locks.
+ *
+ * The processor finds the boundary: each plugin switches where its own phrase
+ * changes take effect.
+*/
+class PhrasePrograms
+{
+public:
+    PhrasePrograms ();
+
+    /**
+     * Fill the bank with the processor's default parameter values.
+     *
+     * Message thread, at the end of the processor's constructor.
+    */
+    void initialise (const juce::AudioProcessor& processor);
+
+    //==============================================================================
+    // Message thread, for the AudioProcessor program methods.
+    int getCurrentProgram ();
+    void setCurrentProgram (juce::AudioProcessor& processor, ParameterConfigSwap& parameterConfig, int index);
+    juce::String getProgramName (int index);
+    void changeProgramName (int index, const juce::String& newName);
+
+    /**
+     * Add the bank to a state being saved, as a PROGRAMS child.
+     * Programs left at their defaults aren't saved.
+     *
+     * Message thread, after ParameterConfigSwap::flushPending() and copying the
+     * parameters' state, so the state and the current program agree.
+    */
+    void writeToState (juce::ValueTree& state, juce::AudioProcessor& processor, ParameterConfigSwap& parameterConfig);
+
+    /**
+     * Load the bank from a saved state, and remove it from the state so only
+     * the current parameter values are left.
+     *
+     * Message thread.
+    */
+    void readFromState (juce::ValueTree& state, const juce::AudioProcessor& processor);
+
+    //==============================================================================
+    /**
+     * Handle the program changes in this block. A program change before the phrase
+     * boundary switches on it, one after waits for the next boundary.
+     *
+     * Audio thread, once per block.
+     *
+     * @param boundaryOffset Offset of the phrase boundary in this block, 0 to switch
+     *                       at the start of the block, or -1 if there isn't one.
+     * @return The program to switch to on this block's boundary, or -1.
+    */
+    int takeProgramChange (const juce::MidiBuffer& midiMessages, int boundaryOffset);
+
+    /**
+     * Queue a program change as if one arrived at the start of the next block,
+     * e.g. from an OSC cue.
+     *
+     * Audio thread, before takeProgramChange().
+    */
+    void queueProgramChange (int program);
+
+    /**
+     * Switch to a program, replacing the block's config from here on.
+     *
+     * Audio thread, at the boundary, with the program from takeProgramChange().
+    */
+    void switchProgram (int program, juce::AudioProcessor& processor, ParameterConfigSwap& parameterConfig);
+
+    /**
+     * The program waiting for the next boundary, or -1.
+     *
+     * Audio thread.
+    */
+    int getPendingProgram () const { return pendingProgram; }
+
+private:
+    struct ProgramEdit
+    {
+        int program;
+        ParameterConfig config;
+    };
+
+    void publishBank ();
+    void collectEdits ();
+    void storeCurrentProgram (juce::AudioProcessor& processor, ParameterConfigSwap& parameterConfig);
+    bool isDefault (int index) const;
+
+    // Owned by the message thread.
+    std::unique_ptr<ProgramBank> bank;
+    ParameterConfig defaults;
+
+    ConfigSwap<ProgramBank> bankSwap;
+    std::atomic<int> currentProgram { 0 };
+    // Odd while the audio thread is switching program.
+    std::atomic<juce::uint32> switchSequence { 0 };
+
+    // Values of the outgoing program, from the audio thread when it switches.
+    juce::AbstractFifo editFifo;
+    ProgramEdit edits[CBR_PROGRAMS_EDIT_SLOTS];
+
+    // Owned by the audio thread.
+    const ProgramBank* audioBank = nullptr;
+    int pendingProgram = -1;
+
+    JUCE_DECLARE_NON_COPYABLE (PhrasePrograms)
+};
@@ -0,0 +1,58 @@
+/*
+  ==============================================================================
+
+    RealtimeCheck.cpp
+    Marks processBlock as real-time code, for the RealtimeCheck host.
+
+  ==============================================================================
+*/
+
+#include "RealtimeCheck.h"
+
+#if CBR_REALTIME_CHECK
+
+#include <dlfcn.h>
+
+typedef void (*ScopeFunction) ();
+
+/**
+ * The host's scope functions, or null if not running in RealtimeCheck.
+*/
+struct HostScopeFunctions
+{
+    HostScopeFunctions ()
+    {
+        enter = (ScopeFunction) dlsym (RTLD_DEFAULT, CBR_REALTIME_ENTER_SYMBOL);
+        exit = (ScopeFunction) dlsym (RTLD_DEFAULT, CBR_REALTIME_EXIT_SYMBOL);
+        if (enter == nullptr || exit == nullptr) {
+            enter = nullptr;
+            exit = nullptr;
+        }
+    }
+
+    ScopeFunction enter;
+    ScopeFunction exit;
+};
+
+static const HostScopeFunctions& getHostScopeFunctions ()
+{
+    // Looked up on the first block, before the scope is entered.
+    static const HostScopeFunctions functions;
+    return functions;
+}
+
+RealtimeCheckScope::RealtimeCheckScope ()
+{
+    if (getHostScopeFunctions().enter != nullptr) {
+        getHostScopeFunctions().enter();
+    }
+}
+
+RealtimeCheckScope::~RealtimeCheckScope ()
+{
+    if (getHostScopeFunctions().exit != nullptr) {
+        getHostScopeFunctions().exit();
+    }
+}
+
+#endif
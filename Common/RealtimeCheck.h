@@ -0,0 +1,54 @@
+/*
+  ==============================================================================
+
+    RealtimeCheck.h
+    Marks processBlock as real-time code, so the RealtimeCheck host (see
+    Tools/RealtimeCheck) can report allocations, locks and blocking calls made
+    while it runs.
+
+    Compiled out unless CBR_REALTIME_CHECK=1 is added to the project's
+    preprocessor definitions (the RealtimeCheck build configuration does this).
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#ifndef CBR_REALTIME_CHECK
+ #define CBR_REALTIME_CHECK 0
+#endif
+
+// Functions exported by the checking host, looked up at runtime.
+#define CBR_REALTIME_ENTER_SYMBOL "cbrRealtimeScopeEnter"
+#define CBR_REALTIME_EXIT_SYMBOL "cbrRealtimeScopeExit"
+
+// Bytes each plugin reserves for its output MidiBuffer in prepareToPlay, so a
+// dense block doesn't grow it on the audio thread.
+#define CBR_MIDI_OUTPUT_RESERVE_BYTES 8192
+
+#if CBR_REALTIME_CHECK
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+ * Tells the checking host that the current thread is in real-time code, for the
+ * lifetime of the object. Does nothing if the host isn't RealtimeCheck.
+*/
+class RealtimeCheckScope
+{
+public:
+    RealtimeCheckScope ();
+    ~RealtimeCheckScope ();
+
+private:
+    JUCE_DECLARE_NON_COPYABLE (RealtimeCheckScope)
+};
+
+#define CBR_REALTIME_SCOPE RealtimeCheckScope realtimeCheckScope
+
+#else
+
+#define CBR_REALTIME_SCOPE ((void) 0)
+
+#endif
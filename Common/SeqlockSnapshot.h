@@ -0,0 +1,85 @@
+/*
+  ==============================================================================
+
+    SeqlockSnapshot.h
+    Hands a small plain-data snapshot from the audio thread to the UI without
+    locking or waiting on the audio side.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+// Attempts to get a consistent copy before the reader gives up until next time.
+#define CBR_SEQLOCK_READ_ATTEMPTS 4
+
+//==============================================================================
+/**
+ * A sequence lock around one copy of the snapshot. The writer bumps the
+ * sequence to odd, copies the snapshot in and bumps it back to even - two
+ * atomic stores and a copy, however many readers there are. A reader copies
+ * the snapshot out and keeps it if the sequence was even and unchanged.
+ *
+ * Only one thread may publish. Readers never block the writer.
+*/
+template <typename Snapshot>
+class SeqlockSnapshot
+{
+public:
+    static_assert (std::is_trivially_copyable<Snapshot>::value, "Snapshot is copied as raw bytes");
+
+    SeqlockSnapshot () = default;
+
+    /**
+     * Publish a new snapshot. Never blocks.
+     *
+     * Audio thread, once per block.
+    */
+    void publish (const Snapshot& newSnapshot)
+    {
+        const juce::uint32 start = sequence.load (std::memory_order_relaxed);
+        sequence.store (start + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_release);
+
+        std::memcpy (&snapshot, &newSnapshot, sizeof (Snapshot));
+
+        sequence.store (start + 2, std::memory_order_release);
+    }
+
+    /**
+     * Copy the latest snapshot.
+     *
+     * Any thread other than the writer, e.g. an editor's timer.
+     *
+     * @return False if the writer kept overtaking the copy - try again next time.
+    */
+    bool read (Snapshot& result) const
+    {
+        for (int attempt = 0; attempt < CBR_SEQLOCK_READ_ATTEMPTS; attempt++) {
+            const juce::uint32 start = sequence.load (std::memory_order_acquire);
+            if (start % 2 != 0) {
+                continue;
+            }
+
+            std::memcpy (&result, &snapshot, sizeof (Snapshot));
+            std::atomic_thread_fence (std::memory_order_acquire);
+
+            if (sequence.load (std::memory_order_relaxed) == start) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    std::atomic<juce::uint32> sequence { 0 };
+    Snapshot snapshot {};
+
+    JUCE_DECLARE_NON_COPYABLE (SeqlockSnapshot)
+};
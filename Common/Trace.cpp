@@ -0,0 +1,225 @@
+/*
+  ==============================================================================
+
+    Trace.cpp
+    Trace points for processing decisions, written as Chrome trace-event JSON
+    (open in chrome://tracing or ui.perfetto.dev).
+
+  ==============================================================================
+*/
+
+#include "Trace.h"
+
+#if CBR_TRACE_ENABLED
+
+#ifdef JucePlugin_Name
+ #define CBR_TRACE_ROW_NAME JucePlugin_Name
+#else
+ #define CBR_TRACE_ROW_NAME "Plugin"
+#endif
+
+// Time between writes to the trace file.
+static const int writeIntervalMs = 20;
+
+static double getTimeMicroseconds ()
+{
+    return juce::Time::getMillisecondCounterHiRes() * 1000.0;
+}
+
+//==============================================================================
+/**
+ * Writes events from all the instances in the process to one trace file.
+ * Shared by the recorders, and runs while any exist.
+*/
+class TraceWriter : private juce::Thread
+{
+public:
+    TraceWriter ()
+        : juce::Thread ("CBR trace writer")
+    {
+        // One file per plugin type, each plugin binary has its own writer.
+        const juce::String traceDir = juce::SystemStats::getEnvironmentVariable (CBR_TRACE_DIR_ENV, {});
+        const juce::File folder = traceDir.isNotEmpty() ? juce::File (traceDir) : juce::File::getSpecialLocation (juce::File::tempDirectory);
+        folder.createDirectory();
+        const juce::File file = folder.getNonexistentChildFile (juce::String (CBR_TRACE_ROW_NAME) + "-trace", ".json", false);
+
+        output.reset (new juce::FileOutputStream (file));
+        if (output->failedToOpen()) {
+            output.reset();
+            return;
+        }
+
+        // The trace-event format allows the array to be left open, so events can be streamed.
+        *output << "[\n";
+        startThread();
+    }
+
+    ~TraceWriter () override
+    {
+        stopThread (1000);
+        writeEvents();
+    }
+
+    /**
+     * @return Timeline row for the recorder.
+    */
+    int addRecorder (TraceRecorder* recorder)
+    {
+        const juce::ScopedLock sl (lock);
+        recorders.add (recorder);
+        return ++lastRowId;
+    }
+
+    void removeRecorder (TraceRecorder* recorder)
+    {
+        const juce::ScopedLock sl (lock);
+        writeEvents (*recorder);
+        recorders.removeFirstMatchingValue (recorder);
+    }
+
+private:
+    void run () override
+    {
+        while (! threadShouldExit()) {
+            wait (writeIntervalMs);
+            writeEvents();
+        }
+    }
+
+    void writeEvents ()
+    {
+        const juce::ScopedLock sl (lock);
+        for (TraceRecorder* recorder : recorders) {
+            writeEvents (*recorder);
+        }
+        if (output != nullptr) {
+            output->flush();
+        }
+    }
+
+    void writeEvents (TraceRecorder& recorder)
+    {
+        if (output == nullptr) {
+            return;
+        }
+
+        const juce::String row = juce::String (recorder.rowId);
+
+        if (! recorder.rowNamed) {
+            *output << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << row
+                << ",\"args\":{\"name\":\"" << CBR_TRACE_ROW_NAME << " " << row << "\"}},\n";
+            recorder.rowNamed = true;
+        }
+
+        int start1, size1, start2, size2;
+        recorder.fifo.prepareToRead (recorder.fifo.getNumReady(), start1, size1, start2, size2);
+        for (int i = 0; i < size1; i++) {
+            writeEvent (recorder.events[start1 + i], row);
+        }
+        for (int i = 0; i < size2; i++) {
+            writeEvent (recorder.events[start2 + i], row);
+        }
+        recorder.fifo.finishedRead (size1 + size2);
+
+        const int numDropped = recorder.numDropped.exchange (0);
+        if (numDropped > 0) {
+            *output << "{\"name\":\"events dropped\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":" << row
+                << ",\"ts\":" << juce::String (getTimeMicroseconds(), 3)
+                << ",\"args\":{\"count\":" << numDropped << "}},\n";
+        }
+    }
+
+    void writeEvent (const TraceRecorder::Event& event, const juce::String& row)
+    {
+        *output << "{\"name\":\"" << event.name << "\",\"ph\":\"" << juce::String::charToString (event.phase)
+            << "\",\"pid\":1,\"tid\":" << row
+            << ",\"ts\":" << juce::String (event.timeMicroseconds, 3);
+
+        if (event.phase == 'X') {
+            *output << ",\"cat\":\"block\",\"dur\":" << juce::String (event.durationMicroseconds, 3)
+                << ",\"args\":{\"timeInSamples\":" << event.timeInSamples
+                << ",\"numSamples\":" << event.value << "}},\n";
+        }
+        else {
+            *output << ",\"cat\":\"decision\",\"s\":\"t\""
+                << ",\"args\":{\"reason\":\"" << event.reason
+                << "\",\"sampleOffset\":" << event.sampleOffset
+                << ",\"sampleTime\":" << (event.timeInSamples + event.sampleOffset)
+                << ",\"value\":" << event.value << "}},\n";
+        }
+    }
+
+    juce::CriticalSection lock;
+    juce::Array<TraceRecorder*> recorders;
+    std::unique_ptr<juce::FileOutputStream> output;
+    int lastRowId = 0;
+
+    JUCE_DECLARE_NON_COPYABLE (TraceWriter)
+};
+
+//==============================================================================
+TraceRecorder::TraceRecorder ()
+    : fifo (CBR_TRACE_FIFO_SIZE),
+      numDropped (0)
+{
+    blockTimeInSamples = 0;
+    blockNumSamples = 0;
+    blockStartMicroseconds = 0;
+    rowNamed = false;
+    rowId = writer->addRecorder (this);
+}
+
+TraceRecorder::~TraceRecorder ()
+{
+    writer->removeRecorder (this);
+}
+
+void TraceRecorder::push (const Event& event)
+{
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite (1, start1, size1, start2, size2);
+    if (size1 == 0) {
+        numDropped++;
+        return;
+    }
+
+    events[start1] = event;
+    fifo.finishedWrite (1);
+}
+
+void TraceRecorder::beginBlock (juce::int64 timeInSamples, int numSamples)
+{
+    blockTimeInSamples = timeInSamples;
+    blockNumSamples = numSamples;
+    blockStartMicroseconds = getTimeMicroseconds();
+}
+
+void TraceRecorder::endBlock ()
+{
+    Event event;
+    event.name = "processBlock";
+    event.reason = "";
+    event.phase = 'X';
+    event.timeMicroseconds = blockStartMicroseconds;
+    event.durationMicroseconds = getTimeMicroseconds() - blockStartMicroseconds;
+    event.timeInSamples = blockTimeInSamples;
+    event.sampleOffset = 0;
+    event.value = blockNumSamples;
+    push (event);
+}
+
+void TraceRecorder::addEvent (const char* name, int sampleOffset, const char* reason, int value)
+{
+    Event event;
+    event.name = name;
+    event.reason = reason;
+    event.phase = 'i';
+    event.timeMicroseconds = getTimeMicroseconds();
+    event.durationMicroseconds = 0;
+    event.timeInSamples = blockTimeInSamples;
+    event.sampleOffset = sampleOffset;
+    event.value = value;
+    push (event);
+}
+
+#endif
@@ -0,0 +1,106 @@
+/*
+  ==============================================================================
+
+    Trace.h
+    Trace points for processing decisions, written as Chrome trace-event JSON
+    (open in chrome://tracing or ui.perfetto.dev).
+
+    Tracing is compiled out unless CBR_TRACE_ENABLED=1 is added to the
+    project's preprocessor definitions.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#ifndef CBR_TRACE_ENABLED
+ #define CBR_TRACE_ENABLED 0
+#endif
+
+#if CBR_TRACE_ENABLED
+
+#include <JuceHeader.h>
+
+// Folder for trace files. Defaults to the temp folder.
+#define CBR_TRACE_DIR_ENV "CBR_TRACE_DIR"
+// Events buffered per instance between writes. Events are dropped if it fills up.
+#define CBR_TRACE_FIFO_SIZE 4096
+
+class TraceWriter;
+
+//==============================================================================
+/**
+ * Collects trace events for one plugin instance, shown as one row in the timeline.
+ *
+ * Events are queued in a lock-free fifo on the audio thread and written to the
+ * trace file from a background thread.
+*/
+class TraceRecorder
+{
+public:
+    TraceRecorder ();
+    ~TraceRecorder ();
+
+    /**
+     * Mark the start and end of processing a block.
+    */
+    void beginBlock (juce::int64 timeInSamples, int numSamples);
+    void endBlock ();
+
+    /**
+     * Record a decision at a position in the current block.
+     *
+     * @param name What happened. Must be a string literal.
+     * @param sampleOffset Position in the block.
+     * @param reason Why. Must be a string literal.
+     * @param value Related value, e.g. note number or variation.
+    */
+    void addEvent (const char* name, int sampleOffset, const char* reason, int value);
+
+private:
+    friend class TraceWriter;
+
+    struct Event
+    {
+        const char* name;
+        const char* reason;
+        char phase;
+        double timeMicroseconds;
+        double durationMicroseconds;
+        juce::int64 timeInSamples;
+        int sampleOffset;
+        int value;
+    };
+
+    void push (const Event& event);
+
+    juce::AbstractFifo fifo;
+    Event events[CBR_TRACE_FIFO_SIZE];
+    std::atomic<int> numDropped;
+
+    juce::int64 blockTimeInSamples;
+    int blockNumSamples;
+    double blockStartMicroseconds;
+
+    // Timeline row.
+    int rowId;
+    bool rowNamed;
+
+    juce::SharedResourcePointer<TraceWriter> writer;
+
+    JUCE_DECLARE_NON_COPYABLE (TraceRecorder)
+};
+
+#define CBR_TRACE_RECORDER(recorder) TraceRecorder recorder
+#define CBR_TRACE_BLOCK_BEGIN(recorder, timeInSamples, numSamples) recorder.beginBlock (timeInSamples, numSamples)
+#define CBR_TRACE_BLOCK_END(recorder) recorder.endBlock()
+#define CBR_TRACE(recorder, name, sampleOffset, reason, value) recorder.addEvent (name, (int) (sampleOffset), reason, (int) (value))
+
+#else
+
+#define CBR_TRACE_RECORDER(recorder)
+#define CBR_TRACE_BLOCK_BEGIN(recorder, timeInSamples, numSamples) ((void) 0)
+#define CBR_TRACE_BLOCK_END(recorder) ((void) 0)
+#define CBR_TRACE(recorder, name, sampleOffset, reason, value) ((void) 0)
+
+#endif
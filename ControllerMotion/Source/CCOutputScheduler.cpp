@@ -0,0 +1,254 @@
+/*
+  ==============================================================================
+
+    CCOutputScheduler.cpp
+    Bandwidth-budgeted CC output for slow MIDI ports (e.g. 5-pin DIN).
+
+  ==============================================================================
+*/
+
+#include "CCOutputScheduler.h"
+
+// A CC message is 3 bytes. Don't assume running status, the port may interleave other messages.
+static const int bytesPerCC = 3;
+// Largest output is a full NRPN - number MSB/LSB and data MSB/LSB.
+static const int maxBytesPerOutput = bytesPerCC * 4;
+// Priority gained by an output for each block it waits, so low priority outputs
+// (e.g. phrase feedback, at 0) still go out when the port stays busy.
+static const double waitingPriorityPerBlock = 0.25;
+
+// Controller numbers for NRPN.
+static const int nrpnNumberMsbCC = 99;
+static const int nrpnNumberLsbCC = 98;
+static const int dataEntryMsbCC = 6;
+static const int dataEntryLsbCC = 38;
+
+CCOutputScheduler::CCOutputScheduler ()
+    : messagesSaved (0)
+{
+    budgetBytesPerSecond = 0;
+    budgetPerChannel = false;
+
+    reset();
+}
+
+void CCOutputScheduler::reset ()
+{
+    for (int i = 0; i < CBR_CCSCHEDULER_NUM_SLOTS; i++) {
+        pending[i].isPending = false;
+        lastSentKey[i] = -1;
+    }
+    numPending = 0;
+
+    for (int i = 0; i < CBR_CCSCHEDULER_NUM_CHANNELS; i++) {
+        budgetTokens[i] = 0;
+        lastSentNrpnNumber[i] = -1;
+    }
+}
+
+void CCOutputScheduler::setBudget (int bytesPerSecond, bool perChannel)
+{
+    budgetBytesPerSecond = juce::jmax (0, bytesPerSecond);
+    budgetPerChannel = perChannel;
+}
+
+double& CCOutputScheduler::getBudgetTokens (int channel)
+{
+    if (! budgetPerChannel) {
+        return budgetTokens[0];
+    }
+
+    return budgetTokens[juce::jlimit (1, CBR_CCSCHEDULER_NUM_CHANNELS, channel) - 1];
+}
+
+int CCOutputScheduler::getSlot (int outputType, int channel, int number)
+{
+    const int channelSlot = (juce::jlimit (1, CBR_CCSCHEDULER_NUM_CHANNELS, channel) - 1) * CBR_CCSCHEDULER_SLOTS_PER_CHANNEL;
+
+    switch (outputType) {
+        case nrpn: return channelSlot + 128 + (number & 0x7f);
+        case pitchBend: return channelSlot + 256;
+    }
+
+    return channelSlot + (number & 0x7f);
+}
+
+void CCOutputScheduler::invalidate (int outputType, int channel, int number)
+{
+    lastSentKey[getSlot (outputType, channel, number)] = -1;
+}
+
+void CCOutputScheduler::queueOutput (int outputType, int channel, int number, int value, int sampleOffset, double priority)
+{
+    outputType = juce::jlimit (0, numOutputTypes - 1, outputType);
+    value = juce::jlimit (0, getMaxValue (outputType), value);
+
+    const int slot = getSlot (outputType, channel, number);
+    PendingOutput& output = pending[slot];
+
+    if (output.isPending) {
+        // Superseded before it was sent.
+        messagesSaved++;
+        output.outputType = outputType;
+        output.number = number;
+        output.value = value;
+        output.sampleOffset = sampleOffset;
+        output.priority = juce::jmax (output.priority, priority);
+        return;
+    }
+
+    if (getSentKey (outputType, value) == lastSentKey[slot]) {
+        // Redundant repeat.
+        messagesSaved++;
+        return;
+    }
+
+    output.outputType = outputType;
+    output.number = number;
+    output.value = value;
+    output.sampleOffset = sampleOffset;
+    output.priority = priority;
+    output.isPending = true;
+    pendingSlots[numPending++] = slot;
+}
+
+/**
+ * Determine if the receiver already has the MSB for a 14-bit output, so only the LSB needs sending.
+*/
+bool CCOutputScheduler::isMsbUnchanged (const PendingOutput& output, int slot) const
+{
+    const int lastKey = lastSentKey[slot];
+    if (lastKey < 0 || (lastKey >> 16) != output.outputType) {
+        return false;
+    }
+
+    return ((lastKey & 0xffff) >> 7) == (output.value >> 7);
+}
+
+int CCOutputScheduler::getNumBytes (const PendingOutput& output, int slot, int channel) const
+{
+    switch (output.outputType) {
+        case cc14Bit:
+            return isMsbUnchanged (output, slot) ? bytesPerCC : bytesPerCC * 2;
+
+        case nrpn: {
+            const bool isSelected = (lastSentNrpnNumber[channel - 1] == output.number);
+            const int selectBytes = isSelected ? 0 : bytesPerCC * 2;
+            const int msbBytes = (isSelected && isMsbUnchanged (output, slot)) ? 0 : bytesPerCC;
+            return selectBytes + msbBytes + bytesPerCC;
+        }
+
+        default:
+            return bytesPerCC;
+    }
+}
+
+void CCOutputScheduler::sendOutput (juce::MidiBuffer& midiMessages, const PendingOutput& output, int slot, int channel, int sampleOffset)
+{
+    const int msb = (output.value >> 7) & 0x7f;
+    const int lsb = output.value & 0x7f;
+
+    switch (output.outputType) {
+        case cc14Bit: {
+            const int msbNumber = output.number & 0x1f;
+            if (! isMsbUnchanged (output, slot)) {
+                midiMessages.addEvent (juce::MidiMessage::controllerEvent (channel, msbNumber, msb), sampleOffset);
+            }
+            midiMessages.addEvent (juce::MidiMessage::controllerEvent (channel, msbNumber + 32, lsb), sampleOffset);
+            break;
+        }
+
+        case nrpn: {
+            const bool isSelected = (lastSentNrpnNumber[channel - 1] == output.number);
+            if (! isSelected) {
+                midiMessages.addEvent (juce::MidiMessage::controllerEvent (channel, nrpnNumberMsbCC, (output.number >> 7) & 0x7f), sampleOffset);
+                midiMessages.addEvent (juce::MidiMessage::controllerEvent (channel, nrpnNumberLsbCC, output.number & 0x7f), sampleOffset);
+                lastSentNrpnNumber[channel - 1] = output.number;
+            }
+            if (! isSelected || ! isMsbUnchanged (output, slot)) {
+                midiMessages.addEvent (juce::MidiMessage::controllerEvent (channel, dataEntryMsbCC, msb), sampleOffset);
+            }
+            midiMessages.addEvent (juce::MidiMessage::controllerEvent (channel, dataEntryLsbCC, lsb), sampleOffset);
+            break;
+        }
+
+        case pitchBend:
+            midiMessages.addEvent (juce::MidiMessage::pitchWheel (channel, output.value), sampleOffset);
+            break;
+
+        default:
+            midiMessages.addEvent (juce::MidiMessage::controllerEvent (channel, output.number & 0x7f, output.value), sampleOffset);
+            break;
+    }
+
+    lastSentKey[slot] = getSentKey (output.outputType, output.value);
+}
+
+void CCOutputScheduler::flush (juce::MidiBuffer& midiMessages, int numSamples, double sampleRate)
+{
+    const bool unlimited = (budgetBytesPerSecond == 0 || sampleRate <= 0);
+
+    if (! unlimited) {
+        // Top up the budget for the time this block covers.
+        // Allow a burst of up to 20ms worth, and at least one of any output.
+        const double blockBytes = budgetBytesPerSecond * numSamples / sampleRate;
+        const double maxBurst = juce::jmax ((double) maxBytesPerOutput, budgetBytesPerSecond * 0.02);
+        for (int i = 0; i < CBR_CCSCHEDULER_NUM_CHANNELS; i++) {
+            budgetTokens[i] = juce::jmin (budgetTokens[i] + blockBytes, maxBurst);
+        }
+
+        // Everything else on the port uses up budget first.
+        for (const juce::MidiMessageMetadata metadata : midiMessages) {
+            const juce::uint8 status = metadata.data[0];
+            if (status < 0xf0) {
+                getBudgetTokens ((status & 0x0f) + 1) -= metadata.numBytes;
+            }
+            else if (budgetPerChannel) {
+                // System messages (e.g. clock) hold up every channel on the port.
+                for (int i = 0; i < CBR_CCSCHEDULER_NUM_CHANNELS; i++) {
+                    budgetTokens[i] -= metadata.numBytes;
+                }
+            }
+            else {
+                budgetTokens[0] -= metadata.numBytes;
+            }
+        }
+    }
+
+    // Highest priority first.
+    std::sort (pendingSlots, pendingSlots + numPending, [this] (int a, int b) {
+        return pending[a].priority > pending[b].priority;
+    });
+
+    int numStillPending = 0;
+    for (int i = 0; i < numPending; i++) {
+        const int slot = pendingSlots[i];
+        PendingOutput& output = pending[slot];
+        const int channel = (slot / CBR_CCSCHEDULER_SLOTS_PER_CHANNEL) + 1;
+
+        // May have been superseded by the value already sent.
+        if (getSentKey (output.outputType, output.value) == lastSentKey[slot]) {
+            messagesSaved++;
+            output.isPending = false;
+            continue;
+        }
+
+        if (! unlimited) {
+            const int numBytes = getNumBytes (output, slot, channel);
+            double& tokens = getBudgetTokens (channel);
+            if (tokens < numBytes) {
+                // Over budget - wait for the next block, and send at the start of it.
+                output.sampleOffset = 0;
+                output.priority += waitingPriorityPerBlock;
+                pendingSlots[numStillPending++] = slot;
+                continue;
+            }
+            tokens -= numBytes;
+        }
+
+        sendOutput (midiMessages, output, slot, channel, juce::jlimit (0, juce::jmax (0, numSamples - 1), output.sampleOffset));
+        output.isPending = false;
+    }
+
+    numPending = numStillPending;
+}
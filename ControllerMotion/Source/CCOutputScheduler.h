@@ -0,0 +1,161 @@
+/*
+  ==============================================================================
+
+    CCOutputScheduler.h
+    Bandwidth-budgeted CC output for slow MIDI ports (e.g. 5-pin DIN).
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+// Per channel: one slot per CC number, one per NRPN number (0-127), and one for pitch bend.
+#define CBR_CCSCHEDULER_NUM_CHANNELS 16
+#define CBR_CCSCHEDULER_SLOTS_PER_CHANNEL (128 + 128 + 1)
+#define CBR_CCSCHEDULER_NUM_SLOTS (CBR_CCSCHEDULER_NUM_CHANNELS * CBR_CCSCHEDULER_SLOTS_PER_CHANNEL)
+// Full 5-pin DIN MIDI bandwidth: 31250 baud, 10 bits per byte.
+#define CBR_CCSCHEDULER_DIN_BYTES_PER_SECOND 3125
+
+//==============================================================================
+/**
+ * Collects controller output for a block and sends it within a bytes-per-second budget.
+ *
+ * Supports 7-bit CC, 14-bit CC (MSB/LSB pair), NRPN and channel pitch bend.
+ *
+ * - A new value for a controller that is still waiting replaces the old one (coalesced).
+ * - A value that matches the last value sent for that controller is dropped.
+ * - For 14-bit CC and NRPN, the MSB is only sent when it changes.
+ * - When the budget is short, the highest priority CCs go first and the rest wait
+ *   for the next block. Waiting CCs gain priority each block, so none wait forever.
+ *
+ * Fixed-size storage, so nothing is allocated while processing.
+*/
+class CCOutputScheduler
+{
+public:
+    enum OutputType
+    {
+        cc7Bit = 0,
+        cc14Bit,
+        nrpn,
+        pitchBend,
+        numOutputTypes
+    };
+
+    static juce::StringArray getOutputTypeChoices ()
+    {
+        return juce::StringArray( {"CC", "14-bit CC", "NRPN", "Pitch bend"} );
+    }
+
+    /**
+     * Resolution of each output type, e.g. 127 for 7-bit CC.
+    */
+    static int getMaxValue (int outputType)
+    {
+        return (outputType == cc7Bit) ? 127 : 16383;
+    }
+
+    CCOutputScheduler ();
+
+    /**
+     * Forget waiting CCs and last sent values, e.g. before playback starts.
+    */
+    void reset ();
+
+    /**
+     * @param bytesPerSecond Output budget, or 0 for unlimited.
+     * @param perChannel True to give each MIDI channel its own budget, false to share one budget for the port.
+    */
+    void setBudget (int bytesPerSecond, bool perChannel);
+
+    /**
+     * Queue a CC for output in the current block.
+     *
+     * @param channel MIDI channel, 1-16.
+     * @param controllerNumber CC number, 0-127.
+     * @param value CC value, 0-127.
+     * @param sampleOffset Position in the current block to send at, if within budget.
+     * @param priority Higher priority CCs are sent first when over budget.
+    */
+    void queueCC (int channel, int controllerNumber, int value, int sampleOffset, double priority)
+    {
+        queueOutput (cc7Bit, channel, controllerNumber, value, sampleOffset, priority);
+    }
+
+    /**
+     * Queue a controller value of any output type for output in the current block.
+     *
+     * @param outputType One of OutputType.
+     * @param channel MIDI channel, 1-16.
+     * @param number CC number (MSB CC number 0-31 for 14-bit), or NRPN number. Ignored for pitch bend.
+     * @param value Value, 0 to getMaxValue().
+     * @param sampleOffset Position in the current block to send at, if within budget.
+     * @param priority Higher priority outputs are sent first when over budget.
+    */
+    void queueOutput (int outputType, int channel, int number, int value, int sampleOffset, double priority);
+
+    /**
+     * Forget the last value sent for a controller, so the next value queued is sent even if it repeats.
+    */
+    void invalidate (int outputType, int channel, int number);
+
+    /**
+     * Send queued CCs that fit in the budget for this block.
+     * Other events already in the buffer (e.g. notes passing through) count towards the budget.
+     *
+     * @param midiMessages Output buffer for the block.
+     * @param numSamples Length of the block.
+     * @param sampleRate Current sample rate.
+    */
+    void flush (juce::MidiBuffer& midiMessages, int numSamples, double sampleRate);
+
+    /**
+     * Number of messages not sent because they were coalesced or redundant.
+     * Safe to call from any thread.
+    */
+    juce::int64 getNumMessagesSaved () const { return messagesSaved.load(); }
+
+    /**
+     * Number of outputs waiting for budget. Call from the audio thread.
+    */
+    int getNumMessagesWaiting () const { return numPending; }
+
+private:
+    struct PendingOutput
+    {
+        int outputType;
+        int number;
+        int value;
+        int sampleOffset;
+        double priority;
+        bool isPending;
+    };
+
+    static int getSentKey (int outputType, int value) { return (outputType << 16) | value; }
+    static int getSlot (int outputType, int channel, int number);
+    bool isMsbUnchanged (const PendingOutput& output, int slot) const;
+    double& getBudgetTokens (int channel);
+    int getNumBytes (const PendingOutput& output, int slot, int channel) const;
+    void sendOutput (juce::MidiBuffer& midiMessages, const PendingOutput& output, int slot, int channel, int sampleOffset);
+
+    PendingOutput pending[CBR_CCSCHEDULER_NUM_SLOTS];
+    // Slot indices of waiting CCs, the first numPending are valid.
+    int pendingSlots[CBR_CCSCHEDULER_NUM_SLOTS];
+    int numPending;
+
+    // Output type and value last sent for each slot (see getSentKey()), or -1.
+    int lastSentKey[CBR_CCSCHEDULER_NUM_SLOTS];
+    // Last NRPN number selected on each channel, or -1.
+    int lastSentNrpnNumber[CBR_CCSCHEDULER_NUM_CHANNELS];
+
+    int budgetBytesPerSecond;
+    bool budgetPerChannel;
+    // Available bytes, per channel or (index 0) for the port.
+    double budgetTokens[CBR_CCSCHEDULER_NUM_CHANNELS];
+
+    std::atomic<juce::int64> messagesSaved;
+
+    JUCE_DECLARE_NON_COPYABLE (CCOutputScheduler)
+};
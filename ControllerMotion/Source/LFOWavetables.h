@@ -0,0 +1,142 @@
+/*
+  ==============================================================================
+
+    LFOWavetables.h
+    Wavetables for ControllerMotion LFO lanes, locked to the phrase.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "../../Common/LayoutConfig.h"
+
+// Number of segments in each wavetable, the same as the layout file's user table.
+#define CBR_LFO_TABLE_SIZE CBR_LAYOUT_LFO_TABLE_SIZE
+
+//==============================================================================
+/**
+ * Precomputed, normalised LFO cycles.
+ *
+ * Each table maps the phase of one cycle, 0-1, to output 0-1. Cycles are
+ * counted from the phrase boundary, so every phrase modulates the same way.
+ * Evaluating a lane is a table read and a lerp, whatever the shape, so all
+ * the lanes are evaluated together in one loop.
+*/
+class LFOWavetables
+{
+public:
+    enum Shape
+    {
+        // The lane ramps to its target, without an LFO.
+        off = 0,
+        sine,
+        triangle,
+        sawUp,
+        sawDown,
+        square,
+        // One value per cycle, the same sequence every phrase.
+        randomHold,
+        // The `lfoTable` from the layout file.
+        userTable,
+        numShapes
+    };
+
+    static juce::StringArray getShapeChoices ()
+    {
+        return juce::StringArray( {"Off", "Sine", "Triangle", "Saw up", "Saw down", "Square", "Random hold", "User table"} );
+    }
+
+    static juce::StringArray getRateChoices ()
+    {
+        return juce::StringArray( {"4 phrases", "2 phrases", "1 phrase", "1/2 phrase", "1/4 phrase", "1/8 phrase", "1/16 phrase", "1/32 phrase"} );
+    }
+
+    /**
+     * Position in the LFO's cycles for a rate choice, from the phrase boundary -
+     * or for rates slower than a phrase, from every 2nd or 4th boundary.
+     *
+     * @param rate One of the rate choices.
+     * @param phraseIndex The current phrase.
+     * @param phrasePosition Position in the current phrase, 0-1.
+     * @return Cycles since the LFO's phase was reset.
+    */
+    static double getCycles (int rate, juce::int64 phraseIndex, double phrasePosition)
+    {
+        // 4 phrases per cycle up to 32 cycles per phrase, doubling each choice.
+        const int shift = juce::jlimit (0, 7, rate) - 2;
+        if (shift >= 0) {
+            return phrasePosition * (1 << shift);
+        }
+
+        const int phrasesPerCycle = 1 << -shift;
+        const juce::int64 phraseInCycle = ((phraseIndex % phrasesPerCycle) + phrasesPerCycle) % phrasesPerCycle;
+        return (phraseInCycle + phrasePosition) / phrasesPerCycle;
+    }
+
+    /**
+     * Shared tables, built on first use.
+     * Call from the message thread (e.g. processor constructor) before playback.
+    */
+    static const LFOWavetables& getInstance ()
+    {
+        static const LFOWavetables wavetables;
+        return wavetables;
+    }
+
+    /**
+     * Evaluate the LFO for several lanes at once.
+     *
+     * @param shapes One of Shape for each lane.
+     * @param cycles Position for each lane, see getCycles().
+     * @param userWavetable The layout's user table, CBR_LFO_TABLE_SIZE + 1 values.
+     * @param numLanes Number of lanes.
+     * @param values LFO output for each lane, 0-1. Lanes that are off get 0.
+    */
+    void getValues (const int* shapes, const double* cycles, const float* userWavetable, int numLanes, double* values) const
+    {
+        for (int lane = 0; lane < numLanes; lane++) {
+            const int shape = shapes[lane];
+            const int cycle = (int) cycles[lane];
+            const double position = (cycles[lane] - cycle) * CBR_LFO_TABLE_SIZE;
+            const int index = juce::jlimit (0, CBR_LFO_TABLE_SIZE - 1, (int) position);
+
+            if (shape == randomHold) {
+                values[lane] = randomSteps[cycle & (CBR_LFO_TABLE_SIZE - 1)];
+                continue;
+            }
+
+            const float* table = (shape == userTable) ? userWavetable : tables[juce::jlimit (0, numShapes - 1, shape)];
+            const double fraction = position - index;
+            values[lane] = table[index] + fraction * (table[index + 1] - table[index]);
+        }
+    }
+
+private:
+    LFOWavetables ()
+    {
+        for (int i = 0; i <= CBR_LFO_TABLE_SIZE; i++) {
+            const double t = (double) i / CBR_LFO_TABLE_SIZE;
+
+            // Every cycle starts from the bottom, except saw down and square.
+            tables[off][i] = 0.0f;
+            tables[sine][i] = (float) (0.5 - 0.5 * std::cos (juce::MathConstants<double>::twoPi * t));
+            tables[triangle][i] = (float) (1.0 - std::abs (2.0 * t - 1.0));
+            tables[sawUp][i] = (float) t;
+            tables[sawDown][i] = (float) (1.0 - t);
+            tables[square][i] = t < 0.5 ? 1.0f : 0.0f;
+            tables[randomHold][i] = 0.0f;
+            tables[userTable][i] = 0.0f;
+        }
+
+        // A fixed seed, so bounces and replays get the same steps.
+        juce::Random random (0x4c464f);
+        for (int i = 0; i < CBR_LFO_TABLE_SIZE; i++) {
+            randomSteps[i] = random.nextFloat();
+        }
+    }
+
+    float tables[numShapes][CBR_LFO_TABLE_SIZE + 1];
+    float randomSteps[CBR_LFO_TABLE_SIZE];
+};
@@ -0,0 +1,82 @@
+/*
+  ==============================================================================
+
+    LaneRamp.h
+    One ControllerMotion lane's ramp to its target on the next phrase boundary.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "../../Common/PhraseClock.h"
+#include "RampCurves.h"
+
+//==============================================================================
+/**
+ * A ramp from a start value, at a position in the phrase, to a target at the
+ * end of the phrase, along one of the RampCurves shapes.
+ *
+ * Shared with Tools/EnduranceCheck, so the check evaluates ramps exactly as
+ * the plugin does.
+*/
+struct LaneRamp
+{
+    /**
+     * @param newStartValue Lane value at the start of the ramp, 0-1.
+     * @param newStartPosition Phrase position the ramp starts from, 0-1.
+     * @param newTarget Lane value on the next phrase boundary, 0-1.
+    */
+    void start (double newStartValue, double newStartPosition, double newTarget)
+    {
+        startValue = newStartValue;
+        startPosition = newStartPosition;
+        target = newTarget;
+    }
+
+    /**
+     * Evaluate the ramp at a phrase position.
+     *
+     * @param shape One of RampCurves::Shape.
+     * @param phrasePosition Position in the current phrase, 0-1.
+     * @param clock The phrase clock, for the beats of stepped curves.
+     * @param timeSigDenominator Time signature denominator the beats are counted in.
+     * @return The lane value, 0-1.
+    */
+    double getValue (int shape, double phrasePosition, const PhraseClock& clock, int timeSigDenominator) const
+    {
+        // Stepped curves hold each value for a beat.
+        // Include half a sample so the step lands on the sample nearest the beat.
+        if (shape == RampCurves::steppedBeats) {
+            double beatsPerPhrase = (double) clock.getPhraseLengthTicks() / PhraseClock::getBeatTicks(timeSigDenominator);
+            double halfSample = clock.getPhrasesPerSample() * 0.5;
+            phrasePosition = std::floor((phrasePosition + halfSample) * beatsPerPhrase) / beatsPerPhrase;
+        }
+
+        double rampLength = 1.0 - startPosition;
+        double progress = 1.0;
+        if (rampLength > 0) {
+            progress = (phrasePosition - startPosition) / rampLength;
+        }
+
+        double curve = RampCurves::getInstance().getValue(shape, progress);
+        return startValue + curve * (target - startValue);
+    }
+
+    /**
+     * A lane value at an output resolution.
+     *
+     * @param value Lane value, 0-1.
+     * @param maxValue Largest output value, e.g. 127 or 16383.
+     * @return The value to send.
+    */
+    static int getOutputValue (double value, int maxValue)
+    {
+        return juce::jlimit(0, maxValue, juce::roundToInt(value * maxValue));
+    }
+
+    double startValue = 0;
+    double startPosition = 0;
+    double target = 0;
+};
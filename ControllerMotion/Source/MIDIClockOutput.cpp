@@ -0,0 +1,95 @@
+/*
+  ==============================================================================
+
+    MIDIClockOutput.cpp
+    MIDI clock, song position and phrase start output, on the phrase grid.
+
+  ==============================================================================
+*/
+
+#include "MIDIClockOutput.h"
+
+// Song position pointer is 14 bits.
+static const int maxSongPosition = 16383;
+
+MIDIClockOutput::MIDIClockOutput ()
+{
+    isRunning = false;
+    needsResync = true;
+    nextBlockTime = 0;
+    nextClock = 0;
+}
+
+void MIDIClockOutput::requestResync ()
+{
+    needsResync = true;
+}
+
+void MIDIClockOutput::process (const PhraseClock& phraseClock, double ppqPosition, double tempoBpm, double sampleRate,
+                               juce::int64 blockTime, int numSamples, bool isPlaying,
+                               bool clockEnabled, int markerCCNumber, int markerChannel,
+                               juce::MidiBuffer& midiMessages)
+{
+    if (isPlaying && markerCCNumber > 0) {
+        const int phraseStart = phraseClock.getPhraseStartInBlock(blockTime, numSamples);
+        if (phraseStart >= 0) {
+            midiMessages.addEvent(juce::MidiMessage::controllerEvent(markerChannel, markerCCNumber, 127), phraseStart);
+        }
+    }
+
+    if (! isPlaying || ! clockEnabled || tempoBpm <= 0 || sampleRate <= 0) {
+        if (isRunning) {
+            midiMessages.addEvent(juce::MidiMessage::midiStop(), 0);
+            isRunning = false;
+        }
+        return;
+    }
+
+    // The song position in clock ticks. The clock counts from the start of the song, not the phrase grid.
+    const double blockClocks = ppqPosition * CBR_MIDICLOCK_PPQN;
+
+    // Start, or follow a seek or loop - in samples, or in the song position,
+    // allowing for waiting up to a sixteenth to resume.
+    const bool jumped = blockTime != nextBlockTime
+        || blockClocks - nextClock > 1.0
+        || nextClock - blockClocks > CBR_MIDICLOCK_CLOCKS_PER_SPP_BEAT + 1.0;
+    if (! isRunning || needsResync || jumped) {
+        startClock(blockClocks, midiMessages);
+    }
+    nextBlockTime = blockTime + numSamples;
+
+    // Each tick on the sample nearest its time at this block's tempo.
+    // A tick the last block ended just before goes at the start of this one.
+    const double samplesPerClock = sampleRate * 60.0 / (tempoBpm * CBR_MIDICLOCK_PPQN);
+    while (true) {
+        const int offset = juce::jmax(0, (int) std::floor((nextClock - blockClocks) * samplesPerClock + 0.5));
+        if (offset >= numSamples) {
+            break;
+        }
+        midiMessages.addEvent(juce::MidiMessage::midiClock(), offset);
+        nextClock++;
+    }
+}
+
+/**
+ * Send the song position and Start/Continue, to resume on the next sixteenth -
+ * the finest position a song position pointer can give.
+*/
+void MIDIClockOutput::startClock (double blockClocks, juce::MidiBuffer& midiMessages)
+{
+    if (isRunning) {
+        midiMessages.addEvent(juce::MidiMessage::midiStop(), 0);
+    }
+
+    const juce::int64 firstClock = juce::jmax((juce::int64) 0, (juce::int64) std::ceil(blockClocks));
+    const juce::int64 sixteenth = juce::jlimit((juce::int64) 0, (juce::int64) maxSongPosition,
+        (firstClock + CBR_MIDICLOCK_CLOCKS_PER_SPP_BEAT - 1) / CBR_MIDICLOCK_CLOCKS_PER_SPP_BEAT);
+    // Past the last song position, carry on from here.
+    nextClock = juce::jmax(firstClock, sixteenth * CBR_MIDICLOCK_CLOCKS_PER_SPP_BEAT);
+
+    midiMessages.addEvent(juce::MidiMessage::songPositionPointer((int) sixteenth), 0);
+    midiMessages.addEvent(sixteenth == 0 ? juce::MidiMessage::midiStart() : juce::MidiMessage::midiContinue(), 0);
+
+    isRunning = true;
+    needsResync = false;
+}
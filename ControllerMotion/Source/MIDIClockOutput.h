@@ -0,0 +1,78 @@
+/*
+  ==============================================================================
+
+    MIDIClockOutput.h
+    MIDI clock, song position and phrase start output, on the phrase grid.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "../../Common/PhraseClock.h"
+
+// MIDI clock resolution.
+#define CBR_MIDICLOCK_PPQN 24
+// Song position pointer counts sixteenth notes - 6 clocks each.
+#define CBR_MIDICLOCK_CLOCKS_PER_SPP_BEAT 6
+
+//==============================================================================
+/**
+ * Sends MIDI clock for outboard sequencers, following the host's song position.
+ *
+ * Each tick is placed from the host's ppq position at the start of the block,
+ * on the sample nearest its exact time, whatever the block size. Ticks are
+ * counted, never re-placed, so a tempo change carries on from the last tick
+ * sent and the count stays with the host's song position.
+ *
+ * When playback starts, or jumps (seek, loop), the clock sends a song position
+ * pointer and Start/Continue, and resumes on the next sixteenth. Stop is sent
+ * when playback stops.
+ *
+ * A phrase start marker CC can be sent on each boundary. The marker, like the
+ * clock, goes straight into the block's MIDI rather than through the CC
+ * output scheduler, so it's never delayed - but it is counted against the
+ * scheduler's budget, which runs afterwards.
+*/
+class MIDIClockOutput
+{
+public:
+    MIDIClockOutput ();
+
+    /**
+     * Send song position and Start/Continue again on the next block, e.g. after
+     * (re)starting, as the receiving device may have reset.
+    */
+    void requestResync ();
+
+    /**
+     * Add the clock, transport and marker messages for a block.
+     *
+     * @param phraseClock The plugin's phrase clock, for phrase start markers.
+     * @param ppqPosition Host song position at the start of the block, in quarter notes.
+     * @param tempoBpm Host tempo.
+     * @param sampleRate Current sample rate.
+     * @param blockTime Sample time of the start of the block.
+     * @param numSamples Length of the block.
+     * @param isPlaying Whether the transport is playing.
+     * @param clockEnabled Whether to send clock and transport messages.
+     * @param markerCCNumber CC to send with value 127 on each phrase start, or 0 for none.
+     * @param markerChannel Channel for the phrase start CC.
+     * @param midiMessages Output for the block.
+    */
+    void process (const PhraseClock& phraseClock, double ppqPosition, double tempoBpm, double sampleRate,
+                  juce::int64 blockTime, int numSamples, bool isPlaying,
+                  bool clockEnabled, int markerCCNumber, int markerChannel,
+                  juce::MidiBuffer& midiMessages);
+
+private:
+    void startClock (double blockClocks, juce::MidiBuffer& midiMessages);
+
+    bool isRunning;
+    bool needsResync;
+    // Where the next block starts if playback carries straight on.
+    juce::int64 nextBlockTime;
+    // Index of the next clock tick to send, counted from the start of the song.
+    juce::int64 nextClock;
+};
@@ -0,0 +1,106 @@
+/*
+  ==============================================================================
+
+    PhraseFeedback.cpp
+    Change-driven phrase position/length output for controller LEDs and meters.
+
+  ==============================================================================
+*/
+
+#include "PhraseFeedback.h"
+
+// Minimum time between resends of unchanged targets after a re-sync.
+static const double resendIntervalSeconds = 0.02;
+
+PhraseFeedback::PhraseFeedback ()
+{
+    for (int i = 0; i < CBR_FEEDBACK_NUM_TARGETS; i++) {
+        lastSentValue[i] = -1;
+        lastSentCC[i] = 0;
+        lastSentChannel[i] = 0;
+        needsResend[i] = false;
+    }
+
+    secondsSinceResend = resendIntervalSeconds;
+}
+
+void PhraseFeedback::requestResync ()
+{
+    for (int i = 0; i < CBR_FEEDBACK_NUM_TARGETS; i++) {
+        needsResend[i] = true;
+    }
+}
+
+int PhraseFeedback::encode (const Target& target, const PhraseInfo& info)
+{
+    const int segments = juce::jmax (1, target.segments);
+
+    if (target.source == phraseLength) {
+        switch (target.encoding) {
+            case ledMeter:
+                return (int) (juce::jlimit (0, segments, info.lengthChoice) * 127.0 / segments);
+            default:
+                return juce::jlimit (0, 127, juce::roundToInt (info.beatsPerPhrase));
+        }
+    }
+
+    // Phrase position only moves while playing.
+    if (! info.isPlaying) {
+        return -1;
+    }
+
+    switch (target.encoding) {
+        case ledMeter: {
+            const int lit = juce::jmin (segments, (int) (info.position * (segments + 1)));
+            return (int) (lit * 127.0 / segments);
+        }
+        case beatCountdown: {
+            const double beatsLeft = std::ceil ((1.0 - info.position) * info.beatsPerPhrase);
+            return juce::jlimit (0, 127, (int) beatsLeft);
+        }
+        default:
+            return juce::MidiMessage::floatValueToMidiByte ((float) info.position);
+    }
+}
+
+void PhraseFeedback::process (const Target* targets, const PhraseInfo& info, int numSamples, double sampleRate, CCOutputScheduler& scheduler)
+{
+    if (sampleRate > 0) {
+        secondsSinceResend += numSamples / sampleRate;
+    }
+
+    for (int i = 0; i < CBR_FEEDBACK_NUM_TARGETS; i++) {
+        const Target& target = targets[i];
+        if (target.ccNumber == 0) {
+            continue;
+        }
+
+        const int value = encode (target, info);
+        if (value < 0) {
+            continue;
+        }
+
+        // Retargeted - treat as a new display.
+        const bool retargeted = (target.ccNumber != lastSentCC[i] || target.channel != lastSentChannel[i]);
+        const bool changed = retargeted || (value != lastSentValue[i]);
+
+        bool resend = false;
+        if (! changed && needsResend[i] && secondsSinceResend >= resendIntervalSeconds) {
+            resend = true;
+            secondsSinceResend = 0;
+        }
+
+        if (changed || resend) {
+            // The scheduler drops repeats, make sure it sends this one.
+            if (resend || retargeted) {
+                scheduler.invalidate (CCOutputScheduler::cc7Bit, target.channel, target.ccNumber);
+            }
+            scheduler.queueCC (target.channel, target.ccNumber, value, 0, 0.0);
+
+            lastSentValue[i] = value;
+            lastSentCC[i] = target.ccNumber;
+            lastSentChannel[i] = target.channel;
+            needsResend[i] = false;
+        }
+    }
+}
@@ -0,0 +1,108 @@
+/*
+  ==============================================================================
+
+    PhraseFeedback.h
+    Change-driven phrase position/length output for controller LEDs and meters.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "CCOutputScheduler.h"
+
+// Number of feedback targets per instance.
+// The first two use the original phrase position/length CC and channel params.
+#define CBR_FEEDBACK_NUM_TARGETS 4
+
+//==============================================================================
+/**
+ * Encodes phrase info for controller displays, and only sends a target's CC when
+ * its encoded value changes.
+ *
+ * On re-sync (e.g. transport start) every target is resent, but no more than one
+ * target per resend interval, so a controller that has just woken up isn't flooded.
+*/
+class PhraseFeedback
+{
+public:
+    enum Source
+    {
+        phrasePosition = 0,
+        phraseLength
+    };
+
+    enum Encoding
+    {
+        // Position 0-1 over CC 0-127, or length in beats.
+        linear = 0,
+        // Number of segments lit, for N-segment LED meters.
+        ledMeter,
+        // Beats left in the phrase, or length in beats.
+        beatCountdown
+    };
+
+    static juce::StringArray getSourceChoices ()
+    {
+        return juce::StringArray( {"Phrase position", "Phrase length"} );
+    }
+
+    static juce::StringArray getEncodingChoices ()
+    {
+        return juce::StringArray( {"Linear", "LED meter", "Beat countdown"} );
+    }
+
+    struct Target
+    {
+        int source;
+        int encoding;
+        int segments;
+        // CC 0 disables the target.
+        int ccNumber;
+        int channel;
+    };
+
+    struct PhraseInfo
+    {
+        double position;
+        bool isPlaying;
+        // Index of the phrase length choice param, lit segments for length LED meters.
+        int lengthChoice;
+        double beatsPerPhrase;
+    };
+
+    PhraseFeedback ();
+
+    /**
+     * Resend all targets, rate limited. Call when the receiver may be out of sync.
+    */
+    void requestResync ();
+
+    /**
+     * Encode each target and queue CCs for targets that have changed or need resending.
+     *
+     * @param targets Target config, CBR_FEEDBACK_NUM_TARGETS entries.
+     * @param info Phrase info at the start of the block.
+     * @param numSamples Length of the block.
+     * @param sampleRate Current sample rate.
+     * @param scheduler CC output.
+    */
+    void process (const Target* targets, const PhraseInfo& info, int numSamples, double sampleRate, CCOutputScheduler& scheduler);
+
+    /**
+     * Encode phrase info for a target.
+     *
+     * @return CC value 0-127, or -1 if there's nothing to send (e.g. position while stopped).
+    */
+    static int encode (const Target& target, const PhraseInfo& info);
+
+private:
+    int lastSentValue[CBR_FEEDBACK_NUM_TARGETS];
+    int lastSentCC[CBR_FEEDBACK_NUM_TARGETS];
+    int lastSentChannel[CBR_FEEDBACK_NUM_TARGETS];
+    bool needsResend[CBR_FEEDBACK_NUM_TARGETS];
+
+    // Time since the last rate-limited resend.
+    double secondsSinceResend;
+};
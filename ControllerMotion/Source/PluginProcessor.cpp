@@ -27,9 +27,25 @@ MIDIControllerMotionAudioProcessor::MIDIControllerMotionAudioProcessor()
                 std::make_unique<juce::AudioParameterChoice> (
                     "phraseBeats", // parameterID
                     "Phrase length", // parameter name
-                    juce::StringArray( {"1 beat", "4 beats", "8 beats", "16 beats", "32 beats", "64 beats"} ),
+                    PhraseClock::getPhraseChoices(),
                     2 // default index
                 ),
+                // Phrase length for the "Custom beats" and "Custom bars" phrase options.
+                std::make_unique<juce::AudioParameterInt> (
+                    "phraseLength", // parameterID
+                    "Custom phrase length", // parameter name
+                    1,
+                    CBR_PHRASECLOCK_MAX_LENGTH,
+                    8
+                ),
+                // Shift the phrase grid later by a number of beats from the bar.
+                std::make_unique<juce::AudioParameterInt> (
+                    "phraseOffset", // parameterID
+                    "Phrase offset (beats)", // parameter name
+                    0,
+                    CBR_PHRASECLOCK_MAX_LENGTH - 1,
+                    0
+                ),
             
             // Moving CC parameters. The number of these params should match CBR_CCMOTION_NUM_PARAMS constant.
                 std::make_unique<juce::AudioParameterFloat> (
@@ -52,6 +68,58 @@ MIDIControllerMotionAudioProcessor::MIDIControllerMotionAudioProcessor()
                     "Target 4", // parameter name
                     0.0, 1.0, 0.0
                 ),
+
+                // Ramp curve shape for each moving CC.
+                std::make_unique<juce::AudioParameterChoice> (
+                    "curve1", // parameterID
+                    "Curve 1", // parameter name
+                    RampCurves::getShapeChoices(),
+                    0
+                ),
+                std::make_unique<juce::AudioParameterChoice> (
+                    "curve2", // parameterID
+                    "Curve 2", // parameter name
+                    RampCurves::getShapeChoices(),
+                    0
+                ),
+                std::make_unique<juce::AudioParameterChoice> (
+                    "curve3", // parameterID
+                    "Curve 3", // parameter name
+                    RampCurves::getShapeChoices(),
+                    0
+                ),
+                std::make_unique<juce::AudioParameterChoice> (
+                    "curve4", // parameterID
+                    "Curve 4", // parameter name
+                    RampCurves::getShapeChoices(),
+                    0
+                ),
+
+                // Output message type for each moving CC - 7-bit CC, 14-bit CC, NRPN or pitch bend.
+                std::make_unique<juce::AudioParameterChoice> (
+                    "outputMode1", // parameterID
+                    "Output 1", // parameter name
+                    CCOutputScheduler::getOutputTypeChoices(),
+                    0
+                ),
+                std::make_unique<juce::AudioParameterChoice> (
+                    "outputMode2", // parameterID
+                    "Output 2", // parameter name
+                    CCOutputScheduler::getOutputTypeChoices(),
+                    0
+                ),
+                std::make_unique<juce::AudioParameterChoice> (
+                    "outputMode3", // parameterID
+                    "Output 3", // parameter name
+                    CCOutputScheduler::getOutputTypeChoices(),
+                    0
+                ),
+                std::make_unique<juce::AudioParameterChoice> (
+                    "outputMode4", // parameterID
+                    "Output 4", // parameter name
+                    CCOutputScheduler::getOutputTypeChoices(),
+                    0
+                ),
             
                 std::make_unique<juce::AudioParameterInt> (
                     "firstCCNumber", // parameterID
@@ -67,6 +135,13 @@ MIDIControllerMotionAudioProcessor::MIDIControllerMotionAudioProcessor()
                     16,
                     1
                 ),
+                // Quantise CC output to a note grid, locked to the phrase.
+                std::make_unique<juce::AudioParameterChoice> (
+                    "ccGrid", // parameterID
+                    "CC grid", // parameter name
+                    juce::StringArray( {"Off", "1/4", "1/8", "1/16", "1/32"} ),
+                    0 // default index
+                ),
 
                 // Config parameters for outputing phrase position and length.
                 // This allows showing phrase info in LED displays or VU meters etc.
@@ -88,7 +163,7 @@ MIDIControllerMotionAudioProcessor::MIDIControllerMotionAudioProcessor()
                     16
                 ),
                 // Output phrase length in as a CC value.
-                // TBD how this value is encoded - targeting a 7-LED VU meter on Traktor Kontrol S4.
+                // Encoded as a 7-LED VU meter by default, e.g. for Traktor Kontrol S4.
                 // Specify CC=0 to disable.
                  std::make_unique<juce::AudioParameterInt> (
                     "outPhraseLengthCCNumber", 
@@ -105,16 +180,348 @@ MIDIControllerMotionAudioProcessor::MIDIControllerMotionAudioProcessor()
                     16
                 ),
 
+                // Phrase feedback targets - encoding and source for each.
+                // Targets 1 and 2 use the phrase position/length CC and channel params above.
+                std::make_unique<juce::AudioParameterChoice> (
+                    "feedbackSource1",
+                    "Feedback 1 - Source",
+                    PhraseFeedback::getSourceChoices(),
+                    0
+                ),
+                std::make_unique<juce::AudioParameterChoice> (
+                    "feedbackEncoding1",
+                    "Feedback 1 - Encoding",
+                    PhraseFeedback::getEncodingChoices(),
+                    0
+                ),
+                std::make_unique<juce::AudioParameterInt> (
+                    "feedbackSegments1",
+                    "Feedback 1 - LED segments",
+                    2,
+                    16,
+                    7
+                ),
+                std::make_unique<juce::AudioParameterChoice> (
+                    "feedbackSource2",
+                    "Feedback 2 - Source",
+                    PhraseFeedback::getSourceChoices(),
+                    1
+                ),
+                std::make_unique<juce::AudioParameterChoice> (
+                    "feedbackEncoding2",
+                    "Feedback 2 - Encoding",
+                    PhraseFeedback::getEncodingChoices(),
+                    1
+                ),
+                std::make_unique<juce::AudioParameterInt> (
+                    "feedbackSegments2",
+                    "Feedback 2 - LED segments",
+                    2,
+                    16,
+                    7
+                ),
+                std::make_unique<juce::AudioParameterChoice> (
+                    "feedbackSource3",
+                    "Feedback 3 - Source",
+                    PhraseFeedback::getSourceChoices(),
+                    0
+                ),
+                std::make_unique<juce::AudioParameterChoice> (
+                    "feedbackEncoding3",
+                    "Feedback 3 - Encoding",
+                    PhraseFeedback::getEncodingChoices(),
+                    0
+                ),
+                std::make_unique<juce::AudioParameterInt> (
+                    "feedbackSegments3",
+                    "Feedback 3 - LED segments",
+                    2,
+                    16,
+                    7
+                ),
+                // Specify CC=0 to disable.
+                std::make_unique<juce::AudioParameterInt> (
+                    "feedbackCCNumber3",
+                    "CC out - Feedback 3",
+                    0,
+                    127,
+                    0
+                ),
+                std::make_unique<juce::AudioParameterInt> (
+                    "feedbackChannel3",
+                    "Ch out - Feedback 3",
+                    1,
+                    16,
+                    16
+                ),
+                std::make_unique<juce::AudioParameterChoice> (
+                    "feedbackSource4",
+                    "Feedback 4 - Source",
+                    PhraseFeedback::getSourceChoices(),
+                    0
+                ),
+                std::make_unique<juce::AudioParameterChoice> (
+                    "feedbackEncoding4",
+                    "Feedback 4 - Encoding",
+                    PhraseFeedback::getEncodingChoices(),
+                    0
+                ),
+                std::make_unique<juce::AudioParameterInt> (
+                    "feedbackSegments4",
+                    "Feedback 4 - LED segments",
+                    2,
+                    16,
+                    7
+                ),
+                // Specify CC=0 to disable.
+                std::make_unique<juce::AudioParameterInt> (
+                    "feedbackCCNumber4",
+                    "CC out - Feedback 4",
+                    0,
+                    127,
+                    0
+                ),
+                std::make_unique<juce::AudioParameterInt> (
+                    "feedbackChannel4",
+                    "Ch out - Feedback 4",
+                    1,
+                    16,
+                    16
+                ),
+
+                // Limit CC output bytes per second, e.g. for 5-pin DIN hardware.
+                // Specify 0 for unlimited.
+                std::make_unique<juce::AudioParameterInt> (
+                    "ccBudget",
+                    "CC budget (bytes/s)",
+                    0,
+                    CBR_CCSCHEDULER_DIN_BYTES_PER_SECOND,
+                    0
+                ),
+                std::make_unique<juce::AudioParameterBool> (
+                    "ccBudgetPerChannel",
+                    "CC budget per channel",
+                    false
+                ),
+
+                // Address OSC cues to this instance, see CBR_OSC_PORT. 0 ignores cues.
+                std::make_unique<juce::AudioParameterInt> (
+                    "oscInstance", // parameterID
+                    "OSC instance", // parameter name
+                    0,
+                    CBR_OSC_MAX_INSTANCES,
+                    0
+                ),
+
+                // Take each lane's target from an incoming CC instead of its target param.
+                // Specify CC=0 to follow the target param.
+                std::make_unique<juce::AudioParameterInt> (
+                    "learnCCNumber1",
+                    "Learn CC - Target 1",
+                    0,
+                    127,
+                    0
+                ),
+                std::make_unique<juce::AudioParameterInt> (
+                    "learnChannel1",
+                    "Learn ch - Target 1",
+                    1,
+                    16,
+                    1
+                ),
+                std::make_unique<juce::AudioParameterInt> (
+                    "learnCCNumber2",
+                    "Learn CC - Target 2",
+                    0,
+                    127,
+                    0
+                ),
+                std::make_unique<juce::AudioParameterInt> (
+                    "learnChannel2",
+                    "Learn ch - Target 2",
+                    1,
+                    16,
+                    1
+                ),
+                std::make_unique<juce::AudioParameterInt> (
+                    "learnCCNumber3",
+                    "Learn CC - Target 3",
+                    0,
+                    127,
+                    0
+                ),
+                std::make_unique<juce::AudioParameterInt> (
+                    "learnChannel3",
+                    "Learn ch - Target 3",
+                    1,
+                    16,
+                    1
+                ),
+                std::make_unique<juce::AudioParameterInt> (
+                    "learnCCNumber4",
+                    "Learn CC - Target 4",
+                    0,
+                    127,
+                    0
+                ),
+                std::make_unique<juce::AudioParameterInt> (
+                    "learnChannel4",
+                    "Learn ch - Target 4",
+                    1,
+                    16,
+                    1
+                ),
+                // Learn the next incoming CC and channel for a lane.
+                std::make_unique<juce::AudioParameterChoice> (
+                    "midiLearn",
+                    "MIDI learn",
+                    juce::StringArray( {"Off", "Target 1", "Target 2", "Target 3", "Target 4"} ),
+                    0
+                ),
+
+                // LFO for each lane, on top of its ramp, locked to the phrase.
+                std::make_unique<juce::AudioParameterChoice> (
+                    "lfoShape1",
+                    "LFO 1",
+                    LFOWavetables::getShapeChoices(),
+                    0
+                ),
+                std::make_unique<juce::AudioParameterChoice> (
+                    "lfoRate1",
+                    "LFO 1 - Period",
+                    LFOWavetables::getRateChoices(),
+                    2
+                ),
+                std::make_unique<juce::AudioParameterFloat> (
+                    "lfoDepth1",
+                    "LFO 1 - Depth",
+                    0.0, 1.0, 0.5
+                ),
+                std::make_unique<juce::AudioParameterChoice> (
+                    "lfoShape2",
+                    "LFO 2",
+                    LFOWavetables::getShapeChoices(),
+                    0
+                ),
+                std::make_unique<juce::AudioParameterChoice> (
+                    "lfoRate2",
+                    "LFO 2 - Period",
+                    LFOWavetables::getRateChoices(),
+                    2
+                ),
+                std::make_unique<juce::AudioParameterFloat> (
+                    "lfoDepth2",
+                    "LFO 2 - Depth",
+                    0.0, 1.0, 0.5
+                ),
+                std::make_unique<juce::AudioParameterChoice> (
+                    "lfoShape3",
+                    "LFO 3",
+                    LFOWavetables::getShapeChoices(),
+                    0
+                ),
+                std::make_unique<juce::AudioParameterChoice> (
+                    "lfoRate3",
+                    "LFO 3 - Period",
+                    LFOWavetables::getRateChoices(),
+                    2
+                ),
+                std::make_unique<juce::AudioParameterFloat> (
+                    "lfoDepth3",
+                    "LFO 3 - Depth",
+                    0.0, 1.0, 0.5
+                ),
+                std::make_unique<juce::AudioParameterChoice> (
+                    "lfoShape4",
+                    "LFO 4",
+                    LFOWavetables::getShapeChoices(),
+                    0
+                ),
+                std::make_unique<juce::AudioParameterChoice> (
+                    "lfoRate4",
+                    "LFO 4 - Period",
+                    LFOWavetables::getRateChoices(),
+                    2
+                ),
+                std::make_unique<juce::AudioParameterFloat> (
+                    "lfoDepth4",
+                    "LFO 4 - Depth",
+                    0.0, 1.0, 0.5
+                ),
+
+                // MIDI clock for outboard sequencers, on the same grid as the phrases.
+                std::make_unique<juce::AudioParameterBool> (
+                    "midiClock",
+                    "MIDI clock out",
+                    false
+                ),
+                // Send a CC with value 127 on each phrase start.
+                // Specify CC=0 to disable.
+                std::make_unique<juce::AudioParameterInt> (
+                    "phraseMarkerCCNumber",
+                    "CC out - Phrase start",
+                    0,
+                    127,
+                    0
+                ),
+                std::make_unique<juce::AudioParameterInt> (
+                    "phraseMarkerChannel",
+                    "Ch out - Phrase start",
+                    1,
+                    16,
+                    16
+                ),
+
            } )
 #endif
 {
     tempoBpm = 120.0;
+    timeSigNumerator = 4;
+    timeSigDenominator = 4;
     lastBufferTimestamp = 0;
+    lastLaneUpdateTime = 0;
+    wasPlaying = false;
     
     // Assuming it's ok to just cast these to specific param type.
     phraseBeats = (juce::AudioParameterChoice*)parameters.getParameter("phraseBeats");
+    phraseLength = (juce::AudioParameterInt*)parameters.getParameter("phraseLength");
+    phraseOffset = (juce::AudioParameterInt*)parameters.getParameter("phraseOffset");
     firstCCNumber = (juce::AudioParameterInt*)parameters.getParameter("firstCCNumber");
     channelNumber = (juce::AudioParameterInt*)parameters.getParameter("channelNumber");
+    ccGrid = (juce::AudioParameterChoice*)parameters.getParameter("ccGrid");
+    ccBudget = (juce::AudioParameterInt*)parameters.getParameter("ccBudget");
+    ccBudgetPerChannel = (juce::AudioParameterBool*)parameters.getParameter("ccBudgetPerChannel");
+    oscInstance = (juce::AudioParameterInt*)parameters.getParameter("oscInstance");
+    midiLearn = (juce::AudioParameterChoice*)parameters.getParameter("midiLearn");
+    midiClockEnabled = (juce::AudioParameterBool*)parameters.getParameter("midiClock");
+    phraseMarkerCCNumber = (juce::AudioParameterInt*)parameters.getParameter("phraseMarkerCCNumber");
+    phraseMarkerChannel = (juce::AudioParameterInt*)parameters.getParameter("phraseMarkerChannel");
+    numLearnedEvents = 0;
+    nextLearnedEvent = 0;
+
+    feedbackCCNumber[0] = (juce::AudioParameterInt*)parameters.getParameter("outPhrasePosCCNumber");
+    feedbackChannel[0] = (juce::AudioParameterInt*)parameters.getParameter("outPhrasePosChannel");
+    feedbackCCNumber[1] = (juce::AudioParameterInt*)parameters.getParameter("outPhraseLengthCCNumber");
+    feedbackChannel[1] = (juce::AudioParameterInt*)parameters.getParameter("outPhraseLengthChannel");
+    for (int i=0; i<CBR_FEEDBACK_NUM_TARGETS; i++) {
+        int targetNumber = i + 1;
+
+        std::ostringstream sourceIdentifier, encodingIdentifier, segmentsIdentifier;
+        sourceIdentifier << "feedbackSource" << targetNumber;
+        encodingIdentifier << "feedbackEncoding" << targetNumber;
+        segmentsIdentifier << "feedbackSegments" << targetNumber;
+        feedbackSource[i] = (juce::AudioParameterChoice*)parameters.getParameter(sourceIdentifier.str());
+        feedbackEncoding[i] = (juce::AudioParameterChoice*)parameters.getParameter(encodingIdentifier.str());
+        feedbackSegments[i] = (juce::AudioParameterInt*)parameters.getParameter(segmentsIdentifier.str());
+
+        if (i >= 2) {
+            std::ostringstream ccIdentifier, channelIdentifier;
+            ccIdentifier << "feedbackCCNumber" << targetNumber;
+            channelIdentifier << "feedbackChannel" << targetNumber;
+            feedbackCCNumber[i] = (juce::AudioParameterInt*)parameters.getParameter(ccIdentifier.str());
+            feedbackChannel[i] = (juce::AudioParameterInt*)parameters.getParameter(channelIdentifier.str());
+        }
+    }
 
     for (int i=0; i<CBR_CCMOTION_NUM_PARAMS; i++) {
         int controllerNumber = i + 1;
@@ -123,25 +530,53 @@ MIDIControllerMotionAudioProcessor::MIDIControllerMotionAudioProcessor()
         paramIdentifier << "target" << controllerNumber;
 
         currentValue[i] = 0;
-        lastOutputCC[i] = 0;
+        lastOutputValue[i] = 0;
+        lastOutputType[i] = CCOutputScheduler::cc7Bit;
         destinationValue[i] = (juce::AudioParameterFloat*)parameters.getParameter(paramIdentifier.str());
+
+        std::ostringstream curveIdentifier;
+        curveIdentifier << "curve" << controllerNumber;
+        curveShape[i] = (juce::AudioParameterChoice*)parameters.getParameter(curveIdentifier.str());
+
+        std::ostringstream outputModeIdentifier;
+        outputModeIdentifier << "outputMode" << controllerNumber;
+        outputMode[i] = (juce::AudioParameterChoice*)parameters.getParameter(outputModeIdentifier.str());
+
+        std::ostringstream learnCCIdentifier, learnChannelIdentifier;
+        learnCCIdentifier << "learnCCNumber" << controllerNumber;
+        learnChannelIdentifier << "learnChannel" << controllerNumber;
+        learnCCNumber[i] = (juce::AudioParameterInt*)parameters.getParameter(learnCCIdentifier.str());
+        learnChannel[i] = (juce::AudioParameterInt*)parameters.getParameter(learnChannelIdentifier.str());
+        learnedTarget[i] = -1;
+
+        std::ostringstream lfoShapeIdentifier, lfoRateIdentifier, lfoDepthIdentifier;
+        lfoShapeIdentifier << "lfoShape" << controllerNumber;
+        lfoRateIdentifier << "lfoRate" << controllerNumber;
+        lfoDepthIdentifier << "lfoDepth" << controllerNumber;
+        lfoShape[i] = (juce::AudioParameterChoice*)parameters.getParameter(lfoShapeIdentifier.str());
+        lfoRate[i] = (juce::AudioParameterChoice*)parameters.getParameter(lfoRateIdentifier.str());
+        lfoDepth[i] = (juce::AudioParameterFloat*)parameters.getParameter(lfoDepthIdentifier.str());
+        laneValue[i] = 0;
+
+        ramp[i].start(0, 0, 0);
     }
+
+    // Build the curve and LFO tables now, rather than on the audio thread.
+    RampCurves::getInstance();
+    LFOWavetables::getInstance();
+
+    parameterConfig.attach(*this);
+    programs.initialise(*this);
 }
 
-double MIDIControllerMotionAudioProcessor::getPhraseBeats ()
+/**
+ * The built-in CC layout - every lane follows the CC and channel params.
+*/
+LayoutTables MIDIControllerMotionAudioProcessor::createDefaultLayout ()
 {
-    int selected = phraseBeats->getIndex();
-    
-    switch (selected) {
-        case 0: return 1;
-        case 1: return 4;
-        case 2: return 8;
-        case 3: return 16;
-        case 4: return 32;
-        case 5: return 64;
-    }
-    
-    return 4;
+    LayoutTables layout;
+    layout.setLanes(CBR_CCMOTION_NUM_PARAMS);
+    return layout;
 }
 
 MIDIControllerMotionAudioProcessor::~MIDIControllerMotionAudioProcessor()
@@ -188,33 +623,47 @@ double MIDIControllerMotionAudioProcessor::getTailLengthSeconds() const
 
 int MIDIControllerMotionAudioProcessor::getNumPrograms()
 {
-    return 1;   // NB: some hosts don't cope very well if you tell them there are 0 programs,
-                // so this should be at least 1, even if you're not really implementing programs.
+    return CBR_PROGRAMS_NUM;
 }
 
 int MIDIControllerMotionAudioProcessor::getCurrentProgram()
 {
-    return 0;
+    return programs.getCurrentProgram();
 }
 
 void MIDIControllerMotionAudioProcessor::setCurrentProgram (int index)
 {
+    programs.setCurrentProgram (*this, parameterConfig, index);
 }
 
 const juce::String MIDIControllerMotionAudioProcessor::getProgramName (int index)
 {
-    return {};
+    return programs.getProgramName (index);
 }
 
 void MIDIControllerMotionAudioProcessor::changeProgramName (int index, const juce::String& newName)
 {
+    programs.changeProgramName (index, newName);
 }
 
 //==============================================================================
 void MIDIControllerMotionAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
 {
-    // Use this method as the place to do any pre-playback
-    // initialisation that you need..
+    // Resend everything after (re)starting, the receiving device may have reset.
+    ccScheduler.reset();
+    for (int i=0; i<CBR_CCMOTION_NUM_PARAMS; i++) {
+        lastOutputValue[i] = -1;
+        lastOutputType[i] = -1;
+    }
+    phraseFeedback.requestResync();
+    midiClock.requestResync();
+
+    // When learned CCs are removed the output buffer is swapped with the host's, which
+    // the plugin wrapper reserves too, so both storages stay at least this large.
+    outputMidiBuffer.ensureSize(CBR_MIDI_OUTPUT_RESERVE_BYTES);
+
+    blockCapture.openIfEnabled(getName());
+    boundaryTiming.openIfEnabled(getName());
 }
 
 void MIDIControllerMotionAudioProcessor::releaseResources()
@@ -249,38 +698,49 @@ bool MIDIControllerMotionAudioProcessor::isBusesLayoutSupported (const BusesLayo
 }
 #endif
 
-double MIDIControllerMotionAudioProcessor::samplesToBeats(juce::int64 timestamp) {
-    double secondsPerBeat = 60.0 / tempoBpm;
-    double samplesPerBeat = secondsPerBeat * getSampleRate();
-    
-    return (timestamp / samplesPerBeat);
-}
+void MIDIControllerMotionAudioProcessor::updatePhraseClock ()
+{
+    const ParameterConfig& config = parameterConfig.get();
+    juce::int64 lengthTicks = PhraseClock::getPhraseLengthTicks(
+        config.getIndex(phraseBeats),
+        config.getInt(phraseLength),
+        timeSigNumerator,
+        timeSigDenominator
+    );
+    juce::int64 offsetTicks = config.getInt(phraseOffset) * PhraseClock::getBeatTicks(timeSigDenominator);
 
-double MIDIControllerMotionAudioProcessor::beatsToPhrase(double beats) {
-    return (beats / getPhraseBeats());
+    phraseClock.update(tempoBpm, getSampleRate(), lengthTicks, offsetTicks);
+
+    // The CC grid is a phrase clock with a phrase of one grid step, so grid lines line up with phrases.
+    juce::int64 gridTicks = getCCGridTicks();
+    if (gridTicks > 0) {
+        ccGridClock.update(tempoBpm, getSampleRate(), gridTicks, offsetTicks);
+    }
 }
 
-bool MIDIControllerMotionAudioProcessor::timeRangeStraddlesPhraseChange (juce::int64 time1, juce::int64 time2) {
-    double a = samplesToBeats(time1);
-    double b = samplesToBeats(time2);
-
-    // Fudge factor alert!
-    // Sometimes we get a floating point rounding error.
-    // E.g. aPhrase = 2, bPhrase = 2.99998
-    // In this case the phrase is different and we need to catch it.
-    // We add 0.001 phrases because that's much smaller
-    // than the period we're concerned with, and larger
-    // than the rounding error.
-    double aPhrase = beatsToPhrase(a) + 0.001;
-    double bPhrase = beatsToPhrase(b) + 0.001;
-
-    // Determine whether to use current channel or param channel for this event.
-    // If phrase boundary has occurred since start of block, use param.
-    return ( std::floor(aPhrase) < std::floor(bPhrase) );
+int MIDIControllerMotionAudioProcessor::getCCGridTicks ()
+{
+    int selected = parameterConfig.get().getIndex(ccGrid);
+
+    switch (selected) {
+        case 1: return CBR_PHRASECLOCK_TICKS_PER_QUARTER;
+        case 2: return CBR_PHRASECLOCK_TICKS_PER_QUARTER / 2;
+        case 3: return CBR_PHRASECLOCK_TICKS_PER_QUARTER / 4;
+        case 4: return CBR_PHRASECLOCK_TICKS_PER_QUARTER / 8;
+    }
+
+    // Off - output CCs at the start of each block.
+    return 0;
 }
 
 void MIDIControllerMotionAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
+    // Checked for allocations, locks and blocking calls in the RealtimeCheck build.
+    CBR_REALTIME_SCOPE;
+
+    // Read the parameters once, as one consistent set for the whole block.
+    const ParameterConfig& config = parameterConfig.update(*this);
+
     outputMidiBuffer.clear();
   
     juce::int64 playheadTimeSamples = 0;
@@ -293,124 +753,431 @@ void MIDIControllerMotionAudioProcessor::processBlock (juce::AudioBuffer<float>&
         isPlaying = playheadPosition.isPlaying;
         playheadTimeSamples = playheadPosition.timeInSamples;
         tempoBpm = playheadPosition.bpm;
+        timeSigNumerator = playheadPosition.timeSigNumerator;
+        timeSigDenominator = playheadPosition.timeSigDenominator;
     }
 
-    // Determine time left in current phrase (normalised 0-1).
-    double currentPhrase = beatsToPhrase(
-        samplesToBeats(playheadTimeSamples)
-    );
-    double wholePhrase = 0;
-    double currentPhrasePosition = modf(currentPhrase, &wholePhrase);
-    double phraseRemaining = 1.0 - currentPhrasePosition;
+    // Everything traced from here is stamped with this block's time.
+    CBR_TRACE_BLOCK_BEGIN(traceRecorder, playheadTimeSamples, buffer.getNumSamples());
+
+    // Apply OSC cues for this instance, as if the host had set them before the block.
+    oscCommands.setInstanceId(config.getInt(oscInstance));
+    OSCCommand command;
+    while (oscCommands.pop(command)) {
+        oscCommands.apply(command, *this, parameterConfig, programs);
+        CBR_TRACE(traceRecorder, "osc cue applied", 0, command.type == OSCCommand::programChange ? "program" : "parameter",
+                  (juce::Time::getMillisecondCounterHiRes() - command.receivedMs) * 1000.0);
+    }
+
+    // A new CC layout takes over from this block.
+    if (const LayoutTables* newLayout = layoutWatcher.acquire()) {
+        layout = newLayout;
+        // Send every lane on its new CC, even if the value hasn't changed.
+        for (int i=0; i<CBR_CCMOTION_NUM_PARAMS; i++) {
+            lastOutputValue[i] = -1;
+        }
+        CBR_TRACE(traceRecorder, "layout swapped", 0, "layout file changed", 0);
+    }
+
+    updatePhraseClock();
+    boundaryTiming.beginBlock(playhead ? &playheadPosition : nullptr, getSampleRate(), phraseClock);
+
+    // Record the block for replay, if capture is enabled.
+    blockCapture.captureBlockInput(playhead ? &playheadPosition : nullptr, buffer.getNumSamples(), getSampleRate(), parameterConfig.get(), midiMessages);
+
+    // Determine position in current phrase (normalised 0-1).
+    double currentPhrasePosition = phraseClock.getPhrasePosition(playheadTimeSamples);
     
-    // How long is current block in phrase time?
-    juce::int64 blockTimeSamples = playheadTimeSamples - lastBufferTimestamp;
-    double blockTimeBeats = samplesToBeats(blockTimeSamples);
-    double blockPhraseTime = beatsToPhrase(
-        blockTimeBeats
-    );
+    // Have we jumped back in time or looped around?
+    bool jumpedBack = (playheadTimeSamples < lastBufferTimestamp);
+
+    // Resend phrase info when playback starts or jumps, displays may be out of sync.
+    if ((isPlaying && ! wasPlaying) || jumpedBack) {
+        phraseFeedback.requestResync();
+    }
+    wasPlaying = isPlaying;
+
+    // A program change switches on the phrase boundary, so the lanes ramp to its targets
+    // over the new phrase - or straight away when stopped or after a jump.
+    int programBoundaryOffset = 0;
+    if (isPlaying && ! jumpedBack) {
+        if (getCCGridTicks() == 0) {
+            // Without a grid, the lanes see the boundary at the start of the next block.
+            programBoundaryOffset = phraseClock.timeRangeStraddlesPhraseChange(lastBufferTimestamp, playheadTimeSamples) ? 0 : -1;
+        }
+        else {
+            programBoundaryOffset = phraseClock.getPhraseStartInBlock(playheadTimeSamples, buffer.getNumSamples());
+        }
+    }
+    int program = programs.takeProgramChange(midiMessages, programBoundaryOffset);
+
+    // Targets from learned CCs, in order, at their own sample positions.
+    takeLearnedCCs(midiMessages);
+
+    outputPhraseInfoAsCCs(currentPhrasePosition, isPlaying, buffer.getNumSamples());
+
+    if (! isPlaying || jumpedBack || getCCGridTicks() == 0) {
+        if (program >= 0) {
+            switchProgram(program, 0);
+            program = -1;
+        }
+
+        // Output CCs immediately, and again at each learned CC.
+        applyLearnedCCs(playheadTimeSamples, 0, isPlaying && ! jumpedBack, true);
+        updateLanes(playheadTimeSamples, 0, isPlaying && ! jumpedBack, true);
+        applyLearnedCCs(playheadTimeSamples, buffer.getNumSamples(), isPlaying && ! jumpedBack, true);
+    }
+    else {
+        // Output CCs on each grid line in this block, at the exact sample.
+        const juce::int64 blockEndTime = playheadTimeSamples + buffer.getNumSamples();
+        juce::int64 gridTime = ccGridClock.getNextPhraseStart(playheadTimeSamples - 1);
+
+        // And on the phrase start, which can fall between grid lines (e.g. in 7/8 with a quarter note grid),
+        // so ramps land and programs switch on the boundary rather than the grid line after it.
+        juce::int64 phraseStartTime = programBoundaryOffset >= 0 ? playheadTimeSamples + programBoundaryOffset : blockEndTime;
+
+        juce::int64 updateTime = juce::jmin(gridTime, phraseStartTime);
+        while (updateTime < blockEndTime) {
+            // Learned CCs retarget their lanes between updates, but output stays on the grid and boundaries.
+            applyLearnedCCs(playheadTimeSamples, (int)(updateTime - playheadTimeSamples), true, false);
+
+            // Switch on the boundary, where the lanes start their new ramps.
+            if (program >= 0 && updateTime >= phraseStartTime) {
+                switchProgram(program, (int)(updateTime - playheadTimeSamples));
+                program = -1;
+            }
+            updateLanes(updateTime, (int)(updateTime - playheadTimeSamples), true, true);
+
+            if (updateTime == phraseStartTime) {
+                phraseStartTime = blockEndTime;
+            }
+            if (updateTime == gridTime) {
+                gridTime = ccGridClock.getNextPhraseStart(gridTime);
+            }
+            updateTime = juce::jmin(gridTime, phraseStartTime);
+        }
+        applyLearnedCCs(playheadTimeSamples, buffer.getNumSamples(), true, false);
+    }
+
+    // The boundary wasn't in this block's updates.
+    if (program >= 0) {
+        switchProgram(program, programBoundaryOffset);
+    }
+
+    // Clock ticks at their exact samples, ahead of the CCs so they count towards the budget.
+    midiClock.process(phraseClock, playheadPosition.ppqPosition, tempoBpm, getSampleRate(), playheadTimeSamples, buffer.getNumSamples(), isPlaying,
+                      config.getBool(midiClockEnabled), config.getInt(phraseMarkerCCNumber), config.getInt(phraseMarkerChannel),
+                      midiMessages);
+
+    // Send the CCs, within the output budget.
+    ccScheduler.setBudget(config.getInt(ccBudget), config.getBool(ccBudgetPerChannel));
+    ccScheduler.flush(midiMessages, buffer.getNumSamples(), getSampleRate());
 
-    outputPhraseInfoAsCCs(currentPhrasePosition, isPlaying, midiMessages);
+    publishDisplayState(playheadTimeSamples, isPlaying);
     
+    blockCapture.captureBlockOutput(midiMessages);
+    CBR_TRACE_BLOCK_END(traceRecorder);
+
+    lastBufferTimestamp = playheadTimeSamples;
+}
+
+/**
+ * Switch to a program from a program change, on the phrase boundary.
+ *
+ * @param program The program number.
+ * @param sampleOffset Offset in the current block, for tracing.
+*/
+void MIDIControllerMotionAudioProcessor::switchProgram (int program, int sampleOffset)
+{
+    programs.switchProgram(program, *this, parameterConfig);
+    // The program's phrase and grid settings apply from here.
+    updatePhraseClock();
+    CBR_TRACE(traceRecorder, "program switched", sampleOffset, "phrase boundary", program);
+}
+
+/**
+ * Take the CCs for lanes with a learned CC out of the block, to apply at their
+ * sample positions. In MIDI learn, the first CC is learned for the lane.
+ *
+ * @param midiMessages The block's MIDI, with the learned CCs removed.
+*/
+void MIDIControllerMotionAudioProcessor::takeLearnedCCs (juce::MidiBuffer& midiMessages)
+{
+    const ParameterConfig& config = parameterConfig.get();
+
+    numLearnedEvents = 0;
+    nextLearnedEvent = 0;
+
+    int learnLane = config.getIndex(midiLearn) - 1;
+    bool anyLearned = (learnLane >= 0);
     for (int i=0; i<CBR_CCMOTION_NUM_PARAMS; i++) {
-        int controllerNumber = i + *firstCCNumber;
+        if (config.getInt(learnCCNumber[i]) == 0) {
+            // Back to the target param.
+            learnedTarget[i] = -1;
+        }
+        else {
+            anyLearned = true;
+        }
+    }
+    if (! anyLearned) {
+        return;
+    }
+
+    bool consumed = false;
+    for (const juce::MidiMessageMetadata metadata : midiMessages) {
+        const juce::MidiMessage message = metadata.getMessage();
+
+        int lane = -1;
+        if (message.isController() && message.getControllerNumber() > 0) {
+            if (learnLane >= 0) {
+                // Learn this CC, as if the host had set the params.
+                // The params and the host catch up from the message thread.
+                lane = learnLane;
+                learnLane = -1;
+                parameterConfig.applyValue(*this, learnCCNumber[lane]->getParameterIndex(), learnCCNumber[lane]->convertTo0to1((float) message.getControllerNumber()));
+                parameterConfig.applyValue(*this, learnChannel[lane]->getParameterIndex(), learnChannel[lane]->convertTo0to1((float) message.getChannel()));
+                parameterConfig.applyValue(*this, midiLearn->getParameterIndex(), 0.0f);
+                CBR_TRACE(traceRecorder, "CC learned", metadata.samplePosition, "midi learn", message.getControllerNumber());
+            }
+            else {
+                for (int i=0; i<CBR_CCMOTION_NUM_PARAMS; i++) {
+                    if (message.getControllerNumber() == config.getInt(learnCCNumber[i]) && message.getChannel() == config.getInt(learnChannel[i])) {
+                        lane = i;
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (lane < 0) {
+            outputMidiBuffer.addEvent(message, metadata.samplePosition);
+            continue;
+        }
+
+        // If there are too many, the last one in the block wins.
+        consumed = true;
+        const int eventIndex = juce::jmin(numLearnedEvents, CBR_CCMOTION_MAX_LEARNED_EVENTS - 1);
+        learnedEvents[eventIndex] = { lane, metadata.samplePosition, message.getControllerValue() / 127.0 };
+        numLearnedEvents = eventIndex + 1;
+    }
+
+    // Learned CCs aren't passed on.
+    if (consumed) {
+        midiMessages.swapWith(outputMidiBuffer);
+    }
+    outputMidiBuffer.clear();
+}
+
+/**
+ * Retarget lanes from the learned CCs up to a sample offset, updating the lanes
+ * at each CC's own sample. CCs exactly at the offset only set the target, for
+ * the lane update there to pick up.
+ *
+ * @param blockTime Sample time of the start of the block.
+ * @param endOffset Apply CCs up to this offset in the block.
+ * @param isRamping False to jump straight to the targets, e.g. when stopped or after a jump.
+ * @param queueCCs False to update the lanes without output, e.g. between grid lines.
+*/
+void MIDIControllerMotionAudioProcessor::applyLearnedCCs (juce::int64 blockTime, int endOffset, bool isRamping, bool queueCCs)
+{
+    while (nextLearnedEvent < numLearnedEvents && learnedEvents[nextLearnedEvent].sampleOffset <= endOffset) {
+        const LearnedCCEvent& event = learnedEvents[nextLearnedEvent++];
+        learnedTarget[event.lane] = event.value;
+
+        if (event.sampleOffset < endOffset) {
+            updateLanes(blockTime + event.sampleOffset, event.sampleOffset, isRamping, queueCCs);
+        }
+    }
+}
+
+/**
+ * Move each lane along its ramp and queue CCs for any lanes that have changed.
+ *
+ * @param time Sample time to evaluate the lanes at.
+ * @param sampleOffset Offset in the current block for the CC events.
+ * @param isRamping False to jump straight to the targets, e.g. when stopped or after a jump.
+ * @param queueCCs False to move the lanes without output.
+*/
+void MIDIControllerMotionAudioProcessor::updateLanes (juce::int64 time, int sampleOffset, bool isRamping, bool queueCCs)
+{
+    double phrasePosition = phraseClock.getPhrasePosition(time);
+
+    // Did we cross a phrase boundary since the lanes were last updated?
+    bool newPhrase = phraseClock.timeRangeStraddlesPhraseChange(lastLaneUpdateTime, time);
+    if (newPhrase) {
+        CBR_TRACE(traceRecorder, "boundary detected", sampleOffset, isRamping ? "phrase boundary" : "phrase boundary, not ramping", phraseClock.getPhraseIndex(time));
+        if (isRamping) {
+            boundaryTiming.record(BoundaryTimingRecorder::rampBoundary, time);
+        }
+    }
+
+    // Closeness to a boundary, 0-1. Lanes nearer a boundary go first when output is over budget.
+    double boundaryPriority = 1.0 - 2.0 * juce::jmin(phrasePosition, 1.0 - phrasePosition);
+
+    const ParameterConfig& config = parameterConfig.get();
+
+    // Evaluate the LFOs for all lanes together, from the wavetables.
+    int lfoShapes[CBR_CCMOTION_NUM_PARAMS];
+    double lfoCycles[CBR_CCMOTION_NUM_PARAMS];
+    double lfoValues[CBR_CCMOTION_NUM_PARAMS];
+    const juce::int64 phraseIndex = phraseClock.getPhraseIndex(time);
+    for (int i=0; i<CBR_CCMOTION_NUM_PARAMS; i++) {
+        lfoShapes[i] = config.getIndex(lfoShape[i]);
+        lfoCycles[i] = LFOWavetables::getCycles(config.getIndex(lfoRate[i]), phraseIndex, phrasePosition);
+    }
+    LFOWavetables::getInstance().getValues(lfoShapes, lfoCycles, layout->getLFOTable(), CBR_CCMOTION_NUM_PARAMS, lfoValues);
+
+    for (int i=0; i<CBR_CCMOTION_NUM_PARAMS; i++) {
+        // Consecutive CCs from the first CC param, unless the layout file maps the lane.
+        int controllerNumber = layout->getLaneCCNumber(i);
+        if (controllerNumber < 0) {
+            controllerNumber = i + config.getInt(firstCCNumber);
+        }
+
+        // The learned CC, once one arrives, or the target param.
+        double targetValue = learnedTarget[i] >= 0 ? learnedTarget[i] : config.getFloat(destinationValue[i]);
+        double outputValue = targetValue;
 
-        // Interpolate current => destination value.
-        double increment = blockPhraseTime / phraseRemaining;
-        double targetValue = destinationValue[i]->get();
-        double distanceToTarget = targetValue - currentValue[i];
-        double outputValue = currentValue[i] + increment * distanceToTarget;
-        
-        // We have jumped time or looped around (or are paused).
         // Jump to the target value ASAP.
-        if (!isPlaying || blockTimeSamples < 0) {
-            outputValue = targetValue;
+        if (! isRamping) {
+            ramp[i].start(targetValue, phrasePosition, targetValue);
+        }
+        else {
+            // The ramp in progress landed on its target at the boundary.
+            if (newPhrase) {
+                currentValue[i] = ramp[i].target;
+                ramp[i].start(ramp[i].target, 0.0, ramp[i].target);
+            }
+
+            // Target changed - ramp from where we are now to hit it on the next boundary.
+            if (targetValue != ramp[i].target) {
+                ramp[i].start(currentValue[i], phrasePosition, targetValue);
+                CBR_TRACE(traceRecorder, "ramp retargeted", sampleOffset, learnedTarget[i] >= 0 ? "learned CC changed" : "target param changed", i);
+            }
+
+            outputValue = getRampValue(i, phrasePosition);
+        }
+
+        // The LFO swings around the ramp, and goes through the same change detection.
+        double modulatedValue = outputValue;
+        if (lfoShapes[i] != LFOWavetables::off) {
+            modulatedValue = juce::jlimit(0.0, 1.0, outputValue + config.getFloat(lfoDepth[i]) * (lfoValues[i] - 0.5));
         }
         
-        int newCCValue = juce::MidiMessage::floatValueToMidiByte(outputValue);
-
-        // If the value has changed, output a CC event.
-        if ( lastOutputCC[i] != newCCValue ) {        
-            // Add event immediately (in future can align these with beats and/or phrase boundary).
-            int channel = *channelNumber;
-            midiMessages.addEvent(
-                juce::MidiMessage::controllerEvent(
-                   channel,
-                   controllerNumber,
-                   newCCValue
-                ),
-                0
-            );
-            lastOutputCC[i] = newCCValue;
+        // 14-bit CC pairs need the MSB on CC 0-31, with the LSB 32 above.
+        int outputType = config.getIndex(outputMode[i]);
+        if (outputType == CCOutputScheduler::cc14Bit && controllerNumber > 31) {
+            outputType = CCOutputScheduler::cc7Bit;
+        }
+
+        int maxValue = CCOutputScheduler::getMaxValue(outputType);
+        int newOutputValue = LaneRamp::getOutputValue(modulatedValue, maxValue);
+
+        // If the value has changed at the output resolution, output it.
+        if ( queueCCs && (lastOutputValue[i] != newOutputValue || lastOutputType[i] != outputType) ) {
+            int channel = layout->getLaneChannel(i);
+            if (channel == 0) {
+                channel = config.getInt(channelNumber);
+            }
+            // Lanes furthest from their target go first, from what the receiver last got.
+            double targetDistance = 1.0;
+            if (lastOutputValue[i] >= 0 && lastOutputType[i] == outputType) {
+                targetDistance = std::abs(targetValue - (double) lastOutputValue[i] / maxValue);
+            }
+            double priority = targetDistance * (1.0 + boundaryPriority);
+            ccScheduler.queueOutput(outputType, channel, controllerNumber, newOutputValue, sampleOffset, priority);
+            CBR_TRACE(traceRecorder, "CC queued", sampleOffset, isRamping ? "ramp" : "jump to target", newOutputValue);
+            lastOutputValue[i] = newOutputValue;
+            lastOutputType[i] = outputType;
         }
         
-        // Update the floating-point value of the param.
+        // Update the floating-point value of the param. Ramps carry on from the value without the LFO.
         currentValue[i] = outputValue;
+        laneValue[i] = modulatedValue;
     }
-    
-    lastBufferTimestamp = playheadTimeSamples;
+
+    lastLaneUpdateTime = time;
 }
 
-void MIDIControllerMotionAudioProcessor::outputPhraseInfoAsCCs (double position, bool isPlaying, juce::MidiBuffer& midiMessages)
+/**
+ * Evaluate a lane's ramp at a phrase position, using the lane's curve shape.
+ *
+ * @param lane The lane index.
+ * @param phrasePosition Position in the current phrase, 0-1.
+ * @return The lane value, 0-1.
+*/
+double MIDIControllerMotionAudioProcessor::getRampValue (int lane, double phrasePosition)
 {
-    juce::AudioParameterInt* ccNumber;
-    juce::AudioParameterInt* channel;
-    int cc, ch;
-
-    // Phrase position.
-    ccNumber = (juce::AudioParameterInt*)parameters.getParameter("outPhrasePosCCNumber");
-    channel = (juce::AudioParameterInt*)parameters.getParameter("outPhrasePosChannel");
-    cc = ccNumber->get();
-    ch = channel->get();
-    if ( isPlaying && cc ) {
-        midiMessages.addEvent(
-            juce::MidiMessage::controllerEvent(
-                ch,
-                cc,
-                juce::MidiMessage::floatValueToMidiByte(position)
-            ),
-            0
-        );
+    const int shape = parameterConfig.get().getIndex(curveShape[lane]);
+    return ramp[lane].getValue(shape, phrasePosition, phraseClock, timeSigDenominator);
+}
+
+void MIDIControllerMotionAudioProcessor::outputPhraseInfoAsCCs (double position, bool isPlaying, int numSamples)
+{
+    const ParameterConfig& config = parameterConfig.get();
+
+    PhraseFeedback::Target targets[CBR_FEEDBACK_NUM_TARGETS];
+    for (int i=0; i<CBR_FEEDBACK_NUM_TARGETS; i++) {
+        targets[i].source = config.getIndex(feedbackSource[i]);
+        targets[i].encoding = config.getIndex(feedbackEncoding[i]);
+        targets[i].segments = config.getInt(feedbackSegments[i]);
+        targets[i].ccNumber = config.getInt(feedbackCCNumber[i]);
+        targets[i].channel = config.getInt(feedbackChannel[i]);
     }
 
-    // Phrase length.
-    int selected = phraseBeats->getIndex(); // Option index, 0-5.
-    const int ledCount = 7; // Full LED range is 0-7.
-    const double ccPerLed = 127.0 / ledCount;
-    int ccValue = selected * ccPerLed;
-    ccNumber = (juce::AudioParameterInt*)parameters.getParameter("outPhraseLengthCCNumber");
-    channel = (juce::AudioParameterInt*)parameters.getParameter("outPhraseLengthChannel");
-    cc = ccNumber->get();
-    ch = channel->get();
-    if ( cc ) {
-        midiMessages.addEvent(
-            juce::MidiMessage::controllerEvent(
-                ch,
-                cc,
-                ccValue
-            ),
-            0
-        );
+    PhraseFeedback::PhraseInfo info;
+    info.position = position;
+    info.isPlaying = isPlaying;
+    info.lengthChoice = config.getIndex(phraseBeats);
+    info.beatsPerPhrase = (double) phraseClock.getPhraseLengthTicks() / PhraseClock::getBeatTicks(timeSigDenominator);
+
+    phraseFeedback.process(targets, info, numSamples, getSampleRate(), ccScheduler);
+}
+
+/**
+ * Publish what the editor shows, see PhraseDisplay.h.
+ *
+ * @param blockTime Sample time of the start of the block.
+ * @param isPlaying Whether the transport is playing.
+*/
+void MIDIControllerMotionAudioProcessor::publishDisplayState (juce::int64 blockTime, bool isPlaying)
+{
+    displayState.setPhrase(phraseClock, blockTime, timeSigDenominator, isPlaying);
+
+    displayState.numLanes = CBR_CCMOTION_NUM_PARAMS;
+    for (int i=0; i<CBR_CCMOTION_NUM_PARAMS; i++) {
+        displayState.laneValues[i] = (float) laneValue[i];
+        displayState.laneTargets[i] = (float) ramp[i].target;
     }
 
+    displayState.currentProgram = programs.getCurrentProgram();
+    displayState.pendingProgram = programs.getPendingProgram();
 
+    displayState.ccMessagesSaved = ccScheduler.getNumMessagesSaved();
+    displayState.ccMessagesWaiting = ccScheduler.getNumMessagesWaiting();
+
+    displaySnapshot.publish(displayState);
 }
 
 //==============================================================================
 bool MIDIControllerMotionAudioProcessor::hasEditor() const
 {
-    return false;
+    return true;
 }
 
 juce::AudioProcessorEditor* MIDIControllerMotionAudioProcessor::createEditor()
 {
-    return 0;
+    return new PhraseDisplayEditor (*this, displaySnapshot, {}, 0, CBR_CCMOTION_NUM_PARAMS, &layoutWatcher);
 }
 
 //==============================================================================
 void MIDIControllerMotionAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 {
+    // Values set on the audio thread go in the state, with the program they belong to.
+    parameterConfig.flushPending();
     auto state = parameters.copyState();
+    programs.writeToState (state, *this, parameterConfig);
+    layoutWatcher.writeToState (state);
     std::unique_ptr<juce::XmlElement> xml (state.createXml());
     copyXmlToBinary (*xml, destData);
 }
@@ -420,8 +1187,12 @@ void MIDIControllerMotionAudioProcessor::setStateInformation (const void* data,
     std::unique_ptr<juce::XmlElement> xmlState (getXmlFromBinary (data, sizeInBytes));
 
     if (xmlState.get() != nullptr)
-        if (xmlState->hasTagName (parameters.state.getType()))
-            parameters.replaceState (juce::ValueTree::fromXml (*xmlState));
+        if (xmlState->hasTagName (parameters.state.getType())) {
+            juce::ValueTree state = juce::ValueTree::fromXml (*xmlState);
+            programs.readFromState (state, *this);
+            layoutWatcher.readFromState (state);
+            parameterConfig.loadState (parameters, state);
+        }
 }
 
 //==============================================================================
@@ -9,10 +9,27 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "../../Common/PhraseClock.h"
+#include "../../Common/ParameterConfig.h"
+#include "../../Common/PhrasePrograms.h"
+#include "../../Common/LayoutConfig.h"
+#include "../../Common/PhraseDisplay.h"
+#include "../../Common/OSCControl.h"
+#include "../../Common/BlockCapture.h"
+#include "../../Common/BoundaryTiming.h"
+#include "../../Common/Trace.h"
+#include "../../Common/RealtimeCheck.h"
+#include "LaneRamp.h"
+#include "LFOWavetables.h"
+#include "CCOutputScheduler.h"
+#include "PhraseFeedback.h"
+#include "MIDIClockOutput.h"
 
 // These parameters are now hard coded in the constructor initialiser list.
 // If this constant is changed, need to add/remove `target` params accordingly.
 #define CBR_CCMOTION_NUM_PARAMS 4
+// Most learned CCs applied in one block.
+#define CBR_CCMOTION_MAX_LEARNED_EVENTS 256
 
 //==============================================================================
 /**
@@ -61,26 +78,109 @@ private:
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MIDIControllerMotionAudioProcessor)
     
-    double samplesToBeats (juce::int64 timestamp);
-    double beatsToPhrase (double beats);
-    bool timeRangeStraddlesPhraseChange (juce::int64 time1, juce::int64 time2);
-    void outputPhraseInfoAsCCs (double position, bool isPlaying, juce::MidiBuffer& midiMessages);
+    void updatePhraseClock ();
+    void outputPhraseInfoAsCCs (double position, bool isPlaying, int numSamples);
+    void takeLearnedCCs (juce::MidiBuffer& midiMessages);
+    void applyLearnedCCs (juce::int64 blockTime, int endOffset, bool isRamping, bool queueCCs);
+    void updateLanes (juce::int64 time, int sampleOffset, bool isRamping, bool queueCCs);
+    void switchProgram (int program, int sampleOffset);
+    void publishDisplayState (juce::int64 blockTime, bool isPlaying);
+    int getCCGridTicks ();
+    double getRampValue (int lane, double phrasePosition);
 
     int getSemitonesPerVariation ();
-    double getPhraseBeats ();
 
     juce::AudioParameterFloat *destinationValue[CBR_CCMOTION_NUM_PARAMS];
     double currentValue[CBR_CCMOTION_NUM_PARAMS];
-    int lastOutputCC[CBR_CCMOTION_NUM_PARAMS];
+    // Output type and last value output for each lane, at the output type's resolution.
+    juce::AudioParameterChoice *outputMode[CBR_CCMOTION_NUM_PARAMS];
+    int lastOutputValue[CBR_CCMOTION_NUM_PARAMS];
+    int lastOutputType[CBR_CCMOTION_NUM_PARAMS];
+
+    // Current ramp for each lane - from start value at start position to target on the next boundary.
+    juce::AudioParameterChoice *curveShape[CBR_CCMOTION_NUM_PARAMS];
+    LaneRamp ramp[CBR_CCMOTION_NUM_PARAMS];
+
+    // Incoming CC and channel for each lane's target, and the last value received, or -1 to follow the target param.
+    juce::AudioParameterInt *learnCCNumber[CBR_CCMOTION_NUM_PARAMS];
+    juce::AudioParameterInt *learnChannel[CBR_CCMOTION_NUM_PARAMS];
+    juce::AudioParameterChoice* midiLearn;
+    double learnedTarget[CBR_CCMOTION_NUM_PARAMS];
+
+    // Learned CCs in the current block, in order.
+    struct LearnedCCEvent
+    {
+        int lane;
+        int sampleOffset;
+        double value;
+    };
+    LearnedCCEvent learnedEvents[CBR_CCMOTION_MAX_LEARNED_EVENTS];
+    int numLearnedEvents;
+    int nextLearnedEvent;
+
+    // LFO for each lane, and the lane's value with the LFO, as output.
+    juce::AudioParameterChoice *lfoShape[CBR_CCMOTION_NUM_PARAMS];
+    juce::AudioParameterChoice *lfoRate[CBR_CCMOTION_NUM_PARAMS];
+    juce::AudioParameterFloat *lfoDepth[CBR_CCMOTION_NUM_PARAMS];
+    double laneValue[CBR_CCMOTION_NUM_PARAMS];
 
     juce::AudioProcessorValueTreeState parameters;
     
     juce::AudioParameterChoice* phraseBeats;
+    juce::AudioParameterInt* phraseLength;
+    juce::AudioParameterInt* phraseOffset;
     juce::AudioParameterInt* firstCCNumber;
     juce::AudioParameterInt* channelNumber;
+    juce::AudioParameterChoice* ccGrid;
+    juce::AudioParameterInt* ccBudget;
+    juce::AudioParameterBool* ccBudgetPerChannel;
+    juce::AudioParameterInt* oscInstance;
+    juce::AudioParameterBool* midiClockEnabled;
+    juce::AudioParameterInt* phraseMarkerCCNumber;
+    juce::AudioParameterInt* phraseMarkerChannel;
+
+    // Phrase feedback target params.
+    juce::AudioParameterChoice* feedbackSource[CBR_FEEDBACK_NUM_TARGETS];
+    juce::AudioParameterChoice* feedbackEncoding[CBR_FEEDBACK_NUM_TARGETS];
+    juce::AudioParameterInt* feedbackSegments[CBR_FEEDBACK_NUM_TARGETS];
+    juce::AudioParameterInt* feedbackCCNumber[CBR_FEEDBACK_NUM_TARGETS];
+    juce::AudioParameterInt* feedbackChannel[CBR_FEEDBACK_NUM_TARGETS];
+
+    // Parameter values for the current block, see ParameterConfig.h.
+    ParameterConfigSwap parameterConfig;
+    // Programs recalled with program change, see PhrasePrograms.h.
+    PhrasePrograms programs;
+    // CC number and channel for each lane from the layout file, see LayoutConfig.h.
+    static LayoutTables createDefaultLayout ();
+    LayoutWatcher layoutWatcher { createDefaultLayout() };
+    const LayoutTables* layout = &layoutWatcher.getDefaults();
+    // Cues received over OSC, see OSCControl.h.
+    OSCCommandQueue oscCommands { *this };
 
     double tempoBpm;
+    int timeSigNumerator;
+    int timeSigDenominator;
+    PhraseClock phraseClock;
+    PhraseClock ccGridClock;
     juce::int64 lastBufferTimestamp;
 
+    juce::int64 lastLaneUpdateTime;
+    bool wasPlaying;
+
     juce::MidiBuffer outputMidiBuffer;
+
+    CCOutputScheduler ccScheduler;
+    PhraseFeedback phraseFeedback;
+    MIDIClockOutput midiClock;
+
+    // Published once per block for the editor.
+    PhraseDisplayState displayState;
+    SeqlockSnapshot<PhraseDisplayState> displaySnapshot;
+
+    // Post-mortem capture of each block, see CBR_CAPTURE_DIR.
+    BlockCaptureRecorder blockCapture;
+    // How far switches land from the exact boundaries, see CBR_TIMING_DIR.
+    BoundaryTimingRecorder boundaryTiming;
+    // Trace points, compiled out unless CBR_TRACE_ENABLED.
+    CBR_TRACE_RECORDER(traceRecorder);
 };
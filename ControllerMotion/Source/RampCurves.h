@@ -0,0 +1,103 @@
+/*
+  ==============================================================================
+
+    RampCurves.h
+    Lookup tables for ControllerMotion ramp shapes.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+// Number of segments in each curve table. Values in between are interpolated.
+#define CBR_RAMPCURVES_TABLE_SIZE 256
+
+//==============================================================================
+/**
+ * Precomputed, normalised ramp shapes.
+ *
+ * Each table maps ramp progress 0-1 to output 0-1, starting at exactly 0 and
+ * ending at exactly 1, so a ramp always lands on its target. Evaluating a curve
+ * is a table read and a lerp, whatever the shape.
+*/
+class RampCurves
+{
+public:
+    enum Shape
+    {
+        linear = 0,
+        exponential,
+        logarithmic,
+        sCurve,
+        // Linear, but only moves on each beat. Progress is quantised by the caller.
+        steppedBeats,
+        numShapes
+    };
+
+    static juce::StringArray getShapeChoices ()
+    {
+        return juce::StringArray( {"Linear", "Exponential", "Logarithmic", "S-curve", "Stepped (beats)"} );
+    }
+
+    /**
+     * Shared tables, built on first use.
+     * Call from the message thread (e.g. processor constructor) before playback.
+    */
+    static const RampCurves& getInstance ()
+    {
+        static const RampCurves curves;
+        return curves;
+    }
+
+    /**
+     * Evaluate a curve.
+     *
+     * @param shape One of Shape.
+     * @param progress Ramp progress, 0-1. Clamped.
+     * @return Curve output, 0-1.
+    */
+    double getValue (int shape, double progress) const
+    {
+        if (shape < 0 || shape >= numShapes) {
+            shape = linear;
+        }
+
+        const double position = juce::jlimit (0.0, 1.0, progress) * CBR_RAMPCURVES_TABLE_SIZE;
+        const int index = (int) position;
+        if (index >= CBR_RAMPCURVES_TABLE_SIZE) {
+            return 1.0;
+        }
+
+        const float* table = tables[shape];
+        const double fraction = position - index;
+        return table[index] + fraction * (table[index + 1] - table[index]);
+    }
+
+private:
+    RampCurves ()
+    {
+        // Steepness of the exponential/logarithmic curves.
+        const double k = 4.0;
+        const double expScale = 1.0 / (std::exp (k) - 1.0);
+
+        for (int i = 0; i <= CBR_RAMPCURVES_TABLE_SIZE; i++) {
+            const double t = (double) i / CBR_RAMPCURVES_TABLE_SIZE;
+
+            tables[linear][i] = (float) t;
+            tables[steppedBeats][i] = (float) t;
+            tables[exponential][i] = (float) ((std::exp (k * t) - 1.0) * expScale);
+            tables[logarithmic][i] = (float) (1.0 - (std::exp (k * (1.0 - t)) - 1.0) * expScale);
+            tables[sCurve][i] = (float) (0.5 - 0.5 * std::cos (juce::MathConstants<double>::pi * t));
+        }
+
+        // Pin the end points so ramps start and land exactly.
+        for (int shape = 0; shape < numShapes; shape++) {
+            tables[shape][0] = 0.0f;
+            tables[shape][CBR_RAMPCURVES_TABLE_SIZE] = 1.0f;
+        }
+    }
+
+    float tables[numShapes][CBR_RAMPCURVES_TABLE_SIZE + 1];
+};
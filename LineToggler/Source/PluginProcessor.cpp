@@ -8,10 +8,19 @@
 
 #include "PluginProcessor.h"
 
-const int LineTogglerAudioProcessor::notesPerLine[] = { 2, 2, 4, 4 };
+/**
+ * The built-in line map, used unless the layout file changes it.
+*/
+LayoutTables LineTogglerAudioProcessor::createDefaultLayout () {
+    const int notesPerLine[CBR_TOGGLELINES_NUM_LINES] = { 2, 2, 4, 4 };
+
+    // 2 octaves below first line note (36). In future might shift to MIDI zero.
+    const int lineControlNotes[CBR_TOGGLELINES_NUM_LINES] = { 12, 13, 14, 15 };
 
-// 2 octaves below first line note (36). In future might shift to MIDI zero.
-const int LineTogglerAudioProcessor::lineControlNotes[] = { 12, 13, 14, 15 };
+    LayoutTables layout;
+    layout.setLines(CBR_TOGGLELINES_NUM_LINES, CBR_TOGGLELINES_FIRST_MIDI_NOTE, notesPerLine, lineControlNotes);
+    return layout;
+}
 
 //==============================================================================
 LineTogglerAudioProcessor::LineTogglerAudioProcessor()
@@ -48,9 +57,56 @@ LineTogglerAudioProcessor::LineTogglerAudioProcessor()
                 true
             ),
 
+            // Optionally hold control note toggles back until the next phrase boundary.
+            std::make_unique<juce::AudioParameterBool> (
+                "phraseSync", // parameterID
+                "Sync toggles to phrase", // parameter name
+                false
+            ),
+            std::make_unique<juce::AudioParameterChoice> (
+                "phraseBeats", // parameterID
+                "Phrase length", // parameter name
+                PhraseClock::getPhraseChoices(),
+                2 // default index
+            ),
+            // Phrase length for the "Custom beats" and "Custom bars" phrase options.
+            std::make_unique<juce::AudioParameterInt> (
+                "phraseLength", // parameterID
+                "Custom phrase length", // parameter name
+                1,
+                CBR_PHRASECLOCK_MAX_LENGTH,
+                8
+            ),
+            // Shift the phrase grid later by a number of beats from the bar.
+            std::make_unique<juce::AudioParameterInt> (
+                "phraseOffset", // parameterID
+                "Phrase offset (beats)", // parameter name
+                0,
+                CBR_PHRASECLOCK_MAX_LENGTH - 1,
+                0
+            ),
+
+            // Address OSC cues to this instance, see CBR_OSC_PORT. 0 ignores cues.
+            std::make_unique<juce::AudioParameterInt> (
+                "oscInstance", // parameterID
+                "OSC instance", // parameter name
+                0,
+                CBR_OSC_MAX_INSTANCES,
+                0
+            ),
+
             } )
 #endif
 {
+    tempoBpm = 120.0;
+    timeSigNumerator = 4;
+    timeSigDenominator = 4;
+    lastBufferTimestamp = 0;
+
+    lineGateMask = 0;
+    pendingGateMask = 0;
+    pendingGateValues = 0;
+
     for (int i=0; i<CBR_TOGGLELINES_NUM_LINES; i++) {
         int lineNumber = i + 1;
 
@@ -59,9 +115,17 @@ LineTogglerAudioProcessor::LineTogglerAudioProcessor()
 
         allowLinePlayback[i] = (juce::AudioParameterBool*)parameters.getParameter(paramIdentifier.str());
 
-        lineGate[i] = true;
+        lineGateMask |= (1u << i);
     }
 
+    phraseSync = (juce::AudioParameterBool*)parameters.getParameter("phraseSync");
+    phraseBeats = (juce::AudioParameterChoice*)parameters.getParameter("phraseBeats");
+    phraseLength = (juce::AudioParameterInt*)parameters.getParameter("phraseLength");
+    phraseOffset = (juce::AudioParameterInt*)parameters.getParameter("phraseOffset");
+    oscInstance = (juce::AudioParameterInt*)parameters.getParameter("oscInstance");
+
+    parameterConfig.attach(*this);
+    programs.initialise(*this);
 }
 
 LineTogglerAudioProcessor::~LineTogglerAudioProcessor()
@@ -108,26 +172,27 @@ double LineTogglerAudioProcessor::getTailLengthSeconds() const
 
 int LineTogglerAudioProcessor::getNumPrograms()
 {
-    return 1;   // NB: some hosts don't cope very well if you tell them there are 0 programs,
-                // so this should be at least 1, even if you're not really implementing programs.
+    return CBR_PROGRAMS_NUM;
 }
 
 int LineTogglerAudioProcessor::getCurrentProgram()
 {
-    return 0;
+    return programs.getCurrentProgram();
 }
 
 void LineTogglerAudioProcessor::setCurrentProgram (int index)
 {
+    programs.setCurrentProgram (*this, parameterConfig, index);
 }
 
 const juce::String LineTogglerAudioProcessor::getProgramName (int index)
 {
-    return {};
+    return programs.getProgramName (index);
 }
 
 void LineTogglerAudioProcessor::changeProgramName (int index, const juce::String& newName)
 {
+    programs.changeProgramName (index, newName);
 }
 
 //==============================================================================
@@ -135,6 +200,12 @@ void LineTogglerAudioProcessor::prepareToPlay (double sampleRate, int samplesPer
 {
     // Use this method as the place to do any pre-playback
     // initialisation that you need..
+    // The output buffer is swapped with the host's at the end of each block, which
+    // the plugin wrapper reserves too, so both storages stay at least this large.
+    outputMidiBuffer.ensureSize(CBR_MIDI_OUTPUT_RESERVE_BYTES);
+
+    blockCapture.openIfEnabled(getName());
+    boundaryTiming.openIfEnabled(getName());
 }
 
 void LineTogglerAudioProcessor::releaseResources()
@@ -176,20 +247,8 @@ bool LineTogglerAudioProcessor::isBusesLayoutSupported (const BusesLayout& layou
  * @return The slot index for the note, or -1 if the note is not in a slot.
 */
 int LineTogglerAudioProcessor::getSlotIndexForNote(const int midiNoteNumber) {
-    int slotStartNote = CBR_TOGGLELINES_FIRST_MIDI_NOTE;
-
-    // Iterate over each line, and check if the note is in the line's range.
-    for (int i = 0; i < CBR_TOGGLELINES_NUM_LINES; i++)
-    {
-        int nextSlotStart = slotStartNote + notesPerLine[i];
-        if ( midiNoteNumber >= slotStartNote && midiNoteNumber < nextSlotStart ) {
-            return  i;
-        }
-        slotStartNote = nextSlotStart;
-    }
-
-    // Not in a slot!
-    return -1;
+    // Each line's notes follow on from the last, looked up from the compiled layout.
+    return layout->getLineForNote(midiNoteNumber);
 }
 
 /**
@@ -199,129 +258,282 @@ int LineTogglerAudioProcessor::getSlotIndexForNote(const int midiNoteNumber) {
  * @return The slot index that the note controls, or -1.
 */
 int LineTogglerAudioProcessor::getSlotIndexForControlNote(const int midiNoteNumber) {
-    for (int i = 0; i < CBR_TOGGLELINES_NUM_LINES; i++)
-    {
-        if ( midiNoteNumber == lineControlNotes[i] ) {
-            return  i;
-        }
+    return layout->getLineForControlNote(midiNoteNumber);
+}
+
+/**
+ * Latch a gate change for a line, to be applied by applyPendingLineGates().
+ *
+ * @param slotIndex The line to change.
+ * @param gateOpen The new gate state for the line.
+*/
+void LineTogglerAudioProcessor::latchLineGate(const int slotIndex, const bool gateOpen) {
+    const juce::uint32 lineBit = 1u << slotIndex;
+
+    pendingGateMask |= lineBit;
+    if (gateOpen) {
+        pendingGateValues |= lineBit;
+    }
+    else {
+        pendingGateValues &= ~lineBit;
+    }
+}
+
+/**
+ * Apply all latched gate changes at once.
+ * Any number of lines can change on the same sample.
+ *
+ * @param sampleOffset Position in the current block, for tracing.
+ * @param reason Why the gates are changing now, for tracing.
+*/
+void LineTogglerAudioProcessor::applyPendingLineGates(const int sampleOffset, const char* reason) {
+    // A new line map takes over along with the gates.
+    updateLayout(sampleOffset);
+
+    const juce::uint32 newGateMask = (lineGateMask & ~pendingGateMask) | (pendingGateValues & pendingGateMask);
+    if (newGateMask != lineGateMask) {
+        CBR_TRACE(traceRecorder, "gate toggled", sampleOffset, reason, newGateMask);
     }
+    juce::ignoreUnused(sampleOffset, reason);
 
-    return -1;
+    lineGateMask = newGateMask;
+    pendingGateMask = 0;
 }
 
-const juce::MidiMessageMetadata* findNoteOnEvent(
-    juce::MidiBuffer& midiMessages,
-    int afterTimestamp,
-    int midiNoteValue
-) {
+/**
+ * Swap in a line map loaded from the layout file.
+ *
+ * @param sampleOffset Position in the current block, for tracing.
+*/
+void LineTogglerAudioProcessor::updateLayout(const int sampleOffset) {
+    if (const LayoutTables* newLayout = layoutWatcher.acquire()) {
+        layout = newLayout;
+        CBR_TRACE(traceRecorder, "layout swapped", sampleOffset, "layout file changed", 0);
+    }
+    juce::ignoreUnused(sampleOffset);
+}
 
-    for (const juce::MidiMessageMetadata metadata : midiMessages) {
-       const juce:: MidiMessage event = metadata.getMessage();
-        if (event.isNoteOn()) {
-            if (event.getNoteNumber() == midiNoteValue &&
-                metadata.samplePosition >= afterTimestamp) {
+/**
+ * Switch to a program from a program change, and latch every line's gate from it.
+ *
+ * @param program The program number.
+ * @param sampleOffset Position in the current block, for tracing.
+*/
+void LineTogglerAudioProcessor::switchProgram(const int program, const int sampleOffset) {
+    programs.switchProgram(program, *this, parameterConfig);
+    updatePhraseClock();
 
-                // THIS IS A POINTER – we should avoid this and use a reference or a copy. (Compile warning)
-                return &metadata;
-            }
-        }
+    const ParameterConfig& config = parameterConfig.get();
+    for (int i = 0; i < CBR_TOGGLELINES_NUM_LINES; i++) {
+        latchLineGate(i, config.getBool(allowLinePlayback[i]));
     }
 
-    return nullptr;
+    CBR_TRACE(traceRecorder, "program switched", sampleOffset, "phrase boundary", program);
+    juce::ignoreUnused(sampleOffset);
+}
+
+void LineTogglerAudioProcessor::updatePhraseClock() {
+    const ParameterConfig& config = parameterConfig.get();
+    juce::int64 lengthTicks = PhraseClock::getPhraseLengthTicks(
+        config.getIndex(phraseBeats),
+        config.getInt(phraseLength),
+        timeSigNumerator,
+        timeSigDenominator
+    );
+    juce::int64 offsetTicks = config.getInt(phraseOffset) * PhraseClock::getBeatTicks(timeSigDenominator);
+
+    phraseClock.update(tempoBpm, getSampleRate(), lengthTicks, offsetTicks);
 }
 
 void LineTogglerAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
+    // Checked for allocations, locks and blocking calls in the RealtimeCheck build.
+    CBR_REALTIME_SCOPE;
+
+    // Read the parameters once, as one consistent set for the whole block.
+    const ParameterConfig& config = parameterConfig.update(*this);
+
     outputMidiBuffer.clear();
 
-    // TODO: Check transport state, if not playing back then disable all gates / let everything though.
     // TODO: Pass through all unrelated MIDI events (not control notes or notes in lines).
 
-    // Loop over each slot / line.
-    for (int slotIndex = 0; slotIndex < CBR_TOGGLELINES_NUM_LINES; slotIndex++) {
-        const int bufferEndTime = buffer.getNumSamples();
-        int processStartTime = 0, processEndTime = buffer.getNumSamples();
-        int controlNoteSearchStart = 0;
-        bool nextGateState = lineGate[slotIndex];
-
-        // Iterate through the buffer one control note at a time.
-        while ( processStartTime < bufferEndTime ) {
-            // Search for next control note change for the current slot.
-            const juce::MidiMessageMetadata* controlNoteOn = findNoteOnEvent(midiMessages, controlNoteSearchStart, lineControlNotes[slotIndex]);
-
-            // We found a control note:
-            // - Adjust time range to before the note takes effect.
-            // - Stash the toggle param value to apply it for next iteration.
-            if (controlNoteOn != nullptr) {
-                processEndTime = controlNoteOn->samplePosition - 1;
-                controlNoteSearchStart++;
-                nextGateState = allowLinePlayback[slotIndex]->get();
-            }
-            else {
-                processEndTime = buffer.getNumSamples();
+    juce::int64 playheadTimeSamples = 0;
+    bool isPlaying = false;
+
+    juce::AudioPlayHead::CurrentPositionInfo playheadPosition;
+    juce::AudioPlayHead* playhead = AudioProcessor::getPlayHead();
+    if (playhead) {
+        playhead->getCurrentPosition(playheadPosition);
+        isPlaying = playheadPosition.isPlaying;
+        playheadTimeSamples = playheadPosition.timeInSamples;
+        tempoBpm = playheadPosition.bpm;
+        timeSigNumerator = playheadPosition.timeSigNumerator;
+        timeSigDenominator = playheadPosition.timeSigDenominator;
+    }
+
+    // Everything traced from here is stamped with this block's time.
+    CBR_TRACE_BLOCK_BEGIN(traceRecorder, playheadTimeSamples, buffer.getNumSamples());
+
+    // Apply OSC cues for this instance, as if the host had set them before the block.
+    oscCommands.setInstanceId(config.getInt(oscInstance));
+    OSCCommand command;
+    while (oscCommands.pop(command)) {
+        oscCommands.apply(command, *this, parameterConfig, programs);
+        // A cued line enable changes the gate like a control note.
+        for (int i = 0; i < CBR_TOGGLELINES_NUM_LINES; i++) {
+            if (command.type == OSCCommand::setParameter && command.index == allowLinePlayback[i]->getParameterIndex()) {
+                latchLineGate(i, config.getBool(allowLinePlayback[i]));
             }
+        }
+        CBR_TRACE(traceRecorder, "osc cue applied", 0, command.type == OSCCommand::programChange ? "program" : "parameter",
+                  (juce::Time::getMillisecondCounterHiRes() - command.receivedMs) * 1000.0);
+    }
 
-            // Now we have a time range to process - processStartTime…processEndTime.
-            // We have at least two tasks for this time period:
-            // 1. Apply the current line gate - let notes through or not.
-            // 2. If param changes gate state in this period, apply the change at the end.
-            // 3. (bonus) Gate ALL control note events (on and off) so they don't play synth notes. Could do this manually but cleaner to do within the plugin automatically.
+    updatePhraseClock();
+    boundaryTiming.beginBlock(playhead ? &playheadPosition : nullptr, getSampleRate(), phraseClock);
 
-            // Loop over all events.
-            for (auto midiMessageIt = midiMessages.begin(); midiMessageIt != midiMessages.end(); ++midiMessageIt) {
+    // Record the block for replay, if capture is enabled.
+    blockCapture.captureBlockInput(playhead ? &playheadPosition : nullptr, buffer.getNumSamples(), getSampleRate(), parameterConfig.get(), midiMessages);
 
-                const juce::MidiMessageMetadata metadata = *midiMessageIt;
-                const juce::MidiMessage m = metadata.getMessage();
+    // Gate changes are only held back for the phrase boundary while playing.
+    const bool syncToPhrase = config.getBool(phraseSync) && isPlaying;
 
-                // Skip events not in our time period of interest.
-                if ( metadata.samplePosition < processStartTime ||
-                    metadata.samplePosition > processEndTime ) {
-                    continue;
-                }
+    // Find the sample offset of the phrase boundary in this block, if any.
+    int boundaryOffset = -1;
+    if (syncToPhrase) {
+        const juce::int64 nextPhraseStart = phraseClock.getNextPhraseStart(playheadTimeSamples - 1);
+        if (nextPhraseStart < playheadTimeSamples + buffer.getNumSamples()) {
+            boundaryOffset = (int)(nextPhraseStart - playheadTimeSamples);
+        }
+        // Or if the transport has looped back around start.
+        if (lastBufferTimestamp > playheadTimeSamples) {
+            boundaryOffset = 0;
+        }
+        if (boundaryOffset != -1) {
+            CBR_TRACE(traceRecorder, "boundary detected", boundaryOffset, (lastBufferTimestamp > playheadTimeSamples) ? "transport looped" : "phrase boundary", phraseClock.getPhraseIndex(playheadTimeSamples + boundaryOffset));
+            if (lastBufferTimestamp <= playheadTimeSamples) {
+                boundaryTiming.record(BoundaryTimingRecorder::gatedEvent, playheadTimeSamples + boundaryOffset);
+            }
+        }
+    }
+
+    // Program changes switch along with the gates - on the boundary, or straight away when not synced.
+    int program = programs.takeProgramChange(midiMessages, syncToPhrase ? boundaryOffset : 0);
+    if (! syncToPhrase) {
+        if (program >= 0) {
+            switchProgram(program, 0);
+            program = -1;
+        }
+        applyPendingLineGates(0, "not synced to phrase");
+    }
+
+    // Single pass over events in time order.
+    // Control notes latch the line param, and the latched gates are applied
+    // together - immediately, or at the phrase boundary when synced.
+    for (const juce::MidiMessageMetadata metadata : midiMessages) {
+        const juce::MidiMessage m = metadata.getMessage();
 
-                // Find out what kind of event this is.
-                const int noteNumber = m.getNoteNumber();
-                const int eventSlotIndex = this->getSlotIndexForNote(noteNumber); // It's a note in a line.
-                const bool isNoteOn = m.isNoteOn();
-
-                // Is this event in a line? If so, appropriately gate it.
-                if ( eventSlotIndex != -1 ) {
-                    if ( eventSlotIndex == slotIndex ) {
-                        if ( isNoteOn && lineGate[slotIndex] ) {
-                            outputMidiBuffer.addEvent(m, metadata.samplePosition);
-                        }
-                        else if ( ! isNoteOn ) {
-                            outputMidiBuffer.addEvent(m, metadata.samplePosition);
-                        }
-                    }
+        if ( boundaryOffset != -1 && metadata.samplePosition >= boundaryOffset ) {
+            if ( program >= 0 ) {
+                switchProgram(program, boundaryOffset);
+                program = -1;
+            }
+            applyPendingLineGates(boundaryOffset, "phrase boundary");
+            boundaryOffset = -1;
+        }
+
+        if ( ! m.isNoteOnOrOff() ) {
+            // Pass program changes on, so plugins further down the chain switch too.
+            if ( m.isProgramChange() ) {
+                outputMidiBuffer.addEvent(m, metadata.samplePosition);
+            }
+            continue;
+        }
 
+        // Control notes change the gate state, and are never played.
+        const int noteNumber = m.getNoteNumber();
+        const int controlSlotIndex = this->getSlotIndexForControlNote(noteNumber);
+        if ( controlSlotIndex != -1 ) {
+            if ( m.isNoteOn() ) {
+                latchLineGate(controlSlotIndex, config.getBool(allowLinePlayback[controlSlotIndex]));
+                if ( ! syncToPhrase ) {
+                    applyPendingLineGates(metadata.samplePosition, "control note");
                 }
-            } // End loop over all events.
+            }
+            continue;
+        }
+
+        // Is this event in a line? If so, appropriately gate it.
+        // Note-offs always pass so notes don't hang when a gate closes.
+        const int eventSlotIndex = this->getSlotIndexForNote(noteNumber);
+        if ( eventSlotIndex != -1 ) {
+            const bool gateOpen = (lineGateMask >> eventSlotIndex) & 1u;
+            if ( m.isNoteOff() || gateOpen ) {
+                outputMidiBuffer.addEvent(m, metadata.samplePosition);
+            }
+            else {
+                CBR_TRACE(traceRecorder, "note dropped", metadata.samplePosition, "line gate closed", noteNumber);
+            }
+        }
+    }
 
-            // Now we've processed all the events up to processEndTime, iterate.
-            lineGate[slotIndex] = nextGateState;
-            processStartTime = processEndTime;
-        } // End while loop for each control note for the current slot.
-    } // End loop over each slot / line.
+    // Boundary after the last event in the block.
+    if ( boundaryOffset != -1 ) {
+        if ( program >= 0 ) {
+            switchProgram(program, boundaryOffset);
+        }
+        applyPendingLineGates(boundaryOffset, "phrase boundary");
+    }
 
     midiMessages.swapWith(outputMidiBuffer);
+
+    publishDisplayState(playheadTimeSamples, isPlaying);
+
+    blockCapture.captureBlockOutput(midiMessages);
+    CBR_TRACE_BLOCK_END(traceRecorder);
+
+    lastBufferTimestamp = playheadTimeSamples;
+}
+
+/**
+ * Publish what the editor shows, see PhraseDisplay.h.
+ *
+ * @param blockTime Sample time of the start of the block.
+ * @param isPlaying Whether the transport is playing.
+*/
+void LineTogglerAudioProcessor::publishDisplayState(const juce::int64 blockTime, const bool isPlaying) {
+    displayState.setPhrase(phraseClock, blockTime, timeSigDenominator, isPlaying);
+
+    displayState.numLines = CBR_TOGGLELINES_NUM_LINES;
+    displayState.lineGateMask = lineGateMask;
+    displayState.pendingGateMask = pendingGateMask;
+    displayState.pendingGateValues = pendingGateValues;
+
+    displayState.currentProgram = programs.getCurrentProgram();
+    displayState.pendingProgram = programs.getPendingProgram();
+
+    displaySnapshot.publish(displayState);
 }
 
 //==============================================================================
 bool LineTogglerAudioProcessor::hasEditor() const
 {
-    return false;
+    return true;
 }
 
 juce::AudioProcessorEditor* LineTogglerAudioProcessor::createEditor()
 {
-    return 0;
+    return new PhraseDisplayEditor (*this, displaySnapshot, {}, CBR_TOGGLELINES_NUM_LINES, 0, &layoutWatcher);
 }
 
 //==============================================================================
 void LineTogglerAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 {
+    // Values set on the audio thread go in the state, with the program they belong to.
+    parameterConfig.flushPending();
     auto state = parameters.copyState();
+    programs.writeToState (state, *this, parameterConfig);
+    layoutWatcher.writeToState (state);
     std::unique_ptr<juce::XmlElement> xml (state.createXml());
     copyXmlToBinary (*xml, destData);
 }
@@ -331,8 +543,12 @@ void LineTogglerAudioProcessor::setStateInformation (const void* data, int sizeI
     std::unique_ptr<juce::XmlElement> xmlState (getXmlFromBinary (data, sizeInBytes));
 
     if (xmlState.get() != nullptr)
-        if (xmlState->hasTagName (parameters.state.getType()))
-            parameters.replaceState (juce::ValueTree::fromXml (*xmlState));
+        if (xmlState->hasTagName (parameters.state.getType())) {
+            juce::ValueTree state = juce::ValueTree::fromXml (*xmlState);
+            programs.readFromState (state, *this);
+            layoutWatcher.readFromState (state);
+            parameterConfig.loadState (parameters, state);
+        }
 }
 
 //==============================================================================
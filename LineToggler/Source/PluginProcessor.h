@@ -9,12 +9,25 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "../../Common/PhraseClock.h"
+#include "../../Common/ParameterConfig.h"
+#include "../../Common/PhrasePrograms.h"
+#include "../../Common/LayoutConfig.h"
+#include "../../Common/PhraseDisplay.h"
+#include "../../Common/OSCControl.h"
+#include "../../Common/BlockCapture.h"
+#include "../../Common/BoundaryTiming.h"
+#include "../../Common/Trace.h"
+#include "../../Common/RealtimeCheck.h"
 
 // Hard-coded 12 lines for now - one octave of sampler slots.
 #define CBR_TOGGLELINES_NUM_LINES 4
 // Lines start at C1 and go for an octave. @see getSlotIndexForNote().
 #define CBR_TOGGLELINES_FIRST_MIDI_NOTE 36
 
+// Line gates are stored as bits in a 32 bit mask.
+static_assert (CBR_TOGGLELINES_NUM_LINES <= 32, "Too many lines for line gate mask");
+
 //==============================================================================
 /**
 */
@@ -61,22 +74,63 @@ public:
 private:
     int getSlotIndexForNote(const int midiNoteNumber);
     int getSlotIndexForControlNote(const int midiNoteNumber);
+    void latchLineGate(const int slotIndex, const bool gateOpen);
+    void applyPendingLineGates(const int sampleOffset, const char* reason);
+    void updateLayout(const int sampleOffset);
+    void switchProgram(const int program, const int sampleOffset);
+    void publishDisplayState(const juce::int64 blockTime, const bool isPlaying);
+    void updatePhraseClock();
 
 private:
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LineTogglerAudioProcessor)
 
-    static const int notesPerLine[CBR_TOGGLELINES_NUM_LINES];
-    // MIDI note value for control note for each line - e.g. C-2 up.
-    static const int lineControlNotes[CBR_TOGGLELINES_NUM_LINES];
+    static LayoutTables createDefaultLayout();
+
+    // Notes per line and control note for each line, from the layout file or built in, see LayoutConfig.h.
+    LayoutWatcher layoutWatcher { createDefaultLayout() };
+    const LayoutTables* layout = &layoutWatcher.getDefaults();
 
-    // State of each line - true = gate open / is playing.
-    bool lineGate[CBR_TOGGLELINES_NUM_LINES];
+    // State of each line, one bit per line - set = gate open / is playing.
+    juce::uint32 lineGateMask;
+    // Gate changes latched by control notes, waiting for the next phrase boundary.
+    // Lines with a bit set in pendingGateMask take their state from pendingGateValues.
+    juce::uint32 pendingGateMask;
+    juce::uint32 pendingGateValues;
 
     juce::AudioProcessorValueTreeState parameters;
 
     // Store a direct pointer to each param for convenience.
     juce::AudioParameterBool *allowLinePlayback[CBR_TOGGLELINES_NUM_LINES] ;
 
+    juce::AudioParameterBool* phraseSync;
+    juce::AudioParameterChoice* phraseBeats;
+    juce::AudioParameterInt* phraseLength;
+    juce::AudioParameterInt* phraseOffset;
+    juce::AudioParameterInt* oscInstance;
+    // Parameter values for the current block, see ParameterConfig.h.
+    ParameterConfigSwap parameterConfig;
+    // Programs recalled with program change, see PhrasePrograms.h.
+    PhrasePrograms programs;
+    // Cues received over OSC, see OSCControl.h.
+    OSCCommandQueue oscCommands { *this };
+
+    double tempoBpm;
+    int timeSigNumerator;
+    int timeSigDenominator;
+    PhraseClock phraseClock;
+    juce::int64 lastBufferTimestamp;
+
+    // Published once per block for the editor.
+    PhraseDisplayState displayState;
+    SeqlockSnapshot<PhraseDisplayState> displaySnapshot;
+
+    // Post-mortem capture of each block, see CBR_CAPTURE_DIR.
+    BlockCaptureRecorder blockCapture;
+    // How far switches land from the exact boundaries, see CBR_TIMING_DIR.
+    BoundaryTimingRecorder boundaryTiming;
+    // Trace points, compiled out unless CBR_TRACE_ENABLED.
+    CBR_TRACE_RECORDER(traceRecorder);
+
     juce::MidiBuffer outputMidiBuffer;
 };
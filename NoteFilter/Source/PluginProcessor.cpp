@@ -34,58 +34,94 @@ MIDIClipVariationsAudioProcessor::MIDIClipVariationsAudioProcessor()
                 std::make_unique<juce::AudioParameterChoice> (
                     "phraseBeats", // parameterID
                     "Phrase length", // parameter name
-                    juce::StringArray( {"1 beat", "4 beats", "8 beats", "16 beats", "32 beats", "64 beats"} ),
+                    PhraseClock::getPhraseChoices(),
                     2 // default index
                 ),
+                // Phrase length for the "Custom beats" and "Custom bars" phrase options.
+                std::make_unique<juce::AudioParameterInt> (
+                    "phraseLength", // parameterID
+                    "Custom phrase length", // parameter name
+                    1,
+                    CBR_PHRASECLOCK_MAX_LENGTH,
+                    8
+                ),
+                // Shift the phrase grid later by a number of beats from the bar.
+                std::make_unique<juce::AudioParameterInt> (
+                    "phraseOffset", // parameterID
+                    "Phrase offset (beats)", // parameter name
+                    0,
+                    CBR_PHRASECLOCK_MAX_LENGTH - 1,
+                    0
+                ),
             
                 std::make_unique<juce::AudioParameterChoice> (
                     "notesPerVariation", // parameterID
                     "Variation height", // parameter name
                     juce::StringArray( {"6 semitones / half octave", "1 octave", "2 octaves", "3 octaves"} ),
                     1 // default index
+                ),
+
+                // Play the variation for each phrase from the arrangement, or record it.
+                std::make_unique<juce::AudioParameterChoice> (
+                    "arrangement", // parameterID
+                    "Arrangement", // parameter name
+                    PhraseArrangement::getModeChoices(),
+                    0 // default index
+                ),
+
+                // Address OSC cues to this instance, see CBR_OSC_PORT. 0 ignores cues.
+                std::make_unique<juce::AudioParameterInt> (
+                    "oscInstance", // parameterID
+                    "OSC instance", // parameter name
+                    0,
+                    CBR_OSC_MAX_INSTANCES,
+                    0
                 )
             } )
 #endif
 {
     tempoBpm = 120.0;
+    timeSigNumerator = 4;
+    timeSigDenominator = 4;
     lastBufferTimestamp = 0;
     currentVariation = 0; // Zero based .. is that confusing, compared to channel plugin?
     
     selectedVariation = (juce::AudioParameterInt*)parameters.getParameter("variation");
     phraseBeats = (juce::AudioParameterChoice*)parameters.getParameter("phraseBeats");
+    phraseLength = (juce::AudioParameterInt*)parameters.getParameter("phraseLength");
+    phraseOffset = (juce::AudioParameterInt*)parameters.getParameter("phraseOffset");
     notesPerVariation = (juce::AudioParameterChoice*)parameters.getParameter("notesPerVariation");
+    arrangementMode = (juce::AudioParameterChoice*)parameters.getParameter("arrangement");
+    oscInstance = (juce::AudioParameterInt*)parameters.getParameter("oscInstance");
+
+    // Arrangement entries are variations.
+    arrangement.setMaxValue(selectedVariation->getRange().getEnd());
+
+    parameterConfig.attach(*this);
+    programs.initialise(*this);
 }
 
 int MIDIClipVariationsAudioProcessor::getSemitonesPerVariation ()
 {
-    int selected = notesPerVariation->getIndex();
+    int selected = parameterConfig.get().getIndex(notesPerVariation);
     
-    switch (selected) {
-        case 0: return 6;
-        case 1: return 12;
-        case 2: return 24;
-        case 3: return 36;
-    }
-    
-    return 12;
+    // 6, 12, 24 or 36 unless the layout file says otherwise.
+    return layout->getVariationHeight(selected);
 }
 
-int MIDIClipVariationsAudioProcessor::getPhraseBeats ()
+/**
+ * Swap in a layout loaded from the layout file since the last phrase boundary.
+ * Only called where the variation can change, so notes don't jump mid-phrase.
+*/
+void MIDIClipVariationsAudioProcessor::updateLayout ()
 {
-    int selected = phraseBeats->getIndex();
-    
-    switch (selected) {
-        case 0: return 1;
-        case 1: return 4;
-        case 2: return 8;
-        case 3: return 16;
-        case 4: return 32;
-        case 5: return 64;
+    if (const LayoutTables* newLayout = layoutWatcher.acquire()) {
+        layout = newLayout;
+        CBR_TRACE(traceRecorder, "layout swapped", 0, "layout file changed", getSemitonesPerVariation());
     }
-
-    return 4;
 }
 
+
 MIDIClipVariationsAudioProcessor::~MIDIClipVariationsAudioProcessor()
 {
 }
@@ -130,26 +166,27 @@ double MIDIClipVariationsAudioProcessor::getTailLengthSeconds() const
 
 int MIDIClipVariationsAudioProcessor::getNumPrograms()
 {
-    return 1;   // NB: some hosts don't cope very well if you tell them there are 0 programs,
-                // so this should be at least 1, even if you're not really implementing programs.
+    return CBR_PROGRAMS_NUM;
 }
 
 int MIDIClipVariationsAudioProcessor::getCurrentProgram()
 {
-    return 0;
+    return programs.getCurrentProgram();
 }
 
 void MIDIClipVariationsAudioProcessor::setCurrentProgram (int index)
 {
+    programs.setCurrentProgram (*this, parameterConfig, index);
 }
 
 const juce::String MIDIClipVariationsAudioProcessor::getProgramName (int index)
 {
-    return {};
+    return programs.getProgramName (index);
 }
 
 void MIDIClipVariationsAudioProcessor::changeProgramName (int index, const juce::String& newName)
 {
+    programs.changeProgramName (index, newName);
 }
 
 //==============================================================================
@@ -157,6 +194,12 @@ void MIDIClipVariationsAudioProcessor::prepareToPlay (double sampleRate, int sam
 {
     // Use this method as the place to do any pre-playback
     // initialisation that you need..
+    // The output buffer is swapped with the host's at the end of each block, which
+    // the plugin wrapper reserves too, so both storages stay at least this large.
+    outputMidiBuffer.ensureSize(CBR_MIDI_OUTPUT_RESERVE_BYTES);
+
+    blockCapture.openIfEnabled(getName());
+    boundaryTiming.openIfEnabled(getName());
 }
 
 void MIDIClipVariationsAudioProcessor::releaseResources()
@@ -191,34 +234,34 @@ bool MIDIClipVariationsAudioProcessor::isBusesLayoutSupported (const BusesLayout
 }
 #endif
 
-double MIDIClipVariationsAudioProcessor::samplesToBeats(juce::int64 timestamp) {
-    double secondsPerBeat = 60.0 / tempoBpm;
-    double samplesPerBeat = secondsPerBeat * getSampleRate();
-    
-    return (timestamp / samplesPerBeat);
-}
-
-double MIDIClipVariationsAudioProcessor::beatsToPhrase(double beats) {    
-    return (beats / getPhraseBeats());
+void MIDIClipVariationsAudioProcessor::updatePhraseClock ()
+{
+    const ParameterConfig& config = parameterConfig.get();
+    juce::int64 lengthTicks = PhraseClock::getPhraseLengthTicks(
+        config.getIndex(phraseBeats),
+        config.getInt(phraseLength),
+        timeSigNumerator,
+        timeSigDenominator
+    );
+    juce::int64 offsetTicks = config.getInt(phraseOffset) * PhraseClock::getBeatTicks(timeSigDenominator);
+
+    phraseClock.update(tempoBpm, getSampleRate(), lengthTicks, offsetTicks);
 }
 
-bool MIDIClipVariationsAudioProcessor::timeRangeStraddlesPhraseChange (juce::int64 time1, juce::int64 time2) {
-    double a = samplesToBeats(time1);
-    double b = samplesToBeats(time2);
-
-    // Fudge factor alert!
-    // Sometimes we get a floating point rounding error.
-    // E.g. aPhrase = 2, bPhrase = 2.99998
-    // In this case the phrase is different and we need to catch it.
-    // We add 0.001 phrases because that's much smaller
-    // than the period we're concerned with, and larger
-    // than the rounding error.
-    double aPhrase = beatsToPhrase(a) + 0.001;
-    double bPhrase = beatsToPhrase(b) + 0.001;
-
-    // Determine whether to use current channel or param channel for this event.
-    // If phrase boundary has occurred since start of block, use param.
-    return ( std::floor(aPhrase) < std::floor(bPhrase) );
+/**
+ * Switch to a program from a program change. Notes from here on use its
+ * height, arrangement mode and phrase settings.
+ *
+ * @param program The program number.
+ * @param sampleOffset Offset in the current block, for tracing.
+ * @param isPlaying Whether the transport is playing, for tracing.
+*/
+void MIDIClipVariationsAudioProcessor::switchProgram (int program, int sampleOffset, bool isPlaying)
+{
+    programs.switchProgram(program, *this, parameterConfig);
+    updatePhraseClock();
+    CBR_TRACE(traceRecorder, "program switched", sampleOffset, isPlaying ? "phrase boundary" : "not playing", program);
+    juce::ignoreUnused(sampleOffset, isPlaying);
 }
 
 bool MIDIClipVariationsAudioProcessor::processNote (juce::MidiMessage& message, juce::int64 blockTime, juce::int64 eventTime)
@@ -230,42 +273,64 @@ bool MIDIClipVariationsAudioProcessor::processNote (juce::MidiMessage& message,
     auto originalNote = message.getNoteNumber();
     
     int variation = currentVariation;
-    int variationHeight = getSemitonesPerVariation();
     
     // If phrase boundary has occurred since start of block, use the new selected variation.
-    if ( timeRangeStraddlesPhraseChange(blockTime, eventTime) ) {
-        variation = *selectedVariation;
+    const bool afterBoundary = phraseClock.timeRangeStraddlesPhraseChange(blockTime, eventTime);
+    if ( afterBoundary ) {
+        variation = parameterConfig.get().getInt(selectedVariation);
     }
 
-    int variationStartNote = variation * variationHeight;
+    // When playing an arrangement, the phrase alone decides the variation, so seeks and loops play the same.
+    // Phrases without an entry carry on as above.
+    int arrangedVariation = 0;
+    if (parameterConfig.get().getIndex(arrangementMode) == PhraseArrangement::play) {
+        arrangedVariation = arrangement.getValue(phraseClock.getPhraseIndex(eventTime));
+        if (arrangedVariation != 0) {
+            variation = arrangedVariation;
+        }
+    }
+
+    // Which variation the note is in, and the note it plays as, from the layout's note table.
+    // Equal heights and split tables alike are one lookup.
+    const NoteSplit split = layout->getNoteSplit(parameterConfig.get().getIndex(notesPerVariation), originalNote);
+    bool noteInVariation = (split.variation == variation);
 
-    // Transpose all notes down into normalised range.
+    // Transpose notes down into normalised range.
     // Note 1: (pun intended!) this modifies the passed in note by reference.
     // Note 2: this seems to start at the second-lowest octave in the DAWs I tried (Reaper, Bitwig).
     // I had expected note zero would be C-2, bottom of the range.
-    message.setNoteNumber(originalNote - variationStartNote);
+    if (noteInVariation) {
+        message.setNoteNumber(split.note);
+    }
     
     // We may need special handling of note offs now - we need to track them and ensure they get played,
     // and not play all of them, since they might clash with existing notes (after transpose).
-    // The bug is that note-offs near the end of the phrase may get lost – dangling notes.
+    // The bug is that note-offs near the end of the phrase may get lost – dangling notes.
 //    if (message.isNoteOff()) {
 //        // Pass all note-offs.
 //        return true;
 //    }
-    
-    // Filter notes within the (normalised) range.
-    bool noteInVariation = (message.getNoteNumber() >= 0) && (message.getNoteNumber() < (0 + variationHeight));
+
+    CBR_TRACE(traceRecorder, noteInVariation ? "note transposed" : "note dropped", eventTime - blockTime,
+              arrangedVariation != 0 ? "arrangement" : afterBoundary ? "variation switched earlier in block" : "current variation",
+              noteInVariation ? message.getNoteNumber() : originalNote);
+
     return noteInVariation;
 }
 
 
 void MIDIClipVariationsAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
+    // Checked for allocations, locks and blocking calls in the RealtimeCheck build.
+    CBR_REALTIME_SCOPE;
+
+    // Read the parameters once, as one consistent set for the whole block.
+    const ParameterConfig& config = parameterConfig.update(*this);
+
     outputMidiBuffer.clear();
-  
-    const int variation = *selectedVariation;
 
     juce::int64 playheadTimeSamples = 0;
+    bool isPlaying = false;
 
     juce::AudioPlayHead::CurrentPositionInfo playheadPosition;
     juce::AudioPlayHead* playhead = AudioProcessor::getPlayHead();
@@ -273,66 +338,174 @@ void MIDIClipVariationsAudioProcessor::processBlock (juce::AudioBuffer<float>& b
         playhead->getCurrentPosition(playheadPosition);
         playheadTimeSamples = playheadPosition.timeInSamples;
         tempoBpm = playheadPosition.bpm;
-    
+        timeSigNumerator = playheadPosition.timeSigNumerator;
+        timeSigDenominator = playheadPosition.timeSigDenominator;
+        isPlaying = playheadPosition.isPlaying;
+    }
+
+    // Everything traced from here is stamped with this block's time.
+    CBR_TRACE_BLOCK_BEGIN(traceRecorder, playheadTimeSamples, buffer.getNumSamples());
+
+    // Apply OSC cues for this instance, as if the host had set them before the block.
+    oscCommands.setInstanceId(config.getInt(oscInstance));
+    OSCCommand command;
+    while (oscCommands.pop(command)) {
+        oscCommands.apply(command, *this, parameterConfig, programs);
+        CBR_TRACE(traceRecorder, "osc cue applied", 0, command.type == OSCCommand::programChange ? "program" : "parameter",
+                  (juce::Time::getMillisecondCounterHiRes() - command.receivedMs) * 1000.0);
+    }
+
+    // Cued phrase settings apply from this block.
+    if (playhead) {
+        updatePhraseClock();
+    }
+
+    // A program change switches on the phrase boundary in this block, or straight away when stopped or looping.
+    int programBoundaryOffset = 0;
+    if (isPlaying && lastBufferTimestamp <= playheadTimeSamples) {
+        programBoundaryOffset = phraseClock.getPhraseStartInBlock(playheadTimeSamples, buffer.getNumSamples());
+    }
+    // Events before the boundary play with the outgoing program, so a later boundary switches in the event loop.
+    int program = programs.takeProgramChange(midiMessages, programBoundaryOffset);
+    if (program >= 0 && programBoundaryOffset == 0) {
+        switchProgram(program, 0, isPlaying);
+        program = -1;
+    }
+
+    // Measure switches against the exact boundaries from here, with the phrase settings playing now.
+    boundaryTiming.beginBlock(playhead ? &playheadPosition : nullptr, getSampleRate(), phraseClock);
+
+    const int variation = config.getInt(selectedVariation);
+
+    if (playhead) {
         if (! playheadPosition.isPlaying) {
             currentVariation = variation;
+            updateLayout();
         }
         else {
             // Determine if the last block straddled a phrase boundary.
-            bool lastBlockNewPhrase = timeRangeStraddlesPhraseChange(lastBufferTimestamp, playheadTimeSamples);
+            bool lastBlockNewPhrase = phraseClock.timeRangeStraddlesPhraseChange(lastBufferTimestamp, playheadTimeSamples);
             // Or if the transport has looped back around start.
             bool reloopNewPhrase = (lastBufferTimestamp > playheadTimeSamples);
             // If so, apply the channel param.
             if (lastBlockNewPhrase || reloopNewPhrase) {
+                if (! reloopNewPhrase) {
+                    boundaryTiming.record(BoundaryTimingRecorder::blockSwitch, playheadTimeSamples);
+                }
                 currentVariation = variation;
+                CBR_TRACE(traceRecorder, "variation applied", 0, reloopNewPhrase ? "transport looped" : "phrase boundary in last block", variation);
+                updateLayout();
             }
         }
     }
     else {
         currentVariation = variation;
+        updateLayout();
     }
 
+    // Record the variation playing in each phrase.
+    if (isPlaying && config.getIndex(arrangementMode) == PhraseArrangement::record) {
+        arrangement.setValue(phraseClock.getPhraseIndex(playheadTimeSamples), currentVariation);
+    }
+
+    // Notes after a boundary in this block switch on its sample.
+    if (isPlaying && boundaryTiming.isEnabled()) {
+        const juce::int64 nextPhraseStart = phraseClock.getNextPhraseStart(playheadTimeSamples);
+        if (nextPhraseStart < playheadTimeSamples + buffer.getNumSamples()) {
+            boundaryTiming.record(BoundaryTimingRecorder::phraseSwitch, nextPhraseStart);
+        }
+    }
+
+    // Record the block for replay, if capture is enabled.
+    blockCapture.captureBlockInput(playhead ? &playheadPosition : nullptr, buffer.getNumSamples(), getSampleRate(), parameterConfig.get(), midiMessages);
+
     for (auto m: midiMessages)
     {
         auto message = m.getMessage();
         auto timestamp = message.getTimeStamp();
-        
-        auto unprocessedMessage = message;
+
+        if (program >= 0 && timestamp >= programBoundaryOffset) {
+            switchProgram(program, programBoundaryOffset, isPlaying);
+            program = -1;
+        }
         
         // Process the current note.
         // This determines if it is in the current variation's note range,
         // AND transposes the note down into normal range (passed by ref).
+        // processNote() traces what it did with each note.
         if (this->processNote(message, playheadTimeSamples, playheadTimeSamples + timestamp)) {
-            if (message.isNoteOnOrOff()) {
-                std::cout << message.getNoteNumber() << " "
-                    << unprocessedMessage.getDescription() << " playing as "
-                    << message.getDescription() << std:: endl;
-            }
             outputMidiBuffer.addEvent(message, timestamp);
         }
 
     }
 
+    // No events from the boundary on - the program still switches in this block.
+    if (program >= 0) {
+        switchProgram(program, programBoundaryOffset, isPlaying);
+    }
+
     midiMessages.swapWith(outputMidiBuffer);
-    
+
+    publishDisplayState(playheadTimeSamples, isPlaying);
+
+    blockCapture.captureBlockOutput(midiMessages);
+    CBR_TRACE_BLOCK_END(traceRecorder);
+
     lastBufferTimestamp = playheadTimeSamples;
 }
 
+/**
+ * Publish what the editor shows, see PhraseDisplay.h.
+ *
+ * @param blockTime Sample time of the start of the block.
+ * @param isPlaying Whether the transport is playing.
+*/
+void MIDIClipVariationsAudioProcessor::publishDisplayState (juce::int64 blockTime, bool isPlaying)
+{
+    const ParameterConfig& config = parameterConfig.get();
+
+    displayState.setPhrase(phraseClock, blockTime, timeSigDenominator, isPlaying);
+    displayState.currentValue = currentVariation;
+    displayState.pendingValue = config.getInt(selectedVariation);
+
+    // Playing an arrangement, show the variations it has for this phrase and the next.
+    if (config.getIndex(arrangementMode) == PhraseArrangement::play) {
+        const int arrangedCurrent = arrangement.getValue(displayState.phraseIndex);
+        const int arrangedNext = arrangement.getValue(displayState.phraseIndex + 1);
+        if (arrangedCurrent != 0) {
+            displayState.currentValue = arrangedCurrent;
+        }
+        if (arrangedNext != 0) {
+            displayState.pendingValue = arrangedNext;
+        }
+    }
+
+    displayState.currentProgram = programs.getCurrentProgram();
+    displayState.pendingProgram = programs.getPendingProgram();
+
+    displaySnapshot.publish(displayState);
+}
+
 //==============================================================================
 bool MIDIClipVariationsAudioProcessor::hasEditor() const
 {
-    return false;
+    return true;
 }
 
 juce::AudioProcessorEditor* MIDIClipVariationsAudioProcessor::createEditor()
 {
-    return 0;
+    return new PhraseDisplayEditor (*this, displaySnapshot, "Variation", 0, 0, &layoutWatcher);
 }
 
 //==============================================================================
 void MIDIClipVariationsAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 {
+    // Values set on the audio thread go in the state, with the program they belong to.
+    parameterConfig.flushPending();
     auto state = parameters.copyState();
+    programs.writeToState (state, *this, parameterConfig);
+    arrangement.writeToState (state);
+    layoutWatcher.writeToState (state);
     std::unique_ptr<juce::XmlElement> xml (state.createXml());
     copyXmlToBinary (*xml, destData);
 }
@@ -342,8 +515,13 @@ void MIDIClipVariationsAudioProcessor::setStateInformation (const void* data, in
     std::unique_ptr<juce::XmlElement> xmlState (getXmlFromBinary (data, sizeInBytes));
 
     if (xmlState.get() != nullptr)
-        if (xmlState->hasTagName (parameters.state.getType()))
-            parameters.replaceState (juce::ValueTree::fromXml (*xmlState));
+        if (xmlState->hasTagName (parameters.state.getType())) {
+            juce::ValueTree state = juce::ValueTree::fromXml (*xmlState);
+            programs.readFromState (state, *this);
+            arrangement.readFromState (state);
+            layoutWatcher.readFromState (state);
+            parameterConfig.loadState (parameters, state);
+        }
 }
 
 //==============================================================================
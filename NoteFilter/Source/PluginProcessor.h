@@ -9,6 +9,17 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "../../Common/PhraseClock.h"
+#include "../../Common/ParameterConfig.h"
+#include "../../Common/PhrasePrograms.h"
+#include "../../Common/PhraseArrangement.h"
+#include "../../Common/LayoutConfig.h"
+#include "../../Common/PhraseDisplay.h"
+#include "../../Common/OSCControl.h"
+#include "../../Common/BlockCapture.h"
+#include "../../Common/BoundaryTiming.h"
+#include "../../Common/Trace.h"
+#include "../../Common/RealtimeCheck.h"
 
 //==============================================================================
 /**
@@ -57,23 +68,52 @@ private:
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MIDIClipVariationsAudioProcessor)
     
-    double samplesToBeats (juce::int64 timestamp);
-    double beatsToPhrase (double beats);
-    bool timeRangeStraddlesPhraseChange (juce::int64 time1, juce::int64 time2);
+    void updatePhraseClock ();
+    void switchProgram (int program, int sampleOffset, bool isPlaying);
     bool processNote (juce::MidiMessage& message,juce::int64 blockTime, juce::int64 eventTime);
+    void publishDisplayState (juce::int64 blockTime, bool isPlaying);
 
     int getSemitonesPerVariation ();
-    int getPhraseBeats ();
+    void updateLayout ();
 
     juce::AudioProcessorValueTreeState parameters;
 
     juce::AudioParameterInt* selectedVariation;
     juce::AudioParameterChoice* notesPerVariation;
     juce::AudioParameterChoice* phraseBeats;
+    juce::AudioParameterInt* phraseLength;
+    juce::AudioParameterInt* phraseOffset;
+    juce::AudioParameterChoice* arrangementMode;
+    juce::AudioParameterInt* oscInstance;
+    // Parameter values for the current block, see ParameterConfig.h.
+    ParameterConfigSwap parameterConfig;
+    // Programs recalled with program change, see PhrasePrograms.h.
+    PhrasePrograms programs;
+    // Value for each phrase index, see PhraseArrangement.h.
+    PhraseArrangement arrangement;
+    // Variation heights from the layout file, see LayoutConfig.h.
+    LayoutWatcher layoutWatcher { LayoutTables() };
+    const LayoutTables* layout = &layoutWatcher.getDefaults();
+    // Cues received over OSC, see OSCControl.h.
+    OSCCommandQueue oscCommands { *this };
 
     double tempoBpm;
+    int timeSigNumerator;
+    int timeSigDenominator;
+    PhraseClock phraseClock;
     int currentVariation;
     juce::int64 lastBufferTimestamp;
 
+    // Published once per block for the editor.
+    PhraseDisplayState displayState;
+    SeqlockSnapshot<PhraseDisplayState> displaySnapshot;
+
+    // Post-mortem capture of each block, see CBR_CAPTURE_DIR.
+    BlockCaptureRecorder blockCapture;
+    // How far switches land from the exact boundaries, see CBR_TIMING_DIR.
+    BoundaryTimingRecorder boundaryTiming;
+    // Trace points, compiled out unless CBR_TRACE_ENABLED.
+    CBR_TRACE_RECORDER(traceRecorder);
+
     juce::MidiBuffer outputMidiBuffer;
 };
@@ -0,0 +1,376 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+    Renders a folder of MIDI clips through a plugin for every combination of
+    a set of parameter values, using all cores.
+
+    Usage: BatchRender <Plugin.vst3> <clips folder> <matrix.json> <output folder> [--threads N]
+
+    The matrix is a JSON object of parameter name to a list of values, e.g.
+    { "Variation": [1, 2, 3, 4], "Phrase length": ["8 beats", "16 beats"] }
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "WorkStealingPool.h"
+
+#include <iostream>
+
+static const double renderSampleRate = 48000.0;
+static const int renderBlockSize = 512;
+// Used for the output file when the clip uses SMPTE timing.
+static const int defaultTicksPerQuarter = 960;
+
+//==============================================================================
+/**
+ * Parameter values for one render of a clip.
+*/
+struct Setting
+{
+    juce::StringArray paramNames;
+    juce::StringArray paramValues;
+
+    // Used in output file names, e.g. "Variation-2_Phrase-length-8-beats".
+    juce::String label;
+};
+
+struct JobResult
+{
+    bool ok = false;
+    juce::String error;
+    int eventsIn = 0;
+    int eventsOut = 0;
+    double renderMs = 0;
+    int workerIndex = -1;
+};
+
+/**
+ * Transport for offline rendering - always playing, constant tempo from the start of the clip.
+*/
+class BatchPlayHead : public juce::AudioPlayHead
+{
+public:
+    bool getCurrentPosition (CurrentPositionInfo& result) override
+    {
+        result = position;
+        return true;
+    }
+
+    CurrentPositionInfo position;
+};
+
+/**
+ * A plugin instance and buffers, owned by one worker.
+*/
+struct WorkerContext
+{
+    std::unique_ptr<juce::AudioPluginInstance> plugin;
+    BatchPlayHead playHead;
+    juce::AudioBuffer<float> audio;
+    juce::MidiBuffer midiMessages;
+};
+
+//==============================================================================
+/**
+ * Build every combination of the values in the matrix.
+*/
+static juce::Array<Setting> getSettings (const juce::var& matrix)
+{
+    juce::Array<Setting> settings;
+    settings.add (Setting());
+
+    juce::DynamicObject* object = matrix.getDynamicObject();
+    if (object == nullptr) {
+        return settings;
+    }
+
+    for (const juce::NamedValueSet::NamedValue& param : object->getProperties()) {
+        const juce::Array<juce::var>* values = param.value.getArray();
+        if (values == nullptr || values->isEmpty()) {
+            continue;
+        }
+
+        juce::Array<Setting> combined;
+        for (const Setting& setting : settings) {
+            for (const juce::var& value : *values) {
+                Setting next = setting;
+                next.paramNames.add (param.name.toString());
+                next.paramValues.add (value.toString());
+                next.label += juce::String (next.label.isEmpty() ? "" : "_")
+                    + (param.name.toString() + " " + value.toString()).replaceCharacter (' ', '-');
+                combined.add (next);
+            }
+        }
+        settings = combined;
+    }
+
+    return settings;
+}
+
+static juce::AudioProcessorParameter* findParameter (juce::AudioPluginInstance& plugin, const juce::String& name)
+{
+    for (juce::AudioProcessorParameter* param : plugin.getParameters()) {
+        if (param->getName (64).equalsIgnoreCase (name)) {
+            return param;
+        }
+    }
+    return nullptr;
+}
+
+//==============================================================================
+/**
+ * Render one clip through the worker's plugin, and write the output MIDI file.
+*/
+static JobResult renderClip (WorkerContext& context, const juce::File& clipFile, const Setting& setting, const juce::File& outputFile)
+{
+    JobResult result;
+    const double startMs = juce::Time::getMillisecondCounterHiRes();
+
+    juce::MidiFile inputFile;
+    {
+        juce::FileInputStream input (clipFile);
+        if (! input.openedOk() || ! inputFile.readFrom (input)) {
+            result.error = "Can't read MIDI file";
+            return result;
+        }
+    }
+
+    // Tempo and meter from the start of the clip.
+    double bpm = 120.0;
+    int timeSigNumerator = 4;
+    int timeSigDenominator = 4;
+    {
+        juce::MidiMessageSequence metaEvents;
+        inputFile.findAllTempoEvents (metaEvents);
+        if (metaEvents.getNumEvents() > 0) {
+            bpm = 60.0 / metaEvents.getEventPointer (0)->message.getTempoSecondsPerQuarterNote();
+        }
+        metaEvents.clear();
+        inputFile.findAllTimeSigEvents (metaEvents);
+        if (metaEvents.getNumEvents() > 0) {
+            metaEvents.getEventPointer (0)->message.getTimeSignatureInfo (timeSigNumerator, timeSigDenominator);
+        }
+    }
+
+    const int ticksPerQuarter = (inputFile.getTimeFormat() > 0) ? inputFile.getTimeFormat() : defaultTicksPerQuarter;
+    inputFile.convertTimestampTicksToSeconds();
+
+    juce::MidiMessageSequence input;
+    for (int track = 0; track < inputFile.getNumTracks(); track++) {
+        input.addSequence (*inputFile.getTrack (track), 0);
+    }
+
+    // Apply the setting.
+    juce::AudioPluginInstance& plugin = *context.plugin;
+    for (int i = 0; i < setting.paramNames.size(); i++) {
+        juce::AudioProcessorParameter* param = findParameter (plugin, setting.paramNames[i]);
+        if (param == nullptr) {
+            result.error = "No parameter named " + setting.paramNames[i];
+            return result;
+        }
+        param->setValue (param->getValueForText (setting.paramValues[i]));
+    }
+
+    // The worker's plugin has played other clips. Process an empty block with the
+    // transport stopped, so the plugin applies the new params before playback starts.
+    juce::AudioPlayHead::CurrentPositionInfo& position = context.playHead.position;
+    position.resetToDefault();
+    position.bpm = bpm;
+    position.timeSigNumerator = timeSigNumerator;
+    position.timeSigDenominator = timeSigDenominator;
+    context.midiMessages.clear();
+    context.audio.clear();
+    plugin.processBlock (context.audio, context.midiMessages);
+
+    // Render until a block past the last event.
+    juce::MidiMessageSequence output;
+    const juce::int64 endSample = (juce::int64) (input.getEndTime() * renderSampleRate) + renderBlockSize;
+    int nextEvent = 0;
+
+    for (juce::int64 blockStart = 0; blockStart < endSample; blockStart += renderBlockSize) {
+        const juce::int64 blockEnd = blockStart + renderBlockSize;
+
+        context.midiMessages.clear();
+        while (nextEvent < input.getNumEvents()) {
+            const juce::MidiMessage& message = input.getEventPointer (nextEvent)->message;
+            const juce::int64 eventSample = (juce::int64) (message.getTimeStamp() * renderSampleRate + 0.5);
+            if (eventSample >= blockEnd) {
+                break;
+            }
+            if (! message.isMetaEvent()) {
+                context.midiMessages.addEvent (message, (int) (eventSample - blockStart));
+                result.eventsIn++;
+            }
+            nextEvent++;
+        }
+
+        position.isPlaying = true;
+        position.timeInSamples = blockStart;
+        position.timeInSeconds = blockStart / renderSampleRate;
+        position.ppqPosition = position.timeInSeconds * bpm / 60.0;
+
+        context.audio.clear();
+        plugin.processBlock (context.audio, context.midiMessages);
+
+        for (const juce::MidiMessageMetadata metadata : context.midiMessages) {
+            const double seconds = (blockStart + metadata.samplePosition) / renderSampleRate;
+            output.addEvent (juce::MidiMessage (metadata.data, metadata.numBytes, seconds * bpm / 60.0 * ticksPerQuarter));
+            result.eventsOut++;
+        }
+    }
+
+    // Write the output, with the clip's tempo and meter.
+    output.addEvent (juce::MidiMessage::tempoMetaEvent (juce::roundToInt (60000000.0 / bpm)));
+    output.addEvent (juce::MidiMessage::timeSignatureMetaEvent (timeSigNumerator, timeSigDenominator));
+    output.sort();
+    output.updateMatchedPairs();
+
+    juce::MidiFile outputMidi;
+    outputMidi.setTicksPerQuarterNote (ticksPerQuarter);
+    outputMidi.addTrack (output);
+
+    outputFile.deleteFile();
+    juce::FileOutputStream outputStream (outputFile);
+    if (outputStream.failedToOpen() || ! outputMidi.writeTo (outputStream)) {
+        result.error = "Can't write " + outputFile.getFullPathName();
+        return result;
+    }
+
+    result.ok = true;
+    result.renderMs = juce::Time::getMillisecondCounterHiRes() - startMs;
+    return result;
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    // Hosting plugins needs the message manager.
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    juce::ArgumentList args (argc, argv);
+    if (args.size() < 4) {
+        std::cerr << "Usage: BatchRender <Plugin.vst3> <clips folder> <matrix.json> <output folder> [--threads N]" << std::endl;
+        return 1;
+    }
+
+    const juce::File pluginFile = args[0].resolveAsFile();
+    const juce::File clipsFolder = args[1].resolveAsFile();
+    const juce::File matrixFile = args[2].resolveAsFile();
+    const juce::File outputFolder = args[3].resolveAsFile();
+
+    int numWorkers = juce::SystemStats::getNumCpus();
+    if (args.containsOption ("--threads")) {
+        numWorkers = juce::jmax (1, args.getValueForOption ("--threads").getIntValue());
+    }
+
+    // Clips and settings.
+    const juce::Array<juce::File> clips = clipsFolder.findChildFiles (juce::File::findFiles, false, "*.mid;*.midi");
+    if (clips.isEmpty()) {
+        std::cerr << "No MIDI files in " << clipsFolder.getFullPathName() << std::endl;
+        return 1;
+    }
+
+    const juce::var matrix = juce::JSON::parse (matrixFile);
+    if (matrix.getDynamicObject() == nullptr) {
+        std::cerr << "Can't read parameter matrix " << matrixFile.getFullPathName() << std::endl;
+        return 1;
+    }
+    const juce::Array<Setting> settings = getSettings (matrix);
+
+    if (outputFolder.createDirectory().failed()) {
+        std::cerr << "Can't create " << outputFolder.getFullPathName() << std::endl;
+        return 1;
+    }
+
+    // One plugin instance per worker, created up front on this thread.
+    juce::VST3PluginFormat format;
+    juce::OwnedArray<juce::PluginDescription> descriptions;
+    format.findAllTypesForFile (descriptions, pluginFile.getFullPathName());
+    if (descriptions.isEmpty()) {
+        std::cerr << "No plugin found in " << pluginFile.getFullPathName() << std::endl;
+        return 1;
+    }
+
+    juce::OwnedArray<WorkerContext> contexts;
+    for (int i = 0; i < numWorkers; i++) {
+        WorkerContext* context = contexts.add (new WorkerContext());
+        juce::String error;
+        context->plugin = format.createInstanceFromDescription (*descriptions[0], renderSampleRate, renderBlockSize, error);
+        if (context->plugin == nullptr) {
+            std::cerr << "Can't load plugin: " << error << std::endl;
+            return 1;
+        }
+
+        const int numChannels = juce::jmax (1, context->plugin->getTotalNumInputChannels(), context->plugin->getTotalNumOutputChannels());
+        context->audio.setSize (numChannels, renderBlockSize);
+        context->midiMessages.ensureSize (4096);
+        context->plugin->setPlayHead (&context->playHead);
+        context->plugin->prepareToPlay (renderSampleRate, renderBlockSize);
+    }
+
+    // Every clip with every setting.
+    const int numJobs = clips.size() * settings.size();
+    std::vector<JobResult> results ((size_t) numJobs);
+
+    for (const juce::File& clip : clips) {
+        outputFolder.getChildFile (clip.getFileNameWithoutExtension()).createDirectory();
+    }
+
+    std::cout << "Rendering " << clips.size() << " clips x " << settings.size() << " settings on "
+        << numWorkers << " workers" << std::endl;
+
+    WorkStealingPool pool (numWorkers);
+    const double startMs = juce::Time::getMillisecondCounterHiRes();
+
+    pool.run (numJobs, [&] (int workerIndex, int jobIndex) {
+        const juce::File& clip = clips.getReference (jobIndex / settings.size());
+        const Setting& setting = settings.getReference (jobIndex % settings.size());
+        const juce::File outputFile = outputFolder.getChildFile (clip.getFileNameWithoutExtension())
+            .getChildFile (clip.getFileNameWithoutExtension() + (setting.label.isEmpty() ? "" : "__" + setting.label) + ".mid");
+
+        JobResult& result = results[(size_t) jobIndex];
+        result = renderClip (*contexts[workerIndex], clip, setting, outputFile);
+        result.workerIndex = workerIndex;
+    });
+
+    const double elapsedSeconds = (juce::Time::getMillisecondCounterHiRes() - startMs) / 1000.0;
+
+    for (WorkerContext* context : contexts) {
+        context->plugin->releaseResources();
+    }
+
+    // Summary report.
+    juce::String report ("clip,setting,ok,events in,events out,render ms,worker,error\n");
+    int numFailed = 0;
+    double totalRenderMs = 0;
+    for (int job = 0; job < numJobs; job++) {
+        const JobResult& result = results[(size_t) job];
+        numFailed += result.ok ? 0 : 1;
+        totalRenderMs += result.renderMs;
+
+        report << clips.getReference (job / settings.size()).getFileName() << ","
+            << settings.getReference (job % settings.size()).label << ","
+            << (result.ok ? "1" : "0") << ","
+            << result.eventsIn << ","
+            << result.eventsOut << ","
+            << juce::String (result.renderMs, 2) << ","
+            << result.workerIndex << ","
+            << result.error.quoted() << "\n";
+    }
+
+    const juce::File reportFile = outputFolder.getChildFile ("summary.csv");
+    reportFile.replaceWithText (report);
+
+    std::cout << "Rendered " << numJobs << " jobs (" << numFailed << " failed) in "
+        << juce::String (elapsedSeconds, 2) << "s, " << juce::String (numJobs / juce::jmax (elapsedSeconds, 0.001), 1) << " jobs/s" << std::endl;
+    // Close to the number of workers when scaling well.
+    std::cout << "Parallel speedup: " << juce::String (totalRenderMs / 1000.0 / juce::jmax (elapsedSeconds, 0.001), 2) << "x" << std::endl;
+    for (int i = 0; i < pool.getNumWorkers(); i++) {
+        std::cout << "  worker " << i << ": " << pool.getNumJobsRun (i) << " jobs, " << pool.getNumSteals (i) << " stolen" << std::endl;
+    }
+    std::cout << "Report: " << reportFile.getFullPathName() << std::endl;
+
+    return (numFailed == 0) ? 0 : 2;
+}
@@ -0,0 +1,129 @@
+/*
+  ==============================================================================
+
+    WorkStealingPool.h
+    Runs a batch of independent jobs across a fixed set of worker threads.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <deque>
+#include <functional>
+
+//==============================================================================
+/**
+ * Each worker has its own queue of jobs. Workers take jobs from the back of their
+ * own queue, and when it's empty steal from the front of another worker's queue,
+ * so long jobs on one worker don't hold up the batch.
+ *
+ * All jobs are queued up front, so a worker is finished when every queue is empty.
+*/
+class WorkStealingPool
+{
+public:
+    /**
+     * Called on a worker thread for each job.
+     *
+     * @param workerIndex The worker running the job, 0 to numWorkers - 1.
+     * @param jobIndex The job to run.
+    */
+    using JobFunction = std::function<void (int workerIndex, int jobIndex)>;
+
+    explicit WorkStealingPool (int numWorkers)
+    {
+        for (int i = 0; i < juce::jmax (1, numWorkers); i++) {
+            workers.add (new Worker (*this, i));
+        }
+    }
+
+    int getNumWorkers () const { return workers.size(); }
+    int getNumJobsRun (int workerIndex) const { return workers[workerIndex]->numJobsRun; }
+    int getNumSteals (int workerIndex) const { return workers[workerIndex]->numSteals; }
+
+    /**
+     * Run jobs 0 to numJobs - 1, and return when they have all finished.
+    */
+    void run (int numJobs, JobFunction function)
+    {
+        jobFunction = function;
+
+        // Deal jobs out evenly to begin with.
+        for (int job = 0; job < numJobs; job++) {
+            workers[job % workers.size()]->jobs.push_back (job);
+        }
+
+        for (Worker* worker : workers) {
+            worker->numJobsRun = 0;
+            worker->numSteals = 0;
+            worker->startThread();
+        }
+
+        for (Worker* worker : workers) {
+            worker->waitForThreadToExit (-1);
+        }
+    }
+
+private:
+    struct Worker : public juce::Thread
+    {
+        Worker (WorkStealingPool& pool, int index)
+            : juce::Thread ("BatchWorker" + juce::String (index)),
+              pool (pool),
+              index (index)
+        {
+        }
+
+        void run () override
+        {
+            int job;
+            while (pool.takeJob (index, job)) {
+                pool.jobFunction (index, job);
+                numJobsRun++;
+            }
+        }
+
+        WorkStealingPool& pool;
+        const int index;
+
+        juce::CriticalSection lock;
+        std::deque<int> jobs;
+
+        int numJobsRun = 0;
+        int numSteals = 0;
+    };
+
+    bool takeJob (int workerIndex, int& job)
+    {
+        Worker& self = *workers[workerIndex];
+        {
+            const juce::ScopedLock sl (self.lock);
+            if (! self.jobs.empty()) {
+                job = self.jobs.back();
+                self.jobs.pop_back();
+                return true;
+            }
+        }
+
+        for (int i = 1; i < workers.size(); i++) {
+            Worker& victim = *workers[(workerIndex + i) % workers.size()];
+            const juce::ScopedLock sl (victim.lock);
+            if (! victim.jobs.empty()) {
+                job = victim.jobs.front();
+                victim.jobs.pop_front();
+                self.numSteals++;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    juce::OwnedArray<Worker> workers;
+    JobFunction jobFunction;
+
+    JUCE_DECLARE_NON_COPYABLE (WorkStealingPool)
+};
@@ -0,0 +1,418 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+    Measures how per-instance cost scales when hosting many plugin instances.
+
+    Usage: BenchmarkHost <Plugin.vst3>... [--instances=1,10,100,300] [--threads=1]
+                         [--blocks=2000] [--block-size=256] [--bpm=120] [--timing]
+
+    Each instance count N builds N chains, each with one instance of every plugin
+    given, in order (MIDI output of one feeds the next). Chains are shared out
+    across the audio threads, and every block all threads run in lockstep.
+
+    --timing has each instance record how far its switches land from the exact
+    phrase boundaries (see CBR_TIMING_DIR), and prints the histograms for each
+    instance count after the table.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "PerfCounters.h"
+#include "../../../Common/BoundaryTiming.h"
+
+#include <iostream>
+
+static const double benchmarkSampleRate = 48000.0;
+static double benchmarkBpm = 120.0;
+// Blocks run before measuring, e.g. to fault in memory.
+static const int numWarmupBlocks = 32;
+
+//==============================================================================
+/**
+ * Transport for an audio thread - always playing.
+*/
+class BenchmarkPlayHead : public juce::AudioPlayHead
+{
+public:
+    bool getCurrentPosition (CurrentPositionInfo& result) override
+    {
+        result = position;
+        return true;
+    }
+
+    CurrentPositionInfo position;
+};
+
+/**
+ * One instance of each plugin, in series.
+*/
+struct Chain
+{
+    juce::OwnedArray<juce::AudioPluginInstance> instances;
+};
+
+//==============================================================================
+/**
+ * Processes a share of the chains, one block each time it's signalled.
+*/
+class AudioThread : public juce::Thread
+{
+public:
+    AudioThread (int index, int blockSize)
+        : juce::Thread ("BenchmarkAudio" + juce::String (index)),
+          blockSize (blockSize)
+    {
+    }
+
+    void addChain (Chain* chain)
+    {
+        chains.add (chain);
+    }
+
+    void prepare (int maxNumChannels)
+    {
+        audio.setSize (juce::jmax (1, maxNumChannels), blockSize);
+        midiMessages.ensureSize (4096);
+
+        playHead.position.resetToDefault();
+        playHead.position.bpm = benchmarkBpm;
+        playHead.position.isPlaying = true;
+
+        for (Chain* chain : chains) {
+            for (juce::AudioPluginInstance* instance : chain->instances) {
+                instance->setPlayHead (&playHead);
+                instance->prepareToPlay (benchmarkSampleRate, blockSize);
+            }
+        }
+
+        blockIndex = 0;
+    }
+
+    /**
+     * Start the next block. Call from the main thread, then waitForBlock().
+    */
+    void startBlock () { startEvent.signal(); }
+    void waitForBlock () { doneEvent.wait (-1); }
+
+    void stop ()
+    {
+        signalThreadShouldExit();
+        startEvent.signal();
+        waitForThreadToExit (-1);
+    }
+
+    void run () override
+    {
+        counters.open();
+
+        while (true) {
+            startEvent.wait (-1);
+            if (threadShouldExit()) {
+                break;
+            }
+
+            if (blockIndex == numWarmupBlocks) {
+                startCpuSeconds = PerfCounters::getThreadCpuSeconds();
+                for (int i = 0; i < PerfCounters::numCounters; i++) {
+                    startCounts[i] = counters.read (i);
+                }
+            }
+
+            processBlock();
+            blockIndex++;
+
+            doneEvent.signal();
+        }
+
+        // Totals since warmup.
+        cpuSeconds = PerfCounters::getThreadCpuSeconds() - startCpuSeconds;
+        for (int i = 0; i < PerfCounters::numCounters; i++) {
+            counts[i] = counters.isAvailable (i) ? counters.read (i) - startCounts[i] : -1;
+        }
+        counters.close();
+    }
+
+    // Results, valid after stop().
+    double cpuSeconds = 0;
+    juce::int64 counts[PerfCounters::numCounters] = {};
+
+private:
+    /**
+     * A note every 16th, walking over the note range so every variation and line gets some.
+    */
+    void addInputEvents (juce::int64 blockStart)
+    {
+        const juce::int64 samplesPerStep = (juce::int64) (benchmarkSampleRate * 60.0 / benchmarkBpm / 4);
+        juce::int64 step = (blockStart + samplesPerStep - 1) / samplesPerStep;
+
+        for (juce::int64 time = step * samplesPerStep; time < blockStart + blockSize; time += samplesPerStep, step++) {
+            const int offset = (int) (time - blockStart);
+            midiMessages.addEvent (juce::MidiMessage::noteOff (1, (int) ((step - 1) * 7 % 128)), offset);
+            midiMessages.addEvent (juce::MidiMessage::noteOn (1, (int) (step * 7 % 128), (juce::uint8) 100), offset);
+        }
+    }
+
+    void processBlock ()
+    {
+        const juce::int64 blockStart = blockIndex * blockSize;
+        playHead.position.timeInSamples = blockStart;
+        playHead.position.timeInSeconds = blockStart / benchmarkSampleRate;
+        playHead.position.ppqPosition = playHead.position.timeInSeconds * benchmarkBpm / 60.0;
+
+        for (Chain* chain : chains) {
+            midiMessages.clear();
+            addInputEvents (blockStart);
+
+            for (juce::AudioPluginInstance* instance : chain->instances) {
+                audio.clear();
+                instance->processBlock (audio, midiMessages);
+            }
+        }
+    }
+
+    const int blockSize;
+    juce::Array<Chain*> chains;
+
+    BenchmarkPlayHead playHead;
+    juce::AudioBuffer<float> audio;
+    juce::MidiBuffer midiMessages;
+    juce::int64 blockIndex = 0;
+
+    juce::WaitableEvent startEvent;
+    juce::WaitableEvent doneEvent;
+
+    PerfCounters counters;
+    double startCpuSeconds = 0;
+    juce::int64 startCounts[PerfCounters::numCounters] = {};
+};
+
+//==============================================================================
+static juce::Array<int> parseIntList (const juce::String& text)
+{
+    juce::Array<int> values;
+    for (const juce::String& token : juce::StringArray::fromTokens (text, ",", "")) {
+        if (token.getIntValue() > 0) {
+            values.add (token.getIntValue());
+        }
+    }
+    return values;
+}
+
+static juce::String formatCount (double value)
+{
+    return (value < 0) ? juce::String ("n/a") : juce::String (value, 0);
+}
+
+/**
+ * Sum the timing files the instances wrote on destruction, and delete them.
+ *
+ * @return One line per plugin and kind of switch.
+*/
+static juce::StringArray collectTiming (const juce::File& timingDir, int numChains)
+{
+    juce::StringArray pluginNames;
+    juce::Array<BoundaryTimingHistogram> totals;
+    for (const juce::File& file : timingDir.findChildFiles (juce::File::findFiles, false, "*.csv")) {
+        BoundaryTimingRecorder::readFromFile (file, pluginNames, totals);
+        file.deleteFile();
+    }
+
+    juce::StringArray lines;
+    for (int plugin = 0; plugin < pluginNames.size(); plugin++) {
+        for (int kind = 0; kind < BoundaryTimingRecorder::numKinds; kind++) {
+            const BoundaryTimingHistogram& histogram = totals.getReference (plugin * BoundaryTimingRecorder::numKinds + kind);
+            if (histogram.total == 0) {
+                continue;
+            }
+
+            juce::String line;
+            line << numChains << "," << pluginNames[plugin] << "," << BoundaryTimingRecorder::getKindName (kind) << ","
+                 << histogram.total << ","
+                 << juce::String (histogram.getMean(), 2) << ","
+                 << juce::String (histogram.getRMS(), 2) << ","
+                 << juce::String (histogram.minError, 2) << ","
+                 << juce::String (histogram.maxError, 2) << ",";
+            for (int bin = 0; bin < CBR_TIMING_NUM_BINS; bin++) {
+                if (histogram.counts[bin] > 0) {
+                    line << " " << BoundaryTimingHistogram::getBinName (bin) << ":" << histogram.counts[bin];
+                }
+            }
+            lines.add (line);
+        }
+    }
+    return lines;
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    // Hosting plugins needs the message manager.
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    juce::ArgumentList args (argc, argv);
+
+    juce::Array<juce::File> pluginFiles;
+    for (const juce::ArgumentList::Argument& arg : args.arguments) {
+        if (! arg.isOption()) {
+            pluginFiles.add (arg.resolveAsFile());
+        }
+    }
+
+    if (pluginFiles.isEmpty()) {
+        std::cerr << "Usage: BenchmarkHost <Plugin.vst3>... [--instances=1,10,100,300] [--threads=1] [--blocks=2000] [--block-size=256] [--bpm=120] [--timing]" << std::endl;
+        return 1;
+    }
+
+    juce::Array<int> instanceCounts = parseIntList (args.getValueForOption ("--instances"));
+    if (instanceCounts.isEmpty()) {
+        instanceCounts = parseIntList ("1,10,100,300");
+    }
+    const int numThreads = juce::jmax (1, args.containsOption ("--threads") ? args.getValueForOption ("--threads").getIntValue() : 1);
+    const int numBlocks = juce::jmax (1, args.containsOption ("--blocks") ? args.getValueForOption ("--blocks").getIntValue() : 2000);
+    const int blockSize = juce::jmax (16, args.containsOption ("--block-size") ? args.getValueForOption ("--block-size").getIntValue() : 256);
+    benchmarkBpm = juce::jlimit (20.0, 999.0, args.containsOption ("--bpm") ? args.getValueForOption ("--bpm").getDoubleValue() : 120.0);
+
+    // The instances read the folder in prepareToPlay.
+    const bool measureTiming = args.containsOption ("--timing");
+    const juce::File timingDir = juce::File::getSpecialLocation (juce::File::tempDirectory).getChildFile ("BenchmarkHostTiming");
+    if (measureTiming) {
+        timingDir.deleteRecursively();
+        timingDir.createDirectory();
+        setenv (CBR_TIMING_DIR_ENV, timingDir.getFullPathName().toRawUTF8(), 1);
+    }
+    juce::StringArray timingLines;
+
+    // Instances are created through each plugin's factory, i.e. its createPluginFilter().
+    juce::VST3PluginFormat format;
+    juce::OwnedArray<juce::PluginDescription> descriptions;
+    for (const juce::File& pluginFile : pluginFiles) {
+        juce::OwnedArray<juce::PluginDescription> found;
+        format.findAllTypesForFile (found, pluginFile.getFullPathName());
+        if (found.isEmpty()) {
+            std::cerr << "No plugin found in " << pluginFile.getFullPathName() << std::endl;
+            return 1;
+        }
+        descriptions.add (new juce::PluginDescription (*found[0]));
+    }
+
+    const double blockSeconds = blockSize / benchmarkSampleRate;
+    std::cout << descriptions.size() << " plugins per chain, " << numThreads << " audio threads, "
+        << numBlocks << " blocks of " << blockSize << " samples (" << juce::String (blockSeconds * 1.0e6, 0) << "us) at " << benchmarkBpm << " bpm" << std::endl;
+    std::cout << "chains,instances,block us mean,block us p99,load %,cpu us/block,cpu us/instance,KB/instance";
+    for (int i = 0; i < PerfCounters::numCounters; i++) {
+        std::cout << "," << PerfCounters::getCounterName (i) << "/block";
+    }
+    std::cout << std::endl;
+
+    for (int numChains : instanceCounts) {
+        const int numInstances = numChains * descriptions.size();
+
+        // Memory footprint of the instances.
+        const juce::int64 residentBefore = PerfCounters::getResidentBytes();
+        juce::OwnedArray<Chain> chains;
+        int maxNumChannels = 1;
+        for (int c = 0; c < numChains; c++) {
+            Chain* chain = chains.add (new Chain());
+            for (const juce::PluginDescription* description : descriptions) {
+                juce::String error;
+                std::unique_ptr<juce::AudioPluginInstance> instance = format.createInstanceFromDescription (*description, benchmarkSampleRate, blockSize, error);
+                if (instance == nullptr) {
+                    std::cerr << "Can't load plugin: " << error << std::endl;
+                    return 1;
+                }
+                maxNumChannels = juce::jmax (maxNumChannels, instance->getTotalNumInputChannels(), instance->getTotalNumOutputChannels());
+                chain->instances.add (instance.release());
+            }
+        }
+
+        // Share the chains out, and run.
+        juce::OwnedArray<AudioThread> threads;
+        for (int t = 0; t < numThreads; t++) {
+            threads.add (new AudioThread (t, blockSize));
+        }
+        for (int c = 0; c < numChains; c++) {
+            threads[c % numThreads]->addChain (chains[c]);
+        }
+        for (AudioThread* thread : threads) {
+            thread->prepare (maxNumChannels);
+        }
+        const juce::int64 residentAfter = PerfCounters::getResidentBytes();
+
+        for (AudioThread* thread : threads) {
+            thread->startThread (juce::Thread::realtimeAudioPriority);
+        }
+
+        juce::Array<double> blockMicroseconds;
+        blockMicroseconds.ensureStorageAllocated (numBlocks);
+        for (int block = 0; block < numWarmupBlocks + numBlocks; block++) {
+            const double startMs = juce::Time::getMillisecondCounterHiRes();
+            for (AudioThread* thread : threads) {
+                thread->startBlock();
+            }
+            for (AudioThread* thread : threads) {
+                thread->waitForBlock();
+            }
+            if (block >= numWarmupBlocks) {
+                blockMicroseconds.add ((juce::Time::getMillisecondCounterHiRes() - startMs) * 1000.0);
+            }
+        }
+
+        double cpuSeconds = 0;
+        double counts[PerfCounters::numCounters] = {};
+        for (AudioThread* thread : threads) {
+            thread->stop();
+            cpuSeconds += thread->cpuSeconds;
+            for (int i = 0; i < PerfCounters::numCounters; i++) {
+                counts[i] = (thread->counts[i] < 0 || counts[i] < 0) ? -1 : counts[i] + thread->counts[i];
+            }
+        }
+
+        for (Chain* chain : chains) {
+            for (juce::AudioPluginInstance* instance : chain->instances) {
+                instance->releaseResources();
+            }
+        }
+
+        // Report.
+        double meanMicroseconds = 0;
+        for (double microseconds : blockMicroseconds) {
+            meanMicroseconds += microseconds;
+        }
+        meanMicroseconds /= blockMicroseconds.size();
+        std::sort (blockMicroseconds.begin(), blockMicroseconds.end());
+        const double p99Microseconds = blockMicroseconds[juce::jmin (blockMicroseconds.size() - 1, (int) (blockMicroseconds.size() * 0.99))];
+
+        const double cpuMicrosecondsPerBlock = cpuSeconds * 1.0e6 / numBlocks;
+
+        std::cout << numChains << "," << numInstances << ","
+            << juce::String (meanMicroseconds, 1) << ","
+            << juce::String (p99Microseconds, 1) << ","
+            << juce::String (meanMicroseconds / (blockSeconds * 1.0e6) * 100.0, 2) << ","
+            << juce::String (cpuMicrosecondsPerBlock, 1) << ","
+            << juce::String (cpuMicrosecondsPerBlock / numInstances, 3) << ","
+            << juce::String ((residentAfter - residentBefore) / 1024.0 / numInstances, 1);
+        for (int i = 0; i < PerfCounters::numCounters; i++) {
+            std::cout << "," << formatCount (counts[i] < 0 ? -1 : counts[i] / numBlocks);
+        }
+        std::cout << std::endl;
+
+        // The instances write their timing when they're deleted.
+        if (measureTiming) {
+            chains.clear();
+            timingLines.addArray (collectTiming (timingDir, numChains));
+        }
+    }
+
+    if (measureTiming) {
+        // Errors in samples, from the exact boundary at the host's ppq. Positive is late.
+        std::cout << std::endl << "chains,plugin,switch,count,error mean,error rms,error min,error max,histogram" << std::endl;
+        for (const juce::String& line : timingLines) {
+            std::cout << line << std::endl;
+        }
+        timingDir.deleteRecursively();
+    }
+
+    return 0;
+}
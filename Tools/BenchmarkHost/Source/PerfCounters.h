@@ -0,0 +1,154 @@
+/*
+  ==============================================================================
+
+    PerfCounters.h
+    Per-thread CPU time and hardware counters, and process memory use.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#if JUCE_LINUX
+ #include <linux/perf_event.h>
+ #include <sys/syscall.h>
+ #include <unistd.h>
+#endif
+
+#if JUCE_LINUX || JUCE_MAC
+ #include <time.h>
+#endif
+
+//==============================================================================
+/**
+ * Hardware counters for the thread that opens them.
+ *
+ * Uses perf_event on Linux. Counters are unavailable on other platforms, or if the
+ * kernel doesn't allow them (see /proc/sys/kernel/perf_event_paranoid).
+*/
+class PerfCounters
+{
+public:
+    enum Counter
+    {
+        cacheMisses = 0,
+        cacheReferences,
+        instructions,
+        numCounters
+    };
+
+    static const char* getCounterName (int counter)
+    {
+        switch (counter) {
+            case cacheMisses: return "cache misses";
+            case cacheReferences: return "cache refs";
+            case instructions: return "instructions";
+        }
+        return "";
+    }
+
+    PerfCounters ()
+    {
+        for (int i = 0; i < numCounters; i++) {
+            fds[i] = -1;
+        }
+    }
+
+    ~PerfCounters ()
+    {
+        close();
+    }
+
+    /**
+     * Start counting for the calling thread.
+    */
+    void open ()
+    {
+        close();
+
+       #if JUCE_LINUX
+        const juce::uint64 configs[numCounters] = {
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_CACHE_REFERENCES,
+            PERF_COUNT_HW_INSTRUCTIONS
+        };
+
+        for (int i = 0; i < numCounters; i++) {
+            perf_event_attr attr;
+            memset (&attr, 0, sizeof (attr));
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof (attr);
+            attr.config = configs[i];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+
+            // This thread, any CPU.
+            fds[i] = (int) syscall (__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+       #endif
+    }
+
+    void close ()
+    {
+        for (int i = 0; i < numCounters; i++) {
+           #if JUCE_LINUX
+            if (fds[i] >= 0) {
+                ::close (fds[i]);
+            }
+           #endif
+            fds[i] = -1;
+        }
+    }
+
+    bool isAvailable (int counter) const { return fds[counter] >= 0; }
+
+    /**
+     * Count since open(), or 0 if unavailable.
+    */
+    juce::int64 read (int counter) const
+    {
+       #if JUCE_LINUX
+        juce::uint64 value = 0;
+        if (fds[counter] >= 0 && ::read (fds[counter], &value, sizeof (value)) == sizeof (value)) {
+            return (juce::int64) value;
+        }
+       #endif
+        return 0;
+    }
+
+    /**
+     * CPU time used by the calling thread.
+    */
+    static double getThreadCpuSeconds ()
+    {
+       #if JUCE_LINUX || JUCE_MAC
+        timespec time;
+        if (clock_gettime (CLOCK_THREAD_CPUTIME_ID, &time) == 0) {
+            return time.tv_sec + time.tv_nsec * 1.0e-9;
+        }
+       #endif
+        return 0;
+    }
+
+    /**
+     * Resident memory of the process, or 0 if unknown.
+    */
+    static juce::int64 getResidentBytes ()
+    {
+       #if JUCE_LINUX
+        // Second field is resident pages.
+        const juce::StringArray fields = juce::StringArray::fromTokens (juce::File ("/proc/self/statm").loadFileAsString(), false);
+        if (fields.size() > 1) {
+            return fields[1].getLargeIntValue() * (juce::int64) sysconf (_SC_PAGESIZE);
+        }
+       #endif
+        return 0;
+    }
+
+private:
+    int fds[numCounters];
+
+    JUCE_DECLARE_NON_COPYABLE (PerfCounters)
+};
@@ -0,0 +1,212 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+    Feeds a block capture (see Common/BlockCapture.h) back through a plugin,
+    and diffs the MIDI output against what was recorded.
+
+    Usage: CaptureReplay <capture.cbrcap> <Plugin.vst3> [max differences to print]
+
+    Exit code 2 if any block differs, 3 if nothing could be compared or the
+    capture is missing params.
+
+    Each block replays with the params it played with, including values set on
+    the audio thread. The program bank, arrangement and layout file aren't in
+    the capture, so replays of sessions using them may differ.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "../../../Common/BlockCapture.h"
+
+#include <iostream>
+
+using namespace BlockCaptureFormat;
+
+//==============================================================================
+/**
+ * Reports the captured playhead position for the block being replayed.
+*/
+class ReplayPlayHead : public juce::AudioPlayHead
+{
+public:
+    bool getCurrentPosition (CurrentPositionInfo& result) override
+    {
+        result = position;
+        return true;
+    }
+
+    void setBlock (const BlockHeader& block)
+    {
+        position.resetToDefault();
+        position.timeInSamples = block.timeInSamples;
+        position.timeInSeconds = (block.sampleRate > 0) ? block.timeInSamples / block.sampleRate : 0;
+        position.bpm = block.bpm;
+        position.ppqPosition = block.ppqPosition;
+        position.timeSigNumerator = block.timeSigNumerator;
+        position.timeSigDenominator = block.timeSigDenominator;
+        position.isPlaying = (block.flags & isPlaying) != 0;
+        position.isLooping = (block.flags & isLooping) != 0;
+    }
+
+private:
+    CurrentPositionInfo position;
+};
+
+//==============================================================================
+/**
+ * One line per event, so output can be compared and printed.
+*/
+static juce::StringArray describeEvents (const juce::MidiBuffer& midiMessages)
+{
+    juce::StringArray events;
+    for (const juce::MidiMessageMetadata metadata : midiMessages) {
+        events.add (juce::String (metadata.samplePosition) + ": " + juce::String::toHexString (metadata.data, metadata.numBytes));
+    }
+    return events;
+}
+
+static void printEvents (const char* label, const juce::StringArray& events)
+{
+    std::cout << "  " << label << ":" << std::endl;
+    for (const juce::String& event : events) {
+        std::cout << "    " << event << std::endl;
+    }
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    // Hosting plugins needs the message manager.
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    if (argc < 3) {
+        std::cerr << "Usage: CaptureReplay <capture.cbrcap> <Plugin.vst3> [max differences to print]" << std::endl;
+        return 1;
+    }
+
+    const juce::File captureFile = juce::File::getCurrentWorkingDirectory().getChildFile (argv[1]);
+    const juce::File pluginFile = juce::File::getCurrentWorkingDirectory().getChildFile (argv[2]);
+    const int maxDiffsToPrint = (argc > 3) ? juce::String (argv[3]).getIntValue() : 20;
+
+    BlockCaptureReader capture;
+    if (! capture.open (captureFile)) {
+        std::cerr << "Can't read capture " << captureFile.getFullPathName() << std::endl;
+        return 1;
+    }
+    if (capture.getNumBlocks() == 0) {
+        std::cerr << "Capture is empty" << std::endl;
+        return 1;
+    }
+
+    // Load the plugin.
+    juce::VST3PluginFormat format;
+    juce::OwnedArray<juce::PluginDescription> descriptions;
+    format.findAllTypesForFile (descriptions, pluginFile.getFullPathName());
+    if (descriptions.isEmpty()) {
+        std::cerr << "No plugin found in " << pluginFile.getFullPathName() << std::endl;
+        return 1;
+    }
+
+    int maxBlockSize = 0;
+    for (int i = 0; i < capture.getNumBlocks(); i++) {
+        maxBlockSize = juce::jmax (maxBlockSize, (int) capture.getBlock (i).numSamples);
+    }
+    double sampleRate = capture.getBlock (0).sampleRate;
+
+    juce::String error;
+    std::unique_ptr<juce::AudioPluginInstance> plugin = format.createInstanceFromDescription (*descriptions[0], sampleRate, maxBlockSize, error);
+    if (plugin == nullptr) {
+        std::cerr << "Can't load plugin: " << error << std::endl;
+        return 1;
+    }
+
+    if (plugin->getName() != capture.getPluginName()) {
+        std::cout << "Warning: capture is from " << capture.getPluginName() << ", replaying through " << plugin->getName() << std::endl;
+    }
+
+    ReplayPlayHead playHead;
+    plugin->prepareToPlay (sampleRate, maxBlockSize);
+
+    const int numChannels = juce::jmax (1, plugin->getTotalNumInputChannels(), plugin->getTotalNumOutputChannels());
+    juce::AudioBuffer<float> audio (numChannels, maxBlockSize);
+    juce::MidiBuffer midiMessages;
+    juce::MidiBuffer expectedMidi;
+
+    const juce::Array<juce::AudioProcessorParameter*>& params = plugin->getParameters();
+
+    int numDiffs = 0;
+    int numTruncated = 0;
+    int numParamsTruncated = 0;
+
+    for (int i = 0; i < capture.getNumBlocks(); i++) {
+        const BlockHeader& block = capture.getBlock (i);
+
+        if (block.sampleRate > 0 && block.sampleRate != sampleRate) {
+            sampleRate = block.sampleRate;
+            plugin->releaseResources();
+            plugin->prepareToPlay (sampleRate, maxBlockSize);
+        }
+
+        // Restore the params, then the playhead and MIDI for the block.
+        const float* paramValues = capture.getParams (i);
+        for (int p = 0; p < juce::jmin ((int) block.numParams, params.size()); p++) {
+            params[p]->setValue (paramValues[p]);
+        }
+
+        playHead.setBlock (block);
+        plugin->setPlayHead ((block.flags & hasPlayhead) ? &playHead : nullptr);
+
+        midiMessages.clear();
+        capture.getMidiIn (i, midiMessages);
+
+        audio.setSize (numChannels, block.numSamples, false, false, true);
+        audio.clear();
+        plugin->processBlock (audio, midiMessages);
+
+        if (block.flags & paramsTruncated) {
+            numParamsTruncated++;
+        }
+        if (block.flags & truncated) {
+            // Not all events were captured, the diff may be misleading.
+            numTruncated++;
+            continue;
+        }
+
+        expectedMidi.clear();
+        capture.getMidiOut (i, expectedMidi);
+
+        const juce::StringArray expected = describeEvents (expectedMidi);
+        const juce::StringArray actual = describeEvents (midiMessages);
+        if (expected != actual) {
+            if (numDiffs < maxDiffsToPrint) {
+                std::cout << "Block " << (juce::int64) block.sequence << " at sample " << block.timeInSamples
+                    << (block.flags & isPlaying ? " (playing)" : " (stopped)") << " differs" << std::endl;
+                printEvents ("recorded", expected);
+                printEvents ("replayed", actual);
+            }
+            numDiffs++;
+        }
+    }
+
+    plugin->releaseResources();
+
+    std::cout << "Replayed " << capture.getNumBlocks() << " blocks, " << numDiffs << " differ";
+    if (numTruncated > 0) {
+        std::cout << ", " << numTruncated << " not compared (truncated)";
+    }
+    std::cout << std::endl;
+
+    // A capture where nothing was compared, or with params missing, isn't a pass.
+    if (numParamsTruncated > 0) {
+        std::cout << numParamsTruncated << " blocks are missing params - the plugin has more than " << CBR_CAPTURE_MAX_PARAMS << std::endl;
+        return 3;
+    }
+    if (numTruncated == capture.getNumBlocks()) {
+        std::cout << "No blocks could be compared" << std::endl;
+        return 3;
+    }
+
+    return (numDiffs == 0) ? 0 : 2;
+}
@@ -0,0 +1,136 @@
+/*
+  ==============================================================================
+
+    EnduranceTransport.h
+    A long, eventful host transport, one block at a time.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+ * What the host does for one block.
+*/
+struct EnduranceBlock
+{
+    juce::int64 timeInSamples;
+    int numSamples;
+    // Tempo in thousandths of a bpm, so the exact grid can use whole numbers.
+    juce::int64 tempoMilliBpm;
+    // Index of the phrase settings in use, as after a program change.
+    int setup;
+};
+
+//==============================================================================
+/**
+ * Plays continuously for a given length, with the changes a long show throws
+ * at the plugins: tempo changes, program changes, loops, seeks and split blocks.
+ * Changes happen between blocks, as in a host.
+ *
+ * The same seed always gives the same session.
+*/
+class EnduranceTransport
+{
+public:
+    /**
+     * @param sampleRate Sample rate, in Hz.
+     * @param maxBlockSize Block size - some blocks are shorter.
+     * @param numSetups Number of phrase settings to switch between.
+     * @param lengthSamples Samples to play in total, including repeated loops.
+     * @param seed Random seed.
+    */
+    EnduranceTransport (juce::int64 sampleRate, int maxBlockSize, int numSetups, juce::int64 lengthSamples, juce::int64 seed)
+        : sampleRate (sampleRate),
+          maxBlockSize (maxBlockSize),
+          numSetups (numSetups),
+          lengthSamples (lengthSamples),
+          random (seed)
+    {
+        // Start in the pre-roll, before the first bar.
+        timeInSamples = -8 * maxBlockSize;
+    }
+
+    /**
+     * @return False when the session is over.
+    */
+    bool nextBlock (EnduranceBlock& block)
+    {
+        if (playedSamples >= lengthSamples) {
+            return false;
+        }
+
+        if (loopRepeats > 0 && timeInSamples >= loopEnd) {
+            timeInSamples = loopStart;
+            loopRepeats--;
+            numLoops++;
+        }
+        else if (random.nextInt (20000) == 0) {
+            tempoMilliBpm = getTempoChoice (random.nextInt (numTempoChoices));
+            numTempoChanges++;
+        }
+        else if (random.nextInt (50000) == 0) {
+            setup = random.nextInt (numSetups);
+            numSetupChanges++;
+        }
+        else if (loopRepeats == 0 && random.nextInt (30000) == 0) {
+            // Anywhere in twice the session length, so seeks reach well past the end.
+            timeInSamples = (juce::int64) (random.nextDouble() * 2.0 * lengthSamples);
+            numSeeks++;
+        }
+        else if (loopRepeats == 0 && random.nextInt (10000) == 0) {
+            // Loop the next 1-8 bars of 4/4 a few times, from wherever we are.
+            loopStart = timeInSamples;
+            loopEnd = loopStart + (1 + random.nextInt (8)) * 4 * 60 * 1000 * sampleRate / tempoMilliBpm;
+            loopRepeats = 1 + random.nextInt (4);
+        }
+
+        // Hosts split blocks for automation, and at the loop end.
+        int numSamples = (random.nextInt (16) == 0) ? 1 + random.nextInt (maxBlockSize) : maxBlockSize;
+        if (loopRepeats > 0 && timeInSamples < loopEnd) {
+            numSamples = (int) juce::jmin ((juce::int64) numSamples, loopEnd - timeInSamples);
+        }
+
+        block.timeInSamples = timeInSamples;
+        block.numSamples = numSamples;
+        block.tempoMilliBpm = tempoMilliBpm;
+        block.setup = setup;
+
+        timeInSamples += numSamples;
+        playedSamples += numSamples;
+        return true;
+    }
+
+    // Changes so far.
+    int numTempoChanges = 0;
+    int numSetupChanges = 0;
+    int numLoops = 0;
+    int numSeeks = 0;
+
+private:
+    // Tempos that come up in sets, plus one that isn't exact in binary.
+    static const int numTempoChoices = 8;
+    static juce::int64 getTempoChoice (int index)
+    {
+        static const juce::int64 tempos[numTempoChoices] = {120000, 60000, 93750, 127500, 140000, 174000, 200000, 133333};
+        return tempos[index];
+    }
+
+    const juce::int64 sampleRate;
+    const int maxBlockSize;
+    const int numSetups;
+    const juce::int64 lengthSamples;
+    juce::Random random;
+
+    juce::int64 timeInSamples;
+    juce::int64 playedSamples = 0;
+    juce::int64 tempoMilliBpm = 120000;
+    int setup = 0;
+
+    juce::int64 loopStart = 0;
+    juce::int64 loopEnd = 0;
+    int loopRepeats = 0;
+};
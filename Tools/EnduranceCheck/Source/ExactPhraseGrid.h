@@ -0,0 +1,158 @@
+/*
+  ==============================================================================
+
+    ExactPhraseGrid.h
+    The phrase grid in whole-number maths, to check PhraseClock against.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "../../../Common/PhraseClock.h"
+
+//==============================================================================
+/**
+ * Where PhraseClock's boundaries should be, worked out exactly.
+ *
+ * The tempo is held in thousandths of a bpm and the sample rate in whole Hz, so
+ * one sample is exactly 2 * tempoMilliBpm / (125 * sampleRate) ticks and every
+ * boundary is a ratio of whole numbers. Samples follow the same rule as the
+ * clock: the sample nearest to the exact boundary starts the new phrase.
+ *
+ * Everything fits in an int64 for up to a few days at 192kHz and phrases up to
+ * 1024 beats.
+*/
+class ExactPhraseGrid
+{
+public:
+    void update (juce::int64 newTempoMilliBpm, juce::int64 newSampleRate, juce::int64 newPhraseLengthTicks, juce::int64 newOffsetTicks)
+    {
+        tempoMilliBpm = newTempoMilliBpm;
+        phraseLengthTicks = newPhraseLengthTicks;
+        offsetTicks = newOffsetTicks;
+        samplesScale = 125 * newSampleRate;
+    }
+
+    /**
+     * The phrase a sample falls in, as PhraseClock::getPhraseIndex().
+    */
+    juce::int64 getPhraseIndex (juce::int64 timeInSamples) const
+    {
+        // Ticks at the middle of the sample, against the phrase grid.
+        return floorDiv ((2 * timeInSamples + 1) * tempoMilliBpm - offsetTicks * samplesScale, phraseLengthTicks * samplesScale);
+    }
+
+    /**
+     * The first sample of a phrase.
+    */
+    juce::int64 getPhraseStart (juce::int64 phraseIndex) const
+    {
+        return ceilDiv (getBoundaryNumerator (phraseIndex) - tempoMilliBpm, 2 * tempoMilliBpm);
+    }
+
+    /**
+     * First sample after a given time that starts a new phrase, as PhraseClock::getNextPhraseStart().
+    */
+    juce::int64 getNextPhraseStart (juce::int64 timeInSamples) const
+    {
+        return getPhraseStart (getPhraseIndex (timeInSamples) + 1);
+    }
+
+    /**
+     * True if a phrase's exact boundary is half way between two samples,
+     * where either sample is as near.
+    */
+    bool isBoundaryTied (juce::int64 phraseIndex) const
+    {
+        const juce::int64 numerator = getBoundaryNumerator (phraseIndex);
+        return numerator % tempoMilliBpm == 0 && ((numerator / tempoMilliBpm) & 1) != 0;
+    }
+
+    /**
+     * Position within the current phrase, clamped 0-1 as PhraseClock::getPhrasePosition().
+    */
+    double getPhrasePosition (juce::int64 timeInSamples) const
+    {
+        juce::int64 numerator, denominator;
+        getPositionRatio (timeInSamples, numerator, denominator);
+        return juce::jlimit (0.0, 1.0, (double) numerator / (double) denominator);
+    }
+
+    /**
+     * A lane's output for a linear ramp over the phrase, rounded as ControllerMotion rounds CCs.
+     *
+     * @param maxValue 127 or 16383.
+     * @param tieDistance Set to how far the exact value is from rounding the other way, in steps.
+     * @return The CC value.
+    */
+    int getRampValue (juce::int64 timeInSamples, int maxValue, double& tieDistance) const
+    {
+        juce::int64 numerator, denominator;
+        getPositionRatio (timeInSamples, numerator, denominator);
+        numerator = juce::jlimit ((juce::int64) 0, denominator, numerator);
+
+        // round (numerator / denominator * maxValue), and the distance from the rounding point.
+        const juce::int64 scaled = 2 * numerator * maxValue + denominator;
+        const juce::int64 remainder = scaled % (2 * denominator);
+        tieDistance = (double) juce::jmin (remainder, 2 * denominator - remainder) / (double) (2 * denominator);
+        return (int) (scaled / (2 * denominator));
+    }
+
+    /**
+     * A lane's output for a stepped ramp over the phrase, which moves on each beat,
+     * rounded as ControllerMotion rounds CCs.
+     *
+     * @param beatTicks Length of a beat. The phrase must be a whole number of beats.
+     * @param maxValue 127 or 16383.
+     * @param isTied Set true if either sample would be right - a beat half way between
+     *               two samples, or a value half way between two CC values.
+     * @return The CC value.
+    */
+    int getSteppedRampValue (juce::int64 timeInSamples, juce::int64 beatTicks, int maxValue, bool& isTied) const
+    {
+        // Beats are counted from the phrase grid's offset, like phrases.
+        const juce::int64 beatScale = beatTicks * samplesScale;
+        const juce::int64 sampleStart = 2 * timeInSamples * tempoMilliBpm - offsetTicks * samplesScale;
+        const juce::int64 beatsPerPhrase = phraseLengthTicks / beatTicks;
+        const juce::int64 beat = floorDiv (sampleStart + tempoMilliBpm, beatScale) - getPhraseIndex (timeInSamples) * beatsPerPhrase;
+
+        const juce::int64 scaled = 2 * beat * maxValue + beatsPerPhrase;
+        isTied = sampleStart % beatScale == 0 || (sampleStart + 2 * tempoMilliBpm) % beatScale == 0
+                 || scaled % (2 * beatsPerPhrase) == 0;
+        return (int) floorDiv (scaled, 2 * beatsPerPhrase);
+    }
+
+    static juce::int64 floorDiv (juce::int64 numerator, juce::int64 denominator)
+    {
+        const juce::int64 quotient = numerator / denominator;
+        return (numerator % denominator != 0 && (numerator < 0) != (denominator < 0)) ? quotient - 1 : quotient;
+    }
+
+    static juce::int64 ceilDiv (juce::int64 numerator, juce::int64 denominator)
+    {
+        return -floorDiv (-numerator, denominator);
+    }
+
+private:
+    /**
+     * Twice the exact boundary sample, times the tempo.
+    */
+    juce::int64 getBoundaryNumerator (juce::int64 phraseIndex) const
+    {
+        return (phraseIndex * phraseLengthTicks + offsetTicks) * samplesScale;
+    }
+
+    void getPositionRatio (juce::int64 timeInSamples, juce::int64& numerator, juce::int64& denominator) const
+    {
+        denominator = phraseLengthTicks * samplesScale;
+        numerator = 2 * timeInSamples * tempoMilliBpm - offsetTicks * samplesScale - getPhraseIndex (timeInSamples) * denominator;
+    }
+
+    juce::int64 tempoMilliBpm = 120000;
+    juce::int64 phraseLengthTicks = CBR_PHRASECLOCK_TICKS_PER_QUARTER;
+    juce::int64 offsetTicks = 0;
+    // 125 * sample rate - ticks per sample is 2 * tempoMilliBpm / samplesScale.
+    juce::int64 samplesScale = 125 * 48000;
+};
@@ -0,0 +1,304 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+    Plays a day or more of transport through the phrase clock as fast as it
+    will go, and checks every boundary against the exact grid.
+
+    Usage: EnduranceCheck [--hours=24] [--rates=48000,96000,192000]
+                          [--block-size=512] [--seed=1]
+
+    Each block is checked the way the plugins use the clock:
+    - the phrase at the block start (arrangements, LFO phase, display)
+    - the sample a phrase starts on in the block, and that notes either side of
+      it are in the phrases the clock's switch test puts them in
+    - each CC grid line in the block, and the 14-bit value ControllerMotion's own
+      ramp code (LaneRamp) outputs on it for a linear and a stepped ramp across
+      the phrase
+
+    The plugins' switching decisions themselves aren't run - only the clock
+    queries they make.
+
+    The exact grid follows the plugins - a tempo change moves the phrase grid,
+    measured from the host's sample time at the new tempo.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "../../../Common/PhraseClock.h"
+#include "../../../ControllerMotion/Source/LaneRamp.h"
+#include "EnduranceTransport.h"
+#include "ExactPhraseGrid.h"
+
+#include <iostream>
+
+// Failures to print for each sample rate.
+static const int maxFailuresShown = 10;
+
+//==============================================================================
+/**
+ * Phrase settings to switch between, as in a set's programs.
+*/
+struct PhraseSetup
+{
+    const char* name;
+    int phraseChoice;
+    int customLength;
+    int timeSigNumerator;
+    int timeSigDenominator;
+    int offsetBeats;
+    // ControllerMotion's CC grid step.
+    int gridTicks;
+};
+
+static const PhraseSetup phraseSetups[] = {
+    {"1 beat", 0, 1, 4, 4, 0, CBR_PHRASECLOCK_TICKS_PER_QUARTER / 8},
+    {"16 beats", 3, 1, 4, 4, 0, CBR_PHRASECLOCK_TICKS_PER_QUARTER / 4},
+    {"64 beats, offset 3", 5, 1, 4, 4, 3, CBR_PHRASECLOCK_TICKS_PER_QUARTER / 8},
+    {"3 bars of 7/8, offset 2", PhraseClock::customBarsChoice, 3, 7, 8, 2, CBR_PHRASECLOCK_TICKS_PER_QUARTER / 2},
+    {"5 bars of 6/8", PhraseClock::customBarsChoice, 5, 6, 8, 0, CBR_PHRASECLOCK_TICKS_PER_QUARTER / 8},
+    {"1024 beats", PhraseClock::customBeatsChoice, 1024, 4, 4, 0, CBR_PHRASECLOCK_TICKS_PER_QUARTER},
+};
+static const int numPhraseSetups = sizeof (phraseSetups) / sizeof (phraseSetups[0]);
+
+//==============================================================================
+/**
+ * Totals for one session.
+*/
+struct SessionResults
+{
+    juce::int64 numBlocks = 0;
+    juce::int64 numPhraseStarts = 0;
+    juce::int64 numGridLines = 0;
+
+    juce::int64 indexErrors = 0;
+    juce::int64 switchErrors = 0;
+    juce::int64 gridErrors = 0;
+    juce::int64 valueErrors = 0;
+    // Boundaries exactly half way between samples, where either is right.
+    juce::int64 numTies = 0;
+    // Largest difference between the clock's phrase position and the exact one.
+    double maxPositionErrorSamples = 0;
+
+    juce::StringArray failures;
+
+    juce::int64 getNumErrors () const { return indexErrors + switchErrors + gridErrors + valueErrors; }
+};
+
+/**
+ * Check one block against the exact grids.
+*/
+static void checkBlock (const EnduranceBlock& block, const PhraseClock& clock, const ExactPhraseGrid& exact,
+                        const PhraseClock& gridClock, const ExactPhraseGrid& exactGrid, SessionResults& results)
+{
+    const juce::int64 blockStart = block.timeInSamples;
+    const juce::int64 blockEnd = blockStart + block.numSamples;
+
+    auto fail = [&] (juce::int64& count, const char* check, juce::int64 time, juce::int64 expected, juce::int64 actual) {
+        count++;
+        if (results.failures.size() < maxFailuresShown) {
+            juce::String failure;
+            failure << check << " at sample " << time << ", " << juce::String (block.tempoMilliBpm / 1000.0, 3) << " bpm, "
+                    << phraseSetups[block.setup].name << ": expected " << expected << ", got " << actual;
+            results.failures.add (failure);
+        }
+    };
+
+    // The phrase at the block start.
+    const juce::int64 phraseIndex = exact.getPhraseIndex (blockStart);
+    if (clock.getPhraseIndex (blockStart) != phraseIndex) {
+        if (exact.isBoundaryTied (phraseIndex) && exact.getPhraseStart (phraseIndex) == blockStart) {
+            results.numTies++;
+        }
+        else {
+            fail (results.indexErrors, "phrase index", blockStart, phraseIndex, clock.getPhraseIndex (blockStart));
+        }
+    }
+
+    // The phrase start in the block, as a switch sees it.
+    const juce::int64 nextPhrase = exact.getPhraseIndex (blockStart - 1) + 1;
+    const juce::int64 phraseStart = exact.getPhraseStart (nextPhrase);
+    const int expectedOffset = phraseStart < blockEnd ? (int) (phraseStart - blockStart) : -1;
+    const int actualOffset = clock.getPhraseStartInBlock (blockStart, block.numSamples);
+    if (actualOffset != expectedOffset) {
+        // Compare the sample times, as a tie can move the start into the next block.
+        if (exact.isBoundaryTied (nextPhrase) && std::abs (clock.getNextPhraseStart (blockStart - 1) - phraseStart) <= 1) {
+            results.numTies++;
+        }
+        else {
+            fail (results.switchErrors, "phrase start in block", blockStart, expectedOffset, actualOffset);
+        }
+    }
+    else if (actualOffset >= 0) {
+        results.numPhraseStarts++;
+
+        // Notes either side of the switch sample, as NoteFilter::processNote() tests them.
+        if (phraseStart > blockStart && clock.timeRangeStraddlesPhraseChange (blockStart, phraseStart - 1)) {
+            fail (results.switchErrors, "note before phrase start", phraseStart - 1, nextPhrase - 1, clock.getPhraseIndex (phraseStart - 1));
+        }
+        if (! clock.timeRangeStraddlesPhraseChange (phraseStart - 1, phraseStart)) {
+            fail (results.switchErrors, "note on phrase start", phraseStart, nextPhrase, clock.getPhraseIndex (phraseStart));
+        }
+    }
+
+    // CC grid lines in the block, as ControllerMotion walks them.
+    juce::int64 gridTime = gridClock.getNextPhraseStart (blockStart - 1);
+    juce::int64 exactGridTime = exactGrid.getNextPhraseStart (blockStart - 1);
+    while (gridTime < blockEnd || exactGridTime < blockEnd) {
+        if (gridTime != exactGridTime) {
+            const juce::int64 gridLine = exactGrid.getPhraseIndex (exactGridTime);
+            if (exactGrid.isBoundaryTied (gridLine) && std::abs (gridTime - exactGridTime) <= 1) {
+                results.numTies++;
+            }
+            else {
+                fail (results.gridErrors, "CC grid line", blockStart, exactGridTime, gridTime);
+            }
+            break;
+        }
+        results.numGridLines++;
+
+        // Grid lines on a tied phrase boundary can be in either phrase.
+        const juce::int64 gridPhrase = exact.getPhraseIndex (gridTime);
+        if (clock.getPhraseIndex (gridTime) != gridPhrase) {
+            if (exact.isBoundaryTied (gridPhrase) && exact.getPhraseStart (gridPhrase) == gridTime) {
+                results.numTies++;
+            }
+            else {
+                fail (results.indexErrors, "phrase index on grid line", gridTime, gridPhrase, clock.getPhraseIndex (gridTime));
+            }
+            gridTime = gridClock.getNextPhraseStart (gridTime);
+            exactGridTime = exactGrid.getNextPhraseStart (exactGridTime);
+            continue;
+        }
+
+        // A ramp from 0 to 1 across the phrase, output as 14-bit CCs by ControllerMotion's lane code.
+        const double position = clock.getPhrasePosition (gridTime);
+        const double positionError = std::abs (position - exact.getPhrasePosition (gridTime)) / clock.getPhrasesPerSample();
+        results.maxPositionErrorSamples = juce::jmax (results.maxPositionErrorSamples, positionError);
+
+        LaneRamp ramp;
+        ramp.start (0.0, 0.0, 1.0);
+        const int timeSigDenominator = phraseSetups[block.setup].timeSigDenominator;
+
+        double tieDistance = 0;
+        const int expectedValue = exact.getRampValue (gridTime, 16383, tieDistance);
+        const int actualValue = LaneRamp::getOutputValue (ramp.getValue (RampCurves::linear, position, clock, timeSigDenominator), 16383);
+        if (actualValue != expectedValue) {
+            if (tieDistance < 1.0e-6) {
+                results.numTies++;
+            }
+            else {
+                fail (results.valueErrors, "linear ramp CC value", gridTime, expectedValue, actualValue);
+            }
+        }
+
+        // The same ramp, stepped on each beat.
+        bool isSteppedTied = false;
+        const int expectedStepped = exact.getSteppedRampValue (gridTime, PhraseClock::getBeatTicks (timeSigDenominator), 16383, isSteppedTied);
+        const int actualStepped = LaneRamp::getOutputValue (ramp.getValue (RampCurves::steppedBeats, position, clock, timeSigDenominator), 16383);
+        if (actualStepped != expectedStepped) {
+            if (isSteppedTied) {
+                results.numTies++;
+            }
+            else {
+                fail (results.valueErrors, "stepped ramp CC value", gridTime, expectedStepped, actualStepped);
+            }
+        }
+
+        gridTime = gridClock.getNextPhraseStart (gridTime);
+        exactGridTime = exactGrid.getNextPhraseStart (exactGridTime);
+    }
+}
+
+/**
+ * Play a whole session at one sample rate.
+*/
+static SessionResults runSession (juce::int64 sampleRate, int blockSize, double hours, juce::int64 seed,
+                                  int& numTempoChanges, int& numSetupChanges, int& numLoops, int& numSeeks)
+{
+    SessionResults results;
+    EnduranceTransport transport (sampleRate, blockSize, numPhraseSetups, (juce::int64) (hours * 3600.0 * sampleRate), seed);
+
+    PhraseClock clock;
+    PhraseClock gridClock;
+    ExactPhraseGrid exact;
+    ExactPhraseGrid exactGrid;
+
+    EnduranceBlock block;
+    while (transport.nextBlock (block)) {
+        // The same updates the plugins make every block.
+        const PhraseSetup& setup = phraseSetups[block.setup];
+        const juce::int64 lengthTicks = PhraseClock::getPhraseLengthTicks (setup.phraseChoice, setup.customLength, setup.timeSigNumerator, setup.timeSigDenominator);
+        const juce::int64 offsetTicks = setup.offsetBeats * PhraseClock::getBeatTicks (setup.timeSigDenominator);
+        const double tempoBpm = block.tempoMilliBpm / 1000.0;
+
+        clock.update (tempoBpm, (double) sampleRate, lengthTicks, offsetTicks);
+        gridClock.update (tempoBpm, (double) sampleRate, setup.gridTicks, offsetTicks);
+        exact.update (block.tempoMilliBpm, sampleRate, lengthTicks, offsetTicks);
+        exactGrid.update (block.tempoMilliBpm, sampleRate, setup.gridTicks, offsetTicks);
+
+        checkBlock (block, clock, exact, gridClock, exactGrid, results);
+        results.numBlocks++;
+    }
+
+    numTempoChanges = transport.numTempoChanges;
+    numSetupChanges = transport.numSetupChanges;
+    numLoops = transport.numLoops;
+    numSeeks = transport.numSeeks;
+    return results;
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    juce::ArgumentList args (argc, argv);
+
+    const double hours = juce::jlimit (0.01, 96.0, args.containsOption ("--hours") ? args.getValueForOption ("--hours").getDoubleValue() : 24.0);
+    const int blockSize = juce::jlimit (16, 8192, args.containsOption ("--block-size") ? args.getValueForOption ("--block-size").getIntValue() : 512);
+    const juce::int64 seed = args.containsOption ("--seed") ? args.getValueForOption ("--seed").getLargeIntValue() : 1;
+
+    juce::Array<juce::int64> sampleRates;
+    for (const juce::String& token : juce::StringArray::fromTokens (args.getValueForOption ("--rates"), ",", "")) {
+        if (token.getLargeIntValue() > 0) {
+            sampleRates.add (juce::jmin (token.getLargeIntValue(), (juce::int64) 384000));
+        }
+    }
+    if (sampleRates.isEmpty()) {
+        sampleRates.add (48000);
+        sampleRates.add (96000);
+        sampleRates.add (192000);
+    }
+
+    std::cout << hours << " hours at each rate, blocks of up to " << blockSize << " samples, seed " << seed << std::endl;
+    std::cout << "rate,blocks,phrase starts,grid lines,tempo changes,program changes,loops,seeks,"
+              << "index errors,switch errors,grid errors,CC value errors,ties,max position error (samples),"
+              << "seconds,x realtime,blocks/s" << std::endl;
+
+    juce::int64 numErrors = 0;
+    for (juce::int64 sampleRate : sampleRates) {
+        int numTempoChanges = 0, numSetupChanges = 0, numLoops = 0, numSeeks = 0;
+
+        const double startMs = juce::Time::getMillisecondCounterHiRes();
+        const SessionResults results = runSession (sampleRate, blockSize, hours, seed, numTempoChanges, numSetupChanges, numLoops, numSeeks);
+        const double seconds = juce::jmax (1.0e-6, (juce::Time::getMillisecondCounterHiRes() - startMs) / 1000.0);
+
+        std::cout << sampleRate << "," << results.numBlocks << "," << results.numPhraseStarts << "," << results.numGridLines << ","
+                  << numTempoChanges << "," << numSetupChanges << "," << numLoops << "," << numSeeks << ","
+                  << results.indexErrors << "," << results.switchErrors << "," << results.gridErrors << "," << results.valueErrors << ","
+                  << results.numTies << "," << juce::String (results.maxPositionErrorSamples, 9) << ","
+                  << juce::String (seconds, 2) << "," << juce::String (hours * 3600.0 / seconds, 0) << ","
+                  << juce::String (results.numBlocks / seconds, 0) << std::endl;
+
+        for (const juce::String& failure : results.failures) {
+            std::cout << "  " << failure << std::endl;
+        }
+        numErrors += results.getNumErrors();
+    }
+
+    if (numErrors > 0) {
+        std::cout << numErrors << " errors" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,298 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+    Measures how long OSC cues take to reach a plugin's audio thread.
+
+    Usage: OSCLatency <Plugin.vst3> --param=<parameter ID> [--values=1,2]
+                      [--port=9000] [--instance=1] [--cues=200] [--block-size=256]
+
+    Hosts one instance listening on the port, and runs it in real time on an
+    audio thread. Cues alternate the parameter between the two values, sent
+    over the loopback interface at irregular intervals. A cue's latency is
+    the time from sending it to the start of the block that applied it.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "../../../Common/OSCControl.h"
+
+#include <atomic>
+#include <iostream>
+#include <stdlib.h>
+
+static const double latencySampleRate = 48000.0;
+static const double latencyBpm = 120.0;
+// Cues not applied by then are counted as lost.
+static const double cueTimeoutMs = 1000.0;
+// Time between cues, varied so they land anywhere in a block.
+static const int minCueIntervalMs = 20;
+static const int maxCueIntervalMs = 70;
+
+//==============================================================================
+/**
+ * Transport for the audio thread - always playing.
+*/
+class LatencyPlayHead : public juce::AudioPlayHead
+{
+public:
+    bool getCurrentPosition (CurrentPositionInfo& result) override
+    {
+        result = position;
+        return true;
+    }
+
+    CurrentPositionInfo position;
+};
+
+//==============================================================================
+/**
+ * Runs the instance one block per block period, like a sound card would,
+ * and notes the block where any parameter changes.
+*/
+class AudioThread : public juce::Thread
+{
+public:
+    AudioThread (juce::AudioPluginInstance& instance, int blockSize)
+        : juce::Thread ("OSCLatencyAudio"),
+          instance (instance),
+          blockSize (blockSize)
+    {
+        audio.setSize (juce::jmax (1, instance.getTotalNumInputChannels(), instance.getTotalNumOutputChannels()), blockSize);
+        midiMessages.ensureSize (4096);
+
+        playHead.position.resetToDefault();
+        playHead.position.bpm = latencyBpm;
+        playHead.position.isPlaying = true;
+
+        instance.setPlayHead (&playHead);
+        instance.prepareToPlay (latencySampleRate, blockSize);
+
+        for (juce::AudioProcessorParameter* parameter : instance.getParameters()) {
+            lastValues.add (parameter->getValue());
+        }
+    }
+
+    ~AudioThread () override
+    {
+        stopThread (-1);
+        instance.releaseResources();
+    }
+
+    void run () override
+    {
+        const double blockMs = blockSize * 1000.0 / latencySampleRate;
+        double nextBlockMs = juce::Time::getMillisecondCounterHiRes();
+
+        while (! threadShouldExit()) {
+            // Sleep most of the way, then yield until the block is due.
+            double now = juce::Time::getMillisecondCounterHiRes();
+            if (nextBlockMs - now > 2.0) {
+                juce::Thread::sleep ((int) (nextBlockMs - now - 1.0));
+            }
+            while ((now = juce::Time::getMillisecondCounterHiRes()) < nextBlockMs) {
+                juce::Thread::yield();
+            }
+            nextBlockMs += blockMs;
+
+            const int blockIndex = numBlocksStarted++;
+            processBlock (blockIndex, now);
+        }
+    }
+
+    int getNumBlocksStarted () const { return numBlocksStarted.load(); }
+    int getNumChanges () const { return numChanges.load (std::memory_order_acquire); }
+
+    // The block where the parameters last changed, valid once getNumChanges() has moved on.
+    int getChangedBlock () const { return changedBlock; }
+    double getChangedBlockStartMs () const { return changedBlockStartMs; }
+
+private:
+    void processBlock (int blockIndex, double startMs)
+    {
+        const juce::int64 blockStart = (juce::int64) blockIndex * blockSize;
+        playHead.position.timeInSamples = blockStart;
+        playHead.position.timeInSeconds = blockStart / latencySampleRate;
+        playHead.position.ppqPosition = playHead.position.timeInSeconds * latencyBpm / 60.0;
+
+        audio.clear();
+        midiMessages.clear();
+        instance.processBlock (audio, midiMessages);
+
+        bool changed = false;
+        const juce::Array<juce::AudioProcessorParameter*>& parameters = instance.getParameters();
+        for (int i = 0; i < juce::jmin (parameters.size(), lastValues.size()); i++) {
+            const float value = parameters[i]->getValue();
+            if (value != lastValues[i]) {
+                lastValues.set (i, value);
+                changed = true;
+            }
+        }
+
+        if (changed) {
+            changedBlock = blockIndex;
+            changedBlockStartMs = startMs;
+            numChanges.fetch_add (1, std::memory_order_release);
+        }
+    }
+
+    juce::AudioPluginInstance& instance;
+    const int blockSize;
+
+    LatencyPlayHead playHead;
+    juce::AudioBuffer<float> audio;
+    juce::MidiBuffer midiMessages;
+    juce::Array<float> lastValues;
+
+    std::atomic<int> numBlocksStarted { 0 };
+    std::atomic<int> numChanges { 0 };
+    int changedBlock = 0;
+    double changedBlockStartMs = 0;
+};
+
+//==============================================================================
+static juce::AudioProcessorParameter* findParameter (juce::AudioPluginInstance& plugin, const juce::String& name)
+{
+    for (juce::AudioProcessorParameter* param : plugin.getParameters()) {
+        if (param->getName (64).equalsIgnoreCase (name)) {
+            return param;
+        }
+    }
+    return nullptr;
+}
+
+template <typename Value>
+static Value getPercentile (const juce::Array<Value>& sorted, double percentile)
+{
+    return sorted[juce::jmin (sorted.size() - 1, (int) (sorted.size() * percentile))];
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    // Hosting plugins needs the message manager.
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    juce::ArgumentList args (argc, argv);
+
+    juce::File pluginFile;
+    for (const juce::ArgumentList::Argument& arg : args.arguments) {
+        if (! arg.isOption()) {
+            pluginFile = arg.resolveAsFile();
+        }
+    }
+
+    const juce::String parameterID = args.getValueForOption ("--param");
+    if (pluginFile == juce::File() || parameterID.isEmpty()) {
+        std::cerr << "Usage: OSCLatency <Plugin.vst3> --param=<parameter ID> [--values=1,2] [--port=9000] [--instance=1] [--cues=200] [--block-size=256]" << std::endl;
+        return 1;
+    }
+
+    juce::StringArray values = juce::StringArray::fromTokens (args.containsOption ("--values") ? args.getValueForOption ("--values") : "1,2", ",", "");
+    if (values.size() != 2) {
+        std::cerr << "--values takes two values to alternate between" << std::endl;
+        return 1;
+    }
+    const int port = args.containsOption ("--port") ? args.getValueForOption ("--port").getIntValue() : 9000;
+    const int instanceId = juce::jlimit (1, CBR_OSC_MAX_INSTANCES, args.containsOption ("--instance") ? args.getValueForOption ("--instance").getIntValue() : 1);
+    const int numCues = juce::jmax (1, args.containsOption ("--cues") ? args.getValueForOption ("--cues").getIntValue() : 200);
+    const int blockSize = juce::jmax (16, args.containsOption ("--block-size") ? args.getValueForOption ("--block-size").getIntValue() : 256);
+
+    // The plugin reads the port when its first instance is created.
+    setenv (CBR_OSC_PORT_ENV, juce::String (port).toRawUTF8(), 1);
+
+    juce::VST3PluginFormat format;
+    juce::OwnedArray<juce::PluginDescription> found;
+    format.findAllTypesForFile (found, pluginFile.getFullPathName());
+    if (found.isEmpty()) {
+        std::cerr << "No plugin found in " << pluginFile.getFullPathName() << std::endl;
+        return 1;
+    }
+
+    juce::String error;
+    std::unique_ptr<juce::AudioPluginInstance> instance = format.createInstanceFromDescription (*found[0], latencySampleRate, blockSize, error);
+    if (instance == nullptr) {
+        std::cerr << "Can't load plugin: " << error << std::endl;
+        return 1;
+    }
+
+    juce::AudioProcessorParameter* oscInstance = findParameter (*instance, "OSC instance");
+    if (oscInstance == nullptr) {
+        std::cerr << instance->getName() << " has no OSC instance parameter" << std::endl;
+        return 1;
+    }
+    oscInstance->setValue (oscInstance->getValueForText (juce::String (instanceId)));
+
+    juce::OSCSender sender;
+    if (! sender.connect ("127.0.0.1", port)) {
+        std::cerr << "Can't send to port " << port << std::endl;
+        return 1;
+    }
+    const juce::String address = CBR_OSC_ADDRESS_PREFIX + juce::String (instanceId) + "/" + parameterID;
+
+    AudioThread audioThread (*instance, blockSize);
+    audioThread.startThread (juce::Thread::realtimeAudioPriority);
+
+    const double blockMs = blockSize * 1000.0 / latencySampleRate;
+    std::cout << "Cueing " << address << " " << values[0] << "/" << values[1] << ", "
+        << numCues << " cues, blocks of " << blockSize << " samples (" << juce::String (blockMs, 2) << "ms)" << std::endl;
+
+    // Start from the first value, so every measured cue changes the parameter.
+    sender.send (juce::OSCMessage (address, values[0].getFloatValue()));
+    juce::Thread::sleep (200);
+
+    juce::Random random;
+    juce::Array<double> latencyMs;
+    juce::Array<int> latencyBlocks;
+    int numLost = 0;
+
+    for (int cue = 0; cue < numCues; cue++) {
+        const int changesBefore = audioThread.getNumChanges();
+        const int blocksBefore = audioThread.getNumBlocksStarted();
+        const double sentMs = juce::Time::getMillisecondCounterHiRes();
+        sender.send (juce::OSCMessage (address, values[(cue + 1) % 2].getFloatValue()));
+
+        while (audioThread.getNumChanges() == changesBefore && juce::Time::getMillisecondCounterHiRes() - sentMs < cueTimeoutMs) {
+            juce::Thread::sleep (1);
+        }
+
+        if (audioThread.getNumChanges() == changesBefore) {
+            numLost++;
+        }
+        else {
+            latencyMs.add (juce::jmax (0.0, audioThread.getChangedBlockStartMs() - sentMs));
+            // 1 is the first block to start after sending.
+            latencyBlocks.add (audioThread.getChangedBlock() - blocksBefore + 1);
+        }
+
+        juce::Thread::sleep (random.nextInt (juce::Range<int> (minCueIntervalMs, maxCueIntervalMs)));
+    }
+
+    audioThread.stopThread (-1);
+    sender.disconnect();
+
+    // Report.
+    if (latencyMs.isEmpty()) {
+        std::cerr << "No cues were applied - is " << parameterID << " a parameter ID of " << instance->getName() << "?" << std::endl;
+        return 1;
+    }
+
+    std::sort (latencyMs.begin(), latencyMs.end());
+    std::sort (latencyBlocks.begin(), latencyBlocks.end());
+
+    std::cout << ",min,median,p99,max" << std::endl;
+    std::cout << "latency ms,"
+        << juce::String (latencyMs.getFirst(), 2) << ","
+        << juce::String (getPercentile (latencyMs, 0.5), 2) << ","
+        << juce::String (getPercentile (latencyMs, 0.99), 2) << ","
+        << juce::String (latencyMs.getLast(), 2) << std::endl;
+    std::cout << "latency blocks,"
+        << latencyBlocks.getFirst() << ","
+        << getPercentile (latencyBlocks, 0.5) << ","
+        << getPercentile (latencyBlocks, 0.99) << ","
+        << latencyBlocks.getLast() << std::endl;
+    std::cout << latencyMs.size() << " cues applied, " << numLost << " lost" << std::endl;
+
+    return numLost == 0 ? 0 : 1;
+}
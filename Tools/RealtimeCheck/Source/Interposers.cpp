@@ -0,0 +1,450 @@
+/*
+  ==============================================================================
+
+    Interposers.cpp
+    Replacements for allocation, locking, I/O and sleep functions that report
+    any call made from real-time code.
+
+  ==============================================================================
+*/
+
+// The fortified inline versions of open() and read() would clash with the interposers.
+#undef _FORTIFY_SOURCE
+
+#include "Interposers.h"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+
+#if JUCE_LINUX
+ #include <cxxabi.h>
+ #include <dlfcn.h>
+ #include <errno.h>
+ #include <execinfo.h>
+ #include <fcntl.h>
+ #include <pthread.h>
+ #include <semaphore.h>
+ #include <stdarg.h>
+ #include <stdio.h>
+ #include <sys/mman.h>
+ #include <time.h>
+ #include <unistd.h>
+#endif
+
+// Deepest call stack recorded for a violation.
+static const int maxFrames = 48;
+// Frames for reportViolation() and the interposed function.
+static const int numInterposerFrames = 2;
+
+struct ViolationRecord
+{
+    const char* function;
+    const char* context;
+    juce::int64 count;
+    int numFrames;
+    void* frames[maxFrames];
+};
+
+static thread_local int scopeDepth = 0;
+// Set while recording a violation, so the recording itself isn't checked.
+static thread_local bool reporting = false;
+
+static std::atomic<juce::int64> numScopeEntries { 0 };
+static std::atomic<juce::int64> numViolations { 0 };
+static std::atomic<const char*> currentContext { "" };
+
+static std::mutex recordsLock;
+// Keyed by a hash of the function and call stack.
+static std::map<juce::uint64, ViolationRecord> records;
+
+//==============================================================================
+// Called by plugins built with CBR_REALTIME_CHECK. The names must match
+// CBR_REALTIME_ENTER_SYMBOL and CBR_REALTIME_EXIT_SYMBOL in Common/RealtimeCheck.h.
+extern "C" __attribute__ ((visibility ("default"))) void cbrRealtimeScopeEnter ()
+{
+    scopeDepth++;
+    numScopeEntries++;
+}
+
+extern "C" __attribute__ ((visibility ("default"))) void cbrRealtimeScopeExit ()
+{
+    scopeDepth--;
+}
+
+#if JUCE_LINUX
+
+static __attribute__ ((noinline)) void reportViolation (const char* function)
+{
+    reporting = true;
+
+    ViolationRecord record;
+    record.function = function;
+    record.context = currentContext.load();
+    record.count = 1;
+    record.numFrames = backtrace (record.frames, maxFrames);
+
+    // FNV-1a, so each call site is reported once.
+    juce::uint64 hash = 14695981039346656037ull;
+    hash = (hash ^ (juce::uint64) (juce::pointer_sized_int) function) * 1099511628211ull;
+    for (int i = 0; i < record.numFrames; i++) {
+        hash = (hash ^ (juce::uint64) (juce::pointer_sized_int) record.frames[i]) * 1099511628211ull;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock (recordsLock);
+        auto existing = records.find (hash);
+        if (existing != records.end()) {
+            existing->second.count++;
+        }
+        else {
+            records.emplace (hash, record);
+        }
+    }
+
+    numViolations++;
+    reporting = false;
+}
+
+static inline void checkRealtime (const char* function)
+{
+    if (scopeDepth > 0 && ! reporting) {
+        reportViolation (function);
+    }
+}
+
+// The next definition of a function, i.e. libc's.
+#define CBR_REAL_FUNCTION(name) static auto real = (decltype (&::name)) dlsym (RTLD_NEXT, #name)
+
+//==============================================================================
+// Memory. glibc's own entry points are used, as dlsym() can allocate.
+extern "C"
+{
+    void* __libc_malloc (size_t size);
+    void* __libc_calloc (size_t count, size_t size);
+    void* __libc_realloc (void* pointer, size_t size);
+    void* __libc_memalign (size_t alignment, size_t size);
+    void __libc_free (void* pointer);
+
+    void* malloc (size_t size) noexcept
+    {
+        checkRealtime ("malloc");
+        return __libc_malloc (size);
+    }
+
+    void* calloc (size_t count, size_t size) noexcept
+    {
+        checkRealtime ("calloc");
+        return __libc_calloc (count, size);
+    }
+
+    void* realloc (void* pointer, size_t size) noexcept
+    {
+        checkRealtime ("realloc");
+        return __libc_realloc (pointer, size);
+    }
+
+    void free (void* pointer) noexcept
+    {
+        if (pointer != nullptr) {
+            checkRealtime ("free");
+        }
+        __libc_free (pointer);
+    }
+
+    void* memalign (size_t alignment, size_t size) noexcept
+    {
+        checkRealtime ("memalign");
+        return __libc_memalign (alignment, size);
+    }
+
+    void* aligned_alloc (size_t alignment, size_t size) noexcept
+    {
+        checkRealtime ("aligned_alloc");
+        return __libc_memalign (alignment, size);
+    }
+
+    int posix_memalign (void** pointer, size_t alignment, size_t size) noexcept
+    {
+        checkRealtime ("posix_memalign");
+        *pointer = __libc_memalign (alignment, size);
+        return (*pointer != nullptr || size == 0) ? 0 : ENOMEM;
+    }
+
+    void* mmap (void* address, size_t length, int protection, int flags, int fd, off_t offset) noexcept
+    {
+        checkRealtime ("mmap");
+        CBR_REAL_FUNCTION (mmap);
+        return real (address, length, protection, flags, fd, offset);
+    }
+
+    int munmap (void* address, size_t length) noexcept
+    {
+        checkRealtime ("munmap");
+        CBR_REAL_FUNCTION (munmap);
+        return real (address, length);
+    }
+
+    //==============================================================================
+    // Locks and waits. Try-locks don't block, so are allowed.
+    int pthread_mutex_lock (pthread_mutex_t* mutex) noexcept
+    {
+        checkRealtime ("pthread_mutex_lock");
+        CBR_REAL_FUNCTION (pthread_mutex_lock);
+        return real (mutex);
+    }
+
+    int pthread_rwlock_rdlock (pthread_rwlock_t* lock) noexcept
+    {
+        checkRealtime ("pthread_rwlock_rdlock");
+        CBR_REAL_FUNCTION (pthread_rwlock_rdlock);
+        return real (lock);
+    }
+
+    int pthread_rwlock_wrlock (pthread_rwlock_t* lock) noexcept
+    {
+        checkRealtime ("pthread_rwlock_wrlock");
+        CBR_REAL_FUNCTION (pthread_rwlock_wrlock);
+        return real (lock);
+    }
+
+    int pthread_cond_wait (pthread_cond_t* condition, pthread_mutex_t* mutex)
+    {
+        checkRealtime ("pthread_cond_wait");
+        CBR_REAL_FUNCTION (pthread_cond_wait);
+        return real (condition, mutex);
+    }
+
+    int pthread_cond_timedwait (pthread_cond_t* condition, pthread_mutex_t* mutex, const struct timespec* time)
+    {
+        checkRealtime ("pthread_cond_timedwait");
+        CBR_REAL_FUNCTION (pthread_cond_timedwait);
+        return real (condition, mutex, time);
+    }
+
+    int pthread_join (pthread_t thread, void** result)
+    {
+        checkRealtime ("pthread_join");
+        CBR_REAL_FUNCTION (pthread_join);
+        return real (thread, result);
+    }
+
+    int sem_wait (sem_t* semaphore)
+    {
+        checkRealtime ("sem_wait");
+        CBR_REAL_FUNCTION (sem_wait);
+        return real (semaphore);
+    }
+
+    //==============================================================================
+    // Files and console.
+    int open (const char* path, int flags, ...)
+    {
+        checkRealtime ("open");
+        mode_t mode = 0;
+        if ((flags & O_CREAT) != 0) {
+            va_list args;
+            va_start (args, flags);
+            mode = (mode_t) va_arg (args, int);
+            va_end (args);
+        }
+        CBR_REAL_FUNCTION (open);
+        return real (path, flags, mode);
+    }
+
+    ssize_t read (int fd, void* buffer, size_t size)
+    {
+        checkRealtime ("read");
+        CBR_REAL_FUNCTION (read);
+        return real (fd, buffer, size);
+    }
+
+    ssize_t write (int fd, const void* buffer, size_t size)
+    {
+        checkRealtime ("write");
+        CBR_REAL_FUNCTION (write);
+        return real (fd, buffer, size);
+    }
+
+    FILE* fopen (const char* path, const char* mode)
+    {
+        checkRealtime ("fopen");
+        CBR_REAL_FUNCTION (fopen);
+        return real (path, mode);
+    }
+
+    size_t fwrite (const void* buffer, size_t size, size_t count, FILE* file)
+    {
+        checkRealtime ("fwrite");
+        CBR_REAL_FUNCTION (fwrite);
+        return real (buffer, size, count, file);
+    }
+
+    int fputs (const char* text, FILE* file)
+    {
+        checkRealtime ("fputs");
+        CBR_REAL_FUNCTION (fputs);
+        return real (text, file);
+    }
+
+    int puts (const char* text)
+    {
+        checkRealtime ("puts");
+        CBR_REAL_FUNCTION (puts);
+        return real (text);
+    }
+
+    int fflush (FILE* file)
+    {
+        checkRealtime ("fflush");
+        CBR_REAL_FUNCTION (fflush);
+        return real (file);
+    }
+
+    //==============================================================================
+    // Sleeping.
+    unsigned int sleep (unsigned int seconds)
+    {
+        checkRealtime ("sleep");
+        CBR_REAL_FUNCTION (sleep);
+        return real (seconds);
+    }
+
+    int usleep (useconds_t microseconds)
+    {
+        checkRealtime ("usleep");
+        CBR_REAL_FUNCTION (usleep);
+        return real (microseconds);
+    }
+
+    int nanosleep (const struct timespec* time, struct timespec* remaining)
+    {
+        checkRealtime ("nanosleep");
+        CBR_REAL_FUNCTION (nanosleep);
+        return real (time, remaining);
+    }
+}
+
+#endif
+
+//==============================================================================
+namespace RealtimeInterposers
+{
+    void initialise ()
+    {
+       #if JUCE_LINUX
+        // The first backtrace() loads the unwinder, do that now.
+        void* frames[maxFrames];
+        backtrace (frames, maxFrames);
+       #endif
+    }
+
+    bool isSupported ()
+    {
+       #if JUCE_LINUX
+        return true;
+       #else
+        return false;
+       #endif
+    }
+
+    void setContext (const char* context)
+    {
+        currentContext = context;
+    }
+
+    void enterHostScope ()
+    {
+        cbrRealtimeScopeEnter();
+    }
+
+    void exitHostScope ()
+    {
+        cbrRealtimeScopeExit();
+    }
+
+    juce::int64 getNumScopeEntries ()
+    {
+        return numScopeEntries.load();
+    }
+
+    juce::int64 getNumViolations ()
+    {
+        return numViolations.load();
+    }
+
+    juce::Array<Violation> getViolations ()
+    {
+        std::lock_guard<std::mutex> lock (recordsLock);
+
+        juce::Array<Violation> violations;
+        for (const auto& entry : records) {
+            const ViolationRecord& record = entry.second;
+
+            Violation violation;
+            violation.function = record.function;
+            violation.context = record.context;
+            violation.count = record.count;
+            for (int i = numInterposerFrames; i < record.numFrames; i++) {
+                violation.frames.add (record.frames[i]);
+            }
+            violations.add (violation);
+        }
+        return violations;
+    }
+
+    juce::String describeFrame (void* frame)
+    {
+       #if JUCE_LINUX
+        Dl_info info;
+        if (dladdr (frame, &info) == 0 || info.dli_fname == nullptr) {
+            return "?? (" + juce::String::toHexString ((juce::pointer_sized_int) frame) + ")";
+        }
+
+        Dl_info hostInfo;
+        if (dladdr ((void*) &initialise, &hostInfo) != 0 && hostInfo.dli_fbase == info.dli_fbase) {
+            return {};
+        }
+
+        const juce::File module (info.dli_fname);
+
+        // Return addresses point after the call.
+        const juce::pointer_sized_int offset = (juce::pointer_sized_int) frame - (juce::pointer_sized_int) info.dli_fbase - 1;
+
+        // Symbols are usually hidden in plugins, so look up the line with addr2line if it's there.
+        juce::String function;
+        juce::String line;
+        juce::StringArray command ("addr2line", "-f", "-C", "-e");
+        command.add (module.getFullPathName());
+        command.add ("0x" + juce::String::toHexString (offset));
+
+        juce::ChildProcess addr2line;
+        if (addr2line.start (command, juce::ChildProcess::wantStdOut)) {
+            const juce::StringArray lines = juce::StringArray::fromLines (addr2line.readAllProcessOutput());
+            if (lines.size() >= 2) {
+                if (! lines[0].startsWith ("??")) {
+                    function = lines[0];
+                }
+                if (! lines[1].startsWith ("??")) {
+                    line = juce::File (lines[1].upToFirstOccurrenceOf (" ", false, false)).getFileName();
+                }
+            }
+        }
+
+        if (function.isEmpty() && info.dli_sname != nullptr) {
+            int status = 0;
+            char* demangled = abi::__cxa_demangle (info.dli_sname, nullptr, nullptr, &status);
+            function = (status == 0 && demangled != nullptr) ? juce::String (demangled) : juce::String (info.dli_sname);
+            ::free (demangled);
+        }
+        if (function.isEmpty()) {
+            function = "0x" + juce::String::toHexString (offset);
+        }
+
+        return function + (line.isNotEmpty() ? " " + line : juce::String()) + " (" + module.getFileName() + ")";
+       #else
+        juce::ignoreUnused (frame);
+        return {};
+       #endif
+    }
+}
@@ -0,0 +1,79 @@
+/*
+  ==============================================================================
+
+    Interposers.h
+    Replacements for allocation, locking, I/O and sleep functions that report
+    any call made from real-time code.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+ * Real-time code is marked by the plugin (see Common/RealtimeCheck.h), or by the
+ * host with enterHostScope(). While a thread is in real-time code, each call to an
+ * interposed function is recorded with its call stack.
+ *
+ * Interposing works by defining the functions in this executable, which takes
+ * precedence over libc for the plugins it loads. Linux only.
+*/
+namespace RealtimeInterposers
+{
+    /**
+     * Call at the start of main(), before any threads are started.
+    */
+    void initialise ();
+
+    /**
+     * Whether calls are being checked on this platform.
+    */
+    bool isSupported ();
+
+    /**
+     * Label for violations from now on, e.g. plugin and scenario name.
+     * The string must outlive the run.
+    */
+    void setContext (const char* context);
+
+    /**
+     * Mark real-time code from the host, for plugins that weren't built with
+     * CBR_REALTIME_CHECK. This includes the plugin format wrappers.
+    */
+    void enterHostScope ();
+    void exitHostScope ();
+
+    /**
+     * Times any thread has entered real-time code.
+    */
+    juce::int64 getNumScopeEntries ();
+
+    /**
+     * Calls from real-time code so far.
+    */
+    juce::int64 getNumViolations ();
+
+    /**
+     * A function called from real-time code, once per distinct call stack.
+    */
+    struct Violation
+    {
+        juce::String function;
+        juce::String context;
+        juce::int64 count;
+        juce::Array<void*> frames;
+    };
+
+    juce::Array<Violation> getViolations ();
+
+    /**
+     * Describe a return address from a violation's call stack, e.g.
+     * "Processor::processBlock(...) PluginProcessor.cpp:42 (NoteFilter.so)".
+     *
+     * @return Empty if the frame is in this executable, i.e. the host.
+    */
+    juce::String describeFrame (void* frame);
+}
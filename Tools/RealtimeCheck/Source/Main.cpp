@@ -0,0 +1,263 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+    Runs plugins through synthetic transport scenarios, and reports any
+    allocation, lock, file or console write, or sleep made from processBlock.
+
+    Usage: RealtimeCheck <Plugin.vst3>... [--blocks=2000] [--block-size=512]
+                         [--scenarios=playing,looping,...]
+
+    Build the plugins with the RealtimeCheck configuration, which marks just the
+    processor's processBlock (see Common/RealtimeCheck.h). Other builds are
+    checked for the whole host call, including the VST3 wrappers.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "Interposers.h"
+#include "TransportScenarios.h"
+
+#include <iostream>
+
+static const double checkSampleRate = 48000.0;
+
+//==============================================================================
+/**
+ * Reports the scenario's position for the current block.
+*/
+class ScenarioPlayHead : public juce::AudioPlayHead
+{
+public:
+    bool getCurrentPosition (CurrentPositionInfo& result) override
+    {
+        result = position;
+        return true;
+    }
+
+    CurrentPositionInfo position;
+};
+
+//==============================================================================
+/**
+ * The audio thread - processes every block of one scenario.
+*/
+class ScenarioThread : public juce::Thread
+{
+public:
+    ScenarioThread (juce::AudioPluginInstance& instance, int scenarioType, int numBlocks, int maxBlockSize, int numChannels, bool markWholeCall)
+        : juce::Thread ("RealtimeCheckAudio"),
+          instance (instance),
+          scenario (scenarioType, checkSampleRate, maxBlockSize, numBlocks),
+          numBlocks (numBlocks),
+          markWholeCall (markWholeCall),
+          audio (numChannels, maxBlockSize)
+    {
+        midiMessages.ensureSize (4096);
+    }
+
+    void run () override
+    {
+        juce::Random random (numBlocks);
+        ScenarioBlock block;
+
+        for (int i = 0; i < numBlocks && ! threadShouldExit(); i++) {
+            scenario.nextBlock (block);
+
+            playHead.position = block.position;
+            instance.setPlayHead (block.hasPlayHead ? &playHead : nullptr);
+
+            if (block.sweepParameters) {
+                for (juce::AudioProcessorParameter* parameter : instance.getParameters()) {
+                    parameter->setValue (random.nextFloat());
+                }
+            }
+
+            audio.setSize (audio.getNumChannels(), block.numSamples, false, false, true);
+            audio.clear();
+            midiMessages.clear();
+            addInputEvents (block.numSamples);
+
+            if (markWholeCall) {
+                RealtimeInterposers::enterHostScope();
+            }
+            instance.processBlock (audio, midiMessages);
+            if (markWholeCall) {
+                RealtimeInterposers::exitHostScope();
+            }
+
+            samplesProcessed += block.numSamples;
+        }
+
+        instance.setPlayHead (nullptr);
+    }
+
+private:
+    /**
+     * Live input, so it keeps coming when the transport stops: a note every 16th
+     * walking over the note range and channels, and a controller every 8th.
+    */
+    void addInputEvents (int numSamples)
+    {
+        const juce::int64 samplesPerStep = (juce::int64) (checkSampleRate * 60.0 / 120.0 / 4);
+        juce::int64 step = (samplesProcessed + samplesPerStep - 1) / samplesPerStep;
+
+        for (juce::int64 time = step * samplesPerStep; time < samplesProcessed + numSamples; time += samplesPerStep, step++) {
+            const int offset = (int) (time - samplesProcessed);
+            const int channel = 1 + (int) (step % 16);
+            midiMessages.addEvent (juce::MidiMessage::noteOff (1 + (int) ((step - 1) % 16), (int) ((step - 1) * 7 % 128)), offset);
+            midiMessages.addEvent (juce::MidiMessage::noteOn (channel, (int) (step * 7 % 128), (juce::uint8) 100), offset);
+            if (step % 2 == 0) {
+                midiMessages.addEvent (juce::MidiMessage::controllerEvent (channel, (int) (step / 2 % 128), (int) (step % 128)), offset);
+            }
+        }
+    }
+
+    juce::AudioPluginInstance& instance;
+    TransportScenario scenario;
+    const int numBlocks;
+    const bool markWholeCall;
+
+    ScenarioPlayHead playHead;
+    juce::AudioBuffer<float> audio;
+    juce::MidiBuffer midiMessages;
+    juce::int64 samplesProcessed = 0;
+};
+
+//==============================================================================
+/**
+ * Whether the plugin marks its own processBlock, i.e. was built with CBR_REALTIME_CHECK.
+*/
+static bool marksRealtimeCode (juce::AudioPluginInstance& instance, int blockSize, int numChannels)
+{
+    juce::AudioBuffer<float> audio (numChannels, blockSize);
+    audio.clear();
+    juce::MidiBuffer midiMessages;
+
+    const juce::int64 numScopeEntries = RealtimeInterposers::getNumScopeEntries();
+    instance.processBlock (audio, midiMessages);
+    return RealtimeInterposers::getNumScopeEntries() > numScopeEntries;
+}
+
+static void printViolation (const RealtimeInterposers::Violation& violation)
+{
+    std::cout << violation.function << ", " << violation.count << " calls, first in " << violation.context << ":" << std::endl;
+
+    // The stack down to the host's call into the plugin.
+    bool inPlugin = false;
+    for (void* frame : violation.frames) {
+        const juce::String description = RealtimeInterposers::describeFrame (frame);
+        if (description.isEmpty()) {
+            if (inPlugin) {
+                break;
+            }
+            continue;
+        }
+        inPlugin = true;
+        std::cout << "    " << description << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    RealtimeInterposers::initialise();
+    if (! RealtimeInterposers::isSupported()) {
+        std::cerr << "RealtimeCheck is only supported on Linux." << std::endl;
+        return 1;
+    }
+
+    // Hosting plugins needs the message manager.
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    juce::ArgumentList args (argc, argv);
+
+    juce::Array<juce::File> pluginFiles;
+    for (const juce::ArgumentList::Argument& arg : args.arguments) {
+        if (! arg.isOption()) {
+            pluginFiles.add (arg.resolveAsFile());
+        }
+    }
+
+    if (pluginFiles.isEmpty()) {
+        std::cerr << "Usage: RealtimeCheck <Plugin.vst3>... [--blocks=2000] [--block-size=512] [--scenarios=playing,looping,...]" << std::endl;
+        return 1;
+    }
+
+    const int numBlocks = juce::jmax (1, args.containsOption ("--blocks") ? args.getValueForOption ("--blocks").getIntValue() : 2000);
+    const int blockSize = juce::jmax (16, args.containsOption ("--block-size") ? args.getValueForOption ("--block-size").getIntValue() : 512);
+
+    juce::Array<int> scenarioTypes;
+    const juce::StringArray scenarioNames = juce::StringArray::fromTokens (args.getValueForOption ("--scenarios"), ",", "");
+    for (int type = 0; type < TransportScenario::numTypes; type++) {
+        if (scenarioNames.size() == 0 || scenarioNames.contains (TransportScenario::getName (type))) {
+            scenarioTypes.add (type);
+        }
+    }
+
+    juce::VST3PluginFormat format;
+
+    // Labels for violations, kept for the whole run.
+    juce::StringArray contexts;
+
+    for (const juce::File& pluginFile : pluginFiles) {
+        juce::OwnedArray<juce::PluginDescription> found;
+        format.findAllTypesForFile (found, pluginFile.getFullPathName());
+        if (found.isEmpty()) {
+            std::cerr << "No plugin found in " << pluginFile.getFullPathName() << std::endl;
+            return 1;
+        }
+
+        juce::String error;
+        std::unique_ptr<juce::AudioPluginInstance> instance = format.createInstanceFromDescription (*found[0], checkSampleRate, blockSize, error);
+        if (instance == nullptr) {
+            std::cerr << "Can't load plugin: " << error << std::endl;
+            return 1;
+        }
+
+        const int numChannels = juce::jmax (1, instance->getTotalNumInputChannels(), instance->getTotalNumOutputChannels());
+
+        instance->prepareToPlay (checkSampleRate, blockSize);
+        const bool markWholeCall = ! marksRealtimeCode (*instance, blockSize, numChannels);
+        instance->releaseResources();
+
+        std::cout << instance->getName() << std::endl;
+        if (markWholeCall) {
+            std::cout << "  Not a RealtimeCheck build, checking the whole host call." << std::endl;
+        }
+
+        for (int type : scenarioTypes) {
+            contexts.add (instance->getName() + " / " + TransportScenario::getName (type));
+            RealtimeInterposers::setContext (contexts[contexts.size() - 1].toRawUTF8());
+
+            // Each scenario starts from a freshly prepared plugin, as after a host restarts playback.
+            instance->prepareToPlay (checkSampleRate, blockSize);
+            const juce::int64 numViolations = RealtimeInterposers::getNumViolations();
+
+            ScenarioThread thread (*instance, type, numBlocks, blockSize, numChannels, markWholeCall);
+            thread.startThread (juce::Thread::realtimeAudioPriority);
+            thread.waitForThreadToExit (-1);
+
+            instance->releaseResources();
+
+            std::cout << "  " << TransportScenario::getName (type) << ": " << numBlocks << " blocks, "
+                << (RealtimeInterposers::getNumViolations() - numViolations) << " calls from real-time code" << std::endl;
+        }
+    }
+
+    RealtimeInterposers::setContext ("");
+
+    const juce::Array<RealtimeInterposers::Violation> violations = RealtimeInterposers::getViolations();
+    if (violations.isEmpty()) {
+        std::cout << "No calls from real-time code." << std::endl;
+        return 0;
+    }
+
+    std::cout << std::endl << violations.size() << " call sites from real-time code:" << std::endl << std::endl;
+    for (const RealtimeInterposers::Violation& violation : violations) {
+        printViolation (violation);
+    }
+    return 2;
+}
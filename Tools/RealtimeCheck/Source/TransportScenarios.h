@@ -0,0 +1,147 @@
+/*
+  ==============================================================================
+
+    TransportScenarios.h
+    Synthetic host transports, covering the playhead changes the plugins react to.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+ * What the host does for one block.
+*/
+struct ScenarioBlock
+{
+    // False to process without a playhead.
+    bool hasPlayHead;
+    juce::AudioPlayHead::CurrentPositionInfo position;
+    int numSamples;
+    // Set every parameter to a random value before the block.
+    bool sweepParameters;
+};
+
+//==============================================================================
+/**
+ * Generates the transport for each block of a scenario.
+*/
+class TransportScenario
+{
+public:
+    enum Type
+    {
+        playing = 0,
+        stopped,
+        startStop,
+        looping,
+        seeking,
+        tempoRamp,
+        oddMeter,
+        variableBlockSize,
+        noPlayHead,
+        parameterSweep,
+        numTypes
+    };
+
+    static const char* getName (int type)
+    {
+        switch (type) {
+            case playing: return "playing";
+            case stopped: return "stopped";
+            case startStop: return "start-stop";
+            case looping: return "looping";
+            case seeking: return "seeking";
+            case tempoRamp: return "tempo-ramp";
+            case oddMeter: return "odd-meter";
+            case variableBlockSize: return "variable-block-size";
+            case noPlayHead: return "no-playhead";
+            case parameterSweep: return "parameter-sweep";
+        }
+        return "";
+    }
+
+    /**
+     * @param numBlocks Length of the scenario, for tempo ramps.
+    */
+    TransportScenario (int type, double sampleRate, int maxBlockSize, int numBlocks)
+        : type (type),
+          sampleRate (sampleRate),
+          maxBlockSize (maxBlockSize),
+          numBlocks (numBlocks),
+          random (type)
+    {
+        bpm = (type == oddMeter) ? 140.0 : 120.0;
+        numerator = (type == oddMeter) ? 7 : 4;
+        denominator = (type == oddMeter) ? 8 : 4;
+        isPlaying = (type != stopped);
+    }
+
+    void nextBlock (ScenarioBlock& block)
+    {
+        const double beatsPerBar = numerator * 4.0 / denominator;
+
+        // Transport changes happen between blocks, as in a host.
+        if (type == startStop && blockIndex > 0 && blockIndex % 37 == 0) {
+            isPlaying = ! isPlaying;
+        }
+        if (type == seeking && blockIndex > 0 && blockIndex % 16 == 0) {
+            ppqPosition = random.nextInt (64 * 4) * beatsPerBar / 4;
+            timeInSamples = (juce::int64) (ppqPosition * 60.0 / bpm * sampleRate);
+        }
+        if (type == looping && ppqPosition >= loopEndBars * beatsPerBar) {
+            ppqPosition = loopStartBars * beatsPerBar;
+            timeInSamples = (juce::int64) (ppqPosition * 60.0 / bpm * sampleRate);
+        }
+        if (type == tempoRamp) {
+            bpm = 60.0 + 140.0 * blockIndex / juce::jmax (1, numBlocks - 1);
+        }
+
+        block.hasPlayHead = (type != noPlayHead);
+        block.numSamples = (type == variableBlockSize) ? 1 + random.nextInt (maxBlockSize) : maxBlockSize;
+        block.sweepParameters = (type == parameterSweep);
+
+        juce::AudioPlayHead::CurrentPositionInfo& position = block.position;
+        position.resetToDefault();
+        position.bpm = bpm;
+        position.timeSigNumerator = numerator;
+        position.timeSigDenominator = denominator;
+        position.timeInSamples = timeInSamples;
+        position.timeInSeconds = timeInSamples / sampleRate;
+        position.ppqPosition = ppqPosition;
+        position.ppqPositionOfLastBarStart = std::floor (ppqPosition / beatsPerBar) * beatsPerBar;
+        position.isPlaying = isPlaying;
+        position.isLooping = (type == looping);
+        position.ppqLoopStart = loopStartBars * beatsPerBar;
+        position.ppqLoopEnd = loopEndBars * beatsPerBar;
+
+        if (isPlaying) {
+            timeInSamples += block.numSamples;
+            ppqPosition += block.numSamples / sampleRate * bpm / 60.0;
+        }
+        blockIndex++;
+    }
+
+private:
+    // Loop over bars 2 and 3, jumping back as a host does at the loop end.
+    static constexpr double loopStartBars = 1.0;
+    static constexpr double loopEndBars = 3.0;
+
+    const int type;
+    const double sampleRate;
+    const int maxBlockSize;
+    const int numBlocks;
+    juce::Random random;
+
+    double bpm;
+    int numerator;
+    int denominator;
+    bool isPlaying;
+
+    int blockIndex = 0;
+    juce::int64 timeInSamples = 0;
+    double ppqPosition = 0;
+};